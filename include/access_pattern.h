@@ -0,0 +1,221 @@
+#ifndef ACCESS_PATTERN_H
+#define ACCESS_PATTERN_H
+
+#include "address.h"
+#include "latency_model.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// The most deltas, and streams, of an access pattern.
+#define PATTERN_MAX_DELTAS 64
+#define PATTERN_MAX_STREAMS 32
+
+/// The capacity of the name of an access pattern, including the NUL.
+#define PATTERN_NAME_SIZE 64
+
+/// The characters a pattern name may hold, it's part of the file names of
+/// the pattern's results.
+#define PATTERN_NAME_CHARS \
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-"
+
+/// A declarative description of the accesses that train a prefetcher.
+///
+/// Each of `num_streams` streams starts at line `start_line` of its own
+/// region of the target buffer and moves by the `deltas` (in lines, and
+/// repeated in a cycle) from one access to the next. The streams are
+/// accessed in lockstep, one access of each in turn. This describes:
+///
+/// - fixed strides, forwards or backwards: `deltas=4`, `deltas=-1`
+/// - interleaved streams: `deltas=1 streams=4`
+/// - crossing a page: `deltas=1 start=60`, the 5th access is in the next page
+/// - spatial footprints: `deltas=3,2,4,23` touches lines 0, 3, 5 and 9 of
+///   every 32 line region
+/// - irregular delta sequences: `deltas=1,2,1,5,-3`
+///
+/// A prefetcher trained by `t` accesses of each stream is then probed at
+/// the `t + 1`th access of the first stream, the line the pattern predicts.
+typedef struct {
+    char name[PATTERN_NAME_SIZE];
+    ptrdiff_t deltas[PATTERN_MAX_DELTAS];
+    size_t num_deltas;
+    size_t num_streams;
+    size_t start_line;
+    size_t max_training;
+    int write;
+} access_pattern;
+
+/// Parses a pattern from its description: a name of `PATTERN_NAME_CHARS`
+/// followed by `key=value` fields separated by whitespace.
+///
+///     <name> deltas=<d>[,<d>...] [streams=<n>] [start=<line>] [train=<n>] [access=read|write]
+///
+/// `streams` defaults to 1, `start` (the line within a 4 KiB page the
+/// streams start at) to 0, `train` (the largest training size) to 32, and
+/// `access` to write.
+///
+/// @param spec The description to parse.
+/// @param pattern The parsed pattern.
+/// @return 0 on success, -1 (with a message) if the description is malformed.
+int parse_access_pattern(/*in*/ const char* spec, /*out*/ access_pattern* pattern);
+
+/// Prints a pattern in the format `parse_access_pattern` reads.
+void print_access_pattern(/*in*/ FILE* out, /*in*/ const access_pattern* pattern);
+
+/// A pattern compiled against a target buffer: the address of every access,
+/// so that the kernel that trains the prefetcher is a single loop over a
+/// table. Access `i` of stream `s` is `addresses[i * num_streams + s]`.
+typedef struct {
+    byte** addresses;
+    size_t num_streams;
+    size_t accesses_per_stream;
+    int write;
+} access_kernel;
+
+/// Compiles a pattern into the addresses of the `max_training + 1 +
+/// lookahead` accesses of each of its streams. The buffer is split into one
+/// region per stream, a pattern that walks backwards is shifted up by whole
+/// pages so that its lowest access is in the region and its offset within a
+/// page stays `start_line`.
+///
+/// On failure, when a stream doesn't fit in its region, the returned
+/// kernel has `addresses == NULL`.
+///
+/// @param pattern The pattern to compile.
+/// @param lookahead The accesses past the first probe to compile, so that
+///                  `access_kernel_probe` can reach `lookahead + 1` lines
+///                  ahead of the training.
+/// @param target The buffer the pattern accesses.
+/// @param target_size The size of `target` in bytes.
+access_kernel compile_access_pattern(
+    /*in*/ const access_pattern* pattern,
+    /*in*/ const size_t lookahead,
+    /*in*/ byte* target,
+    /*in*/ const size_t target_size);
+
+/// Frees the address table of a kernel and clears the struct.
+void free_access_kernel(/*inout*/ access_kernel* kernel);
+
+/// Makes the first `training` accesses of every stream of a kernel.
+///
+/// @return The address of the next access of the first stream, the line
+///         to probe.
+static inline __attribute__((always_inline))
+const byte* run_access_kernel(/*in*/ const access_kernel kernel, /*in*/ const size_t training)
+{
+    const size_t num_accesses = training * kernel.num_streams;
+
+    if (kernel.write) {
+        for (size_t i = 0; i < num_accesses; i++) {
+            *(volatile byte*)kernel.addresses[i] = (byte)i;
+        }
+    } else {
+        for (size_t i = 0; i < num_accesses; i++) {
+            *(volatile const byte*)kernel.addresses[i];
+        }
+    }
+
+    return kernel.addresses[num_accesses];
+}
+
+/// Returns the access `distance` accesses past the first `training`
+/// accesses of the first stream of a kernel, a distance of 1 is the line
+/// `run_access_kernel` returns.
+static inline __attribute__((always_inline))
+const byte* access_kernel_probe(/*in*/ const access_kernel kernel,
+                                /*in*/ const size_t training,
+                                /*in*/ const size_t distance)
+{
+    return kernel.addresses[(training + distance - 1) * kernel.num_streams];
+}
+
+/// Where the probes of one training size of a pattern were served from.
+typedef struct {
+    uint64_t samples;
+    uint64_t levels[NUM_LEVELS];
+} pattern_coverage;
+
+/// Classifies the probes of a pattern and counts them per training size.
+///
+/// @param model The latency model the probes are classified with.
+/// @param training_size The training size of each probe.
+/// @param cycles The latency of each probe.
+/// @param num_samples The number of probes.
+/// @param max_training The largest training size.
+/// @param coverage The counts of each training size, `max_training + 1` of them.
+void tally_pattern_coverage(
+    /*in*/ const latency_model* model,
+    /*in*/ const uint16_t* training_size,
+    /*in*/ const uint64_t* cycles,
+    /*in*/ const size_t num_samples,
+    /*in*/ const size_t max_training,
+    /*out*/ pattern_coverage* coverage);
+
+/// Writes the header row of a pattern summary, see `write_pattern_coverage`.
+void write_pattern_coverage_header(/*in*/ FILE* out);
+
+/// Appends a row per training size of a pattern to a summary CSV with the
+/// columns Pattern, TrainingSize, Samples, L1, L2, L3, RAM, Coverage, Late.
+/// Coverage is the fraction of probes served from the L2 or closer, the
+/// prefetch arrived in time. Late is the fraction served from in between,
+/// the L3 latency band: the line was prefetched into the LLC only, or was
+/// still in flight when it was probed.
+void write_pattern_coverage(
+    /*in*/ FILE* out,
+    /*in*/ const access_pattern* pattern,
+    /*in*/ const pattern_coverage* coverage);
+
+/// The largest distance, and the most delays, of a timeliness surface.
+#define TIMELINESS_MAX_DISTANCE 64
+#define TIMELINESS_MAX_DELAYS 32
+
+/// One cell of a timeliness surface: the probes of the line `distance`
+/// accesses ahead of the training, after a given delay.
+typedef struct {
+    uint64_t samples;
+    uint64_t median;
+    double coverage;
+} timeliness_cell;
+
+/// Reduces delayed probes to a surface of `max_distance * num_delays`
+/// cells, the cell of distance `d` (from 1) and delay `i` is
+/// `cells[(d - 1) * num_delays + i]`. Coverage is the fraction of probes
+/// served from the L2 or closer.
+///
+/// @param model The latency model the probes are classified with.
+/// @param distance The distance of each probe.
+/// @param delay The index of the delay of each probe.
+/// @param cycles The latency of each probe.
+/// @param num_samples The number of probes.
+/// @param max_distance The largest distance.
+/// @param num_delays The number of delays.
+/// @param cells The surface.
+/// @return 0 on success, -1 if memory couldn't be allocated.
+int tally_timeliness_surface(
+    /*in*/ const latency_model* model,
+    /*in*/ const uint16_t* distance,
+    /*in*/ const uint16_t* delay,
+    /*in*/ const uint64_t* cycles,
+    /*in*/ const size_t num_samples,
+    /*in*/ const size_t max_distance,
+    /*in*/ const size_t num_delays,
+    /*out*/ timeliness_cell* cells);
+
+/// Writes the header row of a timeliness surface, see
+/// `write_timeliness_surface`.
+void write_timeliness_surface_header(/*in*/ FILE* out);
+
+/// Appends the cells of a pattern's surface to a CSV with the columns
+/// Pattern, Distance, Delay, MeasuredDelay, Samples, MedianCycles, Coverage.
+/// Delays are in TSC cycles, MeasuredDelay is the calibrated length of the
+/// wait (see `calibrate_busy_wait`).
+void write_timeliness_surface(
+    /*in*/ FILE* out,
+    /*in*/ const access_pattern* pattern,
+    /*in*/ const size_t max_distance,
+    /*in*/ const uint64_t* delays,
+    /*in*/ const uint64_t* measured_delays,
+    /*in*/ const size_t num_delays,
+    /*in*/ const timeliness_cell* cells);
+
+#endif // ACCESS_PATTERN_H
@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stdio.h>
 
+// Compile time defaults for the L2 of the machine the original experiments 
+// were run on. Use `detect_cache_geometry` and the `*_in` functions in 
+// cache_geometry.h to address the caches of the machine we're running on.
 #define BLOCK_BITS 6 
 #define NUM_SETS 512 
 #define SET_BITS 9
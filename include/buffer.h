@@ -0,0 +1,25 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include "address.h"
+#include <stddef.h>
+
+/// The size of the (x86-64) hugepages buffers are backed by when possible.
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/// Allocates a populated, zeroed buffer of at least `size` bytes. The buffer
+/// is backed by hugepages if any are reserved, so that (within each 2 MiB
+/// page) virtual set bits equal physical set bits. Otherwise it falls back
+/// to regular 4 KiB pages, where only the bits below 4 KiB are physical.
+///
+/// @param size The number of bytes needed.
+/// @param hugepages Set to 1 if the buffer is backed by hugepages, 0 if not.
+///                  May be NULL.
+/// @return The buffer, or NULL if it couldn't be allocated at all. It must
+///         be freed with `unmap_buffer`.
+byte* map_buffer(/*in*/ const size_t size, /*out*/ int* hugepages);
+
+/// Frees a buffer allocated by `map_buffer` with the same `size`.
+void unmap_buffer(/*in*/ byte* buffer, /*in*/ const size_t size);
+
+#endif // BUFFER_H
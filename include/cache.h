@@ -7,6 +7,10 @@
 #include <stddef.h>
 
 #define CACHE_LINE_SIZE 64 
+// The hardware prefetchers never cross a 4 KiB boundary
+#define PREFETCH_REGION_SIZE 4096
+// Compile time defaults, see `detect_cache_geometry` in cache_geometry.h 
+// for the geometry of the machine we're running on
 #define L1_SIZE 32768
 #define L2_SIZE 262144
 #define L2_SETS 512
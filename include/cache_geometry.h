@@ -0,0 +1,121 @@
+#ifndef CACHE_GEOMETRY_H
+#define CACHE_GEOMETRY_H
+
+#include "address.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// The geometry of a single level of cache. A level that wasn't found has
+/// `size == 0`.
+typedef struct {
+    size_t size;
+    size_t line_size;
+    size_t sets;
+    size_t ways;
+    size_t shared_cpus;
+} cache_level_geometry;
+
+/// The geometry of the data caches of the CPU we are running on.
+typedef struct {
+    cache_level_geometry l1d;
+    cache_level_geometry l2;
+    cache_level_geometry l3;
+} cache_geometry;
+
+/// Returns the geometry from the compile time constants in `cache.h`,
+/// which describe the machine the original experiments were run on.
+cache_geometry default_cache_geometry(void);
+
+/// Detects the cache geometry of the CPU the calling thread is running on.
+/// The deterministic cache parameters leaf of CPUID (leaf 4 on Intel,
+/// 0x8000001D on AMD) is read first, and any level it doesn't describe is
+/// read from /sys/devices/system/cpu/cpu*/cache. If the two sources
+/// disagree a warning is printed and CPUID wins. Levels that can't be
+/// detected at all keep their values from `default_cache_geometry`.
+///
+/// @param geometry The detected geometry.
+/// @return 0 if every level was detected, -1 if any level fell back to
+///         the defaults.
+int detect_cache_geometry(/*out*/ cache_geometry* geometry);
+
+/// Reads an attribute of the data (or unified) cache of `level` of `cpu`
+/// from /sys/devices/system/cpu/cpu<cpu>/cache, e.g. the "id" or the
+/// "shared_cpu_list" of the L3. The trailing newline is removed.
+///
+/// @param cpu The logical CPU whose cache is read.
+/// @param level The cache level, 1 to 3.
+/// @param name The name of the attribute file.
+/// @param buffer The value of the attribute.
+/// @param length The size of `buffer`.
+/// @return 0 on success, -1 if `cpu` has no such level or the attribute
+///         can't be read.
+int read_cache_attribute(
+    /*in*/ const int cpu,
+    /*in*/ const unsigned level,
+    /*in*/ const char* name,
+    /*out*/ char* buffer,
+    /*in*/ const size_t length);
+
+/// Prints a one line summary of each level of `geometry`.
+void print_cache_geometry(/*in*/ FILE* out, /*in*/ const cache_geometry geometry);
+
+/// Empirically derives the associativity of a cache level: a line is
+/// accessed followed by `k` lines that map to the same set, and the line
+/// is then timed again. The smallest `k` at which the line is evicted is
+/// the associativity. This needs the hugepage backed memory of an
+/// eviction set so that virtual set bits equal physical set bits.
+///
+/// @param level The geometry (the sets and line size) of the level to check.
+/// @param max_ways The largest associativity to check for.
+/// @param ways The measured associativity.
+/// @return 0 on success, -1 if no eviction was seen up to `max_ways` or
+///         the memory couldn't be allocated.
+int measure_associativity(
+    /*in*/ const cache_level_geometry level,
+    /*in*/ const size_t max_ways,
+    /*out*/ size_t* ways);
+
+/// Returns log2 of a power of two.
+static inline size_t geometry_log2(/*in*/ size_t value)
+{
+    size_t bits = 0;
+    while (value > 1) {
+        value >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+/// Returns the set index of `ptr` in a cache level, the runtime equivalent
+/// of `get_set_index` in `address.h`. Only valid for levels with a power of
+/// two number of sets, which rules out a sliced L3.
+static inline uint64_t get_set_index_in(
+    /*in*/ const void* ptr,
+    /*in*/ const cache_level_geometry level)
+{
+    const uint64_t addr_u = (uint64_t)ptr;
+    return (addr_u / level.line_size) & (level.sets - 1);
+}
+
+/// Returns the block index (offset inside the line) of `ptr` in a cache
+/// level, the runtime equivalent of `get_block_index` in `address.h`.
+static inline uint64_t get_block_index_in(
+    /*in*/ const void* ptr,
+    /*in*/ const cache_level_geometry level)
+{
+    const uint64_t addr_u = (uint64_t)ptr;
+    return addr_u & (level.line_size - 1);
+}
+
+/// Returns the tag of `ptr` in a cache level, the runtime equivalent of
+/// `get_tag` in `address.h`.
+static inline uint64_t get_tag_in(
+    /*in*/ const void* ptr,
+    /*in*/ const cache_level_geometry level)
+{
+    const uint64_t addr_u = (uint64_t)ptr;
+    return addr_u >> geometry_log2(level.sets * level.line_size);
+}
+
+#endif // CACHE_GEOMETRY_H
@@ -0,0 +1,95 @@
+#ifndef CAMPAIGN_H
+#define CAMPAIGN_H
+
+#include "cache_geometry.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// The manifest of a campaign, in the output directory of its experiment.
+#define CAMPAIGN_MANIFEST "manifest.csv"
+
+/// The longest experiment and result file names a manifest keeps.
+#define CAMPAIGN_NAME_SIZE 32
+#define CAMPAIGN_FILE_SIZE 128
+
+/// A range of iterations of one result file that is done, one row of the
+/// manifest.
+typedef struct {
+    /// The machine it was measured on, see `host_fingerprint`.
+    uint64_t host;
+    char experiment[CAMPAIGN_NAME_SIZE];
+    /// The name of the result file (without its directory) it was added to.
+    char file[CAMPAIGN_FILE_SIZE];
+    size_t set;
+    size_t warmup_lines;
+    /// The iterations `[first, first + iterations)` of the file. Fewer
+    /// iterations than `requested` means the profile stopped early.
+    size_t first;
+    size_t requested;
+    size_t iterations;
+    /// `campaign_checksum` of the samples of those iterations.
+    uint64_t checksum;
+    /// A fingerprint of the options the samples were taken with, chunks 
+    /// taken with other options aren't resumed.
+    uint64_t options;
+} campaign_chunk;
+
+/// The chunks of a manifest measured on this host by one experiment, and
+/// the manifest itself, open for appending.
+///
+/// A manifest is a CSV file that only ever grows, one row per chunk:
+///
+/// Host,Experiment,File,Set,Warmup,First,Requested,Iterations,Checksum,Options
+/// 3f0c9a5e1b2d4c67,occupancy,no_warmup_O1_S3.bin,3,0,0,10,10,8d2e...,5b1f...
+/// ...
+///
+/// A row is written with a single `write` to a file opened for appending,
+/// so jobs of the runner that share an output directory can share its
+/// manifest. A later row for the same file and first iteration replaces an
+/// earlier one, e.g. when a profile was started over.
+typedef struct {
+    uint64_t host;
+    char experiment[CAMPAIGN_NAME_SIZE];
+    campaign_chunk* chunks;
+    size_t num_chunks;
+    size_t capacity;
+    int fd;
+} campaign;
+
+/// Returns a fingerprint of the machine: its host name, kernel release,
+/// CPUID signature and brand string, and cache geometry. Results from a
+/// different machine (or the same one after a CPU or kernel change) have a
+/// different fingerprint, and aren't resumed.
+uint64_t host_fingerprint(/*in*/ const cache_geometry geometry);
+
+/// Returns the FNV-1a hash of `size` bytes of samples.
+uint64_t campaign_checksum(/*in*/ const void* data, /*in*/ const size_t size);
+
+/// Reads the chunks that `experiment` measured on `host` from the manifest
+/// in `dir` (if there is one) and opens it for appending, creating it with
+/// its header row if needed.
+///
+/// @return 0 on success, -1 if the manifest couldn't be read or created.
+int open_campaign(
+    /*in*/ const char* dir,
+    /*in*/ const char* experiment,
+    /*in*/ const uint64_t host,
+    /*out*/ campaign* c);
+
+/// Closes the manifest and frees the chunks.
+void close_campaign(/*inout*/ campaign* c);
+
+/// Returns the latest chunk of `file` that starts at iteration `first`, or
+/// NULL if there is none.
+const campaign_chunk* find_campaign_chunk(
+    /*in*/ const campaign* c,
+    /*in*/ const char* file,
+    /*in*/ const size_t first);
+
+/// Appends a chunk to the manifest. Its `host` and `experiment` are those
+/// of the campaign.
+///
+/// @return 0 on success, -1 if the row couldn't be written.
+int record_campaign_chunk(/*inout*/ campaign* c, /*in*/ const campaign_chunk* chunk);
+
+#endif // CAMPAIGN_H
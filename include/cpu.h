@@ -0,0 +1,78 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Pins the calling thread to a single logical CPU using 
+/// `sched_setaffinity`.
+///
+/// @param cpu The logical CPU to pin to.
+/// @return 0 on success, -1 on failure.
+int pin_to_cpu(/*in*/ const int cpu);
+
+/// Returns the logical CPU the calling thread is pinned to, or -1 if it may
+/// run on more than one.
+int pinned_cpu(void);
+
+/// Parses a CPU list in the same format as `taskset -c` and the files in 
+/// /sys/devices/system/cpu, e.g. "0-3,8,10-11".
+///
+/// @param list The string to parse.
+/// @param cpus The array to write the parsed CPU ids into.
+/// @param max_cpus The capacity of `cpus`.
+/// @return The number of CPUs parsed, or 0 if `list` is malformed or 
+///         holds more than `max_cpus` CPUs.
+size_t parse_cpu_list(
+    /*in*/ const char* list,
+    /*out*/ int* cpus,
+    /*in*/ const size_t max_cpus);
+
+/// Returns an id for the physical core a logical CPU belongs to, so that 
+/// two SMT siblings return the same id. Returns -1 if the topology can't 
+/// be read from /sys/devices/system/cpu.
+long physical_core_id(/*in*/ const int cpu);
+
+/// Removes every CPU from `cpus` that shares a physical core with a CPU 
+/// earlier in the list, since SMT siblings share an L1 and L2 and would 
+/// disturb each other's measurements.
+///
+/// @return The new number of CPUs in `cpus`.
+size_t unique_physical_cores(
+    /*inout*/ int* cpus,
+    /*in*/ const size_t num_cpus);
+
+/// Returns an id for the last level cache a logical CPU uses, so that two 
+/// CPUs sharing an L3 return the same id. Returns -1 if there's no L3 or 
+/// it can't be read from /sys/devices/system/cpu.
+long llc_id(/*in*/ const int cpu);
+
+/// Removes every CPU from `cpus` that shares a last level cache with a CPU 
+/// earlier in the list, for measurements of the LLC itself.
+///
+/// @return The new number of CPUs in `cpus`.
+size_t unique_llcs(
+    /*inout*/ int* cpus,
+    /*in*/ const size_t num_cpus);
+
+/// Finds a CPU the calling thread may run on that is on a different physical 
+/// core than `cpu`, e.g. to run a helper thread that mustn't share an L1 
+/// and L2 with the thread being measured.
+///
+/// @return The CPU, or -1 if every allowed CPU is on the same core as `cpu`.
+int other_physical_core(/*in*/ const int cpu);
+
+/// Returns the SMT sibling of a logical CPU, the other hardware thread of 
+/// its physical core, or -1 if it has none (or the topology can't be read).
+int smt_sibling(/*in*/ const int cpu);
+
+/// Reads a model specific register of `cpu` through /dev/cpu/<cpu>/msr, 
+/// which needs the msr module and root.
+///
+/// @param cpu The CPU to read the register of.
+/// @param msr The address of the register.
+/// @param value The value of the register.
+/// @return 0 on success, -1 (silently) if the register can't be read.
+int read_msr(/*in*/ const int cpu, /*in*/ const uint32_t msr, /*out*/ uint64_t* value);
+
+#endif // CPU_H
@@ -0,0 +1,128 @@
+#ifndef EVICTION_SEARCH_H
+#define EVICTION_SEARCH_H
+
+#include "address.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// The size of the regular pages eviction sets are searched over.
+#define SEARCH_PAGE_SIZE 4096
+
+/// The number of times an eviction test is repeated, the majority decides.
+#define EVICTION_TEST_TRIALS 5
+
+/// Marks a page that doesn't belong to any color (yet).
+#define NO_COLOR SIZE_MAX
+
+/// The lines at the same offset of two pages map to the same set iff the
+/// pages have the same "color", the set index bits above the page offset.
+/// A cache with `cache_sets` sets has `cache_sets * CACHE_LINE_SIZE /
+/// SEARCH_PAGE_SIZE` colors (1 for caches indexed by the page offset alone).
+size_t num_page_colors(/*in*/ const size_t cache_sets);
+
+/// Translates virtual addresses into physical ones through
+/// /proc/self/pagemap. Since Linux 4.0 the frame numbers are zeroed for
+/// processes without CAP_SYS_ADMIN, in which case this fails.
+///
+/// @param addresses The (mapped and populated) addresses to translate.
+/// @param num_addresses The number of addresses.
+/// @param physical The physical address of each address.
+/// @return 0 on success, -1 if the pagemap can't be read, hides the frame
+///         numbers, or an address isn't present.
+int physical_addresses(
+    /*in*/ byte* const* addresses,
+    /*in*/ const size_t num_addresses,
+    /*out*/ uint64_t* physical);
+
+/// Colors pages by their physical address from /proc/self/pagemap. Since
+/// Linux 4.0 the frame numbers are zeroed for processes without
+/// CAP_SYS_ADMIN, in which case this fails and the pages have to be colored
+/// with `color_pages_by_eviction`.
+///
+/// @param pages The pages to color.
+/// @param num_pages The number of pages.
+/// @param num_colors The number of colors of the targeted cache.
+/// @param colors The physical color of each page.
+/// @return 0 on success, -1 if the pagemap can't be read or hides the
+///         frame numbers.
+int color_pages_by_pagemap(
+    /*in*/ byte* const* pages,
+    /*in*/ const size_t num_pages,
+    /*in*/ const size_t num_colors,
+    /*out*/ size_t* colors);
+
+/// Finds the latency that separates a line that's still in the targeted
+/// cache from one that was evicted from it: the midpoint between the median
+/// reload latency of a line after touching (like `evicts`) the first line
+/// of an eighth of the pages of `pool`, and of all of them.
+///
+/// @param pool A buffer at least twice the size of the targeted cache.
+/// @param pool_size The size of `pool` in bytes.
+/// @param threshold Reloads slower than this are evictions.
+/// @return 0 on success, -1 if the two latencies can't be told apart.
+int calibrate_eviction_threshold(
+    /*in*/ byte* pool,
+    /*in*/ const size_t pool_size,
+    /*out*/ uint64_t* threshold);
+
+/// Tests whether touching `candidates` evicts `target`: the target is
+/// loaded, the candidates are touched a few times (so the replacement
+/// policy settles on evicting the target), and the target is reloaded. Repeated
+/// `EVICTION_TEST_TRIALS` times, the majority decides.
+///
+/// @return 1 if the candidates evict the target, 0 if not.
+int evicts(
+    /*in*/ const byte* target,
+    /*in*/ byte* const* candidates,
+    /*in*/ const size_t num_candidates,
+    /*in*/ const uint64_t threshold);
+
+/// Reduces an eviction set of `target` to a minimal one with the group
+/// testing algorithm of Vila et al. ("Theory and Practice of Finding
+/// Eviction Sets", S&P 2019): the candidates are split into `ways + 1`
+/// groups, at least one of which can be dropped without losing the
+/// eviction, until no group (and then no single candidate) can be dropped.
+/// Takes O(ways^2 * num_candidates) accesses rather than the
+/// O(num_candidates^2) of removing one candidate at a time.
+///
+/// @param target The line to evict.
+/// @param candidates Lines that evict `target`. Reordered so that the
+///                   minimal eviction set comes first.
+/// @param num_candidates The number of candidates.
+/// @param ways An upper bound on the associativity of the targeted cache.
+/// @param threshold See `calibrate_eviction_threshold`.
+/// @return The size of the minimal eviction set, or 0 if the candidates
+///         didn't evict the target to begin with.
+size_t reduce_eviction_set(
+    /*in*/ const byte* target,
+    /*inout*/ byte** candidates,
+    /*in*/ const size_t num_candidates,
+    /*in*/ const size_t ways,
+    /*in*/ const uint64_t threshold);
+
+/// Colors pages without knowing their physical addresses. An uncolored
+/// page is picked as the target and the remaining uncolored pages are
+/// reduced to a minimal eviction set of it, which together with the target
+/// evicts exactly the pages of the target's color; every uncolored page is
+/// then tested against it. Repeats until every color has been found, so the
+/// colors are numbered in the order they were found rather than by their
+/// physical set bits.
+///
+/// @param pages The pages to color, enough that each color has more than
+///              `ways` of them.
+/// @param num_pages The number of pages.
+/// @param num_colors The number of colors of the targeted cache.
+/// @param ways An upper bound on the associativity of the targeted cache.
+/// @param threshold See `calibrate_eviction_threshold`.
+/// @param colors The color of each page, `NO_COLOR` for pages that
+///               couldn't be colored.
+/// @return 0 if every color was found, -1 otherwise.
+int color_pages_by_eviction(
+    /*in*/ byte* const* pages,
+    /*in*/ const size_t num_pages,
+    /*in*/ const size_t num_colors,
+    /*in*/ const size_t ways,
+    /*in*/ const uint64_t threshold,
+    /*out*/ size_t* colors);
+
+#endif // EVICTION_SEARCH_H
@@ -3,6 +3,7 @@
 
 #include "address.h"
 #include "cache.h"
+#include "cache_geometry.h"
 #include <stddef.h>
 
 typedef struct {
@@ -10,12 +11,31 @@ typedef struct {
     size_t size;
 } wide_ptr;
 
+/// An eviction set of `cache_lines + warmup_lines` lines in each of
+/// `cache_sets` sets.
+///
+/// When backed by hugepages (or when the sets are indexed by the page offset
+/// alone) the set is contiguous, line (s, l) is at `warmup_section.start_addr
+/// + (l * cache_sets + s) * CACHE_LINE_SIZE`, and `lines` is NULL. Otherwise
+/// the lines are spread over congruent 4 KiB pages of `memory` (see
+/// eviction_search.h), `lines[l * cache_sets + s]` is the address of line
+/// (s, l), and the two sections only hold their first line and size.
+///
+/// When the colors of the pages had to be found by eviction, `permuted` is
+/// set: the sets of a color are still consecutive and in the order of their
+/// page offset, but the colors are numbered in the order they were found,
+/// so set `s` is set `s` of the cache only within its group of
+/// `SEARCH_PAGE_SIZE / CACHE_LINE_SIZE` sets, and two such eviction sets
+/// number the groups differently.
 typedef struct {
     wide_ptr warmup_section;
     wide_ptr occupation_section;
     size_t cache_sets;
     size_t cache_lines;
     size_t warmup_lines;
+    byte** lines;
+    wide_ptr memory;
+    int permuted;
 } eviction_set;
 
 /// Generates an eviction set based on the given cache parameters. Note
@@ -26,6 +46,14 @@ typedef struct {
 /// must call free_eviction_set on the generated structure in order 
 /// to avoid memory leaks.
 ///
+/// Hugepages are used when reserved. Otherwise the set is built from 4 KiB 
+/// pages of the same color, found from /proc/self/pagemap if it shows 
+/// physical addresses and with a group testing search if not, which takes 
+/// a few seconds. The search can't tell which color is which, so its sets 
+/// are `permuted` (see `eviction_set`): they cover every set of the cache, 
+/// but set `s` of the eviction set isn't necessarily set `s` of the cache. 
+/// On failure `warmup_section.start_addr` is NULL.
+///
 /// @param cache_sets The number of sets in the targeted cache. In the 
 ///                   PAPP paper this is `s`.
 ///
@@ -40,6 +68,33 @@ eviction_set new_eviction_set(
     /*in*/ const size_t cache_lines, 
     /*in*/ const size_t extra_lines);
 
+/// Generates an eviction set for a cache level described by a (detected) 
+/// `cache_level_geometry`, see `new_eviction_set`.
+///
+/// @param level The geometry of the targeted cache level.
+/// @param extra_lines The number of extra lines to generate for each set.
+eviction_set new_eviction_set_for(
+    /*in*/ const cache_level_geometry level,
+    /*in*/ const size_t extra_lines);
+
+/// Generates an eviction set for a sliced last level cache. Each slice has 
+/// `llc.sets / num_slices` sets, and set `s` of the eviction set is set 
+/// `s % (llc.sets / num_slices)` of slice `s / (llc.sets / num_slices)`, so 
+/// the sets of a slice are consecutive. Lines are placed by their physical 
+/// address from /proc/self/pagemap (which needs CAP_SYS_ADMIN) and the 
+/// slice hash of `llc_slice.h`, through a line table (see `eviction_set`).
+///
+/// On failure, when the pagemap hides physical addresses or the slice hash 
+/// of `num_slices` isn't known, `warmup_section.start_addr` is NULL.
+///
+/// @param llc The geometry of the whole last level cache.
+/// @param num_slices The number of slices, see `detect_llc_slices`.
+/// @param extra_lines The number of extra lines to generate for each set.
+eviction_set new_llc_eviction_set(
+    /*in*/ const cache_level_geometry llc,
+    /*in*/ const size_t num_slices,
+    /*in*/ const size_t extra_lines);
+
 /// Frees the memory allocated to the given eviction set. Sets the values
 /// in the original eviction set struct to 0's in order to attempt to 
 /// prevent extraneous memory access.
@@ -49,6 +104,27 @@ eviction_set new_eviction_set(
 ///           memory accesses.
 void free_eviction_set(/*inout*/ eviction_set* es);
 
+/// Returns the address of line (s, l) in an eviction set, where lines 
+/// `0..warmup_lines` are in the warmup section and the rest are in the 
+/// occupation section.
+///
+/// @param es The eviction set the line is in.
+/// @param set The set index, `s`, of the line.
+/// @param line The line index, `l`, of the line within its set.
+static inline __attribute__((always_inline))
+byte* eviction_set_line(/*in*/ const eviction_set es, 
+                        /*in*/ const size_t set, 
+                        /*in*/ const size_t line)
+{
+    if (es.lines != NULL) {
+        return es.lines[line * es.cache_sets + set];
+    }
+
+    return es.warmup_section.start_addr 
+        + (set * CACHE_LINE_SIZE) 
+        + (line * CACHE_LINE_SIZE * es.cache_sets);
+}
+
 /// Flushes an entire eviction set from the cache. Calls `fence()` after 
 /// to ensure that all flushes are completed before returning.
 ///
@@ -59,6 +135,15 @@ void free_eviction_set(/*inout*/ eviction_set* es);
 static inline __attribute__((always_inline))
 void flush_eviction_set(/*inout*/ eviction_set es)
 {
+    if (es.lines != NULL) {
+        const size_t num_lines = es.cache_sets * (es.cache_lines + es.warmup_lines);
+        for (size_t i = 0; i < num_lines; i++) {
+            clflush(es.lines[i]);
+        }
+        fence();
+        return;
+    }
+
     flush_buffer_unfenced(es.warmup_section.start_addr, 
                           es.warmup_section.size);
     flush_buffer_unfenced(es.occupation_section.start_addr, 
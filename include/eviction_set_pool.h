@@ -0,0 +1,64 @@
+#ifndef EVICTION_SET_POOL_H
+#define EVICTION_SET_POOL_H
+
+#include "eviction_set.h"
+#include <pthread.h>
+#include <stddef.h>
+
+/// An eviction set held by a pool, and the number of LLC slices it was 
+/// placed for (0 for an eviction set of `new_eviction_set`).
+typedef struct {
+    eviction_set es;
+    size_t llc_slices;
+    int in_use;
+} pooled_eviction_set;
+
+/// Eviction sets that outlive the runs they were allocated for. Without 
+/// hugepages an eviction set is placed by page color, or for the LLC by 
+/// physical address, which takes far longer than a short profile: a pool 
+/// lets the jobs of a runner allocate each geometry once and reuse it.
+///
+/// An eviction set is only handed to one user at a time, so workers on 
+/// different cores never touch the same lines. The pool is locked, it may 
+/// be shared between threads.
+typedef struct {
+    pooled_eviction_set* entries;
+    size_t num_entries;
+    size_t capacity;
+    pthread_mutex_t lock;
+} eviction_set_pool;
+
+/// Initializes an empty pool.
+///
+/// @return 0 on success, -1 if the lock can't be initialized.
+int init_eviction_set_pool(/*out*/ eviction_set_pool* pool);
+
+/// Takes an eviction set of the given geometry out of the pool, allocating 
+/// a new one (see `new_eviction_set` and `new_llc_eviction_set`) if every 
+/// one of that geometry is in use. It must be handed back with 
+/// `release_eviction_set`, not freed.
+///
+/// On failure the returned eviction set has `warmup_section.start_addr == 
+/// NULL`.
+///
+/// @param pool The pool to take the eviction set from.
+/// @param cache_sets The number of sets in the targeted cache.
+/// @param cache_lines The number of lines per set in the targeted cache.
+/// @param warmup_lines The number of warmup lines per set.
+/// @param llc_slices The number of slices of the targeted LLC, or 0 if the 
+///                   targeted cache isn't sliced.
+eviction_set acquire_eviction_set(
+    /*inout*/ eviction_set_pool* pool,
+    /*in*/ const size_t cache_sets,
+    /*in*/ const size_t cache_lines,
+    /*in*/ const size_t warmup_lines,
+    /*in*/ const size_t llc_slices);
+
+/// Hands an eviction set of `acquire_eviction_set` back to its pool, and 
+/// clears `es`.
+void release_eviction_set(/*inout*/ eviction_set_pool* pool, /*inout*/ eviction_set* es);
+
+/// Frees every eviction set of a pool, none may still be in use.
+void free_eviction_set_pool(/*inout*/ eviction_set_pool* pool);
+
+#endif // EVICTION_SET_POOL_H
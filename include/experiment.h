@@ -0,0 +1,93 @@
+#ifndef EXPERIMENT_H
+#define EXPERIMENT_H
+
+#include "eviction_set_pool.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+/// The capacity of the paths experiments build from their output directory.
+#define EXPERIMENT_PATH_SIZE 4096
+
+/// What the runner (see papp.c) shares between the jobs it runs.
+///
+/// Jobs may run at the same time on different cores, so the pool is the 
+/// only state they share. `variant` names the build of the runner (e.g. 
+/// "O2", see CMakeLists.txt) and `variant_flags` its compiler flags, 
+/// experiments record them with their results.
+typedef struct {
+    eviction_set_pool* eviction_sets;
+    const char* variant;
+    const char* variant_flags;
+} experiment_context;
+
+/// The entry point of an experiment. It's called with the arguments of a 
+/// job, `argv[0]` being the name the job was given, on a thread of its own 
+/// that the experiment may pin.
+///
+/// @return 0 if the experiment ran, nonzero otherwise.
+typedef int (*experiment_main)(int argc, char** argv, const experiment_context* context);
+
+/// Parses the positive decimal count given to an option, e.g. `--samples`.
+///
+/// @return 0 on success, -1 if `text` isn't a positive number.
+static inline int parse_count(/*in*/ const char* text, /*out*/ size_t* count)
+{
+    char* end;
+    const unsigned long long value = strtoull(text, &end, 10);
+    if (*text < '0' || *text > '9' || *end != '\0' || value == 0) {
+        return -1;
+    }
+
+    *count = (size_t)value;
+    return 0;
+}
+
+/// Parses a size in bytes given to an option, with an optional K, M or G 
+/// suffix, e.g. `--max 64M`.
+///
+/// @return 0 on success, -1 if `text` isn't a positive size.
+static inline int parse_size(/*in*/ const char* text, /*out*/ size_t* size)
+{
+    char* end;
+    const unsigned long long value = strtoull(text, &end, 10);
+    size_t unit = 1;
+    if (*end == 'K' || *end == 'k') {
+        unit = (size_t)1 << 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        unit = (size_t)1 << 20;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        unit = (size_t)1 << 30;
+        end++;
+    }
+
+    if (*text < '0' || *text > '9' || *end != '\0' || value == 0) {
+        return -1;
+    }
+
+    *size = (size_t)value * unit;
+    return 0;
+}
+
+/// Measures the latency of the L1, L2, L3 and RAM, see latency_experiment.c 
+/// for its options.
+int latency_experiment(int argc, char** argv, const experiment_context* context);
+
+/// Measures how the prefetchers respond to access patterns, see 
+/// pattern_experiment.c for its options.
+int pattern_experiment(int argc, char** argv, const experiment_context* context);
+
+/// Profiles the occupancy of the L2 or the L3, see occupancy_experiment.c 
+/// for its options.
+int occupancy_experiment(int argc, char** argv, const experiment_context* context);
+
+/// Measures the latency of dependent loads across working set sizes, see 
+/// chase_experiment.c for its options.
+int chase_experiment(int argc, char** argv, const experiment_context* context);
+
+/// Measures the misses in flight and the streaming bandwidth across working
+/// set sizes, see bandwidth_experiment.c for its options.
+int bandwidth_experiment(int argc, char** argv, const experiment_context* context);
+
+#endif // EXPERIMENT_H
@@ -0,0 +1,163 @@
+#ifndef INTERFERENCE_H
+#define INTERFERENCE_H
+
+#include "address.h"
+#include "cache_geometry.h"
+#include "eviction_set.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// The most aggressor threads, and the most sets they prime.
+#define INTERFERENCE_MAX_AGGRESSORS 256
+#define INTERFERENCE_MAX_SETS 4096
+
+/// How far past the last arrival a `tsc_barrier` releases, in TSC cycles:
+/// enough for every waiter to see the deadline before it passes.
+#define TSC_BARRIER_LEAD 20000
+
+/// A barrier that releases every thread at the same TSC deadline rather
+/// than whenever each one notices the last arrival, so threads on
+/// different cores start within a few cycles of each other (the TSC is
+/// synchronized across the cores of a socket).
+typedef struct {
+    size_t parties;
+    atomic_size_t arrived;
+    atomic_size_t generation;
+    atomic_uint_fast64_t deadline;
+} tsc_barrier;
+
+/// Sets up a barrier for `parties` threads.
+void init_tsc_barrier(/*out*/ tsc_barrier* barrier, /*in*/ const size_t parties);
+
+/// Waits until every party arrived, then spins until the deadline the last
+/// one set, `TSC_BARRIER_LEAD` cycles after it arrived.
+///
+/// @return The deadline every party was released at.
+uint64_t tsc_barrier_wait(/*inout*/ tsc_barrier* barrier);
+
+/// What the aggressors do to the shared cache.
+typedef enum {
+    /// Read-modify-write every line of a buffer in order (`write_buffer`),
+    /// streaming through the LLC and training the prefetchers on it.
+    INTERFERENCE_STREAM = 0,
+    /// Read-modify-write every `stride`-th line of a buffer
+    /// (`write_lines_stride`), a strided stream for the prefetchers.
+    INTERFERENCE_STRIDE = 1,
+    /// Prime a list of sets of an eviction set over and over, evicting the
+    /// victim's lines of those sets from the LLC (see `prime_llc_sets_of`).
+    INTERFERENCE_PRIME = 2,
+} interference_pattern;
+
+/// How to run the aggressors.
+typedef struct {
+    interference_pattern pattern;
+    int cpus[INTERFERENCE_MAX_AGGRESSORS];
+    size_t num_cpus;
+    /// The buffer each aggressor streams over, 0 for twice the LLC.
+    size_t size;
+    /// The lines between the writes of `INTERFERENCE_STRIDE`.
+    size_t stride;
+    /// The sets `INTERFERENCE_PRIME` primes, every set of the eviction set
+    /// if there are none.
+    size_t sets[INTERFERENCE_MAX_SETS];
+    size_t num_sets;
+    /// The cache the eviction sets of `INTERFERENCE_PRIME` are built for,
+    /// with `llc_slices` slices if it's a sliced LLC (0 otherwise).
+    cache_level_geometry level;
+    size_t llc_slices;
+} interference_options;
+
+/// Fills in the defaults: streaming twice the LLC, every 4th line for
+/// `INTERFERENCE_STRIDE`, and no aggressors.
+void default_interference_options(/*out*/ interference_options* options);
+
+/// Parses the aggressor options at `argv[*i]` shared by the experiments
+/// that support them:
+///
+///     --aggressors <cpu list> --aggressor stream|stride|prime
+///     --aggressor-size <bytes> --aggressor-stride <lines>
+///     --aggressor-sets <list>
+///
+/// @param i The index of the option, moved past its value if it's parsed.
+/// @return 1 if `argv[*i]` was an aggressor option, 0 if it wasn't, -1 if
+///         its value is invalid (and a message was printed).
+int parse_interference_option(
+    /*in*/ const int argc,
+    /*in*/ char** argv,
+    /*inout*/ int* i,
+    /*inout*/ interference_options* options);
+
+/// Aims `INTERFERENCE_PRIME` at the last level cache for a victim measured
+/// on the inner cache `inner` (e.g. the L2). Priming sets of the L2's
+/// geometry on another core only evicts from that core's own L2, so the
+/// victim's lines are attacked where the cores share them, in the LLC: every
+/// set of `inner` in `options->sets` is replaced by the sets of an LLC
+/// eviction set (see `new_llc_eviction_set`) whose index within their slice
+/// has the same low bits, in every slice. No sets still means every set.
+/// Lines evicted from the LLC only leave the victim's L2 if the LLC is
+/// inclusive. Without an L3 (`llc.sets == 0`) `inner` is primed.
+///
+/// @param llc_slices The number of slices of `llc`, see `detect_llc_slices`.
+/// @return 0 on success, -1 if a set isn't in `inner` or the sets cover
+///         more than `INTERFERENCE_MAX_SETS` sets of the LLC.
+int prime_llc_sets_of(
+    /*inout*/ interference_options* options,
+    /*in*/ const cache_level_geometry inner,
+    /*in*/ const cache_level_geometry llc,
+    /*in*/ const size_t llc_slices);
+
+/// Returns "stream", "stride" or "prime".
+const char* interference_pattern_name(/*in*/ const interference_pattern pattern);
+
+struct interference_aggressor;
+
+/// A group of aggressor threads, each pinned to a core of its own. They
+/// idle (blocked on a condition variable) until `resume_interference`.
+typedef struct {
+    interference_options options;
+    struct interference_aggressor* aggressors;
+    size_t num_aggressors;
+    tsc_barrier barrier;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    /// `INTERFERENCE_IDLE`, `INTERFERENCE_RUN` or `INTERFERENCE_EXIT`,
+    /// changed under `lock`.
+    atomic_int phase;
+    /// The aggressors set up, and those in their run loop.
+    atomic_size_t ready;
+    atomic_size_t running;
+    atomic_int failed;
+    /// The deadline the last `resume_interference` started at.
+    uint64_t started_at;
+} interference;
+
+#define INTERFERENCE_IDLE 0
+#define INTERFERENCE_RUN 1
+#define INTERFERENCE_EXIT 2
+
+/// Starts an aggressor thread on each CPU of the options, each with a
+/// buffer (or eviction set) of its own, and waits until all of them are
+/// ready and idle.
+///
+/// @return 0 on success, -1 if a thread, buffer or eviction set couldn't be
+///         set up (nothing is left running).
+int start_interference(/*in*/ const interference_options* options, /*out*/ interference* group);
+
+/// Sets the aggressors loose. The calling (victim) thread meets them at a
+/// `tsc_barrier`, so the aggressors start together and the victim returns
+/// at the same deadline.
+void resume_interference(/*inout*/ interference* group);
+
+/// Stops the aggressors at the end of their current pass (a few µs) and
+/// waits until all of them are idle.
+///
+/// @return The lines the aggressors touched since `resume_interference`.
+uint64_t pause_interference(/*inout*/ interference* group);
+
+/// Stops and joins the aggressors, and frees their buffers.
+void stop_interference(/*inout*/ interference* group);
+
+#endif // INTERFERENCE_H
@@ -0,0 +1,166 @@
+#ifndef LATENCY_MODEL_H
+#define LATENCY_MODEL_H
+
+#include "cache_geometry.h"
+#include "eviction_set.h"
+#include "llc_slice.h"
+#include "timer.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// Where in the memory hierarchy a load was served from.
+typedef enum {
+    LEVEL_L1 = 0,
+    LEVEL_L2,
+    LEVEL_L3,
+    LEVEL_RAM,
+    NUM_LEVELS
+} latency_level;
+
+/// The number of samples per level that `calibrate_latency_model` takes.
+#define LATENCY_CALIBRATION_SAMPLES 1001
+
+/// The number of lines of each slice that `calibrate_llc_latency_model` 
+/// times, and how often.
+#define LLC_CALIBRATION_LINES 32
+#define LLC_CALIBRATION_ROUNDS 32
+
+/// The z value of the confidence intervals used to decide a cell, 2.58 for a
+/// 99% interval.
+#define LATENCY_CONFIDENCE_Z 2.58
+
+/// A model of the load latency of each level of the memory hierarchy. A
+/// sample is classified into the first level whose `upper_bound` it doesn't
+/// exceed, the bounds are the midpoints between the medians of adjacent
+/// levels.
+typedef struct {
+    uint64_t median[NUM_LEVELS];
+    uint64_t upper_bound[NUM_LEVELS];
+} latency_model;
+
+/// Fits a model to samples of known level, e.g. the samples of latency.c.
+/// The medians are taken from a histogram, so the samples (which may be a
+/// read-only mapping of a sample file) aren't modified.
+///
+/// @param samples `num_samples` latencies for each level, saturated to 16 bits.
+/// @param num_samples The number of samples per level.
+/// @param model The fitted model.
+/// @return 0 on success, -1 if the medians don't increase from one level to
+///         the next (the levels can't be told apart by latency).
+int fit_latency_model(
+    /*in*/ const uint16_t* const samples[NUM_LEVELS],
+    /*in*/ const size_t num_samples,
+    /*out*/ latency_model* model);
+
+/// Builds a model from a short calibration like latency.c: a line is timed
+/// after being brought into the L1, evicted to the L2 (by writing a buffer
+/// of twice the L1's size), evicted to the L3 (twice the L2's size) and
+/// flushed to RAM, `LATENCY_CALIBRATION_SAMPLES` times each.
+///
+/// @param timer The timer the classified samples will be taken with.
+/// @param geometry The cache geometry of the machine.
+/// @param model The calibrated model.
+/// @return 0 on success, -1 if the memory couldn't be allocated or the
+///         levels can't be told apart.
+int calibrate_latency_model(
+    /*in*/ const probe_timer* timer,
+    /*in*/ const cache_geometry geometry,
+    /*out*/ latency_model* model);
+
+/// Prints the median and upper bound of each level.
+void print_latency_model(/*in*/ FILE* out, /*in*/ const latency_model model);
+
+/// Writes a model as a CSV file with the columns Level, Median, UpperBound.
+int write_latency_model(/*in*/ const char* filename, /*in*/ const latency_model model);
+
+/// A model of the L3 hit and RAM latency of each slice of a sliced last 
+/// level cache. The ring (or mesh) stop of a slice is closer to some cores 
+/// than to others, so a single L3 bound misclassifies the hits in far 
+/// slices. A sample of a line in slice `k` is an L3 hit (or closer) if it 
+/// doesn't exceed `l3_upper_bound[k]`, the midpoint of the two medians.
+typedef struct {
+    size_t num_slices;
+    size_t sets_per_slice;
+    uint64_t l3_median[LLC_MAX_SLICES];
+    uint64_t ram_median[LLC_MAX_SLICES];
+    uint64_t l3_upper_bound[LLC_MAX_SLICES];
+} llc_latency_model;
+
+/// Calibrates a per slice model with the lines of an LLC eviction set: 
+/// `LLC_CALIBRATION_LINES` lines spread over the sets of each slice are 
+/// written, evicted to the L3 (by writing a buffer of twice the L2's size) 
+/// and timed, then flushed to RAM and timed again, `LLC_CALIBRATION_ROUNDS` 
+/// times.
+///
+/// @param timer The timer the classified samples will be taken with.
+/// @param geometry The cache geometry of the machine.
+/// @param llc_es An eviction set from `new_llc_eviction_set`.
+/// @param num_slices The number of slices `llc_es` was built for.
+/// @param model The calibrated model.
+/// @return 0 on success, -1 if the memory couldn't be allocated or the L3 
+///         of a slice can't be told apart from RAM.
+int calibrate_llc_latency_model(
+    /*in*/ const probe_timer* timer,
+    /*in*/ const cache_geometry geometry,
+    /*in*/ const eviction_set llc_es,
+    /*in*/ const size_t num_slices,
+    /*out*/ llc_latency_model* model);
+
+/// Prints the L3 and RAM medians and the L3 bound of each slice.
+void print_llc_latency_model(/*in*/ FILE* out, /*in*/ const llc_latency_model* model);
+
+/// Returns whether a sample of a line in set `set` of an LLC eviction set 
+/// was served from the L3 or closer.
+static inline int llc_hit(/*in*/ const llc_latency_model* model,
+                          /*in*/ const size_t set,
+                          /*in*/ const uint64_t cycles)
+{
+    return cycles <= model->l3_upper_bound[set / model->sets_per_slice];
+}
+
+/// Returns the name of a level ("L1", "L2", "L3" or "RAM").
+const char* latency_level_name(/*in*/ const latency_level level);
+
+/// Classifies a sample.
+static inline latency_level classify_latency(/*in*/ const latency_model* model,
+                                             /*in*/ const uint64_t cycles)
+{
+    for (size_t level = 0; level < LEVEL_RAM; level++)
+    {
+        if (cycles <= model->upper_bound[level]) {
+            return (latency_level)level;
+        }
+    }
+
+    return LEVEL_RAM;
+}
+
+/// Computes the Wilson score interval of a proportion, which stays
+/// meaningful for proportions close to 0 or 1 and few trials.
+///
+/// @param successes The number of successes.
+/// @param trials The number of trials, must be at least 1.
+/// @param z The z value of the interval, e.g. `LATENCY_CONFIDENCE_Z`.
+/// @param lower The lower bound of the interval.
+/// @param upper The upper bound of the interval.
+static inline void wilson_interval(
+    /*in*/ const uint64_t successes,
+    /*in*/ const uint64_t trials,
+    /*in*/ const double z,
+    /*out*/ double* lower,
+    /*out*/ double* upper)
+{
+    const double n = (double)trials;
+    const double p = (double)successes / n;
+    const double z2 = z * z;
+
+    const double center = (p + z2 / (2 * n)) / (1 + z2 / n);
+    const double margin = z / (1 + z2 / n) * sqrt(p * (1 - p) / n + z2 / (4 * n * n));
+
+    *lower = center - margin;
+    *upper = center + margin;
+}
+
+#endif // LATENCY_MODEL_H
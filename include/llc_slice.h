@@ -0,0 +1,51 @@
+#ifndef LLC_SLICE_H
+#define LLC_SLICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// The most LLC slices supported, one per core of the largest parts.
+#define LLC_MAX_SLICES 64
+
+/// Bits of the physical address XORed into each bit of the slice index on
+/// Intel Core parts with 2, 4 or 8 slices (Maurice et al., "Reverse
+/// Engineering Intel Last-Level Cache Complex Addressing Using Performance
+/// Counters", RAID 2015). Bit 0 of the slice index is the parity of
+/// `address & LLC_SLICE_HASH_0`, and so on.
+#define LLC_SLICE_HASH_0 0x1b5f575440ULL
+#define LLC_SLICE_HASH_1 0x2eb5faa880ULL
+#define LLC_SLICE_HASH_2 0x3cccc93100ULL
+
+/// Returns the number of slices of the last level cache. Intel splits the
+/// LLC into one slice per core, so this is the number of physical cores
+/// sharing the L3 of `cpu` (from /sys/devices/system/cpu), or 0 if there's
+/// no L3 or it can't be read.
+///
+/// @param cpu The CPU whose L3 is profiled, or -1 for the CPU the calling
+///            thread is running on.
+size_t detect_llc_slices(/*in*/ const int cpu);
+
+/// Returns whether `llc_slice` knows the slice hash for `num_slices`
+/// slices. The hash of parts with a slice count that isn't a power of two
+/// (most Xeons) isn't linear, and isn't known.
+int llc_slice_hash_known(/*in*/ const size_t num_slices);
+
+/// Returns the slice a physical address maps to. `num_slices` must be
+/// known to `llc_slice_hash_known`.
+static inline __attribute__((always_inline))
+size_t llc_slice(/*in*/ const uint64_t physical, /*in*/ const size_t num_slices)
+{
+    size_t slice = 0;
+    if (num_slices >= 2) {
+        slice |= (size_t)__builtin_parityll(physical & LLC_SLICE_HASH_0);
+    }
+    if (num_slices >= 4) {
+        slice |= (size_t)__builtin_parityll(physical & LLC_SLICE_HASH_1) << 1;
+    }
+    if (num_slices >= 8) {
+        slice |= (size_t)__builtin_parityll(physical & LLC_SLICE_HASH_2) << 2;
+    }
+    return slice;
+}
+
+#endif // LLC_SLICE_H
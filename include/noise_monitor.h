@@ -0,0 +1,144 @@
+#ifndef NOISE_MONITOR_H
+#define NOISE_MONITOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// The frequency MSRs: MPERF counts at the TSC's rate and APERF at the
+/// core's actual rate, both only while the core isn't halted.
+#define NOISE_MPERF_MSR 0xe7
+#define NOISE_APERF_MSR 0xe8
+
+/// Sources of noise a batch can be disturbed by, see `end_noise_batch`.
+#define NOISE_INTERRUPTS (1u << 0)
+#define NOISE_FREQUENCY (1u << 1)
+#define NOISE_HALTED (1u << 2)
+#define NOISE_SIBLING (1u << 3)
+#define NOISE_GOVERNOR (1u << 4)
+
+/// A batch is disturbed by interrupts if it took more than twice the
+/// interrupts the idle rate predicts, plus this many.
+#define NOISE_INTERRUPT_SLACK 2
+
+/// The relative change of the core frequency, and the fraction of the batch
+/// the core may be halted (or the sibling busy) for, before a batch is
+/// disturbed.
+#define NOISE_FREQUENCY_TOLERANCE 0.05
+#define NOISE_HALTED_TOLERANCE 0.02
+#define NOISE_SIBLING_TOLERANCE 0.05
+
+/// How many times a disturbed batch is taken again before it's kept anyway.
+#define NOISE_MAX_RETRIES 3
+
+/// The capacity of the governor and turbo states, including the NUL.
+#define NOISE_STATE_SIZE 32
+
+/// What a batch of samples taken on `cpu` is compared against, measured by
+/// `init_noise_monitor` while the machine is (hopefully) quiet.
+///
+/// The core frequency is measured with APERF/MPERF when they can be read,
+/// and otherwise with `frequency_probe`: the TSC cycles of a fixed chain of
+/// dependent adds, which take longer as the core slows down since the TSC
+/// runs at a constant rate. `tick_cycles` is the TSC cycles of a tick of
+/// /proc/stat, the shortest batch the sibling's busy time can be told for.
+typedef struct {
+    int cpu;
+    int sibling;
+    int irq_column;
+    int has_aperf_mperf;
+    double frequency;
+    uint64_t frequency_probe;
+    double interrupt_rate;
+    uint64_t tick_cycles;
+    char governor[NOISE_STATE_SIZE];
+    char turbo[NOISE_STATE_SIZE];
+} noise_monitor;
+
+/// The state of the counters at the start of a batch.
+typedef struct {
+    uint64_t tsc;
+    uint64_t interrupts;
+    uint64_t aperf;
+    uint64_t mperf;
+    uint64_t frequency_probe;
+    uint64_t sibling_busy;
+    uint64_t sibling_total;
+} noise_snapshot;
+
+/// What disturbed a batch. `sources` holds the `NOISE_*` bits of every
+/// check that failed, `frequency` is relative to the baseline (to the start
+/// of the batch without APERF/MPERF), `unhalted`
+/// is the fraction of the batch the core ran for (1 without APERF/MPERF)
+/// and `sibling_busy` the fraction the SMT sibling was busy for.
+///
+/// The busy time of the sibling comes from /proc/stat, which only advances
+/// once per scheduler tick. A batch shorter than a tick (see
+/// `noise_batch_size`) usually sees no tick, `sibling_busy` is then NAN: the
+/// sibling is unknown rather than idle, and doesn't disturb the batch.
+typedef struct {
+    uint32_t sources;
+    uint64_t cycles;
+    uint64_t interrupts;
+    double expected_interrupts;
+    double frequency;
+    double unhalted;
+    double sibling_busy;
+} noise_report;
+
+/// Measures the baseline of a CPU: its interrupt rate, frequency, governor
+/// and turbo state. The calling thread must be pinned to `cpu`.
+///
+/// @param cpu The CPU the batches are taken on.
+/// @param monitor The baseline.
+/// @return 0 on success, -1 if /proc/interrupts has no column for `cpu`.
+int init_noise_monitor(/*in*/ const int cpu, /*out*/ noise_monitor* monitor);
+
+/// Prints the baseline, and warns about what will make the batches noisy:
+/// a governor other than performance, turbo, or a busy SMT sibling.
+void print_noise_monitor(/*in*/ FILE* out, /*in*/ const noise_monitor* monitor);
+
+/// How many samples of a batch span a tick of /proc/stat, at the pace of
+/// `samples` samples that took `cycles` TSC cycles. Batches at least this
+/// long always see the sibling's busy time.
+size_t noise_batch_size(
+    /*in*/ const noise_monitor* monitor,
+    /*in*/ const size_t samples,
+    /*in*/ const uint64_t cycles);
+
+/// Reads the counters at the start of a batch.
+void begin_noise_batch(/*in*/ const noise_monitor* monitor, /*out*/ noise_snapshot* begin);
+
+/// Reads the counters at the end of a batch and checks them against the
+/// baseline: the batch is disturbed if it took more interrupts than the
+/// idle rate predicts, the core changed frequency or was halted (it was
+/// descheduled), the SMT sibling was busy, or the governor or turbo state
+/// changed.
+///
+/// @param monitor The baseline.
+/// @param begin The counters at the start of the batch.
+/// @param report What disturbed the batch.
+/// @return The `NOISE_*` bits of what disturbed the batch, 0 for a clean
+///         batch.
+uint32_t end_noise_batch(
+    /*in*/ const noise_monitor* monitor,
+    /*in*/ const noise_snapshot* begin,
+    /*out*/ noise_report* report);
+
+/// Writes the header row of a noise log, see `write_noise_report`.
+void write_noise_report_header(/*in*/ FILE* out);
+
+/// Appends a batch to a noise log with the columns Level, Batch, Attempt,
+/// Kept, Sources, Cycles, Interrupts, ExpectedInterrupts, Frequency,
+/// Unhalted, SiblingBusy. `Sources` lists what disturbed the batch, e.g.
+/// "interrupts|frequency", and `SiblingBusy` is "unknown" when no tick
+/// elapsed (see `noise_report`).
+void write_noise_report(
+    /*in*/ FILE* out,
+    /*in*/ const char* level,
+    /*in*/ const size_t batch,
+    /*in*/ const size_t attempt,
+    /*in*/ const int kept,
+    /*in*/ const noise_report* report);
+
+#endif // NOISE_MONITOR_H
@@ -0,0 +1,139 @@
+#ifndef OCCUPANCY_AGGREGATE_H
+#define OCCUPANCY_AGGREGATE_H
+
+#include "address.h"
+#include "eviction_set.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// "PAPA" in little-endian byte order, used to recognize aggregate files.
+#define OCCUPANCY_AGGREGATE_MAGIC 0x41504150u
+#define OCCUPANCY_AGGREGATE_VERSION 2
+
+/// Number of latency histogram bins kept for every cell. The last bin
+/// collects every sample at or above `(OCCUPANCY_HIST_BINS - 1) * bin_width`.
+#define OCCUPANCY_HIST_BINS 8
+#define OCCUPANCY_HIST_BIN_WIDTH 32
+
+/// Streaming statistics for a single (s, s', l') cell. The mean is
+/// `sum / count`. Histogram counts saturate at `UINT16_MAX`.
+///
+/// PERF: the cell is exactly half a cache line, so updating a cell never
+/// touches more than one line of the aggregate.
+typedef struct {
+    uint64_t sum;
+    uint32_t count;
+    uint16_t min;
+    uint16_t max;
+    uint16_t histogram[OCCUPANCY_HIST_BINS];
+} occupancy_cell;
+
+/// In-memory aggregates for an occupancy profile of every set in an
+/// eviction set. Cells are stored as `[s][s'][l']`, so the memory used is
+/// `cache_sets * cache_sets * lines_per_set * sizeof(occupancy_cell)`.
+typedef struct {
+    occupancy_cell* cells;
+    size_t cache_sets;
+    size_t cache_lines;
+    size_t warmup_lines;
+    size_t lines_per_set;
+    size_t bin_width;
+    size_t num_iterations;
+    size_t size;
+    /// The logical CPU every set was profiled on, or -1 if they were
+    /// profiled on more than one.
+    int cpu;
+} occupancy_aggregate;
+
+/// Header of the binary file written by `write_occupancy_aggregate`,
+/// followed by every `occupancy_cell` of the aggregate in `[s][s'][l']` order.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t line_size;
+    uint32_t cache_sets;
+    uint32_t cache_lines;
+    uint32_t warmup_lines;
+    uint32_t num_iterations;
+    uint32_t hist_bins;
+    uint32_t bin_width;
+    uint32_t cell_size;
+    /// The `cpu` of the aggregate, `UINT32_MAX` if there was more than one.
+    uint32_t cpu;
+} occupancy_aggregate_header;
+
+/// Allocates (using `mmap`) an empty aggregate large enough to hold every
+/// cell of an all sets occupancy profile of `es`. The memory is populated
+/// up front so that no page faults happen in between probes.
+///
+/// On failure the returned struct has `cells == NULL`. You must call
+/// `free_occupancy_aggregate` on the result in order to avoid memory leaks.
+///
+/// @param es The eviction set that will be profiled.
+/// @param bin_width The width, in cycles, of each histogram bin.
+occupancy_aggregate new_occupancy_aggregate(
+    /*in*/ const eviction_set es,
+    /*in*/ const size_t bin_width);
+
+/// Frees the memory of an aggregate and clears the struct.
+void free_occupancy_aggregate(/*inout*/ occupancy_aggregate* agg);
+
+/// Writes the aggregate to a binary file (see `occupancy_aggregate_header`).
+///
+/// @return 0 on success, -1 on failure.
+int write_occupancy_aggregate(
+    /*in*/ const occupancy_aggregate agg,
+    /*in*/ const char* filename);
+
+/// Converts an aggregate file written by `write_occupancy_aggregate` into
+/// a CSV file with one row per cell:
+///
+/// Set,SetIndex,LineIndex,Count,Min,Max,Mean,H0,...,H7
+/// 0,0,0,50,262,301,270.5,0,...,50
+/// ...
+///
+/// @return 0 on success, -1 on failure.
+int occupancy_aggregate_to_csv(
+    /*in*/ const char* binary_filename,
+    /*in*/ const char* csv_filename);
+
+/// Returns a pointer to the cell for (set, s', l').
+static inline __attribute__((always_inline))
+occupancy_cell* occupancy_aggregate_cell(
+    /*in*/ const occupancy_aggregate agg,
+    /*in*/ const size_t set,
+    /*in*/ const size_t s_prime,
+    /*in*/ const size_t l_prime)
+{
+    return agg.cells
+        + (set * agg.cache_sets + s_prime) * agg.lines_per_set
+        + l_prime;
+}
+
+/// Adds one sample to the cell for (set, s', l').
+static inline __attribute__((always_inline))
+void record_occupancy_sample(
+    /*inout*/ occupancy_aggregate agg,
+    /*in*/ const size_t set,
+    /*in*/ const size_t s_prime,
+    /*in*/ const size_t l_prime,
+    /*in*/ const uint64_t cycles)
+{
+    occupancy_cell* cell = occupancy_aggregate_cell(agg, set, s_prime, l_prime);
+    const uint16_t c = cycles > UINT16_MAX ? UINT16_MAX : (uint16_t)cycles;
+
+    size_t bin = c / agg.bin_width;
+    if (bin >= OCCUPANCY_HIST_BINS) {
+        bin = OCCUPANCY_HIST_BINS - 1;
+    }
+
+    cell->sum += c;
+    cell->count += 1;
+    cell->min = c < cell->min ? c : cell->min;
+    cell->max = c > cell->max ? c : cell->max;
+    if (cell->histogram[bin] != UINT16_MAX) {
+        cell->histogram[bin] += 1;
+    }
+}
+
+#endif // OCCUPANCY_AGGREGATE_H
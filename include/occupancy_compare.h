@@ -0,0 +1,46 @@
+#ifndef OCCUPANCY_COMPARE_H
+#define OCCUPANCY_COMPARE_H
+
+#include <stddef.h>
+
+/// The default |t| above which a cell is considered to differ between two 
+/// engines. 3.29 is the two-sided 99.9% point of the normal distribution, 
+/// so with ~8k cells per profile roughly 8 cells are expected to differ by 
+/// chance alone.
+#define OCCUPANCY_DEFAULT_CRITICAL_T 3.29
+
+/// The default fraction of cells that may differ before two profiles are 
+/// considered not equivalent.
+#define OCCUPANCY_DEFAULT_TOLERANCE 0.01
+
+/// The result of comparing two occupancy profiles of the same set.
+typedef struct {
+    size_t num_cells;
+    size_t differing_cells;
+    double max_mean_difference;
+    double mean_difference;
+    int equivalent;
+} occupancy_equivalence;
+
+/// Checks whether two occupancy profiles of the same set and geometry (e.g. 
+/// one from the exhaustive engine and one from the targeted engine) are 
+/// statistically equivalent.
+///
+/// For every (s', l') cell a Welch's t-test is run over the samples of all 
+/// iterations in each file. The profiles are equivalent if the fraction of 
+/// cells with |t| > `critical_t` is at most `tolerance`.
+///
+/// @param reference_filename The binary result file from the reference engine.
+/// @param candidate_filename The binary result file from the engine under test.
+/// @param critical_t The |t| above which a cell differs.
+/// @param tolerance The fraction of cells allowed to differ.
+/// @param result The comparison results.
+/// @return 0 on success, -1 if the files can't be read or don't match.
+int compare_occupancy_results(
+    /*in*/ const char* reference_filename,
+    /*in*/ const char* candidate_filename,
+    /*in*/ const double critical_t,
+    /*in*/ const double tolerance,
+    /*out*/ occupancy_equivalence* result);
+
+#endif // OCCUPANCY_COMPARE_H
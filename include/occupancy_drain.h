@@ -0,0 +1,155 @@
+#ifndef OCCUPANCY_DRAIN_H
+#define OCCUPANCY_DRAIN_H
+
+#include "cache.h"
+#include "eviction_set.h"
+#include "occupancy_aggregate.h"
+#include "perf_counters.h"
+#include "spsc_ring.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// The default capacity of a drain in samples, 8 MiB of records: several
+/// iterations of the largest L2 and LLC eviction sets.
+#define OCCUPANCY_DRAIN_DEFAULT_CAPACITY (1024 * 1024)
+
+/// The counter rows a drain holds before the profiling thread waits.
+#define OCCUPANCY_DRAIN_ROWS 1024
+
+/// The `cell` of the record that ends an iteration.
+#define OCCUPANCY_DRAIN_END_ITERATION UINT32_MAX
+
+/// One sample as it's handed from the profiling thread to the drain: the
+/// cell `s' * lines_per_set + l'` it was taken for and its cycle count.
+typedef struct {
+    uint32_t cell;
+    uint32_t cycles;
+} occupancy_record;
+
+/// The counter totals of one iteration, see `occupancy_options`.
+typedef struct {
+    size_t warmup_lines;
+    size_t set;
+    size_t iteration;
+    size_t probes;
+    uint64_t cycles;
+    perf_counts counts;
+} occupancy_counter_row;
+
+/// A consumer thread, pinned to a core other than the profiling thread's,
+/// that takes the samples and counter rows of the profiling thread off two
+/// `spsc_ring`s and folds the samples into an aggregate and writes the rows
+/// to the counter log. The profiling thread only stores 8 byte records into
+/// the ring, so the histogram updates of an aggregate and the stdio of the
+/// counter log happen on another core.
+///
+/// The samples of a result file aren't drained: storing one into the mapped
+/// file is a 2 byte store, a quarter of a record, so handing it over would
+/// only add stores and coherence traffic. A profile into a result file only
+/// drains its counter rows.
+///
+/// Backpressure only applies between iterations: `wait_for_drain_room`
+/// makes sure a whole iteration fits before it starts, so the profiling
+/// thread never waits (or makes a system call) in the middle of one.
+///
+/// A drain serves one profiling thread, one profile at a time.
+typedef struct {
+    spsc_ring* samples;
+    spsc_ring* rows;
+    FILE* counter_log;
+
+    /// Where the samples of the current profile go, NULL if only its counter
+    /// rows are drained. Only changed while the rings are drained.
+    occupancy_aggregate* agg;
+    size_t set;
+    size_t lines_per_set;
+    size_t iteration_records;
+
+    /// The iterations that waited for room before they started.
+    size_t stalls;
+
+    /// Consumer state: the iteration the samples it takes belong to.
+    _Alignas(CACHE_LINE_SIZE) size_t iteration;
+
+    _Alignas(CACHE_LINE_SIZE) atomic_int stop;
+    int cpu;
+    pthread_t thread;
+} occupancy_drain;
+
+/// Allocates a drain and starts its thread, pinned to `cpu` (or unpinned if
+/// `cpu < 0`).
+///
+/// @param cpu The CPU to drain on, which shouldn't share a core with the
+///            profiling thread.
+/// @param capacity The samples the drain holds before the profiling thread
+///                 has to wait, at least one iteration of every profile.
+/// @param counter_log The log the counter rows are appended to, may be NULL
+///                    if no rows are pushed.
+/// @return The drain, or NULL if it couldn't be allocated or started.
+occupancy_drain* start_occupancy_drain(
+    /*in*/ const int cpu,
+    /*in*/ const size_t capacity,
+    /*in*/ FILE* counter_log);
+
+/// Waits until everything pushed was drained, stops the thread and frees
+/// the drain.
+void stop_occupancy_drain(/*inout*/ occupancy_drain* drain);
+
+/// Waits until the last profile was drained, then sends the samples of a
+/// profile of `set` in `es` to `agg`. If `agg` is NULL the profile stores 
+/// its own samples and only hands over its iterations and counter rows.
+///
+/// @return 0 on success, -1 if an iteration of `es` doesn't fit in the
+///         drain, in which case the profile has to store its own samples.
+int begin_drained_profile(
+    /*inout*/ occupancy_drain* drain,
+    /*in*/ const eviction_set es,
+    /*in*/ const size_t set,
+    /*in*/ occupancy_aggregate* agg);
+
+/// Waits until everything pushed was drained, so the result file or the
+/// aggregate of the profile is complete.
+void finish_drained_profile(/*inout*/ occupancy_drain* drain);
+
+/// Waits until an iteration of samples and a counter row fit in the drain.
+/// Only called between iterations.
+void wait_for_drain_room(/*inout*/ occupancy_drain* drain);
+
+/// Hands a sample of the current iteration to the drain. Only a store.
+static inline __attribute__((always_inline))
+void drain_sample(
+    /*inout*/ occupancy_drain* drain,
+    /*in*/ const size_t s_prime,
+    /*in*/ const size_t l_prime,
+    /*in*/ const uint64_t cycles)
+{
+    occupancy_record* record = spsc_ring_slot(drain->samples);
+    record->cell = (uint32_t)(s_prime * drain->lines_per_set + l_prime);
+    record->cycles = cycles > UINT32_MAX ? UINT32_MAX : (uint32_t)cycles;
+    spsc_ring_advance(drain->samples);
+}
+
+/// Ends the current iteration and publishes its samples to the drain.
+static inline __attribute__((always_inline))
+void end_drained_iteration(/*inout*/ occupancy_drain* drain)
+{
+    occupancy_record* end = spsc_ring_slot(drain->samples);
+    end->cell = OCCUPANCY_DRAIN_END_ITERATION;
+    end->cycles = 0;
+    spsc_ring_advance(drain->samples);
+    spsc_ring_publish(drain->samples);
+}
+
+/// Hands the counter row of an iteration to the drain, to be appended to
+/// its counter log.
+static inline __attribute__((always_inline))
+void drain_counter_row(/*inout*/ occupancy_drain* drain, /*in*/ const occupancy_counter_row* row)
+{
+    spsc_ring_push(drain->rows, row);
+    spsc_ring_publish(drain->rows);
+}
+
+#endif // OCCUPANCY_DRAIN_H
@@ -4,7 +4,132 @@
 #include "address.h"
 #include "cache.h"
 #include "eviction_set.h"
+#include "eviction_set_pool.h"
+#include "latency_model.h"
+#include "occupancy_aggregate.h"
+#include "occupancy_drain.h"
+#include "perf_counters.h"
+#include "timer.h"
+#include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/// A neighborhood that covers the whole 4 KiB region of a touched line. The 
+/// L2 streamer can run many lines ahead of an access, but never past the 
+/// end of the 4 KiB region, so this catches everything the prefetchers pull 
+/// in around a line.
+#define OCCUPANCY_NEIGHBORHOOD_REGION SIZE_MAX
+
+/// The default neighborhood flushed by the targeted engine. Validating with 
+/// smaller neighborhoods (2-16 lines) showed lines brought in by the 
+/// streamer surviving from one probe to the next.
+#define OCCUPANCY_DEFAULT_NEIGHBORHOOD OCCUPANCY_NEIGHBORHOOD_REGION
+
+/// How the eviction set is cleaned out of the cache before each probe.
+typedef enum {
+    /// Flush the entire eviction set before every probe, exactly as in the 
+    /// PAPP algorithm.
+    OCCUPANCY_FLUSH_FULL = 0,
+    /// Only flush the lines that the previous prime and probe could have 
+    /// brought into the cache: every line of the primed set and the previous 
+    /// probed line, each with `neighborhood` lines on either side (or their 
+    /// whole 4 KiB region, see `OCCUPANCY_NEIGHBORHOOD_REGION`). The whole 
+    /// eviction set is still flushed once before the first probe.
+    OCCUPANCY_FLUSH_TARGETED = 1,
+} occupancy_flush_mode;
+
+/// Samples served from this level or closer count as hits when classifying.
+#define OCCUPANCY_HIT_LEVEL LEVEL_L2
+
+/// The largest number of probes that can follow a single prime.
+#define OCCUPANCY_MAX_BATCH_SIZE 64
+
+/// The byte offset inside each line of the eviction set where the batched 
+/// engine stores the pointer to the next line to probe. The prime only 
+/// writes to byte 0, so this never conflicts with priming.
+#define OCCUPANCY_CHASE_OFFSET 8
+
+/// The mean latency of the probes at each position of a batch, summed over 
+/// every batch. Since each batch probes lines in a random order, any 
+/// difference between position 0 (which no earlier probe could have 
+/// perturbed) and later positions is caused by the earlier probes.
+typedef struct {
+    uint64_t sum[OCCUPANCY_MAX_BATCH_SIZE];
+    uint64_t count[OCCUPANCY_MAX_BATCH_SIZE];
+} occupancy_perturbation;
+
+/// Options shared by all of the occupancy profiling engines. A zero 
+/// initialized struct gives the original PAPP algorithm.
+///
+/// With `batch_size > 1` the set is primed once and then `batch_size` lines 
+/// are probed, in a pseudorandom order, through a pointer chase (each probed 
+/// line holds the address of the next one) so the prefetcher can't learn 
+/// the order. If `perturbation` isn't NULL the latency of each position in 
+/// the batch is added to it (atomically, so it may be shared between 
+/// workers).
+///
+/// The prime (and in the single probe engine, the prime and the probe) run 
+/// through a kernel specialized for the geometry of the eviction set when 
+/// one exists (see `probe_kernels.h`). `generic_kernels` forces the generic 
+/// `prime_set_write_with_warmup` instead, to compare the two.
+///
+/// If `timer` isn't NULL every probe is timed through it, with its overhead 
+/// subtracted (see `timer.h`). Otherwise the raw `rdtscp` measurement of 
+/// `time_one_line_read_access` is recorded.
+///
+/// If `counter_log` isn't NULL the hardware counters in `counters` (opened 
+/// on the profiling thread) are enabled around each probe, or each batch of 
+/// probes, and their totals for every iteration are appended to it as a CSV 
+/// row (see `write_occupancy_counters_header`). Each row is written with the 
+/// stream locked, so workers can share the log. Enabling the counters is a 
+/// system call in between the prime and the probe, so timings taken with 
+/// counters aren't comparable to timings without.
+///
+/// If `model` isn't NULL every sample is classified as it's taken, a sample 
+/// served from `OCCUPANCY_HIT_LEVEL` or closer is a hit. The profile of a set 
+/// stops early, once the hit rate of every cell is decided: its Wilson 
+/// interval (see `wilson_interval`) lies entirely above or below 1/2. The 
+/// number of iterations is then only a maximum. If `llc_model` isn't NULL 
+/// too (the eviction set is an LLC eviction set) a sample is a hit if it was 
+/// served from the L3 or closer, by the bound of the slice of its set.
+///
+/// If `eviction_sets` isn't NULL the workers of `run_occupancy_jobs` take 
+/// their eviction sets from it and hand them back when they're done, 
+/// rather than allocating and freeing their own (see eviction_set_pool.h).
+///
+/// If `drain` isn't NULL the profiling thread only stores each sample of an 
+/// aggregate (and the counter row of each iteration) into the rings of the 
+/// drain, whose thread on another core folds it into the aggregate and 
+/// writes the counter log (see occupancy_drain.h). The samples of a result 
+/// file are still stored by the profiling thread. The workers of 
+/// `run_occupancy_jobs` each start a drain of their own if `drain_cpus` 
+/// isn't NULL, pinned to the CPU at the index of their CPU in `cpus` (or 
+/// `drain_cpus[0]` if the jobs run on the calling thread), and ignore 
+/// `drain`.
+///
+/// `fingerprint` is recorded in the header of every result file written 
+/// with these options (see `occupancy_result_header`). It should tell apart 
+/// the options that change the samples, so that a profile is never made of 
+/// chunks sampled differently.
+typedef struct {
+    occupancy_flush_mode flush_mode;
+    size_t neighborhood;
+    size_t batch_size;
+    occupancy_perturbation* perturbation;
+    int generic_kernels;
+    const probe_timer* timer;
+    FILE* counter_log;
+    const perf_counters* counters;
+    const latency_model* model;
+    const llc_latency_model* llc_model;
+    eviction_set_pool* eviction_sets;
+    const int* drain_cpus;
+    occupancy_drain* drain;
+    uint64_t fingerprint;
+} occupancy_options;
+
+/// Writes the header row of a counter log, see `occupancy_options`.
+void write_occupancy_counters_header(/*in*/ FILE* counter_log);
 
 /// Performs the occupancy profiling from the PAPP paper.
 ///
@@ -14,18 +139,75 @@
 ///           the PAPP paper. 
 /// @param set The set to profile.
 /// @param num_iterations The number of iterations to run the analysis for.
-/// @param output_filename The CSV file to write the results to.
+/// @param output_filename The binary file to write the results to.
+/// @param options Selects the profiling engine, see `occupancy_options`.
 ///
-/// The output CSV file follows the format of:
+/// The output file is a compact binary file (see `result_file.h`) made of 
+/// an `occupancy_result_header` followed by one `uint16_t` cycle count per 
+/// probe. Use `occupancy_result_to_csv` (or the `occupancy_to_csv` target) 
+/// to turn it back into the CSV format of:
 ///
 /// Iteration,SetIndex,LineIndex,Cycles
 /// 0,0,0,270
 /// 0,1,0,45
 /// ...
-void occupancy_profile(/*inout*/ eviction_set es, 
-                       /*in*/ const size_t set,
-                       /*in*/ const size_t num_iterations, 
-                       /*in*/ const char* output_filename);
+///
+/// If the profile stops early (see `occupancy_options`) the file only holds 
+/// the iterations that ran, and its header says so.
+///
+/// The samples are written to `<output_filename>.partial`, which is only 
+/// renamed to `output_filename` once the profile is done. A result file 
+/// under its final name is always complete, so an interrupted sweep can be 
+/// resumed by skipping the sets whose file exists. A profile that fails is 
+/// removed instead.
+///
+/// @return 0 on success, -1 if the result file couldn't be written or the 
+///         profile couldn't allocate its buffers.
+int occupancy_profile(/*inout*/ eviction_set es, 
+                      /*in*/ const size_t set,
+                      /*in*/ const size_t num_iterations, 
+                      /*in*/ const char* output_filename,
+                      /*in*/ const occupancy_options options);
+
+/// Performs the occupancy profiling from the PAPP paper for _every_ set in 
+/// `es` in a single pass. Rather than keeping every raw sample, each sample 
+/// is folded into the streaming statistics of its (s, s', l') cell in `agg` 
+/// as soon as it is measured.
+///
+/// @param es The eviction set that is used to test the prefetcher. If 
+///           `es` is set up to have a warm up section then this will 
+///           perform the warmup first as described in Section 3.1 of 
+///           the PAPP paper. 
+/// @param num_iterations The number of iterations to run the analysis for.
+/// @param agg The aggregate to add the samples to, created with 
+///            `new_occupancy_aggregate(es, ...)`. Samples are added to any 
+///            already in `agg`. If sets stop early (see `occupancy_options`) 
+///            the count of each cell, not `agg->num_iterations`, says how 
+///            many samples it holds.
+/// @param options Selects the profiling engine, see `occupancy_options`.
+/// @return 0 on success, -1 if a set couldn't be profiled.
+int occupancy_profile_all_sets(/*inout*/ eviction_set es, 
+                               /*in*/ const size_t num_iterations, 
+                               /*inout*/ occupancy_aggregate* agg,
+                               /*in*/ const occupancy_options options);
+
+/// Performs the occupancy profiling from the PAPP paper for a single set, 
+/// folding each sample into the streaming statistics of `agg` rather than 
+/// keeping the raw samples. Only the cells of `set` are written to, so 
+/// different sets can be profiled into the same aggregate concurrently.
+///
+/// @param es The eviction set that is used to test the prefetcher.
+/// @param set The set to profile.
+/// @param num_iterations The number of iterations to run the analysis for.
+/// @param agg The aggregate to add the samples to, created with 
+///            `new_occupancy_aggregate(es, ...)`.
+/// @param options Selects the profiling engine, see `occupancy_options`.
+/// @return 0 on success, -1 if the profile couldn't allocate its buffers.
+int occupancy_profile_aggregate(/*inout*/ eviction_set es, 
+                                /*in*/ const size_t set,
+                                /*in*/ const size_t num_iterations, 
+                                /*inout*/ occupancy_aggregate agg,
+                                /*in*/ const occupancy_options options);
 
 /// Primes a given set (with warmup if specified in es) inside an eviction set.
 ///
@@ -37,6 +219,15 @@ void occupancy_profile(/*inout*/ eviction_set es,
 static inline __attribute__((always_inline))
 void prime_set_write_with_warmup(/*inout*/ eviction_set es, /*in*/ const size_t set)
 {
+    if (es.lines != NULL) {
+        for (size_t line = 0; line < es.warmup_lines + es.cache_lines; line++)
+        {
+            volatile byte* addr = es.lines[line * es.cache_sets + set];
+            *addr = *addr * 2;
+        }
+        return;
+    }
+
     // calculate the stride for moving through the eviction set, as well as 
     // the offset for the initial set 
     const size_t set_stride = es.cache_sets * CACHE_LINE_SIZE;
@@ -0,0 +1,61 @@
+#ifndef PARALLEL_PROFILE_H
+#define PARALLEL_PROFILE_H
+
+#include "occupancy_aggregate.h"
+#include "occupancy_profile.h"
+#include <stddef.h>
+
+/// A single unit of work for `run_occupancy_jobs`: profile `set` in an 
+/// eviction set with `warmup_lines` warmup lines.
+///
+/// If `agg` is NULL the raw samples are written to `output_filename` (see 
+/// `occupancy_profile`), otherwise they are folded into the cells of `set` 
+/// in `agg` (see `occupancy_profile_aggregate`). Jobs sharing an aggregate 
+/// must profile different sets.
+typedef struct {
+    size_t set;
+    size_t warmup_lines;
+    const char* output_filename;
+    occupancy_aggregate* agg;
+} occupancy_job;
+
+/// Runs a list of occupancy profiling jobs in parallel, with one worker 
+/// pinned to each CPU in `cpus`. Since the L2 is private to each core, 
+/// workers on different physical cores can profile independent sets at the 
+/// same time. Each worker allocates its own eviction set (or takes one from 
+/// the pool of `options`), and jobs are handed out in order from a shared 
+/// queue.
+///
+/// If `llc_slices` isn't 0 the targeted cache is a sliced last level cache 
+/// and the workers allocate their eviction sets with `new_llc_eviction_set`. 
+/// Every probe touches lines of every set, so workers sharing an LLC would 
+/// disturb each other's profiles: `cpus` should hold one CPU per LLC (see 
+/// `unique_llcs`).
+///
+/// PERF: workers only reallocate their eviction set when the warmup size 
+/// changes, so jobs should be grouped by `warmup_lines`.
+///
+/// @param jobs The jobs to run.
+/// @param num_jobs The number of jobs in `jobs`.
+/// @param cpus The CPUs to pin a worker to. If `num_cpus == 0` the jobs are 
+///             run on the calling thread, without pinning.
+/// @param num_cpus The number of CPUs in `cpus`.
+/// @param cache_sets The number of sets in the targeted cache.
+/// @param cache_lines The number of lines per set in the targeted cache.
+/// @param llc_slices The number of slices of the targeted LLC, or 0 if the 
+///                   targeted cache isn't sliced.
+/// @param num_iterations The number of iterations to run each job for.
+/// @param options Selects the profiling engine, see `occupancy_options`.
+/// @return 0 if every job was profiled, -1 otherwise.
+int run_occupancy_jobs(
+    /*in*/ const occupancy_job* jobs,
+    /*in*/ const size_t num_jobs,
+    /*in*/ const int* cpus,
+    /*in*/ const size_t num_cpus,
+    /*in*/ const size_t cache_sets,
+    /*in*/ const size_t cache_lines,
+    /*in*/ const size_t llc_slices,
+    /*in*/ const size_t num_iterations,
+    /*in*/ const occupancy_options options);
+
+#endif // PARALLEL_PROFILE_H
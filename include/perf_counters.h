@@ -0,0 +1,98 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// The hardware events counted around each probe. Not every event exists on
+/// every CPU, unsupported ones are simply not counted.
+typedef enum {
+    /// L1D read misses (generic cache event).
+    PERF_L1D_MISS = 0,
+    /// Lines brought into the L1D, including by the L1 prefetchers
+    /// (Intel L1D.REPLACEMENT).
+    PERF_L1D_REPLACEMENT,
+    /// Demand and prefetch requests that missed the L2 (Intel L2_RQSTS.MISS).
+    PERF_L2_MISS,
+    /// Requests from the L2 hardware prefetchers (Intel L2_RQSTS.ALL_PF).
+    PERF_L2_PREFETCH,
+    /// L1D prefetches (generic cache event), only exposed on some CPUs.
+    PERF_L1D_PREFETCH,
+    /// Last level cache read misses (generic cache event).
+    PERF_LLC_MISS,
+    PERF_NUM_EVENTS
+} perf_event_id;
+
+/// A group of hardware counters for the calling thread, enabled and read
+/// together. `fds[event] < 0` for events that couldn't be opened.
+typedef struct {
+    int group_fd;
+    int fds[PERF_NUM_EVENTS];
+    uint64_t ids[PERF_NUM_EVENTS];
+    size_t num_open;
+} perf_counters;
+
+/// Counts of each event over a counting region. Events that aren't counted
+/// are `PERF_COUNT_UNAVAILABLE`.
+typedef struct {
+    uint64_t values[PERF_NUM_EVENTS];
+} perf_counts;
+
+#define PERF_COUNT_UNAVAILABLE UINT64_MAX
+
+/// Opens every event that the CPU and kernel support as one group on the
+/// calling thread. The group starts disabled. Counters only count for the
+/// thread that opened them.
+///
+/// @param pc The opened counters.
+/// @return 0 if at least one event was opened, -1 if none were (perf isn't
+///         available or not allowed), in which case `pc` counts nothing and
+///         can still be passed to the other functions.
+int open_perf_counters(/*out*/ perf_counters* pc);
+
+/// Closes every counter in the group.
+void close_perf_counters(/*inout*/ perf_counters* pc);
+
+/// Resets the counters to 0. Does nothing if no event is open.
+void reset_perf_counters(/*in*/ const perf_counters* pc);
+
+/// Starts counting. Does nothing if no event is open.
+///
+/// PERF: this is an ioctl, so the kernel runs in between the calling code
+/// and whatever is counted (kernel events themselves aren't counted).
+void enable_perf_counters(/*in*/ const perf_counters* pc);
+
+/// Stops counting. Does nothing if no event is open.
+void disable_perf_counters(/*in*/ const perf_counters* pc);
+
+/// Reads the counts since the last reset.
+///
+/// @return 0 on success, -1 if the counters couldn't be read (every count
+///         is then `PERF_COUNT_UNAVAILABLE`).
+int read_perf_counters(/*in*/ const perf_counters* pc, /*out*/ perf_counts* counts);
+
+/// Returns the CSV column name of an event.
+const char* perf_event_name(/*in*/ const perf_event_id event);
+
+/// Writes the column name of every event, each preceded by a comma.
+void write_perf_counts_header(/*in*/ FILE* out);
+
+/// Writes every count, each preceded by a comma. Unavailable counts are
+/// written as empty fields.
+void write_perf_counts(/*in*/ FILE* out, /*in*/ const perf_counts counts);
+
+/// Adds the counts in `add` to `sum`, keeping unavailable counts unavailable.
+static inline void add_perf_counts(/*inout*/ perf_counts* sum, /*in*/ const perf_counts add)
+{
+    for (size_t i = 0; i < PERF_NUM_EVENTS; i++)
+    {
+        if (sum->values[i] == PERF_COUNT_UNAVAILABLE || add.values[i] == PERF_COUNT_UNAVAILABLE) {
+            sum->values[i] = PERF_COUNT_UNAVAILABLE;
+        } else {
+            sum->values[i] += add.values[i];
+        }
+    }
+}
+
+#endif // PERF_COUNTERS_H
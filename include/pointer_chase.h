@@ -0,0 +1,137 @@
+#ifndef POINTER_CHASE_H
+#define POINTER_CHASE_H
+
+#include "address.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// The page size the TLB-aware layouts are built around. Buffers backed by
+/// hugepages only have a TLB entry per 2 MiB, see `map_buffer`.
+#define CHASE_PAGE_SIZE 4096
+
+/// The loads `time_chase` makes per iteration of its loop, the number of
+/// loads timed is rounded up to a multiple of it.
+#define CHASE_UNROLL 16
+
+/// The most chains `time_chases` follows at once.
+#define CHASE_MAX_CHAINS 16
+
+/// Seeds the random layouts of the experiments, so every run links the
+/// same chains.
+#define CHASE_SEED 0x9E3779B97F4A7C15ULL
+
+/// The least of the largest working set the experiments sweep by default
+/// (8 times the L3), to reach well into RAM.
+#define CHASE_MIN_DEFAULT_MAX_SIZE ((size_t)64 << 20)
+
+/// Returns the working set after `size` in a sweep: every power of two,
+/// and the size half way to the next one.
+static inline size_t next_chase_size(/*in*/ const size_t size)
+{
+    return size % 3 == 0 ? size / 3 * 4 : size / 2 * 3;
+}
+
+/// How the working set of a chain is laid out.
+typedef enum {
+    /// Every line in a random order, so every load misses in the caches
+    /// the working set doesn't fit in, and in the TLB once its pages don't.
+    CHASE_RANDOM = 0,
+    /// Every line, a page at a time: the pages are visited in a random order
+    /// and the lines of each page in a random order. A TLB miss is paid once
+    /// per page of loads, so the latency is that of the caches alone.
+    CHASE_PAGES = 1,
+    /// One line per page, the pages in a random order. Every load needs a
+    /// new translation, so the latency steps up as the pages outgrow each
+    /// level of the TLB. The line within each page varies so the loads are
+    /// spread over the cache sets.
+    CHASE_TLB = 2,
+    /// Every `stride` bytes in order, the latency left once the
+    /// prefetchers have seen the stride.
+    CHASE_STRIDE = 3,
+} chase_layout;
+
+/// A cyclic chain of pointers: each node holds the address of the next.
+typedef struct {
+    void** start;
+    size_t nodes;
+    size_t working_set;
+} chase_chain;
+
+/// Parses "random", "pages", "tlb" or "stride".
+///
+/// @return 0 on success, -1 if the name is unknown.
+int parse_chase_layout(/*in*/ const char* name, /*out*/ chase_layout* layout);
+
+/// Returns the name `parse_chase_layout` reads.
+const char* chase_layout_name(/*in*/ const chase_layout layout);
+
+/// Returns the bytes between the nodes of a layout: a line, a page for
+/// `CHASE_TLB` and `stride` for `CHASE_STRIDE`.
+size_t chase_node_spacing(/*in*/ const chase_layout layout, /*in*/ const size_t stride);
+
+/// Links the first `working_set` bytes of `buffer` into a chain laid out
+/// by `layout`, with a node at the start of each line (at a random line of
+/// each page for `CHASE_TLB`, every `stride` bytes for `CHASE_STRIDE`). The
+/// random layouts are a single cycle through every node.
+///
+/// On failure (the permutation couldn't be allocated) the returned chain
+/// has `start == NULL`.
+///
+/// @param buffer The buffer to link, at least `working_set` bytes.
+/// @param working_set The bytes the chain spans.
+/// @param layout The order of the nodes.
+/// @param stride The distance between nodes of `CHASE_STRIDE`, a multiple
+///               of the pointer size.
+/// @param seed Seeds the random layouts.
+chase_chain build_chase_chain(
+    /*in*/ byte* buffer,
+    /*in*/ const size_t working_set,
+    /*in*/ const chase_layout layout,
+    /*in*/ const size_t stride,
+    /*in*/ const uint64_t seed);
+
+/// Links the first `working_set` bytes of `buffer` into `num_chains`
+/// disjoint chains of (nearly) the same length: the nodes of a single
+/// chain laid out by `layout` (see `build_chase_chain`) are split into
+/// consecutive runs, each closed into a cycle of its own.
+///
+/// @param num_chains The number of chains, at most the number of nodes.
+/// @param chains The chains, `num_chains` of them.
+/// @return 0 on success, -1 if the chains couldn't be built.
+int build_chase_chains(
+    /*in*/ byte* buffer,
+    /*in*/ const size_t working_set,
+    /*in*/ const chase_layout layout,
+    /*in*/ const size_t stride,
+    /*in*/ const uint64_t seed,
+    /*in*/ const size_t num_chains,
+    /*out*/ chase_chain* chains);
+
+/// Follows a chain for at least `loads` dependent loads between a single
+/// pair of timestamps, so the timer's overhead is spread over all of them.
+///
+/// @param chain The chain to follow, from its start.
+/// @param loads The loads to make, rounded up to a multiple of `CHASE_UNROLL`.
+/// @return The TSC cycles per load.
+double time_chase(/*in*/ const chase_chain chain, /*in*/ const size_t loads);
+
+/// Follows `num_chains` chains in lockstep, one load of each per round,
+/// between a single pair of timestamps. The loads of a chain depend on each
+/// other but not on the other chains', so up to `num_chains` misses can be
+/// in flight: by Little's law the misses in flight are the latency of a
+/// single chain over the cycles per load here.
+///
+/// Each chain count has a loop of its own with the chains' pointers in
+/// registers, past about 12 chains some are kept on the stack, adding a
+/// store-forward to their loads (small next to a miss).
+///
+/// @param chains The chains to follow, from their start.
+/// @param num_chains The number of chains, at most `CHASE_MAX_CHAINS`.
+/// @param rounds The rounds to make.
+/// @return The TSC cycles per round, 0 if there are too many chains.
+double time_chases(
+    /*in*/ const chase_chain* chains,
+    /*in*/ const size_t num_chains,
+    /*in*/ const size_t rounds);
+
+#endif // POINTER_CHASE_H
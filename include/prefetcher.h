@@ -1,15 +1,84 @@
 #ifndef PREFETCHER_H
-#define PREFETECHER_H
+#define PREFETCHER_H
 
+#include "address.h"
+#include "cache_geometry.h"
 #include <stddef.h>
+#include <stdint.h>
 
-static inline void retrain_prefetcher(const size_t num_streams)
-{
-    static size_t n = 0;
+/// MSR_MISC_FEATURE_CONTROL, whose low 4 bits disable the hardware
+/// prefetchers of a core on Intel CPUs since Nehalem. Other vendors don't
+/// have it, reading it there fails.
+#define PREFETCHER_CONTROL_MSR 0x1a4
 
-    // dynamically store a list of blocks the size of 2x L2 to 
-    // use to retrain the prefetcher by striding through the 
-    // blocks several times.
-}
+/// Bits of `PREFETCHER_CONTROL_MSR`, a set bit disables the prefetcher.
+#define PREFETCHER_L2_STREAMER (1u << 0)
+#define PREFETCHER_L2_ADJACENT_LINE (1u << 1)
+#define PREFETCHER_DCU_NEXT_LINE (1u << 2)
+#define PREFETCHER_DCU_IP (1u << 3)
+#define PREFETCHER_ALL 0xfu
 
-#endif 
+/// The number of streams a trainer walks by default, twice the 32 streams
+/// the L2 streamer of recent Intel cores tracks, so every entry is replaced.
+#define PREFETCHER_DEFAULT_STREAMS 64
+
+/// The number of passes `retrain_prefetcher` makes over its buffer.
+#define PREFETCHER_TRAINING_PASSES 2
+
+/// A buffer of twice the size of the L2, split into `num_streams` blocks
+/// of `stream_size` bytes that `retrain_prefetcher` walks as independent
+/// streams.
+typedef struct {
+    byte* buffer;
+    size_t size;
+    size_t num_streams;
+    size_t stream_size;
+} prefetcher_trainer;
+
+/// Allocates a trainer (see `map_buffer`) for the given L2.
+///
+/// On failure the returned struct has `buffer == NULL`.
+///
+/// @param l2 The geometry of the L2.
+/// @param num_streams The number of streams to train, at least 1.
+prefetcher_trainer new_prefetcher_trainer(
+    /*in*/ const cache_level_geometry l2,
+    /*in*/ const size_t num_streams);
+
+/// Unmaps the buffer of a trainer and clears the struct.
+void free_prefetcher_trainer(/*inout*/ prefetcher_trainer* trainer);
+
+/// Puts the prefetchers into the same state, whatever the previous
+/// experiment left behind. The streams are read in lockstep a line at a
+/// time, `PREFETCHER_TRAINING_PASSES` times, so that every entry of the
+/// stream trackers ends up following one of them and the L1 and L2 only
+/// hold lines of the trainer. Lines are only read, so none of them is
+/// dirty and evicting them later doesn't cost a writeback.
+void retrain_prefetcher(/*in*/ const prefetcher_trainer trainer);
+
+/// Measures how long `retrain_prefetcher` takes.
+///
+/// @param trainer The trainer to time.
+/// @param repetitions The number of times to retrain, at least 1.
+/// @return The median time of a retraining in cycles.
+uint64_t time_prefetcher_retrain(
+    /*in*/ const prefetcher_trainer trainer,
+    /*in*/ const size_t repetitions);
+
+/// Reads which hardware prefetchers of `cpu` are disabled, through
+/// /dev/cpu/<cpu>/msr (which needs the msr module and root).
+///
+/// @param cpu The CPU to read the control MSR of.
+/// @param disabled The `PREFETCHER_*` bits of the disabled prefetchers.
+/// @return 0 on success, -1 if the MSR can't be read.
+int read_prefetcher_control(/*in*/ const int cpu, /*out*/ uint32_t* disabled);
+
+/// Disables the hardware prefetchers in `disabled` on `cpu` and enables
+/// the others, leaving the rest of the MSR untouched.
+///
+/// @param cpu The CPU to write the control MSR of.
+/// @param disabled The `PREFETCHER_*` bits of the prefetchers to disable.
+/// @return 0 on success, -1 if the MSR can't be written.
+int write_prefetcher_control(/*in*/ const int cpu, /*in*/ const uint32_t disabled);
+
+#endif // PREFETCHER_H
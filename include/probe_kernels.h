@@ -0,0 +1,67 @@
+#ifndef PROBE_KERNELS_H
+#define PROBE_KERNELS_H
+
+#include "address.h"
+#include "cache.h"
+#include "utility.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// Every (sets, ways, warmup lines) tuple that a specialized kernel is 
+/// generated for. Add a line here to support another geometry.
+#define PROBE_KERNEL_LIST(X) \
+    X(512, 8, 0)   X(512, 8, 8)    \
+    X(512, 16, 0)  X(512, 16, 8)   \
+    X(1024, 8, 0)  X(1024, 8, 8)   \
+    X(1024, 16, 0) X(1024, 16, 8)  \
+    X(1024, 20, 0) X(1024, 20, 8)  \
+    X(2048, 16, 0) X(2048, 16, 8)  \
+    X(2048, 20, 0) X(2048, 20, 8)
+
+/// Primes `set` by writing to each of its warmup and occupation lines. 
+/// `base` is the start of the eviction set (its warmup section).
+typedef void (*prime_kernel)(byte* base, size_t set);
+
+/// Primes `set` exactly like a `prime_kernel`, then times a read of `line`. 
+/// Nothing but the read sits between the two timestamps.
+typedef uint64_t (*prime_probe_kernel)(byte* base, size_t set, const byte* line);
+
+/// The kernels generated for one geometry.
+typedef struct {
+    size_t sets;
+    size_t ways;
+    size_t warmup_lines;
+    prime_kernel prime;
+    prime_probe_kernel prime_probe;
+} probe_kernels;
+
+/// Looks up the kernels specialized for a geometry.
+///
+/// @return The kernels, or NULL if no kernel was generated for the geometry 
+///         (see `PROBE_KERNEL_LIST`), in which case the generic 
+///         `prime_set_write_with_warmup` has to be used instead.
+const probe_kernels* find_probe_kernels(
+    /*in*/ const size_t sets,
+    /*in*/ const size_t ways,
+    /*in*/ const size_t warmup_lines);
+
+/// The body of every prime kernel. Since `sets` and `lines` are compile 
+/// time constants in each kernel, the loop is fully unrolled into a straight 
+/// run of read-modify-writes at constant offsets from `base + set * 64`.
+static inline __attribute__((always_inline))
+void prime_kernel_body(byte* base, const size_t set, const size_t sets, const size_t lines)
+{
+    byte* start = base + set * CACHE_LINE_SIZE;
+    // keep the compiler from folding `set` back into every address, so each
+    // access is a single instruction with a constant displacement
+    __asm__ volatile("" : "+r"(start));
+
+    #pragma GCC unroll 64
+    for (size_t line = 0; line < lines; line++)
+    {
+        volatile byte* addr = start + line * sets * CACHE_LINE_SIZE;
+        *addr = *addr * 2;
+    }
+}
+
+#endif // PROBE_KERNELS_H
@@ -0,0 +1,181 @@
+#ifndef RESULT_FILE_H
+#define RESULT_FILE_H
+
+#include "address.h"
+#include "eviction_set.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// "PAPP" in little-endian byte order, used to recognize result files.
+#define OCCUPANCY_RESULT_MAGIC 0x50504150u
+#define OCCUPANCY_RESULT_VERSION 4
+
+/// The `cpu` of a profile that wasn't pinned, or whose iterations were
+/// profiled on more than one CPU.
+#define OCCUPANCY_RESULT_ANY_CPU UINT32_MAX
+
+/// A `flags` bit: the profile ran on a `permuted` eviction set, so its 
+/// SetIndex (and `set`) may not be the physical set of the cache.
+#define OCCUPANCY_RESULT_PERMUTED_SETS 0x1u
+
+/// Fixed size header at the start of every binary occupancy result file.
+///
+/// The header is followed by `num_iterations * cache_sets * (cache_lines +
+/// warmup_lines)` packed `uint16_t` cycle values. The indices of a sample
+/// are implicit in its position, the value for (iter, s', l') is stored at
+///
+///     (iter * cache_sets + s') * (cache_lines + warmup_lines) + l'
+///
+/// which is the same order in which `occupancy_profile` visits the lines.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t line_size;
+    uint32_t cache_sets;
+    uint32_t cache_lines;
+    uint32_t warmup_lines;
+    uint32_t set;
+    uint32_t num_iterations;
+    /// The logical CPU the profile ran on, see `OCCUPANCY_RESULT_ANY_CPU`.
+    uint32_t cpu;
+    /// `OCCUPANCY_RESULT_*` bits.
+    uint32_t flags;
+    /// A fingerprint of the options that change the samples, see 
+    /// `occupancy_options`. Chunks of a profile are only appended to each 
+    /// other if it's the same.
+    uint64_t sampling;
+} occupancy_result_header;
+
+typedef struct {
+    occupancy_result_header* header;
+    uint16_t* cycles;
+    size_t lines_per_set;
+    size_t map_size;
+    int fd;
+} occupancy_result_file;
+
+/// Creates (or truncates) `filename` and maps it into memory with enough
+/// room for every sample of an occupancy profile of `set` in `es`. The
+/// mapping is populated up front so that storing a sample never faults or
+/// calls into libc.
+///
+/// On failure the returned struct has `cycles == NULL`. The CPU the calling
+/// thread is pinned to is recorded in the header.
+///
+/// @param filename The binary file to write the results to.
+/// @param es The eviction set that will be profiled.
+/// @param set The set that will be primed.
+/// @param num_iterations The number of iterations to reserve space for.
+occupancy_result_file open_occupancy_result_file(
+    /*in*/ const char* filename,
+    /*in*/ const eviction_set es,
+    /*in*/ const size_t set,
+    /*in*/ const size_t num_iterations);
+
+/// Maps an existing result file read-only, e.g. to analyze it. The header 
+/// is validated against the size of the file.
+///
+/// On failure the returned struct has `cycles == NULL`. The file must be 
+/// closed with `close_occupancy_result_file`.
+///
+/// @param filename The binary result file to read.
+occupancy_result_file read_occupancy_result_file(/*in*/ const char* filename);
+
+/// Records that only the first `num_iterations` iterations of a result file 
+/// opened with `open_occupancy_result_file` were profiled, e.g. because the 
+/// profile stopped early. The header is updated and the file is truncated 
+/// to the samples of those iterations, the mapping stays valid until the 
+/// file is closed but nothing past the new end may be accessed.
+///
+/// @return 0 on success, -1 if the file couldn't be truncated.
+int truncate_occupancy_result_file(
+    /*inout*/ occupancy_result_file* rf,
+    /*in*/ const size_t num_iterations);
+
+/// Appends the iterations of the result file `chunk_filename` to those of
+/// `filename` and removes `chunk_filename`, e.g. to add iterations to a
+/// profile that was profiled in chunks. Both must hold a profile of the same
+/// set in the same geometry, sampled with the same options. The samples are written before the header, so
+/// an interrupted append leaves the file as it was (plus samples past its
+/// end, which are cut off by the next append). If `filename` doesn't exist
+/// yet the chunk is renamed to it.
+///
+/// @return 0 on success, -1 if either file couldn't be read or written, or
+///         they hold profiles of different sets, geometries or options.
+int append_occupancy_result_file(
+    /*in*/ const char* filename,
+    /*in*/ const char* chunk_filename);
+
+/// Cuts the result file `filename` down to its first `num_iterations`
+/// iterations, like `truncate_occupancy_result_file` but for a file that
+/// isn't open.
+///
+/// @return 0 on success, -1 if the file isn't a result file or couldn't be
+///         truncated.
+int cut_occupancy_result_file(
+    /*in*/ const char* filename,
+    /*in*/ const size_t num_iterations);
+
+/// Unmaps and closes a result file opened with `open_occupancy_result_file`
+/// or `read_occupancy_result_file`, clearing the struct afterwards.
+void close_occupancy_result_file(/*inout*/ occupancy_result_file* rf);
+
+/// Converts a binary occupancy result file back into the CSV format that
+/// `plot.py` reads:
+///
+/// Iteration,SetIndex,LineIndex,Cycles
+/// 0,0,0,270
+/// ...
+///
+/// @return 0 on success, -1 if either file could not be opened or the
+///         binary file is malformed.
+int occupancy_result_to_csv(
+    /*in*/ const char* binary_filename,
+    /*in*/ const char* csv_filename);
+
+/// Reduces a binary occupancy result file to the mean latency of every 
+/// (s', l') cell over its iterations, written as the SetIndex x LineIndex 
+/// matrix `plot.py` draws, one row per set:
+///
+/// SetIndex,0,1,...
+/// 0,270.50,268.12,...
+/// ...
+///
+/// The cells are added up a whole iteration at a time with vector 
+/// instructions (see `sum_sample_rows`), so even a sweep of many sets is 
+/// reduced in milliseconds.
+///
+/// @return 0 on success, -1 if either file could not be opened or the
+///         binary file is malformed.
+int occupancy_result_to_means(
+    /*in*/ const char* binary_filename,
+    /*in*/ const char* csv_filename);
+
+/// Returns the sample stored for (iter, s', l').
+static inline __attribute__((always_inline))
+uint16_t load_occupancy_result(
+    /*in*/ const occupancy_result_file rf,
+    /*in*/ const size_t iter,
+    /*in*/ const size_t s_prime,
+    /*in*/ const size_t l_prime)
+{
+    return rf.cycles[(iter * rf.header->cache_sets + s_prime)
+        * rf.lines_per_set + l_prime];
+}
+
+/// Stores one sample. Cycle counts that don't fit in 16 bits saturate at
+/// `UINT16_MAX`.
+static inline __attribute__((always_inline))
+void store_occupancy_result(
+    /*inout*/ occupancy_result_file rf,
+    /*in*/ const size_t iter,
+    /*in*/ const size_t s_prime,
+    /*in*/ const size_t l_prime,
+    /*in*/ const uint64_t cycles)
+{
+    const size_t index = (iter * rf.header->cache_sets + s_prime)
+        * rf.lines_per_set + l_prime;
+    rf.cycles[index] = cycles > UINT16_MAX ? UINT16_MAX : (uint16_t)cycles;
+}
+
+#endif // RESULT_FILE_H
@@ -0,0 +1,146 @@
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include "address.h"
+#include "cache.h"
+#include "cache_geometry.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// The number of 16 bit samples that fit in a cache line.
+#define SAMPLES_PER_LINE (CACHE_LINE_SIZE / sizeof(uint16_t))
+
+/// The default capacity of a ring in samples, 2 MiB of samples.
+#define SAMPLE_RING_DEFAULT_CAPACITY (1024 * 1024)
+
+/// A single producer, single consumer ring of 16 bit samples that a writer
+/// thread drains to a file while the samples are being taken, so the number
+/// of samples isn't bounded by memory.
+///
+/// The ring is made of cache lines that are placed so that none of them
+/// maps to the cache sets of the memory under test: the lines skip
+/// `excluded_count` sets starting at `excluded_first`, out of every `period`
+/// sets. With hugepages the period is the number of L2 sets, otherwise only
+/// the bits below 4 KiB are physical and the period is the 64 lines of a
+/// page (the L1 sets on current x86 CPUs).
+///
+/// The producer only touches the line it's filling, and publishes a line
+/// when it's full, so the writer never touches a line the producer is
+/// still using. As in `spsc_ring`, `head`, `tail` and each side's own state
+/// sit on lines of their own, and the producer only reloads `tail` when its
+/// copy says the ring is full.
+typedef struct {
+    byte* memory;
+    size_t memory_size;
+    int hugepages;
+
+    size_t capacity_lines;
+    size_t period;
+    size_t excluded_first;
+    size_t excluded_count;
+
+    /// Full lines published by the producer, and lines drained by the writer.
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+
+    /// Producer state: the line being filled, the next line to fill, and
+    /// its copy of `tail`.
+    _Alignas(CACHE_LINE_SIZE) uint16_t* cursor;
+    size_t in_line;
+    size_t next_line;
+    size_t cached_tail;
+
+    /// Writer state.
+    _Alignas(CACHE_LINE_SIZE) int fd;
+    int writer_cpu;
+    pthread_t writer;
+    size_t final_samples;
+    atomic_int done;
+    atomic_int failed;
+} sample_ring;
+
+/// Allocates a ring (see `map_buffer`) whose lines avoid the sets of
+/// `excluded_lines` lines starting at `excluded`.
+///
+/// @param capacity The number of samples the ring holds before the producer
+///                 has to wait for the writer.
+/// @param excluded The first line under test, or NULL to exclude nothing.
+/// @param excluded_lines The number of consecutive lines under test. If they
+///                       cover every set of the period nothing is excluded.
+/// @param geometry The cache geometry of the machine.
+/// @return The ring, or NULL if it couldn't be allocated.
+sample_ring* new_sample_ring(
+    /*in*/ const size_t capacity,
+    /*in*/ const void* excluded,
+    /*in*/ const size_t excluded_lines,
+    /*in*/ const cache_geometry geometry);
+
+/// Frees a ring. Its writer must have been finished.
+void free_sample_ring(/*inout*/ sample_ring* ring);
+
+/// Empties the ring and starts a writer thread, pinned to `cpu` (or unpinned
+/// if `cpu < 0`), that drains the samples pushed from now on into `filename`
+/// as raw `uint16_t` values.
+///
+/// @return 0 on success, -1 if the file couldn't be created or the thread
+///         couldn't be started.
+int start_sample_writer(
+    /*inout*/ sample_ring* ring,
+    /*in*/ const char* filename,
+    /*in*/ const int cpu);
+
+/// Publishes the samples pushed so far, waits for the writer to drain them
+/// and closes the file.
+///
+/// @return 0 if every sample was written, -1 otherwise.
+int finish_sample_writer(/*inout*/ sample_ring* ring);
+
+/// Moves the producer on to the next line of the ring, publishing the line
+/// it just filled and waiting for room if the ring is full.
+void advance_sample_ring(/*inout*/ sample_ring* ring);
+
+/// Adds a sample to the ring, saturating at `UINT16_MAX`. Only a store,
+/// unless a line was just filled.
+static inline __attribute__((always_inline))
+void push_sample(/*inout*/ sample_ring* ring, /*in*/ const uint64_t cycles)
+{
+    if (ring->in_line == SAMPLES_PER_LINE) {
+        advance_sample_ring(ring);
+    }
+
+    ring->cursor[ring->in_line++] = cycles > UINT16_MAX ? UINT16_MAX : (uint16_t)cycles;
+}
+
+/// Maps a file written by a sample ring writer read-only.
+///
+/// @param filename The file to map.
+/// @param count The number of samples in the file.
+/// @return The samples, or NULL on failure. Must be unmapped with
+///         `unmap_sample_file`. An empty file returns NULL with `count == 0`.
+const uint16_t* map_sample_file(/*in*/ const char* filename, /*out*/ size_t* count);
+
+/// Unmaps a file mapped with `map_sample_file`.
+void unmap_sample_file(/*in*/ const uint16_t* samples, /*in*/ const size_t count);
+
+/// Drops runs of samples from a file written by a sample ring writer, e.g.
+/// the batches a noise monitor rejected (see noise_monitor.h). The file is
+/// made of `num_runs` consecutive runs of `run_lengths[i]` samples, the
+/// runs with `keep[i] == 0` are removed and the file is truncated.
+///
+/// @param filename The file to compact.
+/// @param run_lengths The number of samples of each run.
+/// @param keep Whether each run is kept.
+/// @param num_runs The number of runs.
+/// @param kept The number of samples left in the file.
+/// @return 0 on success, -1 if the file couldn't be mapped or is shorter
+///         than its runs.
+int compact_sample_file(
+    /*in*/ const char* filename,
+    /*in*/ const size_t* run_lengths,
+    /*in*/ const uint8_t* keep,
+    /*in*/ const size_t num_runs,
+    /*out*/ size_t* kept);
+
+#endif // SAMPLE_RING_H
@@ -0,0 +1,107 @@
+#ifndef SAMPLE_STATS_H
+#define SAMPLE_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// The bins of a histogram of 16 bit samples, one per value.
+#define SAMPLE_HISTOGRAM_BINS ((size_t)UINT16_MAX + 1)
+
+/// The most edges of a banded histogram, see `sample_band_histogram`.
+#define SAMPLE_MAX_BANDS 16
+
+/// The most rows `sum_sample_rows` can add up, so that the sums of 16 bit
+/// samples fit in 32 bits.
+#define SAMPLE_MAX_SUM_ROWS ((size_t)(UINT32_MAX / UINT16_MAX))
+
+/// The instruction sets the reductions are implemented with. The widest one
+/// the CPU supports is picked the first time a reduction runs.
+typedef enum {
+    SAMPLE_STATS_SCALAR = 0,
+    SAMPLE_STATS_AVX2 = 1,
+    SAMPLE_STATS_AVX512 = 2,
+} sample_stats_isa;
+
+/// Returns the instruction set the reductions run with.
+sample_stats_isa sample_stats_selected_isa(void);
+
+/// Forces the reductions to run with `isa`, e.g. to compare the
+/// implementations.
+///
+/// @return 0 on success, -1 if the CPU doesn't support `isa`.
+int select_sample_stats_isa(/*in*/ const sample_stats_isa isa);
+
+/// Returns "scalar", "avx2" or "avx512".
+const char* sample_stats_isa_name(/*in*/ const sample_stats_isa isa);
+
+/// Finds the smallest and largest of `num_samples` samples. Both are 0 if
+/// there are no samples.
+void sample_min_max(
+    /*in*/ const uint16_t* samples,
+    /*in*/ const size_t num_samples,
+    /*out*/ uint16_t* min,
+    /*out*/ uint16_t* max);
+
+/// Counts the samples of each value into a histogram of
+/// `SAMPLE_HISTOGRAM_BINS` bins, adding to the counts already in it.
+///
+/// PERF: consecutive samples are counted into separate sub-histograms, so
+/// repeated values (most of a level's samples are a few values) don't wait
+/// on each other's increments. There is no vector form, AVX-512 scatters
+/// are slower than these stores.
+///
+/// @return 0 on success, -1 if the sub-histograms couldn't be allocated.
+int sample_histogram(
+    /*in*/ const uint16_t* samples,
+    /*in*/ const size_t num_samples,
+    /*inout*/ uint64_t* histogram);
+
+/// Finds percentiles (from 0 to 1) of the samples counted in a histogram of
+/// `SAMPLE_HISTOGRAM_BINS` bins: the smallest value more than
+/// `percentile * num_samples` samples are at or below (the largest value
+/// for 1).
+///
+/// @param histogram The histogram, see `sample_histogram`.
+/// @param percentiles The percentiles to find, in increasing order.
+/// @param num_percentiles The number of percentiles.
+/// @param values The value of each percentile.
+void histogram_percentiles(
+    /*in*/ const uint64_t* histogram,
+    /*in*/ const double* percentiles,
+    /*in*/ const size_t num_percentiles,
+    /*out*/ uint64_t* values);
+
+/// Counts the samples into the bands between increasing edges: band 0
+/// holds the samples at or below `edges[0]`, band `i` those in
+/// `(edges[i - 1], edges[i]]`, and band `num_edges` the samples above the
+/// last edge. E.g. the upper bounds of a latency model classify samples by
+/// level (see latency_model.h).
+///
+/// @param samples The samples.
+/// @param num_samples The number of samples.
+/// @param edges The upper edge of each band but the last, in increasing order.
+/// @param num_edges The number of edges, at most `SAMPLE_MAX_BANDS`.
+/// @param counts The samples of each band, `num_edges + 1` of them.
+void sample_band_histogram(
+    /*in*/ const uint16_t* samples,
+    /*in*/ const size_t num_samples,
+    /*in*/ const uint16_t* edges,
+    /*in*/ const size_t num_edges,
+    /*out*/ uint64_t* counts);
+
+/// Adds up `num_rows` consecutive rows of `row_length` samples element by
+/// element: `sums[i]` is the sum of sample `i` of every row. E.g. the rows of
+/// an occupancy result file (see result_file.h) are its iterations, and the
+/// sums those of every (s', l') cell.
+///
+/// @param samples The rows.
+/// @param num_rows The number of rows, at most `SAMPLE_MAX_SUM_ROWS`.
+/// @param row_length The samples in a row.
+/// @param sums The sums, `row_length` of them.
+void sum_sample_rows(
+    /*in*/ const uint16_t* samples,
+    /*in*/ const size_t num_rows,
+    /*in*/ const size_t row_length,
+    /*out*/ uint32_t* sums);
+
+#endif // SAMPLE_STATS_H
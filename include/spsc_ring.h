@@ -0,0 +1,145 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include "address.h"
+#include "cache.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/// A lock-free single producer, single consumer ring of fixed size records.
+///
+/// `head` (written by the producer) and `tail` (written by the consumer)
+/// each sit on a cache line of their own, and so does each side's private
+/// state, so neither side writes a line the other one polls except to
+/// publish. Each side also keeps a copy of the other side's index and only
+/// reloads it when the copy says the ring is full (or empty), so the
+/// producer doesn't miss on `tail` for every record.
+///
+/// The producer pushes records privately and publishes them in bulk with
+/// `spsc_ring_publish`, e.g. once per iteration of a measurement, so the
+/// line holding `head` moves to the consumer once per publish rather than
+/// once per record. A push is only a store: the producer checks for room up
+/// front with `spsc_ring_reserve`, and small records are written in place
+/// through `spsc_ring_slot` rather than copied with `spsc_ring_push`.
+typedef struct {
+    /// Set up by `new_spsc_ring`, read-only afterwards.
+    byte* records;
+    size_t records_size;
+    size_t record_size;
+    size_t capacity;
+    size_t mask;
+
+    /// The records published by the producer.
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+    /// The records the consumer is done with.
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+
+    /// Producer state: the next record to push (everything before it is
+    /// pushed, everything before `head` is published) and its copy of `tail`.
+    _Alignas(CACHE_LINE_SIZE) size_t next;
+    size_t cached_tail;
+
+    /// Consumer state: its copy of `head`.
+    _Alignas(CACHE_LINE_SIZE) size_t cached_head;
+} spsc_ring;
+
+/// Allocates a ring. The records are backed by a populated buffer (see
+/// `map_buffer`), so pushing never faults.
+///
+/// @param record_size The size of a record in bytes.
+/// @param capacity The number of records the ring holds, rounded up to a
+///                 power of two.
+/// @return The ring, or NULL if it couldn't be allocated.
+spsc_ring* new_spsc_ring(/*in*/ const size_t record_size, /*in*/ const size_t capacity);
+
+/// Frees a ring allocated with `new_spsc_ring`.
+void free_spsc_ring(/*inout*/ spsc_ring* ring);
+
+/// Returns whether `count` more records can be pushed without overwriting
+/// any the consumer hasn't released. Producer only, never blocks.
+static inline __attribute__((always_inline))
+int spsc_ring_reserve(/*inout*/ spsc_ring* ring, /*in*/ const size_t count)
+{
+    if (ring->next + count - ring->cached_tail <= ring->capacity) {
+        return 1;
+    }
+
+    ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return ring->next + count - ring->cached_tail <= ring->capacity;
+}
+
+/// Returns the slot of the next record, to be written in place (as a typed
+/// store, not a `memcpy` of `record_size` bytes) and then pushed with
+/// `spsc_ring_advance`. There must be room for it (see `spsc_ring_reserve`).
+/// Producer only.
+static inline __attribute__((always_inline))
+void* spsc_ring_slot(/*in*/ const spsc_ring* ring)
+{
+    return ring->records + (ring->next & ring->mask) * ring->record_size;
+}
+
+/// Pushes the record written to `spsc_ring_slot` without publishing it.
+/// Producer only.
+static inline __attribute__((always_inline))
+void spsc_ring_advance(/*inout*/ spsc_ring* ring)
+{
+    ring->next++;
+}
+
+/// Copies a record into the ring without publishing it, e.g. a record too
+/// large to build in place. There must be room for it (see
+/// `spsc_ring_reserve`). Producer only.
+static inline __attribute__((always_inline))
+void spsc_ring_push(/*inout*/ spsc_ring* ring, /*in*/ const void* record)
+{
+    memcpy(spsc_ring_slot(ring), record, ring->record_size);
+    spsc_ring_advance(ring);
+}
+
+/// Makes every record pushed so far visible to the consumer. Producer only.
+static inline __attribute__((always_inline))
+void spsc_ring_publish(/*inout*/ spsc_ring* ring)
+{
+    atomic_store_explicit(&ring->head, ring->next, memory_order_release);
+}
+
+/// Returns whether the consumer released every published record.
+static inline __attribute__((always_inline))
+int spsc_ring_drained(/*in*/ spsc_ring* ring)
+{
+    return atomic_load_explicit(&ring->tail, memory_order_acquire)
+        == atomic_load_explicit(&ring->head, memory_order_relaxed);
+}
+
+/// Returns the published records the consumer hasn't released yet that are
+/// contiguous in memory, i.e. up to the end of the ring. Consumer only.
+///
+/// @param records Set to the first of the records.
+/// @return The number of records, 0 if there are none.
+static inline __attribute__((always_inline))
+size_t spsc_ring_peek(/*inout*/ spsc_ring* ring, /*out*/ const void** records)
+{
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == ring->cached_head) {
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+
+    const size_t first = tail & ring->mask;
+    const size_t available = ring->cached_head - tail;
+    const size_t contiguous = ring->capacity - first;
+    *records = ring->records + first * ring->record_size;
+    return available < contiguous ? available : contiguous;
+}
+
+/// Hands the first `count` records of the last `spsc_ring_peek` back to the
+/// producer. Consumer only.
+static inline __attribute__((always_inline))
+void spsc_ring_release(/*inout*/ spsc_ring* ring, /*in*/ const size_t count)
+{
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+#endif // SPSC_RING_H
@@ -0,0 +1,69 @@
+#ifndef STREAM_KERNELS_H
+#define STREAM_KERNELS_H
+
+#include "address.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// The bytes every kernel handles per iteration of its loop (4 lines). The
+/// sizes handed to the kernels must be multiples of it, and the buffers
+/// aligned to a line.
+#define STREAM_BLOCK 256
+
+/// What a kernel does to its buffers.
+typedef enum {
+    /// Reads `src`.
+    STREAM_READ = 0,
+    /// Writes `dst`.
+    STREAM_WRITE = 1,
+    /// Reads `src` and writes it to `dst`.
+    STREAM_COPY = 2,
+} stream_op;
+
+/// The instruction set a kernel needs.
+typedef enum {
+    STREAM_SCALAR = 0,
+    STREAM_AVX2 = 1,
+    STREAM_AVX512 = 2,
+} stream_isa;
+
+/// Streams over `bytes` bytes of `src` and/or `dst` (see `stream_op`), once.
+///
+/// @return Something computed from the data read, so the loads of the read
+///         kernels can't be dropped, 0 for the others.
+typedef uint64_t (*stream_kernel_fn)(byte* dst, const byte* src, size_t bytes);
+
+/// A streaming kernel.
+typedef struct {
+    const char* name;
+    stream_op op;
+    stream_isa isa;
+    /// Whether the stores bypass the caches (non-temporal stores). They are
+    /// fenced before the kernel returns.
+    int nontemporal;
+    stream_kernel_fn run;
+} stream_kernel;
+
+/// Returns every kernel, supported by the CPU or not.
+///
+/// The kernels are `read-lines` and `rmw-lines`, the `read_buffer` and
+/// `write_buffer` helpers of cache.h (a byte per line through volatile
+/// pointers, the serial baseline), then `read`, `write` and `copy` with
+/// 64 bit words (`-scalar`), 256 bit (`-avx2`) and 512 bit (`-avx512`)
+/// vectors, and `write-nt` and `copy-nt` with non-temporal vector stores.
+///
+/// @param num_kernels Set to the number of kernels.
+const stream_kernel* stream_kernels(/*out*/ size_t* num_kernels);
+
+/// Looks up a kernel by name.
+///
+/// @return The kernel, or NULL if there is none of that name.
+const stream_kernel* find_stream_kernel(/*in*/ const char* name);
+
+/// Returns whether the CPU supports the instruction set of a kernel.
+int stream_kernel_supported(/*in*/ const stream_kernel* kernel);
+
+/// Returns "read", "write" or "copy".
+const char* stream_op_name(/*in*/ const stream_op op);
+
+#endif // STREAM_KERNELS_H
@@ -0,0 +1,250 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "address.h"
+#include "utility.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// How the start and end of a timed region are serialized.
+typedef enum {
+    /// `rdtscp; lfence` to start and `rdtscp` to end, the sequence used by
+    /// `time_one_line_read_access`.
+    TIMER_RDTSCP = 0,
+    /// `cpuid; rdtsc` to start and `rdtscp; cpuid` to end (Intel's "How to
+    /// Benchmark Code Execution Times" white paper). `cpuid` is fully
+    /// serializing but slow, and traps to the hypervisor in a VM.
+    TIMER_CPUID_RDTSC = 1,
+    /// `lfence; rdpmc; lfence` on the core cycle counter, through a
+    /// `perf_event_open` event that allows userspace `rdpmc`. Counts core
+    /// clock cycles rather than reference (TSC) cycles.
+    TIMER_RDPMC = 2,
+} timer_mode;
+
+/// The number of empty measurements `init_timer` takes the overhead from.
+#define TIMER_CALIBRATION_SAMPLES 10001
+
+/// A calibrated timer. Times returned through a timer have `overhead`
+/// subtracted already.
+typedef struct {
+    timer_mode mode;
+    /// The median of `TIMER_CALIBRATION_SAMPLES` empty measurements.
+    uint64_t overhead;
+    /// The smallest nonzero difference between two empty measurements,
+    /// i.e. the granularity of the counter.
+    uint64_t resolution;
+    /// The interquartile range of the empty measurements.
+    uint64_t jitter;
+    /// `rdpmc` only: the counter to read, and the mask for its width.
+    uint32_t pmc_index;
+    uint64_t counter_mask;
+    /// `rdpmc` only: the perf event and its mapped metadata page.
+    int perf_fd;
+    void* perf_page;
+} probe_timer;
+
+/// Sets up a timer and calibrates its overhead, resolution and jitter on the
+/// calling thread. The calibration should be run on the CPU (and with
+/// `rdpmc`, the thread) the timer is used on.
+///
+/// @param mode The serialization mode to use.
+/// @param timer The calibrated timer. If `mode` isn't available (`rdpmc`
+///              isn't allowed from userspace) it falls back to
+///              `TIMER_RDTSCP`.
+/// @return 0 on success, -1 if the timer fell back to `TIMER_RDTSCP`.
+int init_timer(/*in*/ const timer_mode mode, /*out*/ probe_timer* timer);
+
+/// Releases the perf event of an `rdpmc` timer.
+void free_timer(/*inout*/ probe_timer* timer);
+
+/// Parses a mode name ("rdtscp", "cpuid" or "rdpmc").
+///
+/// @return 0 on success, -1 if `name` isn't a mode.
+int parse_timer_mode(/*in*/ const char* name, /*out*/ timer_mode* mode);
+
+/// Returns the name of a mode, as accepted by `parse_timer_mode`.
+const char* timer_mode_name(/*in*/ const timer_mode mode);
+
+/// Prints the mode, overhead, resolution and jitter of a timer.
+void print_timer(/*in*/ FILE* out, /*in*/ const probe_timer timer);
+
+/// The number of waits `calibrate_busy_wait` takes the median of.
+#define BUSY_WAIT_CALIBRATION_SAMPLES 101
+
+/// Spins until at least `cycles` TSC cycles have passed. The wait only reads 
+/// the TSC with `rdtsc`, which (unlike `rdtscp`) doesn't wait for earlier 
+/// loads, so loads and prefetches in flight keep going during the wait.
+///
+/// @return The TSC cycles that actually passed.
+static inline __attribute__((always_inline))
+uint64_t busy_wait(/*in*/ const uint64_t cycles)
+{
+    const uint64_t start = __builtin_ia32_rdtsc();
+    uint64_t now = start;
+    while (now - start < cycles) {
+        now = __builtin_ia32_rdtsc();
+    }
+
+    return now - start;
+}
+
+/// Measures how long `busy_wait(cycles)` really takes, which overshoots by 
+/// up to a read of the TSC, and a wait of 0 cycles still takes one.
+///
+/// @return The median TSC cycles of `BUSY_WAIT_CALIBRATION_SAMPLES` waits.
+uint64_t calibrate_busy_wait(/*in*/ const uint64_t cycles);
+
+/// Reads the counter at the start of a timed region. `mode` is always a
+/// constant at the call sites below, so the switch is resolved at compile
+/// time.
+static inline __attribute__((always_inline))
+uint64_t timer_begin(const timer_mode mode, const uint32_t pmc_index)
+{
+    uint64_t lo, hi;
+
+    switch (mode) {
+        case TIMER_CPUID_RDTSC:
+            asm volatile("cpuid\n\t"
+                         "rdtsc"
+                         : "=a"(lo), "=d"(hi)
+                         : "a"(0)
+                         : "rbx", "rcx");
+            break;
+        case TIMER_RDPMC:
+            asm volatile("lfence\n\t"
+                         "rdpmc\n\t"
+                         "lfence"
+                         : "=a"(lo), "=d"(hi)
+                         : "c"(pmc_index));
+            break;
+        default:
+            asm volatile("rdtscp\n\t"
+                         "lfence"
+                         : "=a"(lo), "=d"(hi)
+                         :
+                         : "rcx");
+            break;
+    }
+
+    return (hi << 32) | lo;
+}
+
+/// Reads the counter at the end of a timed region.
+static inline __attribute__((always_inline))
+uint64_t timer_end(const timer_mode mode, const uint32_t pmc_index)
+{
+    uint64_t lo, hi;
+
+    switch (mode) {
+        case TIMER_CPUID_RDTSC:
+            // cpuid clobbers eax and edx, so save the timestamp first
+            asm volatile("rdtscp\n\t"
+                         "mov %%eax, %%r8d\n\t"
+                         "mov %%edx, %%r9d\n\t"
+                         "xor %%eax, %%eax\n\t"
+                         "cpuid\n\t"
+                         "mov %%r8, %0\n\t"
+                         "mov %%r9, %1"
+                         : "=r"(lo), "=r"(hi)
+                         :
+                         : "rax", "rbx", "rcx", "rdx", "r8", "r9");
+            break;
+        case TIMER_RDPMC:
+            asm volatile("lfence\n\t"
+                         "rdpmc"
+                         : "=a"(lo), "=d"(hi)
+                         : "c"(pmc_index));
+            break;
+        default:
+            asm volatile("rdtscp"
+                         : "=a"(lo), "=d"(hi)
+                         :
+                         : "rcx");
+            break;
+    }
+
+    return (hi << 32) | lo;
+}
+
+/// Times a read of *addr with a constant mode, without subtracting the
+/// overhead.
+static inline __attribute__((always_inline))
+uint64_t timer_read_access_as(const timer_mode mode, const probe_timer* timer, const byte* addr)
+{
+    mfence(); // ensure all previous memory access is complete
+    const uint64_t start = timer_begin(mode, timer->pmc_index);
+    *(const volatile byte*)addr;
+    const uint64_t end = timer_end(mode, timer->pmc_index);
+    return (end - start) & timer->counter_mask;
+}
+
+/// Times a read of the pointer stored at *addr with a constant mode,
+/// without subtracting the overhead. See `time_one_pointer_chase`.
+static inline __attribute__((always_inline))
+uint64_t timer_pointer_chase_as(const timer_mode mode, const probe_timer* timer,
+                                byte* const* addr, byte** next)
+{
+    mfence(); // ensure all previous memory access is complete
+    const uint64_t start = timer_begin(mode, timer->pmc_index);
+    *next = *(byte* const volatile*)addr;
+    const uint64_t end = timer_end(mode, timer->pmc_index);
+    return (end - start) & timer->counter_mask;
+}
+
+/// Subtracts the calibrated overhead from a raw measurement.
+static inline __attribute__((always_inline))
+uint64_t timer_subtract_overhead(const probe_timer* timer, const uint64_t elapsed)
+{
+    return elapsed > timer->overhead ? elapsed - timer->overhead : 0;
+}
+
+/// Times a read of *addr, with the timer's overhead subtracted.
+///
+/// PERF: the mode is dispatched before the timed region, each case is a
+/// separate copy of the whole measurement.
+static inline __attribute__((always_inline))
+uint64_t timed_read(/*in*/ const probe_timer* timer, /*in*/ const byte* addr)
+{
+    uint64_t elapsed;
+
+    switch (timer->mode) {
+        case TIMER_CPUID_RDTSC:
+            elapsed = timer_read_access_as(TIMER_CPUID_RDTSC, timer, addr);
+            break;
+        case TIMER_RDPMC:
+            elapsed = timer_read_access_as(TIMER_RDPMC, timer, addr);
+            break;
+        default:
+            elapsed = timer_read_access_as(TIMER_RDTSCP, timer, addr);
+            break;
+    }
+
+    return timer_subtract_overhead(timer, elapsed);
+}
+
+/// Times a read of the pointer stored at *addr, returning the pointer
+/// through `next`, with the timer's overhead subtracted.
+static inline __attribute__((always_inline))
+uint64_t timed_pointer_chase(/*in*/ const probe_timer* timer,
+                             /*in*/ byte* const* addr,
+                             /*out*/ byte** next)
+{
+    uint64_t elapsed;
+
+    switch (timer->mode) {
+        case TIMER_CPUID_RDTSC:
+            elapsed = timer_pointer_chase_as(TIMER_CPUID_RDTSC, timer, addr, next);
+            break;
+        case TIMER_RDPMC:
+            elapsed = timer_pointer_chase_as(TIMER_RDPMC, timer, addr, next);
+            break;
+        default:
+            elapsed = timer_pointer_chase_as(TIMER_RDTSCP, timer, addr, next);
+            break;
+    }
+
+    return timer_subtract_overhead(timer, elapsed);
+}
+
+#endif // TIMER_H
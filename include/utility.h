@@ -84,6 +84,36 @@ static inline ALWAYS_INLINE uint64_t time_one_line_read_access(const byte *addr)
     return elapsed_time;
 }
 
+// Times a read of the pointer stored at *addr, and returns the pointer 
+// through `next`. Since the address of the next access depends on the value 
+// loaded here, a chain of these accesses can't be issued early or predicted 
+// by the prefetcher.
+static inline ALWAYS_INLINE uint64_t time_one_pointer_chase(byte* const* addr, byte** next) {
+    mfence(); // ensure all previous memory access is complete
+    const uint64_t time_init = read_timestamp();
+    lfence(); // inserted due to the advice in Intel SDM Vol. 2B 4-560
+    *next = *(byte* const volatile*)addr; // read the next address
+    const uint64_t elapsed_time = read_timestamp() - time_init;
+    return elapsed_time;
+}
+
+// Compares two `uint64_t` values for `qsort`, e.g. to take the median of a 
+// batch of timings.
+static inline int compare_u64(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// xorshift64*, a small pseudorandom generator that is only used to shuffle 
+// probe orders and chains. `state` must not be 0.
+static inline uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
 // Compatability Section For Older Versions of utility.h
 
 static inline uint64_t 
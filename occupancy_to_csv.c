@@ -0,0 +1,71 @@
+#include "occupancy_aggregate.h"
+#include "result_file.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Reads the magic number at the start of a binary result file, returns 0 
+// if the file can't be read.
+static uint32_t read_magic(const char* filename)
+{
+    uint32_t magic = 0;
+    FILE* in = fopen(filename, "rb");
+    if (in == NULL) {
+        return 0;
+    }
+
+    if (fread(&magic, sizeof(magic), 1, in) != 1) {
+        magic = 0;
+    }
+
+    fclose(in);
+    return magic;
+}
+
+// Converts binary occupancy results (raw samples or all sets aggregates) back into CSV files next to them, 
+// e.g. `results/occupancy/no_warmup_O1_S0.bin` is written to 
+// `results/occupancy/no_warmup_O1_S0.csv`. With `--means` raw samples 
+// are reduced to the mean of every cell instead, written to 
+// `results/occupancy/no_warmup_O1_S0_means.csv` (see 
+// `occupancy_result_to_means`).
+int main(int argc, char** argv)
+{
+    const int means = argc > 1 && strcmp(argv[1], "--means") == 0;
+    if (argc < 2 + means) {
+        fprintf(stderr, "usage: %s [--means] <result.bin>...\n", argv[0]);
+        return 1;
+    }
+
+    int status = 0;
+    char csv_filename[4096] = {0};
+
+    for (int i = 1 + means; i < argc; i++)
+    {
+        const char* binary_filename = argv[i];
+        const int aggregate = read_magic(binary_filename) == OCCUPANCY_AGGREGATE_MAGIC;
+
+        // swap the `.bin` extension (if any) for `.csv`
+        size_t length = strlen(binary_filename);
+        if (length >= 4 && strcmp(binary_filename + length - 4, ".bin") == 0) {
+            length -= 4;
+        }
+        snprintf(csv_filename, sizeof(csv_filename), "%.*s%s.csv", (int)length, binary_filename,
+                 means && !aggregate ? "_means" : "");
+
+        const int converted = aggregate
+            ? occupancy_aggregate_to_csv(binary_filename, csv_filename)
+            : means
+            ? occupancy_result_to_means(binary_filename, csv_filename)
+            : occupancy_result_to_csv(binary_filename, csv_filename);
+
+        if (converted != 0) {
+            status = 1;
+            continue;
+        }
+
+        printf("%s -> %s\n", binary_filename, csv_filename);
+    }
+
+    return status;
+}
@@ -0,0 +1,550 @@
+#include "cpu.h"
+#include "eviction_set_pool.h"
+#include "experiment.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The build variant, set for every variant by CMakeLists.txt
+#ifndef PAPP_VARIANT
+#define PAPP_VARIANT "O1"
+#endif
+#ifndef PAPP_FLAGS
+#define PAPP_FLAGS "-O1"
+#endif
+
+#define MAX_JOBS 256
+#define MAX_JOB_ARGS 256
+#define MAX_LINE_SIZE 4096
+#define MAX_CPUS 1024
+
+// The stack of a job's thread, experiments keep their set and pattern
+// tables on the stack
+#define JOB_STACK_SIZE (64 << 20)
+
+// An experiment a job can run, and where it writes its results unless
+// given `--output`. The pattern presets are the pattern experiment with
+// `--preset`.
+typedef struct {
+    const char* name;
+    experiment_main run;
+    const char* preset;
+    const char* default_output;
+} experiment;
+
+static const experiment experiments[] = {
+    { "latency", latency_experiment, NULL, "results" },
+    { "patterns", pattern_experiment, NULL, "results/patterns" },
+    { "next-line", pattern_experiment, "next-line", "results/patterns" },
+    { "stride", pattern_experiment, "stride", "results/patterns" },
+    { "occupancy", occupancy_experiment, NULL, "results/occupancy" },
+    { "chase", chase_experiment, NULL, "results/chase" },
+    { "bandwidth", bandwidth_experiment, NULL, "results/bandwidth" },
+};
+#define NUM_EXPERIMENTS (sizeof(experiments) / sizeof(experiment))
+
+typedef enum {
+    JOB_PENDING,
+    JOB_RUNNING,
+    JOB_DONE
+} job_state;
+
+struct scheduler;
+
+// A job and the physical cores it runs on. An exclusive job runs alone.
+typedef struct {
+    const experiment* experiment;
+    int argc;
+    char** argv;
+    long cores[MAX_CPUS];
+    size_t num_cores;
+    int exclusive;
+    size_t index;
+    job_state state;
+    int status;
+    pthread_t thread;
+    struct scheduler* scheduler;
+} job;
+
+typedef struct scheduler {
+    job* jobs;
+    size_t num_jobs;
+    experiment_context context;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} scheduler;
+
+static const experiment* find_experiment(const char* name)
+{
+    for (size_t i = 0; i < NUM_EXPERIMENTS; i++) {
+        if (strcmp(experiments[i].name, name) == 0) {
+            return &experiments[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Returns the value of the last `option` in the arguments of a job, or NULL
+static const char* job_option(const job* j, const char* option)
+{
+    const char* value = NULL;
+    for (int i = 1; i + 1 < j->argc; i++) {
+        if (strcmp(j->argv[i], option) == 0) {
+            value = j->argv[i + 1];
+        }
+    }
+
+    return value;
+}
+
+// Returns the directory a job writes its results to
+static const char* job_output(const job* j)
+{
+    const char* output = job_option(j, "--output");
+    return output != NULL ? output : j->experiment->default_output;
+}
+
+// Works out which physical cores a job runs on from its `--cpu` or `--cpus`,
+// and the `--drain` cores its samples are stored on. Jobs that measure the
+// shared L3 or RAM (latency, chase, bandwidth, occupancy of any level but
+// the L2 or of given `--slices`, and any job with aggressors on other
+// cores), and jobs that don't say where they run, can't share the machine.
+// The L2 geometry (`--sets`, `--geometry`) is private to each core.
+static int find_job_cores(job* j)
+{
+    int cpus[MAX_CPUS];
+    size_t num_cpus = 0;
+
+    const char* cpu = job_option(j, "--cpu");
+    const char* cpu_list = job_option(j, "--cpus");
+    if (cpu != NULL) {
+        num_cpus = parse_cpu_list(cpu, cpus, 1);
+    } else if (cpu_list != NULL) {
+        num_cpus = parse_cpu_list(cpu_list, cpus, MAX_CPUS);
+    }
+    if ((cpu != NULL || cpu_list != NULL) && num_cpus == 0) {
+        fprintf(stderr, "job %lu: invalid cpu list: %s\n", j->index, cpu != NULL ? cpu : cpu_list);
+        return -1;
+    }
+
+    const char* level = job_option(j, "--level");
+    j->exclusive = num_cpus == 0
+        || j->experiment->run == latency_experiment
+        || j->experiment->run == chase_experiment
+        || j->experiment->run == bandwidth_experiment
+        || job_option(j, "--aggressors") != NULL
+        || (level != NULL && strcmp(level, "l2") != 0)
+        || job_option(j, "--slices") != NULL;
+
+    // without topology information a cpu is its own core
+    j->num_cores = 0;
+    for (size_t i = 0; i < num_cpus; i++) {
+        const long core = physical_core_id(cpus[i]);
+        j->cores[j->num_cores++] = core < 0 ? cpus[i] : core;
+    }
+
+    const char* drain_list = job_option(j, "--drain");
+    if (drain_list != NULL) {
+        const size_t num_drain_cpus = parse_cpu_list(drain_list, cpus, MAX_CPUS - j->num_cores);
+        for (size_t i = 0; i < num_drain_cpus; i++) {
+            const long core = physical_core_id(cpus[i]);
+            j->cores[j->num_cores++] = core < 0 ? cpus[i] : core;
+        }
+    }
+
+    return 0;
+}
+
+// Builds a job from its arguments, `args[0]` being the experiment
+static int new_job(job* j, const size_t index, char** args, const int num_args)
+{
+    const experiment* e = find_experiment(args[0]);
+    if (e == NULL) {
+        fprintf(stderr, "job %lu: unknown experiment: %s\n", index, args[0]);
+        return -1;
+    }
+
+    const int argc = num_args + (e->preset != NULL ? 2 : 0);
+    char** argv = calloc((size_t)argc + 1, sizeof(char*));
+    if (argv == NULL) {
+        perror("new_job");
+        return -1;
+    }
+
+    int arg = 0;
+    argv[arg++] = strdup(args[0]);
+    if (e->preset != NULL) {
+        argv[arg++] = strdup("--preset");
+        argv[arg++] = strdup(e->preset);
+    }
+    for (int i = 1; i < num_args; i++) {
+        argv[arg++] = strdup(args[i]);
+    }
+
+    *j = (job){
+        .experiment = e,
+        .argc = argc,
+        .argv = argv,
+        .index = index,
+        .state = JOB_PENDING
+    };
+    return find_job_cores(j);
+}
+
+static void free_job(job* j)
+{
+    for (int i = 0; i < j->argc; i++) {
+        free(j->argv[i]);
+    }
+    free(j->argv);
+}
+
+// Splits a line of a job file into arguments at whitespace, a double
+// quoted argument (e.g. a pattern description) may hold whitespace
+static int split_job_line(char* line, char** args, const int max_args)
+{
+    int num_args = 0;
+    char* p = line;
+    for (;;)
+    {
+        p += strspn(p, " \t\r\n");
+        if (*p == '\0') {
+            return num_args;
+        }
+        if (num_args == max_args) {
+            return -1;
+        }
+
+        if (*p == '"') {
+            args[num_args++] = ++p;
+            p = strchr(p, '"');
+            if (p == NULL) {
+                return -1;
+            }
+        } else {
+            args[num_args++] = p;
+            p += strcspn(p, " \t\r\n");
+            if (*p == '\0') {
+                return num_args;
+            }
+        }
+        *p++ = '\0';
+    }
+}
+
+// Reads the jobs of a job file, one per line. Blank lines and lines
+// starting with '#' are skipped.
+static int read_job_file(const char* filename, job* jobs, size_t* num_jobs)
+{
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        perror(filename);
+        return -1;
+    }
+
+    int status = 0;
+    char line[MAX_LINE_SIZE];
+    char* args[MAX_JOB_ARGS];
+    for (size_t line_number = 1; status == 0 && fgets(line, sizeof(line), file) != NULL; line_number++)
+    {
+        // the rest of a longer line would be read as the next job
+        if (strchr(line, '\n') == NULL && !feof(file)) {
+            fprintf(stderr, "%s:%lu: longer than %d characters\n", filename, line_number, MAX_LINE_SIZE - 2);
+            status = -1;
+            break;
+        }
+
+        const char* start = line + strspn(line, " \t");
+        if (*start == '#') {
+            continue;
+        }
+
+        const int num_args = split_job_line(line, args, MAX_JOB_ARGS);
+        if (num_args < 0) {
+            fprintf(stderr, "%s:%lu: unterminated quote or too many arguments\n", filename, line_number);
+            status = -1;
+        } else if (num_args > 0 && *num_jobs == MAX_JOBS) {
+            fprintf(stderr, "%s: more than %d jobs\n", filename, MAX_JOBS);
+            status = -1;
+        } else if (num_args > 0) {
+            status = new_job(&jobs[*num_jobs], *num_jobs, args, num_args);
+            (*num_jobs)++;
+        }
+    }
+
+    fclose(file);
+    return status;
+}
+
+// Reads the jobs of the command line, separated by a lone "+"
+static int read_job_arguments(const int argc, char** argv, job* jobs, size_t* num_jobs)
+{
+    int first = 0;
+    for (int i = 0; i <= argc; i++)
+    {
+        if (i < argc && strcmp(argv[i], "+") != 0) {
+            continue;
+        }
+
+        if (i == first) {
+            fprintf(stderr, "empty job\n");
+            return -1;
+        }
+        if (*num_jobs == MAX_JOBS) {
+            fprintf(stderr, "more than %d jobs\n", MAX_JOBS);
+            return -1;
+        }
+
+        const int status = new_job(&jobs[*num_jobs], *num_jobs, argv + first, i - first);
+        (*num_jobs)++;
+        if (status != 0) {
+            return -1;
+        }
+        first = i + 1;
+    }
+
+    return 0;
+}
+
+// Returns whether a job would disturb, or be disturbed by, a running job.
+// Jobs that write to the same output directory never run together, since
+// they'd write the same summaries (and the same result files if their sets
+// overlap).
+static int interferes(const scheduler* s, const job* j)
+{
+    for (size_t i = 0; i < s->num_jobs; i++)
+    {
+        const job* other = &s->jobs[i];
+        if (other->state != JOB_RUNNING) {
+            continue;
+        }
+        if (j->exclusive || other->exclusive || strcmp(job_output(j), job_output(other)) == 0) {
+            return 1;
+        }
+
+        for (size_t a = 0; a < j->num_cores; a++) {
+            for (size_t b = 0; b < other->num_cores; b++) {
+                if (j->cores[a] == other->cores[b]) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void print_job(FILE* out, const job* j)
+{
+    fprintf(out, "job %lu:", j->index);
+    for (int i = 0; i < j->argc; i++) {
+        fprintf(out, " %s", j->argv[i]);
+    }
+}
+
+// Appends a job to runs.csv in its output directory, with the build
+// variant that ran it, so every result can be traced to its codegen
+static void record_job(const scheduler* s, const job* j, const double seconds)
+{
+    char filename[EXPERIMENT_PATH_SIZE];
+    snprintf(filename, sizeof(filename), "%s/runs.csv", job_output(j));
+
+    FILE* runs = fopen(filename, "a");
+    if (runs == NULL) {
+        perror(filename);
+        return;
+    }
+
+    if (ftell(runs) == 0) {
+        fprintf(runs, "Variant,Flags,Status,Seconds,Job\n");
+    }
+    fprintf(runs, "%s,%s,%d,%.1f,\"", s->context.variant, s->context.variant_flags, j->status, seconds);
+    for (int i = 0; i < j->argc; i++) {
+        if (i > 0) {
+            fputc(' ', runs);
+        }
+        // a quote inside the quoted field is doubled
+        for (const char* c = j->argv[i]; *c != '\0'; c++) {
+            if (*c == '"') {
+                fputc('"', runs);
+            }
+            fputc(*c, runs);
+        }
+    }
+    fprintf(runs, "\"\n");
+    fclose(runs);
+}
+
+static double elapsed_seconds(const struct timespec start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void* job_main(void* arg)
+{
+    job* j = arg;
+    scheduler* s = j->scheduler;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const int status = j->experiment->run(j->argc, j->argv, &s->context);
+    const double seconds = elapsed_seconds(start);
+
+    pthread_mutex_lock(&s->lock);
+    j->status = status;
+    j->state = JOB_DONE;
+    record_job(s, j, seconds);
+    printf("job %lu (%s) finished%s\n", j->index, j->argv[0], status == 0 ? "" : ", FAILED");
+    fflush(stdout);
+    pthread_cond_broadcast(&s->finished);
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+// Starts the jobs in order, each as soon as it doesn't interfere with any
+// running job, and waits for all of them
+static int run_jobs(scheduler* s)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, JOB_STACK_SIZE);
+
+    size_t started = 0;
+    for (; started < s->num_jobs; started++)
+    {
+        job* j = &s->jobs[started];
+        j->scheduler = s;
+
+        pthread_mutex_lock(&s->lock);
+        while (interferes(s, j)) {
+            pthread_cond_wait(&s->finished, &s->lock);
+        }
+        j->state = JOB_RUNNING;
+        print_job(stdout, j);
+        printf(j->exclusive ? " (exclusive)\n" : "\n");
+        fflush(stdout);
+        pthread_mutex_unlock(&s->lock);
+
+        if (pthread_create(&j->thread, &attr, job_main, j) != 0) {
+            fprintf(stderr, "failed to start job %lu\n", j->index);
+            j->state = JOB_DONE;
+            j->status = 1;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(s->jobs[i].thread, NULL);
+    }
+    pthread_attr_destroy(&attr);
+
+    int status = started == s->num_jobs ? 0 : 1;
+    for (size_t i = 0; i < started; i++) {
+        status |= s->jobs[i].status != 0;
+    }
+
+    return status;
+}
+
+// Usage: papp <experiment> [options] [+ <experiment> [options]]...
+//        papp --jobs <file>
+//
+// Runs a list of jobs, each an experiment and its options: `latency`,
+// `patterns` (and its presets `next-line` and `stride`), `occupancy`, 
+// `chase` or `bandwidth`, see
+// src/<experiment>_experiment.c for their options. The jobs are given on
+// the command line, separated by a lone "+", or in a job file with one job
+// per line in the same format (blank lines and lines starting with '#' are
+// skipped, double quotes keep a pattern description in one argument):
+//
+//     occupancy --cpus 2 --sets 0-63 --warmups 0,8 --iterations 50 --output results/occupancy
+//     next-line --cpu 4 --samples 200 --output results/patterns
+//     latency --cpu 2 --output results
+//
+// Jobs start in the order they're listed, each as soon as it doesn't
+// interfere with a running job: jobs on different physical cores (by their
+// `--cpu` or `--cpus`) run at the same time, since the L1 and L2 are
+// private. Jobs that measure the shared L3 or RAM (latency, chase, 
+// bandwidth, occupancy with a `--level` other than l2 or with `--slices`, 
+// and jobs with `--aggressors`) and jobs that don't give their CPUs run 
+// alone. The sets of the L2 a job profiles don't matter, every core has its 
+// own.
+// Jobs with the same output directory (by `--output`, or the default of 
+// their experiment) run one after the other, e.g. `next-line` and `stride`, 
+// which both write to results/patterns.
+//
+// Eviction sets are allocated once and reused by every later job of the
+// same geometry (see eviction_set_pool.h), which saves rebuilding them by
+// page color or physical address for every job when there are no
+// hugepages.
+//
+// Every build variant (papp_O0 to papp_O3 and papp_native, see
+// CMakeLists.txt) appends each job it ran to runs.csv in the job's output
+// directory, with its flags, status and run time.
+int main(int argc, char** argv)
+{
+    static job jobs[MAX_JOBS];
+    size_t num_jobs = 0;
+
+    int status = 0;
+    if (argc == 3 && strcmp(argv[1], "--jobs") == 0) {
+        status = read_job_file(argv[2], jobs, &num_jobs);
+    } else if (argc >= 2 && argv[1][0] != '-') {
+        status = read_job_arguments(argc - 1, argv + 1, jobs, &num_jobs);
+    } else {
+        status = -1;
+    }
+
+    if (status != 0 || num_jobs == 0) {
+        fprintf(stderr, "usage: %s <experiment> [options] [+ <experiment> [options]]...\n"
+                "       %s --jobs <file>\n"
+                "experiments:", argv[0], argv[0]);
+        for (size_t i = 0; i < NUM_EXPERIMENTS; i++) {
+            fprintf(stderr, " %s", experiments[i].name);
+        }
+        fprintf(stderr, "\n");
+        for (size_t i = 0; i < num_jobs; i++) {
+            free_job(&jobs[i]);
+        }
+        return 1;
+    }
+
+    eviction_set_pool pool;
+    if (init_eviction_set_pool(&pool) != 0) {
+        return 1;
+    }
+
+    scheduler s = {
+        .jobs = jobs,
+        .num_jobs = num_jobs,
+        .context = {
+            .eviction_sets = &pool,
+            .variant = PAPP_VARIANT,
+            .variant_flags = PAPP_FLAGS
+        }
+    };
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.finished, NULL);
+
+    printf("papp %s (%s), %lu jobs\n", PAPP_VARIANT, PAPP_FLAGS, num_jobs);
+    fflush(stdout);
+
+    status = run_jobs(&s);
+
+    pthread_cond_destroy(&s.finished);
+    pthread_mutex_destroy(&s.lock);
+    free_eviction_set_pool(&pool);
+    for (size_t i = 0; i < num_jobs; i++) {
+        free_job(&jobs[i]);
+    }
+
+    return status;
+}
@@ -62,7 +62,7 @@ def timing(*, plot=True) -> tuple[float, float, float]:
     return (l3_lower, l3_upper, ram_upper)
 
 def nlp(ram_bound: float, plot=False):
-    df = pd.read_csv("results/next_line.csv")
+    df = pd.read_csv("results/patterns/next_line.csv")
     df = df[df["Cycles"] <= ram_bound]
 
     print("#### Next Line Analysis ####")
@@ -103,7 +103,7 @@ def stride(ram_bound: float, *, plot=False, max_lines=20):
     strides = [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 16, 24, 32]
 
     for stride in strides:
-        df = pd.read_csv(f"results/next_line/{stride}.csv")
+        df = pd.read_csv(f"results/patterns/stride_{stride}.csv")
         df = df[df["Cycles"] <= ram_bound]
        
         # Group by TrainingSize and calculate mean of Cycles
@@ -135,8 +135,182 @@ def stride(ram_bound: float, *, plot=False, max_lines=20):
 
     return
 
-def occupancy(bounds: BoundChecker):
-    file_match = re.compile(r"(\d+)?.*_O1_CPU4_S([0-9]+)")
+def coverage(*, plot=False):
+    df = pd.read_csv("results/patterns/summary.csv")
+    data = df.pivot_table(index="TrainingSize", columns="Pattern", values="Coverage")
+
+    print("#### Prefetch Coverage ####")
+    print(data)
+    print()
+
+    if not plot:
+        return
+
+    fig = plt.figure(figsize=(12, 6))
+    sns.heatmap(data, vmin=0, vmax=1, cmap="viridis", cbar_kws={'label': 'Coverage'})
+
+    plt.title('Prefetch Coverage by Access Pattern')
+    plt.ylabel('Training Size')
+    plt.xlabel('Pattern')
+
+    plt.show()
+    fig.savefig("figs/pattern_coverage.pdf")
+    plt.close(fig)
+
+def timeliness(*, plot=False):
+    df = pd.read_csv("results/patterns/timeliness.csv")
+
+    for pattern in df["Pattern"].unique():
+        data = df[df["Pattern"] == pattern].pivot_table(index="Distance", columns="MeasuredDelay", values="MedianCycles")
+
+        print(f"#### Timeliness of {pattern} ####")
+        print(data)
+        print()
+
+        if not plot:
+            continue
+
+        fig = plt.figure(figsize=(8, 6))
+        sns.heatmap(data, cmap="inferno_r", cbar_kws={'label': 'Median cycles'})
+
+        plt.title(f'Prefetch Timeliness of {pattern}')
+        plt.ylabel('Distance (accesses ahead)')
+        plt.xlabel('Delay (cycles)')
+
+        fig.savefig(f"figs/timeliness_{pattern}.pdf")
+        plt.close(fig)
+
+def codegen(*, plot=False):
+    df = pd.read_csv("results/codegen.csv")
+    # the latest run of every variant
+    df = df.groupby(["Variant", "Level"]).last().reset_index()
+    data = df.pivot_table(index="Variant", columns="Level", values="IQR")[["L1", "L2", "L3", "RAM"]]
+    timer = df.groupby("Variant")[["TimerOverhead", "TimerJitter"]].first()
+
+    print("#### Jitter by Build Variant (IQR, cycles) ####")
+    print(pd.concat([timer, data], axis=1))
+    print()
+
+    if not plot:
+        return
+
+    fig = plt.figure(figsize=(8, 4))
+    sns.heatmap(pd.concat([timer, data], axis=1), annot=True, fmt=".0f", cmap="viridis", cbar_kws={'label': 'Cycles'})
+
+    plt.title('Timer Overhead and Probe Jitter by Build Variant')
+    plt.ylabel('Variant')
+    plt.xlabel('')
+
+    plt.show()
+    fig.savefig("figs/codegen.pdf")
+    plt.close(fig)
+
+def chase(*, plot=False):
+    df = pd.read_csv("results/chase/chase.csv")
+    data = df.pivot_table(index="WorkingSet", columns="Layout", values="MinCycles")
+
+    print("#### Dependent Load Latency (cycles per load) ####")
+    print(data)
+    print()
+
+    if not plot:
+        return
+
+    fig = plt.figure(figsize=(12, 6))
+    for layout in data.columns:
+        plt.plot(data.index, data[layout], marker=".", label=layout)
+
+    plt.xscale("log", base=2)
+    plt.yscale("log")
+    plt.xlabel("Working set (bytes)")
+    plt.ylabel("Cycles per load")
+    plt.title("Pointer Chase Latency by Working Set")
+    plt.legend()
+
+    plt.show()
+    fig.savefig("figs/chase.pdf")
+    plt.close(fig)
+
+def mlp(*, plot=False):
+    df = pd.read_csv("results/bandwidth/mlp.csv")
+    data = df.pivot_table(index="Chains", columns="WorkingSet", values="LoadsInFlight")
+
+    print("#### Loads in Flight by Interleaved Chains ####")
+    print(data.max())
+    print()
+
+    if not plot:
+        return
+
+    fig = plt.figure(figsize=(12, 6))
+    for size in data.columns:
+        plt.plot(data.index, data[size], marker=".", label=f"{size // 1024} KiB")
+
+    plt.xlabel("Interleaved chains")
+    plt.ylabel("Loads in flight")
+    plt.title("Memory-Level Parallelism by Working Set")
+    plt.legend(ncol=2, fontsize="small")
+
+    plt.show()
+    fig.savefig("figs/mlp.pdf")
+    plt.close(fig)
+
+def bandwidth(*, plot=False):
+    df = pd.read_csv("results/bandwidth/bandwidth.csv")
+
+    for threads, runs in df.groupby("Threads"):
+        data = runs.pivot_table(index="WorkingSet", columns="Kernel", values="GBps")
+        print(f"#### Bandwidth with {threads} Threads (GB/s) ####")
+        print(data)
+        print()
+
+        if not plot:
+            continue
+
+        fig = plt.figure(figsize=(12, 6))
+        for kernel in data.columns:
+            plt.plot(data.index, data[kernel], marker=".", label=kernel)
+
+        plt.xscale("log", base=2)
+        plt.xlabel("Working set per thread (bytes)")
+        plt.ylabel("GB/s")
+        plt.title(f"Streaming Bandwidth with {threads} Threads")
+        plt.legend(ncol=2, fontsize="small")
+
+        plt.show()
+        fig.savefig(f"figs/bandwidth_T{threads}.pdf")
+        plt.close(fig)
+
+def interference(*, plot=False):
+    df = pd.read_csv("results/patterns/interference.csv")
+    df["CoverageLoss"] = df["QuietCoverage"] - df["Coverage"]
+    data = df.pivot_table(index="TrainingSize", columns="Pattern", values="CoverageLoss")
+
+    print("#### Coverage Lost to Neighbors ####")
+    print(data.mean())
+    print()
+
+    if not plot:
+        return
+
+    fig = plt.figure(figsize=(12, 6))
+    for pattern in data.columns:
+        plt.plot(data.index, data[pattern], marker=".", label=pattern)
+
+    plt.axhline(0, color="gray", linewidth=0.5)
+    plt.xlabel("Training size (accesses)")
+    plt.ylabel("Coverage alone - coverage with neighbors")
+    plt.title(f"Prefetch Coverage Lost to {df['Aggressor'].iloc[0]} Aggressors")
+    plt.legend(ncol=2, fontsize="small")
+
+    plt.show()
+    fig.savefig("figs/interference.pdf")
+    plt.close(fig)
+
+def occupancy(bounds: BoundChecker, variant="O1"):
+    # the per cell means papp writes next to every profile, see 
+    # occupancy_result_to_means (or `occupancy_to_csv --means`)
+    file_match = re.compile(rf"(\d+)?.*_{variant}_S([0-9]+)_means\.csv$")
     
     os.makedirs("figs/occupancy", exist_ok=True)
 
@@ -152,10 +326,9 @@ def occupancy(bounds: BoundChecker):
             warmup = int(warmup)
         s = int(s)
 
-        # get data 
-        df = pd.read_csv(f"results/occupancy/{file}")
-        data = df.groupby(['Iteration', 'SetIndex', 'LineIndex'])['Cycles'].mean().reset_index()
-        data = data.drop(['Iteration'], axis = 1).pivot_table(index='SetIndex', columns='LineIndex', values='Cycles')
+        # get data, already a SetIndex x LineIndex matrix of mean cycles
+        data = pd.read_csv(f"results/occupancy/{file}", index_col="SetIndex")
+        data.columns.name = "LineIndex"
         
         expected_min = s - 10
         expected_max = s + 10
@@ -168,7 +341,7 @@ def occupancy(bounds: BoundChecker):
             expected_min -= expected_max - 511 
             expected_max = 511
 
-        data = data.loc[df.index[expected_min:expected_max+1]]
+        data = data.iloc[expected_min:expected_max+1]
 
         fig = plt.figure(figsize=(6, 4.5))
         sns.heatmap(data, vmin=50, vmax=300, cbar_kws={'label': 'Cycles'})
@@ -186,5 +359,12 @@ if __name__ == "__main__":
     l3_bounds = BoundChecker(l3_lower, l3_upper)
     # nlp(ram_bound, plot=True)
     # stride(ram_bound, plot=True)
+    # coverage(plot=True)
+    # timeliness(plot=True)
+    # codegen(plot=True)
+    # chase(plot=True)
+    # mlp(plot=True)
+    # bandwidth(plot=True)
+    # interference(plot=True)
     occupancy(l3_bounds)
 
@@ -0,0 +1,345 @@
+#include "access_pattern.h"
+#include "cache.h"
+#include "utility.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The training size of a pattern that doesn't give one
+#define DEFAULT_MAX_TRAINING 32
+
+// The lines of a 4 KiB page, which the prefetchers don't cross
+#define LINES_PER_PAGE (PREFETCH_REGION_SIZE / CACHE_LINE_SIZE)
+
+// Parses "<d>[,<d>...]" into the deltas of `pattern`
+static int parse_deltas(const char* list, access_pattern* pattern)
+{
+    pattern->num_deltas = 0;
+
+    const char* p = list;
+    while (*p != '\0')
+    {
+        if (pattern->num_deltas == PATTERN_MAX_DELTAS) {
+            fprintf(stderr, "access pattern %s: more than %d deltas\n", pattern->name, PATTERN_MAX_DELTAS);
+            return -1;
+        }
+
+        char* end;
+        const long delta = strtol(p, &end, 10);
+        if (end == p || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "access pattern %s: invalid deltas %s\n", pattern->name, list);
+            return -1;
+        }
+
+        pattern->deltas[pattern->num_deltas++] = (ptrdiff_t)delta;
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if (pattern->num_deltas == 0) {
+        fprintf(stderr, "access pattern %s: no deltas\n", pattern->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Parses a non-negative number that must be in [min, max]
+static int parse_count(const access_pattern* pattern, const char* key, const char* value,
+                       const size_t min, const size_t max, size_t* count)
+{
+    char* end;
+    const unsigned long parsed = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < min || parsed > max) {
+        fprintf(stderr, "access pattern %s: %s must be between %lu and %lu\n",
+                pattern->name, key, min, max);
+        return -1;
+    }
+
+    *count = parsed;
+    return 0;
+}
+
+int parse_access_pattern(/*in*/ const char* spec, /*out*/ access_pattern* pattern)
+{
+    *pattern = (access_pattern){
+        .num_deltas = 0,
+        .num_streams = 1,
+        .start_line = 0,
+        .max_training = DEFAULT_MAX_TRAINING,
+        .write = 1
+    };
+
+    char* copy = strdup(spec);
+    if (copy == NULL) {
+        perror("parse_access_pattern");
+        return -1;
+    }
+
+    int status = 0;
+    char* saved;
+    // the name goes into file names, so no '/' or '.' that could leave 
+    // the output directory
+    const char* name = strtok_r(copy, " \t\n", &saved);
+    if (name == NULL || strlen(name) >= PATTERN_NAME_SIZE
+        || strspn(name, PATTERN_NAME_CHARS) != strlen(name)) {
+        fprintf(stderr, "access pattern \"%s\" doesn't start with a name of letters, digits, '_' or '-'\n", spec);
+        status = -1;
+    } else {
+        strcpy(pattern->name, name);
+    }
+
+    for (char* field = strtok_r(NULL, " \t\n", &saved); field != NULL && status == 0;
+         field = strtok_r(NULL, " \t\n", &saved))
+    {
+        char* value = strchr(field, '=');
+        if (value == NULL) {
+            fprintf(stderr, "access pattern %s: expected key=value, got %s\n", pattern->name, field);
+            status = -1;
+            break;
+        }
+        *value++ = '\0';
+
+        if (strcmp(field, "deltas") == 0) {
+            status = parse_deltas(value, pattern);
+        } else if (strcmp(field, "streams") == 0) {
+            status = parse_count(pattern, field, value, 1, PATTERN_MAX_STREAMS, &pattern->num_streams);
+        } else if (strcmp(field, "start") == 0) {
+            status = parse_count(pattern, field, value, 0, LINES_PER_PAGE - 1, &pattern->start_line);
+        } else if (strcmp(field, "train") == 0) {
+            status = parse_count(pattern, field, value, 0, UINT16_MAX - 1, &pattern->max_training);
+        } else if (strcmp(field, "access") == 0 && strcmp(value, "read") == 0) {
+            pattern->write = 0;
+        } else if (strcmp(field, "access") == 0 && strcmp(value, "write") == 0) {
+            pattern->write = 1;
+        } else {
+            fprintf(stderr, "access pattern %s: unknown field %s=%s\n", pattern->name, field, value);
+            status = -1;
+        }
+    }
+
+    if (status == 0 && pattern->num_deltas == 0) {
+        fprintf(stderr, "access pattern %s: no deltas\n", pattern->name);
+        status = -1;
+    }
+
+    free(copy);
+    return status;
+}
+
+void print_access_pattern(/*in*/ FILE* out, /*in*/ const access_pattern* pattern)
+{
+    fprintf(out, "%s deltas=", pattern->name);
+    for (size_t i = 0; i < pattern->num_deltas; i++) {
+        fprintf(out, i == 0 ? "%ld" : ",%ld", pattern->deltas[i]);
+    }
+    fprintf(out, " streams=%lu start=%lu train=%lu access=%s\n", pattern->num_streams,
+            pattern->start_line, pattern->max_training, pattern->write ? "write" : "read");
+}
+
+access_kernel compile_access_pattern(
+    /*in*/ const access_pattern* pattern,
+    /*in*/ const size_t lookahead,
+    /*in*/ byte* target,
+    /*in*/ const size_t target_size)
+{
+    const access_kernel failed = { .addresses = NULL };
+
+    const size_t accesses = pattern->max_training + 1 + lookahead;
+    ptrdiff_t* lines = malloc(accesses * sizeof(ptrdiff_t));
+    byte** addresses = malloc(accesses * pattern->num_streams * sizeof(byte*));
+    if (lines == NULL || addresses == NULL) {
+        perror("compile_access_pattern");
+        free(lines);
+        free(addresses);
+        return failed;
+    }
+
+    // the line of every access relative to the start of a region
+    ptrdiff_t lowest = 0;
+    ptrdiff_t highest = 0;
+    lines[0] = (ptrdiff_t)pattern->start_line;
+    for (size_t i = 1; i < accesses; i++)
+    {
+        lines[i] = lines[i - 1] + pattern->deltas[(i - 1) % pattern->num_deltas];
+        lowest = lines[i] < lowest ? lines[i] : lowest;
+        highest = lines[i] > highest ? lines[i] : highest;
+    }
+
+    // shift backwards patterns up by whole pages, so the page offset of
+    // every access stays the same
+    const ptrdiff_t shift = lowest < 0
+        ? (-lowest + LINES_PER_PAGE - 1) / LINES_PER_PAGE * LINES_PER_PAGE
+        : 0;
+
+    const size_t region_lines = target_size / pattern->num_streams / PREFETCH_REGION_SIZE * LINES_PER_PAGE;
+    if ((size_t)(highest + shift) >= region_lines) {
+        fprintf(stderr, "access pattern %s: spans %ld lines, only %lu fit per stream\n",
+                pattern->name, highest + shift + 1, region_lines);
+        free(lines);
+        free(addresses);
+        return failed;
+    }
+
+    for (size_t i = 0; i < accesses; i++)
+    {
+        for (size_t stream = 0; stream < pattern->num_streams; stream++)
+        {
+            const size_t line = stream * region_lines + (size_t)(lines[i] + shift);
+            addresses[i * pattern->num_streams + stream] = target + line * CACHE_LINE_SIZE;
+        }
+    }
+
+    free(lines);
+
+    return (access_kernel){
+        .addresses = addresses,
+        .num_streams = pattern->num_streams,
+        .accesses_per_stream = accesses,
+        .write = pattern->write
+    };
+}
+
+void free_access_kernel(/*inout*/ access_kernel* kernel)
+{
+    if (kernel == NULL) {
+        return;
+    }
+
+    free(kernel->addresses);
+    *kernel = (access_kernel){ .addresses = NULL };
+}
+
+void tally_pattern_coverage(
+    /*in*/ const latency_model* model,
+    /*in*/ const uint16_t* training_size,
+    /*in*/ const uint64_t* cycles,
+    /*in*/ const size_t num_samples,
+    /*in*/ const size_t max_training,
+    /*out*/ pattern_coverage* coverage)
+{
+    memset(coverage, 0, (max_training + 1) * sizeof(pattern_coverage));
+
+    for (size_t i = 0; i < num_samples; i++)
+    {
+        if (training_size[i] > max_training) {
+            continue;
+        }
+
+        pattern_coverage* c = &coverage[training_size[i]];
+        c->samples++;
+        c->levels[classify_latency(model, cycles[i])]++;
+    }
+}
+
+void write_pattern_coverage_header(/*in*/ FILE* out)
+{
+    fprintf(out, "Pattern,TrainingSize,Samples,L1,L2,L3,RAM,Coverage,Late\n");
+}
+
+void write_pattern_coverage(
+    /*in*/ FILE* out,
+    /*in*/ const access_pattern* pattern,
+    /*in*/ const pattern_coverage* coverage)
+{
+    for (size_t ts = 0; ts <= pattern->max_training; ts++)
+    {
+        const pattern_coverage c = coverage[ts];
+        if (c.samples == 0) {
+            continue;
+        }
+
+        const double samples = (double)c.samples;
+        fprintf(out, "%s,%lu,%lu,%lu,%lu,%lu,%lu,%.4f,%.4f\n", pattern->name, ts, c.samples,
+                c.levels[LEVEL_L1], c.levels[LEVEL_L2], c.levels[LEVEL_L3], c.levels[LEVEL_RAM],
+                (double)(c.levels[LEVEL_L1] + c.levels[LEVEL_L2]) / samples,
+                (double)c.levels[LEVEL_L3] / samples);
+    }
+}
+
+int tally_timeliness_surface(
+    /*in*/ const latency_model* model,
+    /*in*/ const uint16_t* distance,
+    /*in*/ const uint16_t* delay,
+    /*in*/ const uint64_t* cycles,
+    /*in*/ const size_t num_samples,
+    /*in*/ const size_t max_distance,
+    /*in*/ const size_t num_delays,
+    /*out*/ timeliness_cell* cells)
+{
+    const size_t num_cells = max_distance * num_delays;
+
+    // gather the probes of each cell next to each other, to take medians
+    size_t* start = calloc(num_cells + 1, sizeof(size_t));
+    size_t* filled = calloc(num_cells, sizeof(size_t));
+    uint64_t* sorted = malloc(num_samples * sizeof(uint64_t));
+    if (start == NULL || filled == NULL || sorted == NULL) {
+        perror("tally_timeliness_surface");
+        free(start);
+        free(filled);
+        free(sorted);
+        return -1;
+    }
+
+    for (size_t i = 0; i < num_samples; i++) {
+        start[(distance[i] - 1) * num_delays + delay[i] + 1]++;
+    }
+    for (size_t cell = 0; cell < num_cells; cell++) {
+        start[cell + 1] += start[cell];
+    }
+
+    for (size_t cell = 0; cell < num_cells; cell++) {
+        cells[cell] = (timeliness_cell){ .samples = 0, .median = 0, .coverage = 0 };
+    }
+
+    for (size_t i = 0; i < num_samples; i++)
+    {
+        const size_t cell = (distance[i] - 1) * num_delays + delay[i];
+        sorted[start[cell] + filled[cell]++] = cycles[i];
+        cells[cell].samples++;
+        cells[cell].coverage += classify_latency(model, cycles[i]) <= LEVEL_L2;
+    }
+
+    for (size_t cell = 0; cell < num_cells; cell++)
+    {
+        if (cells[cell].samples == 0) {
+            continue;
+        }
+
+        qsort(sorted + start[cell], cells[cell].samples, sizeof(uint64_t), compare_u64);
+        cells[cell].median = sorted[start[cell] + cells[cell].samples / 2];
+        cells[cell].coverage /= (double)cells[cell].samples;
+    }
+
+    free(start);
+    free(filled);
+    free(sorted);
+    return 0;
+}
+
+void write_timeliness_surface_header(/*in*/ FILE* out)
+{
+    fprintf(out, "Pattern,Distance,Delay,MeasuredDelay,Samples,MedianCycles,Coverage\n");
+}
+
+void write_timeliness_surface(
+    /*in*/ FILE* out,
+    /*in*/ const access_pattern* pattern,
+    /*in*/ const size_t max_distance,
+    /*in*/ const uint64_t* delays,
+    /*in*/ const uint64_t* measured_delays,
+    /*in*/ const size_t num_delays,
+    /*in*/ const timeliness_cell* cells)
+{
+    for (size_t d = 1; d <= max_distance; d++)
+    {
+        for (size_t i = 0; i < num_delays; i++)
+        {
+            const timeliness_cell c = cells[(d - 1) * num_delays + i];
+            fprintf(out, "%s,%lu,%lu,%lu,%lu,%lu,%.4f\n", pattern->name, d, delays[i],
+                    measured_delays[i], c.samples, c.median, c.coverage);
+        }
+    }
+}
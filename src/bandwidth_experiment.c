@@ -0,0 +1,502 @@
+#define _GNU_SOURCE
+#include "address.h"
+#include "buffer.h"
+#include "cache.h"
+#include "cache_geometry.h"
+#include "cpu.h"
+#include "experiment.h"
+#include "pointer_chase.h"
+#include "stream_kernels.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define DEFAULT_OUTPUT "results/bandwidth"
+#define DEFAULT_MIN_SIZE (16 * 1024)
+#define DEFAULT_BYTES ((size_t)256 << 20)
+#define DEFAULT_LOADS (1 << 20)
+#define DEFAULT_REPEATS 3
+#define MAX_REPEATS 64
+#define MAX_CPUS 1024
+#define MAX_THREAD_COUNTS 16
+
+// Which measurements to make
+#define SUITE_MLP 1
+#define SUITE_STREAM 2
+
+// Where the results of the read kernels are stored, so their loads can't be
+// dropped
+static volatile uint64_t stream_sink;
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// Times `num_chains` chains of a working set, the fastest of `repeats` runs
+// of `loads` loads after a warmup pass over every node. Returns the cycles
+// per load, or a negative number if the chains couldn't be built.
+static double time_mlp(byte* buffer, const size_t size, const chase_layout layout, const size_t num_chains,
+                       const size_t loads, const size_t repeats)
+{
+    chase_chain chains[CHASE_MAX_CHAINS];
+    if (build_chase_chains(buffer, size, layout, CACHE_LINE_SIZE, CHASE_SEED, num_chains, chains) != 0) {
+        return -1;
+    }
+
+    time_chases(chains, num_chains, chains[0].nodes);
+
+    const size_t rounds = (loads + num_chains - 1) / num_chains;
+    double best = 0;
+    for (size_t r = 0; r < repeats; r++)
+    {
+        const double cycles = time_chases(chains, num_chains, rounds) / (double)num_chains;
+        if (r == 0 || cycles < best) {
+            best = cycles;
+        }
+    }
+
+    return best;
+}
+
+// Runs 1 to `max_chains` interleaved chains over every working set size,
+// single threaded, and writes the misses in flight to <dir>/mlp.csv
+static int run_mlp(const char* output, const chase_layout layout, const size_t min_size, const size_t max_size,
+                   const size_t max_chains, const size_t loads, const size_t repeats)
+{
+    int hugepages = 0;
+    byte* buffer = map_buffer(max_size, &hugepages);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    char filename[EXPERIMENT_PATH_SIZE];
+    snprintf(filename, sizeof(filename), "%s/mlp.csv", output);
+    FILE* out = fopen(filename, "w");
+    if (out == NULL) {
+        perror(filename);
+        unmap_buffer(buffer, max_size);
+        return 1;
+    }
+    fprintf(out, "Layout,WorkingSet,Hugepages,Chains,CyclesPerLoad,LoadsInFlight\n");
+
+    int status = 0;
+    for (size_t size = min_size; size <= max_size && status == 0; size = next_chase_size(size))
+    {
+        if (size / chase_node_spacing(layout, CACHE_LINE_SIZE) < 2 * max_chains) {
+            continue;
+        }
+
+        double latency = 0;
+        double most_in_flight = 0;
+        for (size_t n = 1; n <= max_chains; n++)
+        {
+            const double cycles = time_mlp(buffer, size, layout, n, loads, repeats);
+            if (cycles < 0) {
+                status = 1;
+                break;
+            }
+            if (n == 1) {
+                latency = cycles;
+            }
+
+            // Little's law: a load takes `latency`, one completes every
+            // `cycles`, so `latency / cycles` are in flight at any time
+            const double in_flight = latency / cycles;
+            most_in_flight = in_flight > most_in_flight ? in_flight : most_in_flight;
+            fprintf(out, "%s,%lu,%d,%lu,%.3f,%.3f\n", chase_layout_name(layout), size, hugepages, n,
+                    cycles, in_flight);
+        }
+
+        printf("mlp %10lu bytes: %7.2f cycles per load, %5.2f loads in flight\n", size, latency,
+               most_in_flight);
+        fflush(stdout);
+    }
+
+    fclose(out);
+    unmap_buffer(buffer, max_size);
+    return status;
+}
+
+// State shared by the threads of a bandwidth run
+typedef struct {
+    const stream_kernel* const* kernels;
+    size_t num_kernels;
+    size_t min_size;
+    size_t max_size;
+    size_t bytes;
+    size_t repeats;
+    size_t num_threads;
+    const int* cpus;
+    FILE* out;
+    pthread_barrier_t barrier;
+    // 0 until every thread started, then 1 to run or -1 to give up
+    atomic_int go;
+    atomic_int failed;
+} stream_run;
+
+typedef struct {
+    stream_run* run;
+    size_t index;
+    pthread_t thread;
+} stream_thread;
+
+// Runs every kernel over every working set size in step with the other
+// threads, each over a buffer of its own. Thread 0 times the passes from the
+// barrier before them to the barrier after the slowest thread's.
+static void run_stream_thread(stream_run* run, const size_t index)
+{
+    while (atomic_load(&run->go) == 0) {
+        sched_yield();
+    }
+    if (atomic_load(&run->go) < 0) {
+        return;
+    }
+
+    // pinned first, so the buffer is local to the thread's node
+    byte* buffer = NULL;
+    if (pin_to_cpu(run->cpus[index]) != 0 || (buffer = map_buffer(run->max_size, NULL)) == NULL) {
+        atomic_store(&run->failed, 1);
+    }
+    pthread_barrier_wait(&run->barrier);
+    if (atomic_load(&run->failed)) {
+        if (buffer != NULL) {
+            unmap_buffer(buffer, run->max_size);
+        }
+        return;
+    }
+
+    uint64_t sink = 0;
+    for (size_t k = 0; k < run->num_kernels; k++)
+    {
+        const stream_kernel* kernel = run->kernels[k];
+        for (size_t size = run->min_size; size <= run->max_size; size = next_chase_size(size))
+        {
+            // a copy reads one half of the working set and writes the other
+            const size_t half = size / 2 / STREAM_BLOCK * STREAM_BLOCK;
+            const size_t length = kernel->op == STREAM_COPY ? half : size / STREAM_BLOCK * STREAM_BLOCK;
+            byte* dst = kernel->op == STREAM_COPY ? buffer + half : buffer;
+            const size_t traffic = kernel->op == STREAM_COPY ? 2 * length : length;
+            if (length == 0) {
+                continue;
+            }
+            const size_t passes = run->bytes > traffic ? run->bytes / traffic : 1;
+
+            sink += kernel->run(dst, buffer, length);
+
+            double best = 0;
+            for (size_t r = 0; r < run->repeats; r++)
+            {
+                pthread_barrier_wait(&run->barrier);
+                const double start = now_seconds();
+                for (size_t p = 0; p < passes; p++) {
+                    sink += kernel->run(dst, buffer, length);
+                }
+                pthread_barrier_wait(&run->barrier);
+                const double seconds = now_seconds() - start;
+                if (r == 0 || seconds < best) {
+                    best = seconds;
+                }
+            }
+
+            if (index == 0)
+            {
+                const size_t total = traffic * passes * run->num_threads;
+                const double gbps = (double)total / best * 1e-9;
+                fprintf(run->out, "%s,%s,%d,%lu,%lu,%lu,%.6f,%.3f\n", kernel->name,
+                        stream_op_name(kernel->op), kernel->nontemporal, run->num_threads, size,
+                        total, best, gbps);
+                printf("%-16s %2lu threads %10lu bytes: %8.2f GB/s\n", kernel->name, run->num_threads,
+                       size, gbps);
+                fflush(stdout);
+            }
+        }
+    }
+
+    stream_sink = sink;
+    unmap_buffer(buffer, run->max_size);
+}
+
+static void* stream_thread_main(void* arg)
+{
+    stream_thread* t = arg;
+    run_stream_thread(t->run, t->index);
+    return NULL;
+}
+
+// Runs every kernel with `num_threads` threads, one pinned to each of the
+// first CPUs of the list
+static int run_stream(stream_run* run)
+{
+    stream_thread* threads = calloc(run->num_threads, sizeof(stream_thread));
+    if (threads == NULL) {
+        perror("bandwidth");
+        return 1;
+    }
+    if (pthread_barrier_init(&run->barrier, NULL, (unsigned)run->num_threads) != 0) {
+        perror("bandwidth");
+        free(threads);
+        return 1;
+    }
+    atomic_init(&run->go, 0);
+    atomic_init(&run->failed, 0);
+
+    size_t started = 0;
+    for (; started < run->num_threads; started++)
+    {
+        threads[started] = (stream_thread){ .run = run, .index = started };
+        if (pthread_create(&threads[started].thread, NULL, stream_thread_main, &threads[started]) != 0) {
+            fprintf(stderr, "failed to start a thread on cpu %d\n", run->cpus[started]);
+            break;
+        }
+    }
+
+    // the barriers need every thread, so none runs unless all of them started
+    atomic_store(&run->go, started == run->num_threads ? 1 : -1);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    pthread_barrier_destroy(&run->barrier);
+    free(threads);
+    return started < run->num_threads || atomic_load(&run->failed) ? 1 : 0;
+}
+
+// Usage: bandwidth [--suite mlp|stream|all] [--kernel <name>]... [--cpus <list>]
+//                  [--threads <n>]... [--min <size>] [--max <size>] [--bytes <size>]
+//                  [--chains <n>] [--layout random|pages|tlb|stride] [--loads <n>]
+//                  [--repeats <n>] [--output <dir>]
+//
+// Measures how many misses can be in flight and the bandwidth that
+// sustains, across working set sizes, complementing the serial latency of
+// `chase` and the one byte per line helpers of cache.h.
+//
+// `mlp` follows 1 to `--chains` (16 by default, at most 16) independent
+// pointer chains in lockstep (see `time_chases` in pointer_chase.h) over
+// each working set, linked by `--layout` (`random` by default) and split
+// between the chains. The cycles per load fall as more loads overlap,
+// until the misses in flight hit the limit of the level the working set
+// is in: by Little's law the loads in flight are the latency of a single
+// chain over the cycles per load, written to <dir>/mlp.csv. `--loads`
+// (2^20 by default) loads are timed, the fastest of `--repeats` (3) runs.
+// This runs on the first CPU of `--cpus`.
+//
+// `stream` runs the streaming kernels of stream_kernels.h (every one the
+// CPU supports, or each `--kernel`) over each working set: the scalar and
+// vector read, write and copy kernels, with non-temporal stores and
+// without, and cache.h's `read_buffer` and `write_buffer` as a baseline.
+// Each kernel runs with each `--threads` count (1 and every CPU of `--cpus`
+// by default), one thread pinned to each of the first CPUs of `--cpus`,
+// each over a buffer of its own the size of the working set. A copy reads
+// half of the working set and writes the other half. Each measurement
+// makes passes over the working set until `--bytes` (256M) per thread have
+// been moved, and the bytes every thread moved in the fastest of
+// `--repeats` runs, over its wall clock time, are written to
+// <dir>/bandwidth.csv in GB/s.
+//
+// The working sets go from `--min` (16K) to `--max` (8 times the L3, at
+// least 64M), doubling with a step half way in between, sizes take a K, M
+// or G suffix. `--suite` picks `mlp`, `stream` or `all` (the default),
+// `--cpus` is a list like "0-3,8" (the CPU the job started on by default),
+// and the output directory is results/bandwidth by default.
+int bandwidth_experiment(int argc, char** argv, const experiment_context* context)
+{
+    (void)context;
+    int suites = SUITE_MLP | SUITE_STREAM;
+    const stream_kernel* kernels[64];
+    size_t num_kernels = 0;
+    int cpus[MAX_CPUS];
+    size_t num_cpus = 0;
+    size_t thread_counts[MAX_THREAD_COUNTS];
+    size_t num_thread_counts = 0;
+    size_t min_size = DEFAULT_MIN_SIZE;
+    size_t max_size = 0;
+    size_t bytes = DEFAULT_BYTES;
+    size_t max_chains = CHASE_MAX_CHAINS;
+    chase_layout layout = CHASE_RANDOM;
+    size_t loads = DEFAULT_LOADS;
+    size_t repeats = DEFAULT_REPEATS;
+    const char* output = DEFAULT_OUTPUT;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--suite") == 0 && i + 1 < argc) {
+            i++;
+            suites = strcmp(argv[i], "mlp") == 0 ? SUITE_MLP
+                : strcmp(argv[i], "stream") == 0 ? SUITE_STREAM
+                : strcmp(argv[i], "all") == 0 ? SUITE_MLP | SUITE_STREAM
+                : 0;
+            if (suites == 0) {
+                fprintf(stderr, "unknown suite: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            const stream_kernel* kernel = find_stream_kernel(argv[++i]);
+            if (kernel == NULL || num_kernels == sizeof(kernels) / sizeof(kernels[0])) {
+                fprintf(stderr, "unknown kernel: %s\n", argv[i]);
+                return 1;
+            }
+            if (!stream_kernel_supported(kernel)) {
+                fprintf(stderr, "this CPU doesn't support %s\n", argv[i]);
+                return 1;
+            }
+            kernels[num_kernels++] = kernel;
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            num_cpus = parse_cpu_list(argv[++i], cpus, MAX_CPUS);
+            if (num_cpus == 0) {
+                fprintf(stderr, "invalid cpu list: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            const size_t threads = strtoul(argv[++i], NULL, 10);
+            if (threads == 0 || num_thread_counts == MAX_THREAD_COUNTS) {
+                fprintf(stderr, "--threads must be positive, given at most %d times\n", MAX_THREAD_COUNTS);
+                return 1;
+            }
+            thread_counts[num_thread_counts++] = threads;
+        } else if (strcmp(argv[i], "--min") == 0 && i + 1 < argc) {
+            if (parse_size(argv[++i], &min_size) != 0) {
+                fprintf(stderr, "invalid size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            if (parse_size(argv[++i], &max_size) != 0) {
+                fprintf(stderr, "invalid size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc) {
+            if (parse_size(argv[++i], &bytes) != 0) {
+                fprintf(stderr, "invalid size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--chains") == 0 && i + 1 < argc) {
+            max_chains = strtoul(argv[++i], NULL, 10);
+            if (max_chains == 0 || max_chains > CHASE_MAX_CHAINS) {
+                fprintf(stderr, "--chains must be between 1 and %d\n", CHASE_MAX_CHAINS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+            if (parse_chase_layout(argv[++i], &layout) != 0) {
+                fprintf(stderr, "unknown layout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--loads") == 0 && i + 1 < argc) {
+            loads = strtoul(argv[++i], NULL, 10);
+            if (loads == 0) {
+                fprintf(stderr, "--loads must be positive\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc) {
+            repeats = strtoul(argv[++i], NULL, 10);
+            if (repeats == 0 || repeats > MAX_REPEATS) {
+                fprintf(stderr, "--repeats must be between 1 and %d\n", MAX_REPEATS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--suite mlp|stream|all] [--kernel <name>]... [--cpus <list>] "
+                    "[--threads <n>]... [--min <size>] [--max <size>] [--bytes <size>] "
+                    "[--chains <n>] [--layout random|pages|tlb|stride] [--loads <n>] "
+                    "[--repeats <n>] [--output <dir>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (num_cpus == 0) {
+        cpus[0] = sched_getcpu();
+        num_cpus = 1;
+    }
+    if (num_thread_counts == 0) {
+        thread_counts[num_thread_counts++] = 1;
+        if (num_cpus > 1) {
+            thread_counts[num_thread_counts++] = num_cpus;
+        }
+    }
+    for (size_t i = 0; i < num_thread_counts; i++)
+    {
+        if (thread_counts[i] > num_cpus) {
+            fprintf(stderr, "%lu threads need as many cpus in --cpus\n", thread_counts[i]);
+            return 1;
+        }
+    }
+
+    if (num_kernels == 0)
+    {
+        size_t count;
+        const stream_kernel* all = stream_kernels(&count);
+        for (size_t k = 0; k < count && num_kernels < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            if (stream_kernel_supported(&all[k])) {
+                kernels[num_kernels++] = &all[k];
+            }
+        }
+    }
+
+    if (pin_to_cpu(cpus[0]) != 0) {
+        return 1;
+    }
+
+    cache_geometry geometry;
+    detect_cache_geometry(&geometry);
+    print_cache_geometry(stdout, geometry);
+    if (max_size == 0) {
+        max_size = 8 * geometry.l3.size > CHASE_MIN_DEFAULT_MAX_SIZE ? 8 * geometry.l3.size : CHASE_MIN_DEFAULT_MAX_SIZE;
+    }
+    if (min_size > max_size) {
+        fprintf(stderr, "--min is larger than --max\n");
+        return 1;
+    }
+
+    if (suites & SUITE_MLP)
+    {
+        if (run_mlp(output, layout, min_size, max_size, max_chains, loads, repeats) != 0) {
+            return 1;
+        }
+    }
+
+    if (suites & SUITE_STREAM)
+    {
+        char filename[EXPERIMENT_PATH_SIZE];
+        snprintf(filename, sizeof(filename), "%s/bandwidth.csv", output);
+        FILE* out = fopen(filename, "w");
+        if (out == NULL) {
+            perror(filename);
+            return 1;
+        }
+        fprintf(out, "Kernel,Op,Nontemporal,Threads,WorkingSet,Bytes,Seconds,GBps\n");
+
+        int status = 0;
+        for (size_t t = 0; t < num_thread_counts && status == 0; t++)
+        {
+            stream_run run = {
+                .kernels = kernels,
+                .num_kernels = num_kernels,
+                .min_size = min_size,
+                .max_size = max_size,
+                .bytes = bytes,
+                .repeats = repeats,
+                .num_threads = thread_counts[t],
+                .cpus = cpus,
+                .out = out
+            };
+            status = run_stream(&run);
+        }
+
+        fclose(out);
+        if (status != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include "buffer.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+// Hugepage mappings have to be a multiple of the hugepage size, use the same
+// rounded size for every mapping so `unmap_buffer` doesn't need to know
+// which kind of page the buffer got
+static size_t mapping_size(const size_t size)
+{
+    return (size + HUGEPAGE_SIZE - 1) & ~(size_t)(HUGEPAGE_SIZE - 1);
+}
+
+byte* map_buffer(/*in*/ const size_t size, /*out*/ int* hugepages)
+{
+    const size_t length = mapping_size(size);
+
+    byte* mem = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                     MAP_POPULATE | MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB,
+                     -1, 0);
+    if (mem != MAP_FAILED) {
+        if (hugepages != NULL) {
+            *hugepages = 1;
+        }
+        return mem;
+    }
+
+    // no hugepages are reserved, fall back to regular pages
+    mem = mmap(NULL, length, PROT_READ | PROT_WRITE,
+               MAP_POPULATE | MAP_ANONYMOUS | MAP_PRIVATE,
+               -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("map_buffer");
+        return NULL;
+    }
+
+    if (hugepages != NULL) {
+        *hugepages = 0;
+    }
+    return mem;
+}
+
+void unmap_buffer(/*in*/ byte* buffer, /*in*/ const size_t size)
+{
+    if (buffer != NULL) {
+        munmap(buffer, mapping_size(size));
+    }
+}
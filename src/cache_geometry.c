@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include "cache_geometry.h"
+#include "cache.h"
+#include "eviction_set.h"
+#include "utility.h"
+
+#include <cpuid.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CPUID cache types (Intel SDM Vol. 2A, CPUID leaf 4, EAX[4:0])
+#define CPUID_CACHE_NULL 0
+#define CPUID_CACHE_DATA 1
+#define CPUID_CACHE_UNIFIED 3
+
+// Number of repetitions per candidate way count in `measure_associativity`
+#define ASSOCIATIVITY_SAMPLES 1001
+
+cache_geometry default_cache_geometry(void)
+{
+    return (cache_geometry){
+        .l1d = {
+            .size = L1_SIZE,
+            .line_size = CACHE_LINE_SIZE,
+            .sets = L1_SIZE / (CACHE_LINE_SIZE * 8),
+            .ways = 8,
+            .shared_cpus = 1
+        },
+        .l2 = {
+            .size = L2_SIZE,
+            .line_size = CACHE_LINE_SIZE,
+            .sets = L2_SETS,
+            .ways = L2_ASSOCIATIVITY,
+            .shared_cpus = 1
+        },
+        .l3 = { .size = 0 }
+    };
+}
+
+// Returns the level struct that a (level, type) pair from CPUID or sysfs
+// describes, or NULL for instruction caches and levels we don't track
+static cache_level_geometry* level_slot(cache_geometry* geometry, const unsigned level, const int data)
+{
+    if (!data) {
+        return NULL;
+    }
+
+    switch (level) {
+        case 1: return &geometry->l1d;
+        case 2: return &geometry->l2;
+        case 3: return &geometry->l3;
+        default: return NULL;
+    }
+}
+
+// Fills in every level described by the deterministic cache parameters
+// leaf. Returns a bit mask of the levels found (bit n for level n).
+static unsigned read_cpuid_geometry(cache_geometry* geometry)
+{
+    unsigned eax, ebx, ecx, edx;
+
+    // AMD describes its caches in the extended leaf 0x8000001D, with the
+    // same layout as Intel's leaf 4
+    unsigned leaf = 4;
+    if (__get_cpuid(0, &eax, &ebx, &ecx, &edx) && ebx == 0x68747541 /* "Auth" */) {
+        leaf = 0x8000001D;
+    }
+
+    if (__get_cpuid_max(leaf & 0x80000000, NULL) < leaf) {
+        return 0;
+    }
+
+    unsigned found = 0;
+    for (unsigned subleaf = 0; subleaf < 16; subleaf++)
+    {
+        __cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+
+        const unsigned type = eax & 0x1f;
+        if (type == CPUID_CACHE_NULL) {
+            break;
+        }
+
+        const unsigned level = (eax >> 5) & 0x7;
+        cache_level_geometry* slot = level_slot(
+            geometry, level, type == CPUID_CACHE_DATA || type == CPUID_CACHE_UNIFIED);
+        if (slot == NULL) {
+            continue;
+        }
+
+        const size_t ways = ((ebx >> 22) & 0x3ff) + 1;
+        const size_t partitions = ((ebx >> 12) & 0x3ff) + 1;
+        const size_t line_size = (ebx & 0xfff) + 1;
+        const size_t sets = (size_t)ecx + 1;
+
+        *slot = (cache_level_geometry){
+            .size = ways * partitions * line_size * sets,
+            .line_size = line_size,
+            .sets = sets,
+            .ways = ways,
+            .shared_cpus = ((eax >> 14) & 0xfff) + 1
+        };
+        found |= 1u << level;
+    }
+
+    return found;
+}
+
+// Reads one line from a file in a sysfs cache index directory
+static int read_sysfs_string(const int cpu, const int index, const char* name,
+                             char* buffer, const size_t length)
+{
+    char path[128] = {0};
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/%s", cpu, index, name);
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    const int ok = fgets(buffer, (int)length, f) != NULL;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+static size_t read_sysfs_size(const int cpu, const int index, const char* name)
+{
+    char buffer[64] = {0};
+    if (read_sysfs_string(cpu, index, name, buffer, sizeof(buffer)) != 0) {
+        return 0;
+    }
+
+    // sizes are written as e.g. "2048K"
+    char* end = NULL;
+    size_t value = strtoul(buffer, &end, 10);
+    if (*end == 'K') {
+        value *= 1024;
+    } else if (*end == 'M') {
+        value *= 1024 * 1024;
+    }
+    return value;
+}
+
+// Fills in every level described in sysfs for `cpu` into `geometry`.
+// Returns a bit mask of the levels found (bit n for level n).
+static unsigned read_sysfs_geometry(const int cpu, cache_geometry* geometry)
+{
+    unsigned found = 0;
+
+    for (int index = 0; index < 16; index++)
+    {
+        char type[32] = {0};
+        if (read_sysfs_string(cpu, index, "type", type, sizeof(type)) != 0) {
+            break;
+        }
+
+        const unsigned level = (unsigned)read_sysfs_size(cpu, index, "level");
+        cache_level_geometry* slot = level_slot(
+            geometry, level, strncmp(type, "Data", 4) == 0 || strncmp(type, "Unified", 7) == 0);
+        if (slot == NULL) {
+            continue;
+        }
+
+        char shared[256] = {0};
+        size_t shared_cpus = 1;
+        if (read_sysfs_string(cpu, index, "shared_cpu_list", shared, sizeof(shared)) == 0) {
+            // count the CPUs in a list like "0-3,8"
+            shared_cpus = 0;
+            for (char* p = shared; *p != '\0' && *p != '\n';)
+            {
+                const long first = strtol(p, &p, 10);
+                const long last = *p == '-' ? strtol(p + 1, &p, 10) : first;
+                shared_cpus += (size_t)(last - first + 1);
+                if (*p == ',') {
+                    p++;
+                } else {
+                    break;
+                }
+            }
+        }
+
+        *slot = (cache_level_geometry){
+            .size = read_sysfs_size(cpu, index, "size"),
+            .line_size = read_sysfs_size(cpu, index, "coherency_line_size"),
+            .sets = read_sysfs_size(cpu, index, "number_of_sets"),
+            .ways = read_sysfs_size(cpu, index, "ways_of_associativity"),
+            .shared_cpus = shared_cpus
+        };
+        found |= 1u << level;
+    }
+
+    return found;
+}
+
+int read_cache_attribute(
+    /*in*/ const int cpu,
+    /*in*/ const unsigned level,
+    /*in*/ const char* name,
+    /*out*/ char* buffer,
+    /*in*/ const size_t length)
+{
+    // the indices of the levels aren't guaranteed, the L3 is usually index3
+    for (int index = 0; index < 16; index++)
+    {
+        char type[32] = {0};
+        if (read_sysfs_string(cpu, index, "type", type, sizeof(type)) != 0) {
+            return -1;
+        }
+
+        if ((strncmp(type, "Data", 4) != 0 && strncmp(type, "Unified", 7) != 0)
+            || read_sysfs_size(cpu, index, "level") != level) {
+            continue;
+        }
+
+        if (read_sysfs_string(cpu, index, name, buffer, length) != 0) {
+            return -1;
+        }
+        buffer[strcspn(buffer, "\n")] = '\0';
+        return 0;
+    }
+
+    return -1;
+}
+
+int detect_cache_geometry(/*out*/ cache_geometry* geometry)
+{
+    cache_geometry from_cpuid = default_cache_geometry();
+    cache_geometry from_sysfs = default_cache_geometry();
+
+    const int cpu = sched_getcpu();
+    const unsigned cpuid_found = read_cpuid_geometry(&from_cpuid);
+    const unsigned sysfs_found = read_sysfs_geometry(cpu < 0 ? 0 : cpu, &from_sysfs);
+
+    *geometry = from_cpuid;
+
+    const char* names[] = {"L1d", "L2", "L3"};
+    cache_level_geometry* levels[] = {&geometry->l1d, &geometry->l2, &geometry->l3};
+    const cache_level_geometry* sysfs_levels[] = {&from_sysfs.l1d, &from_sysfs.l2, &from_sysfs.l3};
+
+    int status = 0;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        const unsigned bit = 1u << (i + 1);
+
+        if (!(cpuid_found & bit) && (sysfs_found & bit)) {
+            *levels[i] = *sysfs_levels[i];
+        } else if ((cpuid_found & bit) && (sysfs_found & bit)
+                   && (levels[i]->sets != sysfs_levels[i]->sets
+                       || levels[i]->ways != sysfs_levels[i]->ways))
+        {
+            fprintf(stderr, "warning: %s is %lu sets x %lu ways according to CPUID "
+                    "but %lu sets x %lu ways according to sysfs\n", names[i],
+                    levels[i]->sets, levels[i]->ways,
+                    sysfs_levels[i]->sets, sysfs_levels[i]->ways);
+        } else if (!(cpuid_found & bit) && !(sysfs_found & bit)) {
+            status = -1;
+        }
+    }
+
+    return status;
+}
+
+void print_cache_geometry(/*in*/ FILE* out, /*in*/ const cache_geometry geometry)
+{
+    const char* names[] = {"L1d", "L2", "L3"};
+    const cache_level_geometry levels[] = {geometry.l1d, geometry.l2, geometry.l3};
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        if (levels[i].size == 0) {
+            fprintf(out, "%-3s: not present\n", names[i]);
+            continue;
+        }
+
+        fprintf(out, "%-3s: %lu KiB, %lu sets x %lu ways x %lu B lines, shared by %lu cpus\n",
+                names[i], levels[i].size / 1024, levels[i].sets, levels[i].ways,
+                levels[i].line_size, levels[i].shared_cpus);
+    }
+}
+
+int measure_associativity(
+    /*in*/ const cache_level_geometry level,
+    /*in*/ const size_t max_ways,
+    /*out*/ size_t* ways)
+{
+    // the victim plus up to `max_ways + 1` lines that map to the same set
+    eviction_set es = new_eviction_set(level.sets, max_ways + 2, 0);
+    if (es.warmup_section.start_addr == NULL) {
+        return -1;
+    }
+
+    uint64_t* samples = malloc(ASSOCIATIVITY_SAMPLES * sizeof(uint64_t));
+    uint64_t* medians = malloc((max_ways + 2) * sizeof(uint64_t));
+    if (samples == NULL || medians == NULL) {
+        free(samples);
+        free(medians);
+        free_eviction_set(&es);
+        return -1;
+    }
+
+    byte* victim = eviction_set_line(es, 0, 0);
+
+    // median reload latency of the victim after touching `k` congruent lines
+    for (size_t k = 0; k <= max_ways + 1; k++)
+    {
+        for (size_t sample = 0; sample < ASSOCIATIVITY_SAMPLES; sample++)
+        {
+            flush_eviction_set(es);
+            *(volatile byte*)victim;
+
+            // touch the congruent lines twice so that the replacement
+            // policy settles on evicting the victim
+            for (size_t pass = 0; pass < 2; pass++) {
+                for (size_t line = 1; line <= k; line++) {
+                    *(volatile byte*)eviction_set_line(es, 0, line);
+                }
+            }
+
+            samples[sample] = time_one_line_read_access(victim);
+        }
+
+        qsort(samples, ASSOCIATIVITY_SAMPLES, sizeof(uint64_t), compare_u64);
+        medians[k] = samples[ASSOCIATIVITY_SAMPLES / 2];
+    }
+
+    // the associativity is where the latency jumps past the midpoint between
+    // a hit (k = 0) and the slowest reload
+    const size_t last = max_ways + 1;
+    uint64_t slowest = 0;
+    for (size_t k = 0; k <= last; k++) {
+        slowest = medians[k] > slowest ? medians[k] : slowest;
+    }
+    const uint64_t threshold = medians[0] + (slowest - medians[0]) / 2;
+
+    int status = -1;
+    for (size_t k = 1; k <= last; k++) {
+        if (slowest > medians[0] && medians[k] > threshold) {
+            *ways = k;
+            status = 0;
+            break;
+        }
+    }
+
+    free(samples);
+    free(medians);
+    free_eviction_set(&es);
+
+    return status;
+}
@@ -0,0 +1,202 @@
+#include "campaign.h"
+#include "cache_geometry.h"
+#include "experiment.h"
+
+#include <cpuid.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+#define MANIFEST_HEADER "Host,Experiment,File,Set,Warmup,First,Requested,Iterations,Checksum,Options\n"
+
+// The longest row of a manifest
+#define ROW_SIZE 512
+
+static uint64_t fnv_bytes(uint64_t hash, const void* data, const size_t size)
+{
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t campaign_checksum(/*in*/ const void* data, /*in*/ const size_t size)
+{
+    return fnv_bytes(FNV_OFFSET, data, size);
+}
+
+uint64_t host_fingerprint(/*in*/ const cache_geometry geometry)
+{
+    uint64_t hash = FNV_OFFSET;
+
+    struct utsname host;
+    if (uname(&host) == 0) {
+        hash = fnv_bytes(hash, host.nodename, strlen(host.nodename));
+        hash = fnv_bytes(hash, host.release, strlen(host.release));
+    }
+
+    // the family, model and stepping, then the 48 character brand string
+    unsigned regs[4] = {0};
+    if (__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        hash = fnv_bytes(hash, &regs[0], sizeof(regs[0]));
+    }
+    for (unsigned leaf = 0x80000002; leaf <= 0x80000004; leaf++)
+    {
+        if (__get_cpuid(leaf, &regs[0], &regs[1], &regs[2], &regs[3])) {
+            hash = fnv_bytes(hash, regs, sizeof(regs));
+        }
+    }
+
+    const cache_level_geometry levels[] = {geometry.l1d, geometry.l2, geometry.l3};
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+    {
+        const size_t fields[] = {levels[i].size, levels[i].line_size, levels[i].sets, levels[i].ways};
+        hash = fnv_bytes(hash, fields, sizeof(fields));
+    }
+
+    return hash;
+}
+
+// Adds a chunk to the in-memory list, returns -1 if it couldn't grow
+static int add_chunk(campaign* c, const campaign_chunk* chunk)
+{
+    if (c->num_chunks == c->capacity) {
+        const size_t capacity = c->capacity == 0 ? 64 : 2 * c->capacity;
+        campaign_chunk* chunks = realloc(c->chunks, capacity * sizeof(campaign_chunk));
+        if (chunks == NULL) {
+            perror("campaign");
+            return -1;
+        }
+        c->chunks = chunks;
+        c->capacity = capacity;
+    }
+
+    c->chunks[c->num_chunks++] = *chunk;
+    return 0;
+}
+
+// Reads the rows of `experiment` on `host` from the manifest, if it exists
+static int read_manifest(campaign* c, const char* filename)
+{
+    FILE* in = fopen(filename, "r");
+    if (in == NULL) {
+        return 0;
+    }
+
+    char row[ROW_SIZE];
+    while (fgets(row, sizeof(row), in) != NULL)
+    {
+        campaign_chunk chunk;
+        const int fields = sscanf(row, "%lx,%31[^,],%127[^,],%lu,%lu,%lu,%lu,%lu,%lx,%lx",
+                                  &chunk.host, chunk.experiment, chunk.file, &chunk.set,
+                                  &chunk.warmup_lines, &chunk.first, &chunk.requested,
+                                  &chunk.iterations, &chunk.checksum, &chunk.options);
+
+        // the header, and rows cut short by an interrupted write, don't parse
+        if (fields != 10 || chunk.host != c->host || strcmp(chunk.experiment, c->experiment) != 0) {
+            continue;
+        }
+        if (add_chunk(c, &chunk) != 0) {
+            fclose(in);
+            return -1;
+        }
+    }
+
+    fclose(in);
+    return 0;
+}
+
+int open_campaign(
+    /*in*/ const char* dir,
+    /*in*/ const char* experiment,
+    /*in*/ const uint64_t host,
+    /*out*/ campaign* c)
+{
+    memset(c, 0, sizeof(*c));
+    c->host = host;
+    c->fd = -1;
+    snprintf(c->experiment, sizeof(c->experiment), "%s", experiment);
+
+    char filename[EXPERIMENT_PATH_SIZE];
+    snprintf(filename, sizeof(filename), "%s/%s", dir, CAMPAIGN_MANIFEST);
+    if (read_manifest(c, filename) != 0) {
+        close_campaign(c);
+        return -1;
+    }
+
+    c->fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (c->fd < 0) {
+        perror(filename);
+        close_campaign(c);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(c->fd, &st) == 0 && st.st_size == 0
+        && write(c->fd, MANIFEST_HEADER, strlen(MANIFEST_HEADER)) < 0) {
+        perror(filename);
+        close_campaign(c);
+        return -1;
+    }
+
+    return 0;
+}
+
+void close_campaign(/*inout*/ campaign* c)
+{
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    free(c->chunks);
+    c->chunks = NULL;
+    c->num_chunks = 0;
+    c->capacity = 0;
+    c->fd = -1;
+}
+
+const campaign_chunk* find_campaign_chunk(
+    /*in*/ const campaign* c,
+    /*in*/ const char* file,
+    /*in*/ const size_t first)
+{
+    // later rows replace earlier ones
+    for (size_t i = c->num_chunks; i > 0; i--)
+    {
+        const campaign_chunk* chunk = &c->chunks[i - 1];
+        if (chunk->first == first && strcmp(chunk->file, file) == 0) {
+            return chunk;
+        }
+    }
+
+    return NULL;
+}
+
+int record_campaign_chunk(/*inout*/ campaign* c, /*in*/ const campaign_chunk* chunk)
+{
+    campaign_chunk row = *chunk;
+    row.host = c->host;
+    memcpy(row.experiment, c->experiment, sizeof(row.experiment));
+
+    // one write per row, so rows appended by other jobs never interleave
+    char line[ROW_SIZE];
+    const int length = snprintf(line, sizeof(line), "%016lx,%s,%s,%lu,%lu,%lu,%lu,%lu,%016lx,%016lx\n",
+                                row.host, row.experiment, row.file, row.set, row.warmup_lines,
+                                row.first, row.requested, row.iterations, row.checksum,
+                                row.options);
+    if (length < 0 || (size_t)length >= sizeof(line) || write(c->fd, line, (size_t)length) != length) {
+        perror("record_campaign_chunk");
+        return -1;
+    }
+
+    return add_chunk(c, &row);
+}
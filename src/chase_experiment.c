@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include "address.h"
+#include "buffer.h"
+#include "cache.h"
+#include "cache_geometry.h"
+#include "cpu.h"
+#include "experiment.h"
+#include "pointer_chase.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define DEFAULT_OUTPUT "results/chase"
+#define DEFAULT_MIN_SIZE (4 * 1024)
+#define DEFAULT_LOADS (1 << 20)
+#define DEFAULT_REPEATS 5
+#define MAX_REPEATS 64
+
+// The layouts measured unless given with `--layout`
+static const chase_layout default_layouts[] = {CHASE_RANDOM, CHASE_PAGES, CHASE_TLB, CHASE_STRIDE};
+#define MAX_LAYOUTS (sizeof(default_layouts) / sizeof(chase_layout))
+
+static int compare_double(const void* a, const void* b)
+{
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Usage: chase [--layout random|pages|tlb|stride]... [--stride <bytes>]
+//              [--min <size>] [--max <size>] [--loads <n>] [--repeats <n>]
+//              [--cpu <cpu>] [--output <dir>]
+//
+// Measures the latency of dependent loads across working set sizes, in the
+// style of lmbench's lat_mem_rd: the working set is linked into a chain of
+// pointers (see pointer_chase.h) and `--loads` (2^20 by default) loads
+// following it are timed with a single pair of timestamps, so the timer's
+// overhead is spread over all of them. Each size is timed `--repeats`
+// times (5 by default) after a warmup pass over the whole chain, the fastest
+// and the median run are kept.
+//
+// The working sets go from `--min` (4K) to `--max` (8 times the L3, at
+// least 64M), doubling with a step half way in between, sizes take a K, M
+// or G suffix. Each `--layout` (all of them by default) links them in its
+// own order: `random` every line in a random order, `pages` every line a
+// page at a time so TLB misses are amortized, `tlb` one line per page so
+// every load needs a translation, and `stride` every `--stride` bytes (a
+// line by default) in order. Where `random` and `pages` part is the cost
+// of the TLB misses, and where `tlb` steps up is the reach of each level of
+// the TLB. The buffer is backed by hugepages when any are reserved, then
+// a TLB entry covers 2 MiB and `tlb` only steps up 512 times later.
+//
+// The loads are made on `--cpu` (the CPU the job started on by default),
+// and the cycles per load (TSC cycles) of every layout and size are
+// written to <dir>/chase.csv, where the output directory is results/chase
+// by default.
+int chase_experiment(int argc, char** argv, const experiment_context* context)
+{
+    (void)context;
+    chase_layout layouts[MAX_LAYOUTS];
+    size_t num_layouts = 0;
+    size_t stride = CACHE_LINE_SIZE;
+    size_t min_size = DEFAULT_MIN_SIZE;
+    size_t max_size = 0;
+    size_t loads = DEFAULT_LOADS;
+    size_t repeats = DEFAULT_REPEATS;
+    int cpu = -1;
+    const char* output = DEFAULT_OUTPUT;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+            if (num_layouts == MAX_LAYOUTS || parse_chase_layout(argv[++i], &layouts[num_layouts++]) != 0) {
+                fprintf(stderr, "unknown or repeated layout: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--stride") == 0 && i + 1 < argc) {
+            stride = strtoul(argv[++i], NULL, 10);
+            if (stride < sizeof(void*) || stride % sizeof(void*) != 0) {
+                fprintf(stderr, "--stride must be a positive multiple of %lu bytes\n", sizeof(void*));
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--min") == 0 && i + 1 < argc) {
+            if (parse_size(argv[++i], &min_size) != 0) {
+                fprintf(stderr, "invalid size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            if (parse_size(argv[++i], &max_size) != 0) {
+                fprintf(stderr, "invalid size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--loads") == 0 && i + 1 < argc) {
+            loads = strtoul(argv[++i], NULL, 10);
+            if (loads == 0) {
+                fprintf(stderr, "--loads must be positive\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc) {
+            repeats = strtoul(argv[++i], NULL, 10);
+            if (repeats == 0 || repeats > MAX_REPEATS) {
+                fprintf(stderr, "--repeats must be between 1 and %d\n", MAX_REPEATS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            if (parse_cpu_list(argv[++i], &cpu, 1) == 0) {
+                fprintf(stderr, "invalid cpu: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--layout random|pages|tlb|stride]... [--stride <bytes>] "
+                    "[--min <size>] [--max <size>] [--loads <n>] [--repeats <n>] "
+                    "[--cpu <cpu>] [--output <dir>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (num_layouts == 0) {
+        memcpy(layouts, default_layouts, sizeof(default_layouts));
+        num_layouts = MAX_LAYOUTS;
+    }
+
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+    if (pin_to_cpu(cpu) != 0) {
+        return 1;
+    }
+
+    cache_geometry geometry;
+    detect_cache_geometry(&geometry);
+    print_cache_geometry(stdout, geometry);
+    if (max_size == 0) {
+        max_size = 8 * geometry.l3.size > CHASE_MIN_DEFAULT_MAX_SIZE ? 8 * geometry.l3.size : CHASE_MIN_DEFAULT_MAX_SIZE;
+    }
+    if (min_size > max_size) {
+        fprintf(stderr, "--min is larger than --max\n");
+        return 1;
+    }
+
+    int hugepages = 0;
+    byte* buffer = map_buffer(max_size, &hugepages);
+    if (buffer == NULL) {
+        return 1;
+    }
+    printf("chase: %lu bytes on cpu %d, %s\n", max_size, cpu,
+           hugepages ? "backed by 2 MiB hugepages" : "backed by 4 KiB pages");
+
+    char filename[EXPERIMENT_PATH_SIZE];
+    snprintf(filename, sizeof(filename), "%s/chase.csv", output);
+    FILE* out = fopen(filename, "w");
+    if (out == NULL) {
+        perror(filename);
+        unmap_buffer(buffer, max_size);
+        return 1;
+    }
+    fprintf(out, "Layout,Stride,WorkingSet,Nodes,Hugepages,Loads,MinCycles,MedianCycles\n");
+
+    int status = 0;
+    for (size_t l = 0; l < num_layouts && status == 0; l++)
+    {
+        const chase_layout layout = layouts[l];
+        const size_t spacing = chase_node_spacing(layout, stride);
+
+        // every power of two, and the size half way to the next one
+        for (size_t size = min_size; size <= max_size && status == 0; size = next_chase_size(size))
+        {
+            if (size < 2 * spacing) {
+                continue;
+            }
+
+            const chase_chain chain = build_chase_chain(buffer, size, layout, stride, CHASE_SEED);
+            if (chain.start == NULL) {
+                status = 1;
+                break;
+            }
+
+            // bring the chain into whatever holds it, and its pages into the TLB
+            time_chase(chain, chain.nodes);
+
+            double cycles[MAX_REPEATS];
+            for (size_t r = 0; r < repeats; r++) {
+                cycles[r] = time_chase(chain, loads);
+            }
+            qsort(cycles, repeats, sizeof(double), compare_double);
+
+            fprintf(out, "%s,%lu,%lu,%lu,%d,%lu,%.3f,%.3f\n", chase_layout_name(layout),
+                    spacing, size, chain.nodes, hugepages, loads, cycles[0], cycles[repeats / 2]);
+            printf("%-6s %10lu bytes: %7.2f cycles per load\n", chase_layout_name(layout), size, cycles[0]);
+            fflush(stdout);
+        }
+    }
+
+    fclose(out);
+    unmap_buffer(buffer, max_size);
+    return status;
+}
@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include "cpu.h"
+#include "cache_geometry.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int pin_to_cpu(/*in*/ const int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    // a pid of 0 applies the mask to the calling thread only
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity");
+        return -1;
+    }
+
+    return 0;
+}
+
+int pinned_cpu(void)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) != 1) {
+        return -1;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed)) {
+            return cpu;
+        }
+    }
+
+    return -1;
+}
+
+size_t parse_cpu_list(
+    /*in*/ const char* list,
+    /*out*/ int* cpus,
+    /*in*/ const size_t max_cpus)
+{
+    size_t count = 0;
+    const char* p = list;
+
+    while (*p != '\0' && *p != '\n')
+    {
+        char* end = NULL;
+        const long first = strtol(p, &end, 10);
+        if (end == p || first < 0) {
+            return 0;
+        }
+        p = end;
+
+        // a range like "4-7"
+        long last = first;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return 0;
+            }
+            p = end;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (count == max_cpus) {
+                return 0;
+            }
+            cpus[count++] = (int)cpu;
+        }
+
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0' && *p != '\n') {
+            return 0;
+        }
+    }
+
+    return count;
+}
+
+// Reads a single integer out of a sysfs topology file for `cpu`
+static long read_topology_value(const int cpu, const char* name)
+{
+    char path[128] = {0};
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    long value = -1;
+    if (fscanf(f, "%ld", &value) != 1) {
+        value = -1;
+    }
+
+    fclose(f);
+    return value;
+}
+
+long physical_core_id(/*in*/ const int cpu)
+{
+    const long package = read_topology_value(cpu, "physical_package_id");
+    const long core = read_topology_value(cpu, "core_id");
+
+    if (package < 0 || core < 0) {
+        return -1;
+    }
+
+    // core ids are only unique within a package
+    return (package << 20) | core;
+}
+
+size_t unique_physical_cores(
+    /*inout*/ int* cpus,
+    /*in*/ const size_t num_cpus)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < num_cpus; i++)
+    {
+        const long core = physical_core_id(cpus[i]);
+
+        int duplicate = 0;
+        for (size_t j = 0; j < count && core >= 0; j++) {
+            if (physical_core_id(cpus[j]) == core) {
+                fprintf(stderr, "cpu %d shares a core with cpu %d, skipping it\n",
+                        cpus[i], cpus[j]);
+                duplicate = 1;
+                break;
+            }
+        }
+
+        if (!duplicate) {
+            cpus[count++] = cpus[i];
+        }
+    }
+
+    return count;
+}
+
+long llc_id(/*in*/ const int cpu)
+{
+    char id[32] = {0};
+    if (read_cache_attribute(cpu, 3, "id", id, sizeof(id)) != 0) {
+        return -1;
+    }
+
+    char* end = NULL;
+    const long value = strtol(id, &end, 10);
+    return end == id ? -1 : value;
+}
+
+size_t unique_llcs(
+    /*inout*/ int* cpus,
+    /*in*/ const size_t num_cpus)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < num_cpus; i++)
+    {
+        const long llc = llc_id(cpus[i]);
+
+        int duplicate = 0;
+        for (size_t j = 0; j < count && llc >= 0; j++) {
+            if (llc_id(cpus[j]) == llc) {
+                fprintf(stderr, "cpu %d shares an L3 with cpu %d, skipping it\n",
+                        cpus[i], cpus[j]);
+                duplicate = 1;
+                break;
+            }
+        }
+
+        if (!duplicate) {
+            cpus[count++] = cpus[i];
+        }
+    }
+
+    return count;
+}
+
+int other_physical_core(/*in*/ const int cpu)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+
+    const long core = physical_core_id(cpu);
+
+    for (int other = 0; other < CPU_SETSIZE; other++)
+    {
+        if (other == cpu || !CPU_ISSET(other, &allowed)) {
+            continue;
+        }
+
+        // without topology information only a different cpu can be checked
+        if (core < 0 || physical_core_id(other) != core) {
+            return other;
+        }
+    }
+
+    return -1;
+}
+
+int smt_sibling(/*in*/ const int cpu)
+{
+    char path[128] = {0};
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    char list[256] = {0};
+    const int read = fgets(list, sizeof(list), f) != NULL;
+    fclose(f);
+
+    int siblings[64];
+    const size_t num_siblings = read ? parse_cpu_list(list, siblings, 64) : 0;
+    for (size_t i = 0; i < num_siblings; i++) {
+        if (siblings[i] != cpu) {
+            return siblings[i];
+        }
+    }
+
+    return -1;
+}
+
+int read_msr(/*in*/ const int cpu, /*in*/ const uint32_t msr, /*out*/ uint64_t* value)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    const int status = pread(fd, value, sizeof(*value), msr) == sizeof(*value) ? 0 : -1;
+    close(fd);
+    return status;
+}
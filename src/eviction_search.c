@@ -0,0 +1,324 @@
+#include "eviction_search.h"
+#include "cache.h"
+#include "utility.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Number of reloads per level in `calibrate_eviction_threshold`
+#define THRESHOLD_SAMPLES 51
+
+// Passes over the candidates per eviction test. The L2 of recent Intel cores 
+// isn't LRU, and needs a few passes over `ways` congruent lines before it 
+// reliably picks the target as the victim
+#define EVICTION_PASSES 4
+
+// Rounds of the reduction in which no group could be dropped before giving 
+// up, since a noisy test can keep a group that isn't needed
+#define REDUCTION_RETRIES 3
+
+// Bits of a pagemap entry (Documentation/admin-guide/mm/pagemap.rst)
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_PFN_MASK ((1ULL << 55) - 1)
+
+size_t num_page_colors(/*in*/ const size_t cache_sets)
+{
+    const size_t colors = cache_sets * CACHE_LINE_SIZE / SEARCH_PAGE_SIZE;
+    return colors == 0 ? 1 : colors;
+}
+
+int physical_addresses(
+    /*in*/ byte* const* addresses,
+    /*in*/ const size_t num_addresses,
+    /*out*/ uint64_t* physical)
+{
+    const int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < num_addresses; i++)
+    {
+        // pagemap entries are per 4 KiB page, even within a hugepage
+        const uint64_t virtual = (uint64_t)addresses[i];
+        uint64_t entry;
+        const off_t offset = (off_t)(virtual / SEARCH_PAGE_SIZE * sizeof(entry));
+        if (pread(fd, &entry, sizeof(entry), offset) != sizeof(entry)) {
+            status = -1;
+            break;
+        }
+
+        // unprivileged readers see a frame number of 0
+        const uint64_t pfn = entry & PAGEMAP_PFN_MASK;
+        if ((entry & PAGEMAP_PRESENT) == 0 || pfn == 0) {
+            status = -1;
+            break;
+        }
+
+        physical[i] = pfn * SEARCH_PAGE_SIZE + virtual % SEARCH_PAGE_SIZE;
+    }
+
+    close(fd);
+    return status;
+}
+
+int color_pages_by_pagemap(
+    /*in*/ byte* const* pages,
+    /*in*/ const size_t num_pages,
+    /*in*/ const size_t num_colors,
+    /*out*/ size_t* colors)
+{
+    uint64_t* physical = malloc(num_pages * sizeof(uint64_t));
+    if (physical == NULL) {
+        return -1;
+    }
+
+    const int status = physical_addresses(pages, num_pages, physical);
+    for (size_t i = 0; i < num_pages && status == 0; i++)
+    {
+        colors[i] = physical[i] / SEARCH_PAGE_SIZE % num_colors;
+    }
+
+    free(physical);
+    return status;
+}
+
+// Reloads `target` and returns its latency. A line in the other half of
+// its page is touched first, so that a TLB miss (a page walk after touching
+// more pages than the TLB holds) isn't mistaken for an eviction.
+static inline uint64_t time_reload(const byte* target)
+{
+    const byte* page = (const byte*)((uint64_t)target & ~(uint64_t)(SEARCH_PAGE_SIZE - 1));
+    *(volatile const byte*)(page + ((target - page + SEARCH_PAGE_SIZE / 2) % SEARCH_PAGE_SIZE));
+    return time_one_line_read_access(target);
+}
+
+int calibrate_eviction_threshold(
+    /*in*/ byte* pool,
+    /*in*/ const size_t pool_size,
+    /*out*/ uint64_t* threshold)
+{
+    // the target is the first line of the last page of the pool, which is 
+    // never touched otherwise. The pool is touched like an eviction test, 
+    // one line per page at the target's offset: the L2 may insert the lines 
+    // of a sequential sweep at low priority, so a sweep doesn't evict it
+    const byte* target = pool + pool_size - SEARCH_PAGE_SIZE;
+    const size_t num_pages = pool_size / SEARCH_PAGE_SIZE - 1;
+
+    uint64_t resident[THRESHOLD_SAMPLES];
+    uint64_t evicted[THRESHOLD_SAMPLES];
+
+    for (size_t i = 0; i < THRESHOLD_SAMPLES; i++)
+    {
+        // an eighth of the pages are too few congruent lines to evict the 
+        // target, whatever their colors
+        *(volatile const byte*)target;
+        for (size_t pass = 0; pass < EVICTION_PASSES; pass++) {
+            for (size_t page = 0; page < num_pages / 8; page++) {
+                *(volatile const byte*)(pool + page * SEARCH_PAGE_SIZE);
+            }
+        }
+        resident[i] = time_reload(target);
+
+        // all of them are twice the lines the cache holds
+        *(volatile const byte*)target;
+        for (size_t pass = 0; pass < EVICTION_PASSES; pass++) {
+            for (size_t page = 0; page < num_pages; page++) {
+                *(volatile const byte*)(pool + page * SEARCH_PAGE_SIZE);
+            }
+        }
+        evicted[i] = time_reload(target);
+    }
+
+    qsort(resident, THRESHOLD_SAMPLES, sizeof(uint64_t), compare_u64);
+    qsort(evicted, THRESHOLD_SAMPLES, sizeof(uint64_t), compare_u64);
+    const uint64_t hit = resident[THRESHOLD_SAMPLES / 2];
+    const uint64_t miss = evicted[THRESHOLD_SAMPLES / 2];
+
+    if (miss <= hit) {
+        fprintf(stderr, "eviction search: can't tell a hit (%lu cycles) from an eviction (%lu cycles)\n",
+                hit, miss);
+        return -1;
+    }
+
+    *threshold = hit + (miss - hit) / 2;
+    return 0;
+}
+
+int evicts(
+    /*in*/ const byte* target,
+    /*in*/ byte* const* candidates,
+    /*in*/ const size_t num_candidates,
+    /*in*/ const uint64_t threshold)
+{
+    size_t evictions = 0;
+
+    for (size_t trial = 0; trial < EVICTION_TEST_TRIALS; trial++)
+    {
+        // flush the target first so it's inserted fresh, rather than 
+        // promoted by the replacement policy for having hit in the last trial
+        clflush(target);
+        mfence();
+        *(volatile const byte*)target;
+
+        // touch the candidates a few times so that the replacement policy 
+        // settles on evicting the target
+        for (size_t pass = 0; pass < EVICTION_PASSES; pass++) {
+            for (size_t i = 0; i < num_candidates; i++) {
+                *(volatile const byte*)candidates[i];
+            }
+        }
+
+        if (time_reload(target) > threshold) {
+            evictions++;
+        }
+    }
+
+    return evictions > EVICTION_TEST_TRIALS / 2;
+}
+
+// Reverses `lines[0..n)` in place
+static void reverse_lines(byte** lines, const size_t n)
+{
+    for (size_t i = 0; i < n / 2; i++)
+    {
+        byte* tmp = lines[i];
+        lines[i] = lines[n - 1 - i];
+        lines[n - 1 - i] = tmp;
+    }
+}
+
+// Rotates `lines[0..n)` left by `k`, so the first `k` lines move to the end
+static void rotate_lines(byte** lines, const size_t n, const size_t k)
+{
+    reverse_lines(lines, k);
+    reverse_lines(lines + k, n - k);
+    reverse_lines(lines, n);
+}
+
+size_t reduce_eviction_set(
+    /*in*/ const byte* target,
+    /*inout*/ byte** candidates,
+    /*in*/ const size_t num_candidates,
+    /*in*/ const size_t ways,
+    /*in*/ const uint64_t threshold)
+{
+    if (!evicts(target, candidates, num_candidates, threshold)) {
+        return 0;
+    }
+
+    size_t size = num_candidates;
+    size_t retries = 0;
+    while (size > 1 && retries < REDUCTION_RETRIES)
+    {
+        // with more than `ways` candidates one of `ways + 1` groups holds no
+        // line the eviction needs, below that try each candidate on its own
+        const size_t groups = size > ways ? ways + 1 : size;
+
+        int dropped = 0;
+        for (size_t group = 0; group < groups && !dropped; group++)
+        {
+            const size_t first = group * size / groups;
+            const size_t last = (group + 1) * size / groups;
+            const size_t group_size = last - first;
+
+            // move the group past the end of the set and test the rest
+            rotate_lines(candidates + first, size - first, group_size);
+            if (evicts(target, candidates, size - group_size, threshold)) {
+                size -= group_size;
+                dropped = 1;
+            } else {
+                rotate_lines(candidates + first, size - first, size - first - group_size);
+            }
+        }
+
+        retries = dropped ? 0 : retries + 1;
+    }
+
+    return size;
+}
+
+// Returns 1 if `page` is one of `lines[0..n)`
+static int contains_line(byte* const* lines, const size_t n, const byte* page)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (lines[i] == page) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int color_pages_by_eviction(
+    /*in*/ byte* const* pages,
+    /*in*/ const size_t num_pages,
+    /*in*/ const size_t num_colors,
+    /*in*/ const size_t ways,
+    /*in*/ const uint64_t threshold,
+    /*out*/ size_t* colors)
+{
+    for (size_t i = 0; i < num_pages; i++)
+    {
+        colors[i] = NO_COLOR;
+    }
+
+    byte** candidates = malloc(num_pages * sizeof(byte*));
+    if (candidates == NULL) {
+        perror("color_pages_by_eviction");
+        return -1;
+    }
+
+    size_t found = 0;
+    for (size_t target = 0; target < num_pages && found < num_colors; target++)
+    {
+        if (colors[target] != NO_COLOR) {
+            continue;
+        }
+
+        size_t num_candidates = 0;
+        for (size_t i = 0; i < num_pages; i++)
+        {
+            if (i != target && colors[i] == NO_COLOR) {
+                candidates[num_candidates++] = pages[i];
+            }
+        }
+
+        // a target whose color has too few uncolored pages left (or that
+        // was lost to noise) can't be reduced, another one will be. Noise 
+        // can leave a few extra lines in the set, which is harmless as long 
+        // as the reduction got close to minimal
+        const size_t size = reduce_eviction_set(pages[target], candidates, num_candidates, ways, threshold);
+        if (size == 0 || size > 2 * ways) {
+            continue;
+        }
+
+        // the minimal set and the target are more lines than the cache
+        // holds, so together they evict any other page of the same color
+        candidates[size] = pages[target];
+        const size_t class_size = size + 1;
+
+        for (size_t i = 0; i < num_pages; i++)
+        {
+            if (colors[i] != NO_COLOR) {
+                continue;
+            }
+
+            if (contains_line(candidates, class_size, pages[i])
+                || evicts(pages[i], candidates, class_size, threshold)) {
+                colors[i] = found;
+            }
+        }
+
+        found++;
+    }
+
+    free(candidates);
+    return found == num_colors ? 0 : -1;
+}
@@ -1,9 +1,120 @@
 #include "eviction_set.h"
+#include "buffer.h"
 #include "cache.h"
+#include "cache_geometry.h"
+#include "eviction_search.h"
+#include "llc_slice.h"
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <sys/mman.h>
+#include <stdlib.h>
+
+// Spreads the lines of an eviction set over 4 KiB pages: a page of a color 
+// holds line l of the 64 consecutive sets of that color, so each color 
+// needs one page per line. The pool has twice the pages 
+// needed on average, since pages are handed out with random colors.
+static eviction_set new_paged_eviction_set(
+    /*in*/ const size_t cache_sets,
+    /*in*/ const size_t cache_lines, 
+    /*in*/ const size_t warmup_lines)
+{
+    const eviction_set failed = { .warmup_section = { .start_addr = NULL } };
+
+    const size_t lines_per_set = cache_lines + warmup_lines;
+    const size_t num_colors = num_page_colors(cache_sets);
+    const size_t sets_per_page = SEARCH_PAGE_SIZE / CACHE_LINE_SIZE;
+    const size_t num_pages = 2 * num_colors * lines_per_set;
+    const size_t pool_size = num_pages * SEARCH_PAGE_SIZE;
+    if (num_pages == 0) {
+        return failed;
+    }
+
+    byte* pool = map_buffer(pool_size, NULL);
+    byte** pages = malloc(num_pages * sizeof(byte*));
+    size_t* colors = malloc(num_pages * sizeof(size_t));
+    byte** lines = malloc(cache_sets * lines_per_set * sizeof(byte*));
+    size_t* filled = calloc(num_colors, sizeof(size_t));
+    if (pool == NULL || pages == NULL || colors == NULL || lines == NULL || filled == NULL) {
+        perror("new_eviction_set");
+        goto fail;
+    }
+
+    for (size_t i = 0; i < num_pages; i++)
+    {
+        pages[i] = pool + i * SEARCH_PAGE_SIZE;
+    }
+
+    // the search only tells which pages share a color, not which color
+    int permuted = 0;
+    if (color_pages_by_pagemap(pages, num_pages, num_colors, colors) != 0) {
+        fprintf(stderr, "note: no hugepages or pagemap access, searching for eviction sets...\n");
+        permuted = 1;
+
+        uint64_t threshold;
+        if (calibrate_eviction_threshold(pool, pool_size, &threshold) != 0
+            || color_pages_by_eviction(pages, num_pages, num_colors, cache_lines, threshold, colors) != 0) {
+            fprintf(stderr, "new_eviction_set: failed to find pages of every color\n");
+            goto fail;
+        }
+    }
+
+    // line l of every set of a color is in the l-th page of that color
+    for (size_t i = 0; i < num_pages; i++)
+    {
+        const size_t color = colors[i];
+        if (color == NO_COLOR || filled[color] == lines_per_set) {
+            continue;
+        }
+
+        const size_t line = filled[color]++;
+        for (size_t offset = 0; offset < sets_per_page && color * sets_per_page + offset < cache_sets; offset++)
+        {
+            lines[line * cache_sets + color * sets_per_page + offset] = pages[i] + offset * CACHE_LINE_SIZE;
+        }
+    }
+
+    for (size_t color = 0; color < num_colors; color++)
+    {
+        if (filled[color] < lines_per_set) {
+            fprintf(stderr, "new_eviction_set: only %lu of %lu pages of color %lu\n",
+                    filled[color], lines_per_set, color);
+            goto fail;
+        }
+    }
+
+    free(pages);
+    free(colors);
+    free(filled);
+
+    return (eviction_set){
+        .warmup_section = (wide_ptr){
+            .start_addr = lines[0],
+            .size = CACHE_LINE_SIZE * cache_sets * warmup_lines
+        },
+        .occupation_section = (wide_ptr){
+            .start_addr = lines[warmup_lines * cache_sets],
+            .size = CACHE_LINE_SIZE * cache_sets * cache_lines
+        },
+        .cache_sets = cache_sets,
+        .cache_lines = cache_lines,
+        .warmup_lines = warmup_lines,
+        .lines = lines,
+        .memory = (wide_ptr){
+            .start_addr = pool,
+            .size = pool_size
+        },
+        .permuted = permuted
+    };
+
+fail:
+    unmap_buffer(pool, pool_size);
+    free(pages);
+    free(colors);
+    free(lines);
+    free(filled);
+    return failed;
+}
 
 eviction_set new_eviction_set(
     /*in*/ const size_t cache_sets,
@@ -14,12 +125,20 @@ eviction_set new_eviction_set(
     // for the eviction set
     const size_t num_bytes_in_cache = CACHE_LINE_SIZE * cache_sets * (cache_lines + warmup_lines);
 
-    // allocate using mmap. This call guarantees that the returned memroy 
-    // will be in set 0, block 0
-    byte* mem = mmap(NULL, num_bytes_in_cache, 
-                     PROT_READ | PROT_WRITE, MAP_POPULATE | MAP_ANONYMOUS | 
-                     MAP_PRIVATE | MAP_HUGETLB,
-                     -1, 0);
+    // allocate using hugepages if we can. This guarantees that the returned 
+    // memory will be in set 0, block 0
+    int hugepages;
+    byte* mem = map_buffer(num_bytes_in_cache, &hugepages);
+    if (mem == NULL) {
+        return (eviction_set){ .warmup_section = { .start_addr = NULL } };
+    }
+
+    // regular pages only keep the set bits within a page, if the sets span 
+    // more than a page the lines have to be placed by color
+    if (!hugepages && cache_sets * CACHE_LINE_SIZE > SEARCH_PAGE_SIZE) {
+        unmap_buffer(mem, num_bytes_in_cache);
+        return new_paged_eviction_set(cache_sets, cache_lines, warmup_lines);
+    }
 
     // calculate the starting address for the warmup section, if 
     // `warmup_size == 0` then this will be the same as 
@@ -42,10 +161,127 @@ eviction_set new_eviction_set(
         },
         .cache_sets = cache_sets,
         .cache_lines = cache_lines,
-        .warmup_lines = warmup_lines
+        .warmup_lines = warmup_lines,
+        .lines = NULL,
+        .memory = (wide_ptr){
+            .start_addr = mem,
+            .size = num_bytes_in_cache
+        }
     };
 }
 
+// The pool of an LLC eviction set holds this many times the lines needed, 
+// so that every (slice, set) gets enough lines despite their random 
+// physical placement
+#define LLC_POOL_FACTOR 3
+
+eviction_set new_llc_eviction_set(
+    /*in*/ const cache_level_geometry llc,
+    /*in*/ const size_t num_slices,
+    /*in*/ const size_t extra_lines)
+{
+    const eviction_set failed = { .warmup_section = { .start_addr = NULL } };
+
+    if (num_slices == 0 || !llc_slice_hash_known(num_slices) || llc.sets % num_slices != 0) {
+        fprintf(stderr, "new_llc_eviction_set: the slice hash of %lu slices isn't known\n", num_slices);
+        return failed;
+    }
+
+    const size_t cache_sets = llc.sets;
+    const size_t sets_per_slice = llc.sets / num_slices;
+    const size_t lines_per_set = llc.ways + extra_lines;
+    const size_t pool_size = LLC_POOL_FACTOR * cache_sets * lines_per_set * CACHE_LINE_SIZE;
+    const size_t num_pages = pool_size / SEARCH_PAGE_SIZE;
+    const size_t lines_per_page = SEARCH_PAGE_SIZE / CACHE_LINE_SIZE;
+    if (num_pages == 0) {
+        return failed;
+    }
+
+    byte* pool = map_buffer(pool_size, NULL);
+    byte** pages = malloc(num_pages * sizeof(byte*));
+    uint64_t* physical = malloc(num_pages * sizeof(uint64_t));
+    byte** lines = malloc(cache_sets * lines_per_set * sizeof(byte*));
+    size_t* filled = calloc(cache_sets, sizeof(size_t));
+    if (pool == NULL || pages == NULL || physical == NULL || lines == NULL || filled == NULL) {
+        perror("new_llc_eviction_set");
+        goto fail;
+    }
+
+    for (size_t i = 0; i < num_pages; i++)
+    {
+        pages[i] = pool + i * SEARCH_PAGE_SIZE;
+    }
+
+    if (physical_addresses(pages, num_pages, physical) != 0) {
+        fprintf(stderr, "new_llc_eviction_set: physical addresses are needed to place lines "
+                "in slices, /proc/self/pagemap can't be read (run as root)\n");
+        goto fail;
+    }
+
+    // hand out every line of the pool to its (slice, set) until each is full
+    for (size_t page = 0; page < num_pages; page++)
+    {
+        for (size_t offset = 0; offset < lines_per_page; offset++)
+        {
+            const uint64_t address = physical[page] + offset * CACHE_LINE_SIZE;
+            const size_t set = llc_slice(address, num_slices) * sets_per_slice
+                + (address / CACHE_LINE_SIZE) % sets_per_slice;
+            if (filled[set] == lines_per_set) {
+                continue;
+            }
+
+            lines[filled[set]++ * cache_sets + set] = pages[page] + offset * CACHE_LINE_SIZE;
+        }
+    }
+
+    for (size_t set = 0; set < cache_sets; set++)
+    {
+        if (filled[set] < lines_per_set) {
+            fprintf(stderr, "new_llc_eviction_set: only %lu of %lu lines of set %lu\n",
+                    filled[set], lines_per_set, set);
+            goto fail;
+        }
+    }
+
+    free(pages);
+    free(physical);
+    free(filled);
+
+    return (eviction_set){
+        .warmup_section = (wide_ptr){
+            .start_addr = lines[0],
+            .size = CACHE_LINE_SIZE * cache_sets * extra_lines
+        },
+        .occupation_section = (wide_ptr){
+            .start_addr = lines[extra_lines * cache_sets],
+            .size = CACHE_LINE_SIZE * cache_sets * llc.ways
+        },
+        .cache_sets = cache_sets,
+        .cache_lines = llc.ways,
+        .warmup_lines = extra_lines,
+        .lines = lines,
+        .memory = (wide_ptr){
+            .start_addr = pool,
+            .size = pool_size
+        }
+    };
+
+fail:
+    unmap_buffer(pool, pool_size);
+    free(pages);
+    free(physical);
+    free(lines);
+    free(filled);
+    return failed;
+}
+
+eviction_set new_eviction_set_for(
+    /*in*/ const cache_level_geometry level,
+    /*in*/ const size_t extra_lines)
+{
+    return new_eviction_set(level.sets, level.ways, extra_lines);
+}
+
 void free_eviction_set(/*inout*/ eviction_set* es)
 {
     // check if we were given a NULL ptr
@@ -55,9 +291,10 @@ void free_eviction_set(/*inout*/ eviction_set* es)
 
     // if we were given a memory address that isn't null, deallocate it 
     // using munmap
-    if (es->warmup_section.start_addr != NULL) {
-        munmap(es->warmup_section.start_addr, es->warmup_section.size + es->occupation_section.size);
+    if (es->memory.start_addr != NULL) {
+        unmap_buffer(es->memory.start_addr, es->memory.size);
     }
+    free(es->lines);
 
     // clear the data in the eviction set data structure
     *es = (eviction_set){
@@ -71,6 +308,11 @@ void free_eviction_set(/*inout*/ eviction_set* es)
         },
         .cache_sets = 0,
         .cache_lines = 0,
-        .warmup_lines = 0
+        .warmup_lines = 0,
+        .lines = NULL,
+        .memory = (wide_ptr){
+            .start_addr = NULL,
+            .size = 0
+        }
     };
 }
@@ -0,0 +1,110 @@
+#include "eviction_set_pool.h"
+#include "eviction_set.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int init_eviction_set_pool(/*out*/ eviction_set_pool* pool)
+{
+    *pool = (eviction_set_pool){ .entries = NULL, .num_entries = 0, .capacity = 0 };
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        fprintf(stderr, "init_eviction_set_pool: failed to initialize the lock\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+eviction_set acquire_eviction_set(
+    /*inout*/ eviction_set_pool* pool,
+    /*in*/ const size_t cache_sets,
+    /*in*/ const size_t cache_lines,
+    /*in*/ const size_t warmup_lines,
+    /*in*/ const size_t llc_slices)
+{
+    const eviction_set failed = { .warmup_section = { .start_addr = NULL } };
+
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < pool->num_entries; i++)
+    {
+        pooled_eviction_set* entry = &pool->entries[i];
+        if (!entry->in_use && entry->llc_slices == llc_slices
+            && entry->es.cache_sets == cache_sets && entry->es.cache_lines == cache_lines
+            && entry->es.warmup_lines == warmup_lines) {
+            entry->in_use = 1;
+            const eviction_set es = entry->es;
+            pthread_mutex_unlock(&pool->lock);
+            return es;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    // searching for an eviction set can take seconds, don't hold up the 
+    // other workers meanwhile
+    eviction_set es = llc_slices == 0
+        ? new_eviction_set(cache_sets, cache_lines, warmup_lines)
+        : new_llc_eviction_set((cache_level_geometry){ .sets = cache_sets, .ways = cache_lines },
+                               llc_slices, warmup_lines);
+    if (es.warmup_section.start_addr == NULL) {
+        return failed;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->num_entries == pool->capacity) {
+        const size_t capacity = pool->capacity == 0 ? 8 : 2 * pool->capacity;
+        pooled_eviction_set* entries = realloc(pool->entries, capacity * sizeof(pooled_eviction_set));
+        if (entries == NULL) {
+            perror("acquire_eviction_set");
+            pthread_mutex_unlock(&pool->lock);
+            free_eviction_set(&es);
+            return failed;
+        }
+        pool->entries = entries;
+        pool->capacity = capacity;
+    }
+    pool->entries[pool->num_entries++] = (pooled_eviction_set){
+        .es = es,
+        .llc_slices = llc_slices,
+        .in_use = 1
+    };
+    pthread_mutex_unlock(&pool->lock);
+
+    return es;
+}
+
+void release_eviction_set(/*inout*/ eviction_set_pool* pool, /*inout*/ eviction_set* es)
+{
+    if (es == NULL || es->memory.start_addr == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < pool->num_entries; i++)
+    {
+        if (pool->entries[i].es.memory.start_addr == es->memory.start_addr) {
+            pool->entries[i].in_use = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    *es = (eviction_set){ .warmup_section = { .start_addr = NULL } };
+}
+
+void free_eviction_set_pool(/*inout*/ eviction_set_pool* pool)
+{
+    for (size_t i = 0; i < pool->num_entries; i++)
+    {
+        if (pool->entries[i].in_use) {
+            fprintf(stderr, "free_eviction_set_pool: an eviction set is still in use\n");
+        }
+        free_eviction_set(&pool->entries[i].es);
+    }
+
+    free(pool->entries);
+    pthread_mutex_destroy(&pool->lock);
+    *pool = (eviction_set_pool){ .entries = NULL, .num_entries = 0, .capacity = 0 };
+}
@@ -0,0 +1,402 @@
+#include "interference.h"
+#include "buffer.h"
+#include "cache.h"
+#include "cpu.h"
+#include "experiment.h"
+#include "occupancy_profile.h"
+#include "utility.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The bytes a streaming aggressor touches between checks of the phase, so
+// it pauses within a few µs
+#define PASS_SIZE (64 * 1024)
+
+#define DEFAULT_STRIDE 4
+
+static const char* const pattern_names[] = {"stream", "stride", "prime"};
+#define NUM_PATTERNS (sizeof(pattern_names) / sizeof(pattern_names[0]))
+
+void init_tsc_barrier(/*out*/ tsc_barrier* barrier, /*in*/ const size_t parties)
+{
+    barrier->parties = parties;
+    atomic_init(&barrier->arrived, 0);
+    atomic_init(&barrier->generation, 0);
+    atomic_init(&barrier->deadline, 0);
+}
+
+uint64_t tsc_barrier_wait(/*inout*/ tsc_barrier* barrier)
+{
+    const size_t generation = atomic_load(&barrier->generation);
+    if (atomic_fetch_add(&barrier->arrived, 1) + 1 == barrier->parties) {
+        // the last one in sets the deadline, then lets the others see it
+        atomic_store(&barrier->arrived, 0);
+        atomic_store(&barrier->deadline, read_timestamp() + TSC_BARRIER_LEAD);
+        atomic_fetch_add(&barrier->generation, 1);
+    } else {
+        while (atomic_load(&barrier->generation) == generation) {
+            __builtin_ia32_pause();
+        }
+    }
+
+    const uint64_t deadline = atomic_load(&barrier->deadline);
+    while (read_timestamp() < deadline) {
+        __builtin_ia32_pause();
+    }
+
+    return deadline;
+}
+
+void default_interference_options(/*out*/ interference_options* options)
+{
+    memset(options, 0, sizeof(*options));
+    options->pattern = INTERFERENCE_STREAM;
+    options->stride = DEFAULT_STRIDE;
+}
+
+int parse_interference_option(
+    /*in*/ const int argc,
+    /*in*/ char** argv,
+    /*inout*/ int* i,
+    /*inout*/ interference_options* options)
+{
+    const char* option = argv[*i];
+    if (*i + 1 >= argc) {
+        return 0;
+    }
+
+    if (strcmp(option, "--aggressors") == 0) {
+        options->num_cpus = parse_cpu_list(argv[++*i], options->cpus, INTERFERENCE_MAX_AGGRESSORS);
+        if (options->num_cpus == 0) {
+            fprintf(stderr, "invalid aggressor cpu list: %s\n", argv[*i]);
+            return -1;
+        }
+    } else if (strcmp(option, "--aggressor") == 0) {
+        const char* name = argv[++*i];
+        size_t p = 0;
+        while (p < NUM_PATTERNS && strcmp(name, pattern_names[p]) != 0) {
+            p++;
+        }
+        if (p == NUM_PATTERNS) {
+            fprintf(stderr, "unknown aggressor pattern: %s\n", name);
+            return -1;
+        }
+        options->pattern = (interference_pattern)p;
+    } else if (strcmp(option, "--aggressor-size") == 0) {
+        if (parse_size(argv[++*i], &options->size) != 0 || options->size < PASS_SIZE) {
+            fprintf(stderr, "--aggressor-size must be at least %d bytes\n", PASS_SIZE);
+            return -1;
+        }
+    } else if (strcmp(option, "--aggressor-stride") == 0) {
+        if (parse_count(argv[++*i], &options->stride) != 0) {
+            fprintf(stderr, "--aggressor-stride must be positive: %s\n", argv[*i]);
+            return -1;
+        }
+    } else if (strcmp(option, "--aggressor-sets") == 0) {
+        int sets[INTERFERENCE_MAX_SETS];
+        options->num_sets = parse_cpu_list(argv[++*i], sets, INTERFERENCE_MAX_SETS);
+        if (options->num_sets == 0) {
+            fprintf(stderr, "invalid aggressor set list: %s\n", argv[*i]);
+            return -1;
+        }
+        for (size_t s = 0; s < options->num_sets; s++) {
+            options->sets[s] = (size_t)sets[s];
+        }
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+int prime_llc_sets_of(
+    /*inout*/ interference_options* options,
+    /*in*/ const cache_level_geometry inner,
+    /*in*/ const cache_level_geometry llc,
+    /*in*/ const size_t llc_slices)
+{
+    options->level = inner;
+    options->llc_slices = 0;
+    if (llc.sets == 0) {
+        return 0;
+    }
+
+    // the set bits the two caches share
+    const size_t slice_sets = llc.sets / (llc_slices == 0 ? 1 : llc_slices);
+    const size_t congruent = slice_sets < inner.sets ? slice_sets : inner.sets;
+
+    size_t sets[INTERFERENCE_MAX_SETS];
+    size_t num_sets = 0;
+    for (size_t s = 0; s < options->num_sets; s++)
+    {
+        if (options->sets[s] >= inner.sets) {
+            fprintf(stderr, "set %lu isn't in the primed cache\n", options->sets[s]);
+            return -1;
+        }
+
+        // sets sharing their low bits share their LLC sets too
+        size_t seen = 0;
+        while (seen < s && options->sets[seen] % congruent != options->sets[s] % congruent) {
+            seen++;
+        }
+        if (seen < s) {
+            continue;
+        }
+
+        for (size_t t = options->sets[s] % congruent; t < llc.sets; t += congruent)
+        {
+            if (num_sets == INTERFERENCE_MAX_SETS) {
+                fprintf(stderr, "the aggressor sets cover more than %d sets of the L3\n",
+                        INTERFERENCE_MAX_SETS);
+                return -1;
+            }
+            sets[num_sets++] = t;
+        }
+    }
+
+    memcpy(options->sets, sets, num_sets * sizeof(size_t));
+    options->num_sets = num_sets;
+    options->level = llc;
+    options->llc_slices = llc_slices;
+    return 0;
+}
+
+const char* interference_pattern_name(/*in*/ const interference_pattern pattern)
+{
+    return (size_t)pattern < NUM_PATTERNS ? pattern_names[pattern] : "unknown";
+}
+
+struct interference_aggressor {
+    interference* group;
+    int cpu;
+    pthread_t thread;
+    byte* buffer;
+    eviction_set es;
+    // where the next pass of a stream starts, and the line within the
+    // stride the current sweep of `INTERFERENCE_STRIDE` is on
+    size_t offset;
+    size_t sweep;
+    // the lines touched since the last resume
+    uint64_t lines;
+};
+
+// Allocates what the aggressor's pattern runs over, on its own core so the
+// memory is local to it
+static int setup_aggressor(struct interference_aggressor* a)
+{
+    const interference_options* options = &a->group->options;
+    if (pin_to_cpu(a->cpu) != 0) {
+        return -1;
+    }
+
+    if (options->pattern == INTERFERENCE_PRIME) {
+        a->es = options->llc_slices == 0
+            ? new_eviction_set_for(options->level, 0)
+            : new_llc_eviction_set(options->level, options->llc_slices, 0);
+        if (a->es.warmup_section.start_addr == NULL) {
+            fprintf(stderr, "aggressor on cpu %d: failed to build an eviction set\n", a->cpu);
+            return -1;
+        }
+        return 0;
+    }
+
+    a->buffer = map_buffer(options->size, NULL);
+    return a->buffer == NULL ? -1 : 0;
+}
+
+// Makes one pass of the aggressor's pattern, returning the lines it touched
+static uint64_t aggressor_pass(struct interference_aggressor* a)
+{
+    const interference_options* options = &a->group->options;
+
+    switch (options->pattern) {
+    case INTERFERENCE_PRIME: {
+        const size_t num_sets = options->num_sets == 0 ? a->es.cache_sets : options->num_sets;
+        for (size_t s = 0; s < num_sets; s++) {
+            prime_set_write_with_warmup(a->es, options->num_sets == 0 ? s : options->sets[s]);
+        }
+        return num_sets * a->es.cache_lines;
+    }
+
+    case INTERFERENCE_STRIDE: {
+        const size_t step = options->stride * CACHE_LINE_SIZE;
+        const size_t max_lines = options->size / step;
+        const size_t lines = max_lines < PASS_SIZE / CACHE_LINE_SIZE ? max_lines : PASS_SIZE / CACHE_LINE_SIZE;
+        if (a->offset + lines * step > options->size) {
+            // start the next sweep one line further, so every line is hit
+            a->sweep = (a->sweep + 1) % options->stride;
+            a->offset = a->sweep * CACHE_LINE_SIZE;
+        }
+        write_lines_stride(a->buffer + a->offset, lines, options->stride);
+        a->offset += lines * step;
+        return lines;
+    }
+
+    default:
+        write_buffer(a->buffer + a->offset, PASS_SIZE);
+        a->offset = (a->offset + PASS_SIZE) % options->size;
+        return PASS_SIZE / CACHE_LINE_SIZE;
+    }
+}
+
+static void* aggressor_main(void* arg)
+{
+    struct interference_aggressor* a = arg;
+    interference* group = a->group;
+
+    if (setup_aggressor(a) != 0) {
+        atomic_store(&group->failed, 1);
+    }
+    atomic_fetch_add(&group->ready, 1);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&group->lock);
+        while (atomic_load(&group->phase) == INTERFERENCE_IDLE) {
+            pthread_cond_wait(&group->wake, &group->lock);
+        }
+        const int phase = atomic_load(&group->phase);
+        pthread_mutex_unlock(&group->lock);
+
+        if (phase == INTERFERENCE_EXIT) {
+            break;
+        }
+
+        atomic_fetch_add(&group->running, 1);
+        tsc_barrier_wait(&group->barrier);
+        a->lines = 0;
+        while (atomic_load_explicit(&group->phase, memory_order_relaxed) == INTERFERENCE_RUN) {
+            a->lines += aggressor_pass(a);
+        }
+
+        atomic_fetch_sub(&group->running, 1);
+    }
+
+    return NULL;
+}
+
+static void set_phase(interference* group, const int phase)
+{
+    pthread_mutex_lock(&group->lock);
+    atomic_store(&group->phase, phase);
+    pthread_cond_broadcast(&group->wake);
+    pthread_mutex_unlock(&group->lock);
+}
+
+// Joins the first `started` aggressors and frees everything
+static void join_aggressors(interference* group, const size_t started)
+{
+    set_phase(group, INTERFERENCE_EXIT);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(group->aggressors[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < group->num_aggressors; i++)
+    {
+        struct interference_aggressor* a = &group->aggressors[i];
+        if (a->buffer != NULL) {
+            unmap_buffer(a->buffer, group->options.size);
+        }
+        if (a->es.warmup_section.start_addr != NULL) {
+            free_eviction_set(&a->es);
+        }
+    }
+
+    pthread_cond_destroy(&group->wake);
+    pthread_mutex_destroy(&group->lock);
+    free(group->aggressors);
+    group->aggressors = NULL;
+    group->num_aggressors = 0;
+}
+
+int start_interference(/*in*/ const interference_options* options, /*out*/ interference* group)
+{
+    memset(group, 0, sizeof(*group));
+    group->options = *options;
+    if (group->options.size == 0) {
+        cache_geometry geometry;
+        detect_cache_geometry(&geometry);
+        group->options.size = 2 * geometry.l3.size;
+    }
+    group->options.size -= group->options.size % PASS_SIZE;
+    if (options->pattern == INTERFERENCE_STRIDE && group->options.size < options->stride * CACHE_LINE_SIZE) {
+        fprintf(stderr, "the aggressor buffer is smaller than its stride\n");
+        return -1;
+    }
+
+    for (size_t s = 0; s < options->num_sets; s++)
+    {
+        if (options->pattern == INTERFERENCE_PRIME && options->sets[s] >= options->level.sets) {
+            fprintf(stderr, "set %lu isn't in the primed cache\n", options->sets[s]);
+            return -1;
+        }
+    }
+
+    group->aggressors = calloc(options->num_cpus, sizeof(struct interference_aggressor));
+    if (group->aggressors == NULL) {
+        perror("start_interference");
+        return -1;
+    }
+    group->num_aggressors = options->num_cpus;
+    init_tsc_barrier(&group->barrier, group->num_aggressors + 1);
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->wake, NULL);
+    atomic_init(&group->phase, INTERFERENCE_IDLE);
+    atomic_init(&group->ready, 0);
+    atomic_init(&group->running, 0);
+    atomic_init(&group->failed, 0);
+
+    size_t started = 0;
+    for (; started < group->num_aggressors; started++)
+    {
+        struct interference_aggressor* a = &group->aggressors[started];
+        *a = (struct interference_aggressor){ .group = group, .cpu = options->cpus[started] };
+        if (pthread_create(&a->thread, NULL, aggressor_main, a) != 0) {
+            fprintf(stderr, "failed to start an aggressor on cpu %d\n", a->cpu);
+            atomic_store(&group->failed, 1);
+            break;
+        }
+    }
+
+    while (atomic_load(&group->ready) < started) {
+        sched_yield();
+    }
+    if (atomic_load(&group->failed)) {
+        join_aggressors(group, started);
+        return -1;
+    }
+
+    return 0;
+}
+
+void resume_interference(/*inout*/ interference* group)
+{
+    set_phase(group, INTERFERENCE_RUN);
+    group->started_at = tsc_barrier_wait(&group->barrier);
+}
+
+uint64_t pause_interference(/*inout*/ interference* group)
+{
+    set_phase(group, INTERFERENCE_IDLE);
+    while (atomic_load(&group->running) > 0) {
+        __builtin_ia32_pause();
+    }
+
+    uint64_t lines = 0;
+    for (size_t i = 0; i < group->num_aggressors; i++) {
+        lines += group->aggressors[i].lines;
+    }
+    return lines;
+}
+
+void stop_interference(/*inout*/ interference* group)
+{
+    if (group->aggressors != NULL) {
+        join_aggressors(group, group->num_aggressors);
+    }
+}
@@ -0,0 +1,555 @@
+#define _GNU_SOURCE
+#include "utility.h"
+#include "address.h"
+#include "buffer.h"
+#include "cache.h"
+#include "cache_geometry.h"
+#include "cpu.h"
+#include "experiment.h"
+#include "latency_model.h"
+#include "noise_monitor.h"
+#include "perf_counters.h"
+#include "sample_ring.h"
+#include "sample_stats.h"
+#include "timer.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define DEFAULT_SAMPLES 100000
+#define MIN_BATCH 1000
+#define DEFAULT_OUTPUT "results"
+#define LEVELS 4
+
+static const char* const level_files[LEVELS] = {"l1", "l2", "l3", "ram"};
+static const char* const level_names[LEVELS] = {"L1", "L2", "L3", "RAM"};
+
+// Times a read of `addr`. If `counts` isn't NULL the hardware counters are 
+// enabled around the read and what they counted is stored in it.
+static inline uint64_t probe(const probe_timer* timer, const perf_counters* counters,
+                             const byte* addr, perf_counts* counts)
+{
+    if (counts == NULL) {
+        return timed_read(timer, addr);
+    }
+
+    reset_perf_counters(counters);
+    enable_perf_counters(counters);
+    const uint64_t time = timed_read(timer, addr);
+    disable_perf_counters(counters);
+    read_perf_counters(counters, counts);
+
+    return time;
+}
+
+// What the samples of every level are taken with
+typedef struct {
+    const probe_timer* timer;
+    const perf_counters* counters;
+    byte* target;
+    byte* eviction;
+    size_t l1_size;
+    size_t l2_size;
+    sample_ring* ring;
+} level_sampler;
+
+// Takes samples `first` to `last` (exclusive) of `level` into the ring, and
+// what the hardware counters counted for each into `counts` unless it's NULL
+static void sample_level(const level_sampler* sampler, const size_t level,
+                         const size_t first, const size_t last, perf_counts* counts)
+{
+    const probe_timer* timer = sampler->timer;
+    const perf_counters* counters = sampler->counters;
+    byte* target = sampler->target;
+    byte* eviction = sampler->eviction;
+    sample_ring* ring = sampler->ring;
+
+    switch (level) {
+    case 0:
+        // L1 latencies
+        for (size_t i = first; i < last; i++) {
+            for (size_t j = 0; j < 10; j++) {
+                write_buffer(target, 1);
+            }
+            *target = 0;
+
+            push_sample(ring, probe(timer, counters, target, counts == NULL ? NULL : &counts[i]));
+        }
+        break;
+
+    case 1:
+        // L2 Latencies
+        for (size_t i = first; i < last; i++) {
+            // bring target into L1
+            for (size_t j = 0; j < 10; j++) {
+                write_buffer(target, 1);
+            }
+
+            // evict target into L2 
+            for (size_t j = 0; j < 10; j++) {
+                write_buffer(eviction, sampler->l1_size);
+            }
+
+            push_sample(ring, probe(timer, counters, target, counts == NULL ? NULL : &counts[i]));
+        }
+        break;
+
+    case 2:
+        // L3 Latencies 
+        for (size_t i = first; i < last; i++) {
+            // bring target into L1
+            for (size_t j = 0; j < 10; j++) {
+                write_buffer(target, 1);
+            }
+
+            // evict target into L3
+            for (size_t j = 0; j < 10; j++) {
+                write_buffer(eviction, sampler->l2_size);
+            }
+
+            push_sample(ring, probe(timer, counters, target, counts == NULL ? NULL : &counts[i]));
+        }
+        break;
+
+    default:
+        // RAM Latencies 
+        for (size_t i = first; i < last; i++) {
+            // flush target to RAM
+            flush_buffer(target, sampler->l2_size);
+
+            push_sample(ring, probe(timer, counters, target, counts == NULL ? NULL : &counts[i]));
+        }
+        break;
+    }
+}
+
+// Finds the quartiles of 16 bit samples through their histogram, so the 
+// samples (a read-only mapping of a sample file) aren't sorted
+static int sample_quartiles(const uint16_t* samples, const size_t num_samples, uint64_t quartiles[3])
+{
+    static const double percentiles[3] = {0.25, 0.5, 0.75};
+
+    uint64_t* histogram = calloc(SAMPLE_HISTOGRAM_BINS, sizeof(uint64_t));
+    if (histogram == NULL) {
+        perror("sample_quartiles");
+        return -1;
+    }
+
+    const int status = sample_histogram(samples, num_samples, histogram);
+    if (status == 0) {
+        histogram_percentiles(histogram, percentiles, 3, quartiles);
+    }
+
+    free(histogram);
+    return status;
+}
+
+// Prints how the samples of each level are classified by the model, the 
+// samples of a level the model puts in another were disturbed (or the 
+// buffers didn't evict the target as intended)
+static void print_classification(const latency_model* model, const uint16_t* const* samples,
+                                 const size_t num_samples)
+{
+    uint16_t edges[LEVELS - 1];
+    for (size_t level = 0; level < LEVELS - 1; level++) {
+        edges[level] = model->upper_bound[level] > UINT16_MAX ? UINT16_MAX : (uint16_t)model->upper_bound[level];
+        if (level > 0 && edges[level] <= edges[level - 1]) {
+            return;
+        }
+    }
+
+    for (size_t level = 0; level < LEVELS; level++)
+    {
+        uint64_t counts[LEVELS];
+        sample_band_histogram(samples[level], num_samples, edges, LEVELS - 1, counts);
+
+        uint16_t min, max;
+        sample_min_max(samples[level], num_samples, &min, &max);
+
+        printf("%-3s: %5.1f%% classified as %-3s (min %u, max %u cycles)\n", level_names[level],
+               100.0 * (double)counts[level] / (double)num_samples, level_names[level], min, max);
+    }
+}
+
+// Appends a row per level to `filename`, with the build variant, the timer 
+// and the median and interquartile range of the level's samples, so runs 
+// of the variants can be compared
+static void write_codegen_record(const char* filename, const experiment_context* context,
+                                 const probe_timer timer, const uint16_t* const* samples,
+                                 const size_t num_samples)
+{
+    FILE* out = fopen(filename, "a");
+    if (out == NULL) {
+        perror(filename);
+        return;
+    }
+
+    if (ftell(out) == 0) {
+        fprintf(out, "Variant,Flags,Timer,TimerOverhead,TimerResolution,TimerJitter,"
+                "Level,Samples,Median,IQR\n");
+    }
+
+    for (size_t level = 0; level < LEVELS; level++)
+    {
+        uint64_t quartiles[3];
+        if (sample_quartiles(samples[level], num_samples, quartiles) != 0) {
+            break;
+        }
+
+        fprintf(out, "%s,%s,%s,%lu,%lu,%lu,%s,%lu,%lu,%lu\n",
+                context == NULL ? "O1" : context->variant,
+                context == NULL ? "-O1" : context->variant_flags,
+                timer_mode_name(timer.mode), timer.overhead, timer.resolution, timer.jitter,
+                level_names[level], num_samples, quartiles[1], quartiles[2] - quartiles[0]);
+    }
+
+    fclose(out);
+}
+
+// Usage: latency [--timer rdtscp|cpuid|rdpmc] [--counters] [--summary]
+//                [--samples N] [--noise] [--batch B] [--cpu <cpu>] [--output <dir>]
+//
+// `N` samples (100000 by default) are taken per level on `--cpu` (the CPU 
+// the job started on by default). They are streamed through a sample ring 
+// (see sample_ring.h) to <dir>/timing_<level>.bin by a writer thread on 
+// another physical core (it fails if there is none), so `N` can be 10^8 without the samples having to 
+// fit in memory; the files are merged into <dir>/timing.csv at the end. 
+// The output directory is results by default.
+//
+// The timer's overhead is calibrated at startup and subtracted from every 
+// sample, so the latencies are of the load alone. `--counters` also counts 
+// the cache misses of every sample with the hardware counters, and writes 
+// them to <dir>/timing_counters.csv (one row per row of timing.csv).
+//
+// The median latency of each level, and the bounds used to classify samples 
+// by level (see latency_model.h), are written to <dir>/latency_model.csv. 
+// The timer's overhead and jitter, and the median and interquartile range 
+// of each level, are appended to <dir>/codegen.csv with the build variant 
+// of the runner, to compare how the variants' codegen changes them. 
+// `--summary` skips writing the raw samples to <dir>/timing.csv.
+//
+// `--noise` takes the samples in batches of `B` under a noise monitor (see 
+// noise_monitor.h): a batch during which the CPU took extra interrupts, 
+// changed frequency, was descheduled, or its SMT sibling was busy is 
+// rejected and taken again, up to NOISE_MAX_RETRIES times. Without 
+// `--batch` the first batch of a level is MIN_BATCH samples, and the 
+// others as many as span a scheduler tick at its pace, the shortest batch 
+// the sibling's busy time can be told for (see `noise_batch_size`). 
+// Every attempt is logged to <dir>/timing_noise.csv, and the rejected ones 
+// are dropped from the sample files before anything is computed from them.
+int latency_experiment(int argc, char** argv, const experiment_context* context)
+{ 
+    timer_mode timer_mode = TIMER_RDTSCP;
+    int record_counters = 0;
+    int write_raw = 1;
+    int monitor_noise = 0;
+    size_t num_samples = DEFAULT_SAMPLES;
+    size_t batch_size = 0;
+    int cpu = -1;
+    const char* output = DEFAULT_OUTPUT;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--timer") == 0 && i + 1 < argc) {
+            if (parse_timer_mode(argv[++i], &timer_mode) != 0) {
+                fprintf(stderr, "unknown timer: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            record_counters = 1;
+        } else if (strcmp(argv[i], "--summary") == 0) {
+            write_raw = 0;
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            if (parse_count(argv[++i], &num_samples) != 0) {
+                fprintf(stderr, "--samples must be positive: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--noise") == 0) {
+            monitor_noise = 1;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            if (parse_count(argv[++i], &batch_size) != 0) {
+                fprintf(stderr, "--batch must be positive: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            if (parse_cpu_list(argv[++i], &cpu, 1) == 0) {
+                fprintf(stderr, "invalid cpu: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--timer rdtscp|cpuid|rdpmc] [--counters] [--summary] [--samples N] "
+                    "[--noise] [--batch B] [--cpu <cpu>] [--output <dir>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!monitor_noise) {
+        batch_size = num_samples;
+    }
+    const size_t min_batch = batch_size != 0 ? batch_size : MIN_BATCH;
+
+    // stay on this cpu, and drain the samples from another physical core so 
+    // the writer doesn't share our L1 and L2. The writer is started once 
+    // we're pinned, so it must be pinned too or it would share our cpu.
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+    const int writer_cpu = other_physical_core(cpu);
+    if (writer_cpu < 0) {
+        fprintf(stderr, "no other physical core than cpu %d to run the sample writer on\n", cpu);
+        return 1;
+    }
+    if (pin_to_cpu(cpu) != 0) {
+        return 1;
+    }
+
+    char sample_files[LEVELS][EXPERIMENT_PATH_SIZE];
+    for (size_t level = 0; level < LEVELS; level++) {
+        snprintf(sample_files[level], EXPERIMENT_PATH_SIZE, "%s/timing_%s.bin", output, level_files[level]);
+    }
+    char filename[EXPERIMENT_PATH_SIZE];
+
+    probe_timer timer;
+    init_timer(timer_mode, &timer);
+    print_timer(stdout, timer);
+
+    // everything below is released at done
+    int status = 1;
+    byte* target = NULL;
+    byte* eviction = NULL;
+    size_t buf_size = 0;
+    sample_ring* ring = NULL;
+    FILE* noise_log = NULL;
+    size_t* run_lengths = NULL;
+    uint8_t* keep = NULL;
+    const uint16_t* samples[LEVELS] = {NULL};
+    size_t sample_counts[LEVELS] = {0};
+
+    // Counter buffers, one per level, only allocated if perf works here
+    perf_counters counters = { .group_fd = -1 };
+    perf_counts* counts[LEVELS] = {NULL};
+    if (record_counters) {
+        if (open_perf_counters(&counters) != 0) {
+            fprintf(stderr, "warning: hardware counters are unavailable, not recording counters\n");
+            record_counters = 0;
+        } else {
+            for (size_t level = 0; level < LEVELS; level++) {
+                counts[level] = calloc(num_samples, sizeof(perf_counts));
+                if (counts[level] == NULL) {
+                    perror("latency");
+                    goto done;
+                }
+            }
+        }
+    }
+
+    // size the buffers from the caches of the machine we're running on
+    cache_geometry geometry;
+    detect_cache_geometry(&geometry);
+    const size_t l1_size = geometry.l1d.size;
+    const size_t l2_size = geometry.l2.size;
+    buf_size = l2_size * 2;
+
+    target = map_buffer(buf_size, NULL);
+    eviction = map_buffer(buf_size, NULL);
+    if (target == NULL || eviction == NULL) {
+        goto done;
+    }
+
+    // the ring's lines skip the target's set, so storing a sample never 
+    // evicts the target
+    ring = new_sample_ring(SAMPLE_RING_DEFAULT_CAPACITY, target, 1, geometry);
+    if (ring == NULL) {
+        goto done;
+    }
+
+    const level_sampler sampler = {
+        .timer = &timer,
+        .counters = &counters,
+        .target = target,
+        .eviction = eviction,
+        .l1_size = l1_size,
+        .l2_size = l2_size,
+        .ring = ring
+    };
+
+    // the baseline the batches are checked against, and every attempt at 
+    // every batch of a level (a batch is retried at most NOISE_MAX_RETRIES 
+    // times) so the rejected ones can be dropped from the sample file
+    noise_monitor monitor;
+    if (monitor_noise) {
+        if (init_noise_monitor(cpu, &monitor) != 0) {
+            goto done;
+        }
+        print_noise_monitor(stdout, &monitor);
+
+        // no batch but the last is shorter than min_batch
+        const size_t max_runs = (num_samples + min_batch - 1) / min_batch * (NOISE_MAX_RETRIES + 1);
+        run_lengths = malloc(max_runs * sizeof(size_t));
+        keep = malloc(max_runs * sizeof(uint8_t));
+        if (run_lengths == NULL || keep == NULL) {
+            perror("latency");
+            goto done;
+        }
+
+        snprintf(filename, sizeof(filename), "%s/timing_noise.csv", output);
+        noise_log = fopen(filename, "w");
+        if (noise_log == NULL) {
+            perror(filename);
+            goto done;
+        }
+        write_noise_report_header(noise_log);
+    }
+
+    for (size_t level = 0; level < LEVELS; level++)
+    {
+        if (start_sample_writer(ring, sample_files[level], writer_cpu) != 0) {
+            goto done;
+        }
+        fence();
+
+        size_t num_runs = 0;
+        size_t rejected = 0;
+        size_t level_batch = min_batch;
+        for (size_t first = 0, batch = 0; first < num_samples; batch++)
+        {
+            const size_t last = first + level_batch < num_samples ? first + level_batch : num_samples;
+
+            // take a disturbed batch again, until it's clean or out of retries
+            noise_report report;
+            for (size_t attempt = 0; ; attempt++)
+            {
+                noise_snapshot begin;
+                if (monitor_noise) {
+                    begin_noise_batch(&monitor, &begin);
+                }
+
+                sample_level(&sampler, level, first, last, counts[level]);
+
+                if (!monitor_noise) {
+                    break;
+                }
+
+                const int kept = end_noise_batch(&monitor, &begin, &report) == 0
+                              || attempt == NOISE_MAX_RETRIES;
+                write_noise_report(noise_log, level_names[level], batch, attempt, kept, &report);
+                run_lengths[num_runs] = last - first;
+                keep[num_runs++] = (uint8_t)kept;
+                if (kept) {
+                    break;
+                }
+                rejected++;
+            }
+
+            // the pace of the level's first batch sizes the others
+            if (monitor_noise && batch_size == 0 && batch == 0) {
+                level_batch = noise_batch_size(&monitor, last - first, report.cycles);
+                level_batch = level_batch > min_batch ? level_batch : min_batch;
+            }
+            first = last;
+        }
+        finish_sample_writer(ring);
+
+        // drop the rejected batches from the sample file
+        if (monitor_noise) {
+            size_t kept;
+            if (compact_sample_file(sample_files[level], run_lengths, keep, num_runs, &kept) != 0) {
+                goto done;
+            }
+            printf("%s: %lu of %lu batches rejected, %lu samples kept\n",
+                   level_names[level], rejected, num_runs, kept);
+        }
+    }
+
+    // Read the samples back, they're only paged in as they're used
+    size_t written = num_samples;
+    for (size_t level = 0; level < LEVELS; level++) {
+        samples[level] = map_sample_file(sample_files[level], &sample_counts[level]);
+        if (sample_counts[level] < written) {
+            written = sample_counts[level];
+        }
+    }
+    if (written < num_samples) {
+        fprintf(stderr, "warning: only %lu of %lu samples were written\n", written, num_samples);
+    }
+    if (written == 0) {
+        goto done;
+    }
+
+    // Print results 
+    if (write_raw) {
+        snprintf(filename, sizeof(filename), "%s/timing.csv", output);
+        FILE *data_fp = fopen(filename, "w");
+        if (data_fp == NULL) {
+            perror(filename);
+        } else {
+            fprintf(data_fp, "L1,L2,L3,RAM\n");
+            for (size_t i = 0; i < written; i++) {
+                fprintf(data_fp, "%u,%u,%u,%u\n", 
+                        samples[0][i], samples[1][i], samples[2][i], samples[3][i]);
+            }
+            fclose(data_fp);
+        }
+    }
+
+    // Fit the per level model
+    latency_model model;
+    if (fit_latency_model(samples, written, &model) != 0) {
+        fprintf(stderr, "warning: the medians don't increase from level to level\n");
+    }
+    print_latency_model(stdout, model);
+    print_classification(&model, samples, written);
+    snprintf(filename, sizeof(filename), "%s/latency_model.csv", output);
+    write_latency_model(filename, model);
+
+    // how this build variant times, see write_codegen_record
+    snprintf(filename, sizeof(filename), "%s/codegen.csv", output);
+    write_codegen_record(filename, context, timer, samples, written);
+
+    if (record_counters) {
+
+        snprintf(filename, sizeof(filename), "%s/timing_counters.csv", output);
+        FILE *counters_fp = fopen(filename, "w");
+        if (counters_fp == NULL) {
+            perror(filename);
+        } else {
+            fprintf(counters_fp, "Level,Sample");
+            write_perf_counts_header(counters_fp);
+            fprintf(counters_fp, "\n");
+            for (size_t level = 0; level < LEVELS; level++) {
+                for (size_t i = 0; i < num_samples; i++) {
+                    fprintf(counters_fp, "%s,%lu", level_names[level], i);
+                    write_perf_counts(counters_fp, counts[level][i]);
+                    fprintf(counters_fp, "\n");
+                }
+            }
+            fclose(counters_fp);
+        }
+    }
+    status = 0;
+
+done:
+    for (size_t level = 0; level < LEVELS; level++) {
+        unmap_sample_file(samples[level], sample_counts[level]);
+        free(counts[level]);
+    }
+    if (record_counters) {
+        close_perf_counters(&counters);
+    }
+    if (noise_log != NULL) {
+        fclose(noise_log);
+    }
+    free(run_lengths);
+    free(keep);
+    free_sample_ring(ring);
+    unmap_buffer(eviction, buf_size);
+    unmap_buffer(target, buf_size);
+    free_timer(&timer);
+    return status;
+}
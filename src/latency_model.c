@@ -0,0 +1,269 @@
+#include "latency_model.h"
+#include "cache.h"
+#include "cache_geometry.h"
+#include "sample_stats.h"
+#include "timer.h"
+#include "utility.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static const char* const level_names[NUM_LEVELS] = {"L1", "L2", "L3", "RAM"};
+
+// Calibration samples are kept at the width of a sample ring
+static inline uint16_t saturate_sample(const uint64_t cycles)
+{
+    return cycles > UINT16_MAX ? UINT16_MAX : (uint16_t)cycles;
+}
+
+const char* latency_level_name(/*in*/ const latency_level level)
+{
+    return level < NUM_LEVELS ? level_names[level] : "Unknown";
+}
+
+// Returns the median of 16 bit samples by counting them, a single pass
+// where sorting would need a writable copy of up to 10^8 samples
+static uint64_t histogram_median(uint64_t* histogram, const uint16_t* samples, const size_t num_samples)
+{
+    static const double half = 0.5;
+
+    memset(histogram, 0, SAMPLE_HISTOGRAM_BINS * sizeof(uint64_t));
+    if (sample_histogram(samples, num_samples, histogram) != 0) {
+        return UINT16_MAX;
+    }
+
+    uint64_t median;
+    histogram_percentiles(histogram, &half, 1, &median);
+    return median;
+}
+
+int fit_latency_model(
+    /*in*/ const uint16_t* const samples[NUM_LEVELS],
+    /*in*/ const size_t num_samples,
+    /*out*/ latency_model* model)
+{
+    uint64_t* histogram = malloc(SAMPLE_HISTOGRAM_BINS * sizeof(uint64_t));
+    if (histogram == NULL) {
+        perror("fit_latency_model");
+        return -1;
+    }
+
+    for (size_t level = 0; level < NUM_LEVELS; level++)
+    {
+        model->median[level] = histogram_median(histogram, samples[level], num_samples);
+    }
+
+    free(histogram);
+
+    int status = 0;
+    for (size_t level = 0; level < LEVEL_RAM; level++)
+    {
+        if (model->median[level + 1] <= model->median[level]) {
+            status = -1;
+        }
+        model->upper_bound[level] = (model->median[level] + model->median[level + 1]) / 2;
+    }
+    model->upper_bound[LEVEL_RAM] = UINT64_MAX;
+
+    return status;
+}
+
+int calibrate_latency_model(
+    /*in*/ const probe_timer* timer,
+    /*in*/ const cache_geometry geometry,
+    /*out*/ latency_model* model)
+{
+    const size_t l1_size = geometry.l1d.size;
+    const size_t l2_size = geometry.l2.size;
+    const size_t buf_size = l2_size * 2;
+
+    // no hugepages needed, the eviction buffer is large enough to evict the
+    // target from the smaller level whatever its physical layout
+    byte* eviction = mmap(NULL, buf_size + CACHE_LINE_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_POPULATE | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    uint16_t* buffer = malloc(NUM_LEVELS * LATENCY_CALIBRATION_SAMPLES * sizeof(uint16_t));
+    if (eviction == MAP_FAILED || buffer == NULL) {
+        perror("calibrate_latency_model");
+        if (eviction != MAP_FAILED) {
+            munmap(eviction, buf_size + CACHE_LINE_SIZE);
+        }
+        free(buffer);
+        return -1;
+    }
+
+    // the target is the line right after the eviction buffer
+    byte* target = eviction + buf_size;
+    uint16_t* const samples[NUM_LEVELS] = {
+        buffer,
+        buffer + LATENCY_CALIBRATION_SAMPLES,
+        buffer + 2 * LATENCY_CALIBRATION_SAMPLES,
+        buffer + 3 * LATENCY_CALIBRATION_SAMPLES,
+    };
+
+    for (size_t i = 0; i < LATENCY_CALIBRATION_SAMPLES; i++)
+    {
+        // L1
+        write_buffer(target, 1);
+        fence();
+        samples[LEVEL_L1][i] = saturate_sample(timed_read(timer, target));
+
+        // L2
+        write_buffer(target, 1);
+        write_buffer(eviction, l1_size * 2);
+        fence();
+        samples[LEVEL_L2][i] = saturate_sample(timed_read(timer, target));
+
+        // L3
+        write_buffer(target, 1);
+        write_buffer(eviction, buf_size);
+        fence();
+        samples[LEVEL_L3][i] = saturate_sample(timed_read(timer, target));
+
+        // RAM
+        flush_buffer(target, 1);
+        samples[LEVEL_RAM][i] = saturate_sample(timed_read(timer, target));
+    }
+
+    const uint16_t* const fitted[NUM_LEVELS] = {
+        samples[LEVEL_L1], samples[LEVEL_L2], samples[LEVEL_L3], samples[LEVEL_RAM],
+    };
+    const int status = fit_latency_model(fitted, LATENCY_CALIBRATION_SAMPLES, model);
+
+    free(buffer);
+    munmap(eviction, buf_size + CACHE_LINE_SIZE);
+
+    return status;
+}
+
+int calibrate_llc_latency_model(
+    /*in*/ const probe_timer* timer,
+    /*in*/ const cache_geometry geometry,
+    /*in*/ const eviction_set llc_es,
+    /*in*/ const size_t num_slices,
+    /*out*/ llc_latency_model* model)
+{
+    const size_t buf_size = geometry.l2.size * 2;
+    const size_t sets_per_slice = llc_es.cache_sets / num_slices;
+    const size_t num_samples = LLC_CALIBRATION_LINES * LLC_CALIBRATION_ROUNDS;
+
+    if (num_slices == 0 || num_slices > LLC_MAX_SLICES || sets_per_slice == 0) {
+        fprintf(stderr, "calibrate_llc_latency_model: unsupported number of slices %lu\n", num_slices);
+        return -1;
+    }
+
+    byte* eviction = mmap(NULL, buf_size, PROT_READ | PROT_WRITE,
+                          MAP_POPULATE | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    uint16_t* buffer = malloc(2 * num_samples * sizeof(uint16_t));
+    uint64_t* histogram = malloc(SAMPLE_HISTOGRAM_BINS * sizeof(uint64_t));
+    if (eviction == MAP_FAILED || buffer == NULL || histogram == NULL) {
+        perror("calibrate_llc_latency_model");
+        if (eviction != MAP_FAILED) {
+            munmap(eviction, buf_size);
+        }
+        free(buffer);
+        free(histogram);
+        return -1;
+    }
+
+    uint16_t* l3 = buffer;
+    uint16_t* ram = buffer + num_samples;
+    byte* lines[LLC_CALIBRATION_LINES];
+
+    model->num_slices = num_slices;
+    model->sets_per_slice = sets_per_slice;
+
+    int status = 0;
+    for (size_t slice = 0; slice < num_slices; slice++)
+    {
+        // spread the lines over the sets of the slice, so the prefetchers 
+        // don't follow them and they don't compete for the same set
+        for (size_t i = 0; i < LLC_CALIBRATION_LINES; i++)
+        {
+            const size_t set = slice * sets_per_slice + i * sets_per_slice / LLC_CALIBRATION_LINES;
+            lines[i] = eviction_set_line(llc_es, set, 0);
+        }
+
+        for (size_t round = 0; round < LLC_CALIBRATION_ROUNDS; round++)
+        {
+            // L3
+            for (size_t i = 0; i < LLC_CALIBRATION_LINES; i++) {
+                write_buffer(lines[i], 1);
+            }
+            write_buffer(eviction, buf_size);
+            fence();
+            for (size_t i = 0; i < LLC_CALIBRATION_LINES; i++) {
+                l3[round * LLC_CALIBRATION_LINES + i] = saturate_sample(timed_read(timer, lines[i]));
+            }
+
+            // RAM
+            for (size_t i = 0; i < LLC_CALIBRATION_LINES; i++) {
+                flush_buffer(lines[i], 1);
+            }
+            fence();
+            for (size_t i = 0; i < LLC_CALIBRATION_LINES; i++) {
+                ram[round * LLC_CALIBRATION_LINES + i] = saturate_sample(timed_read(timer, lines[i]));
+            }
+        }
+
+        model->l3_median[slice] = histogram_median(histogram, l3, num_samples);
+        model->ram_median[slice] = histogram_median(histogram, ram, num_samples);
+        model->l3_upper_bound[slice] = (model->l3_median[slice] + model->ram_median[slice]) / 2;
+        if (model->ram_median[slice] <= model->l3_median[slice]) {
+            status = -1;
+        }
+    }
+
+    free(histogram);
+    free(buffer);
+    munmap(eviction, buf_size);
+
+    return status;
+}
+
+void print_latency_model(/*in*/ FILE* out, /*in*/ const latency_model model)
+{
+    for (size_t level = 0; level < NUM_LEVELS; level++)
+    {
+        if (level == LEVEL_RAM) {
+            fprintf(out, "%-3s: median %4lu cycles\n", level_names[level], model.median[level]);
+        } else {
+            fprintf(out, "%-3s: median %4lu cycles, up to %lu cycles\n", level_names[level],
+                    model.median[level], model.upper_bound[level]);
+        }
+    }
+}
+
+void print_llc_latency_model(/*in*/ FILE* out, /*in*/ const llc_latency_model* model)
+{
+    for (size_t slice = 0; slice < model->num_slices; slice++)
+    {
+        fprintf(out, "slice %2lu: L3 median %4lu cycles, up to %lu cycles, RAM median %4lu cycles\n",
+                slice, model->l3_median[slice], model->l3_upper_bound[slice], model->ram_median[slice]);
+    }
+}
+
+int write_latency_model(/*in*/ const char* filename, /*in*/ const latency_model model)
+{
+    FILE* out = fopen(filename, "w");
+    if (out == NULL) {
+        perror(filename);
+        return -1;
+    }
+
+    fprintf(out, "Level,Median,UpperBound\n");
+    for (size_t level = 0; level < NUM_LEVELS; level++)
+    {
+        if (level == LEVEL_RAM) {
+            fprintf(out, "%s,%lu,\n", level_names[level], model.median[level]);
+        } else {
+            fprintf(out, "%s,%lu,%lu\n", level_names[level], model.median[level], model.upper_bound[level]);
+        }
+    }
+
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#define _GNU_SOURCE
+#include "llc_slice.h"
+#include "cache_geometry.h"
+#include "cpu.h"
+
+#include <sched.h>
+#include <stddef.h>
+
+// The most CPUs that can share an L3
+#define MAX_SHARED_CPUS 1024
+
+size_t detect_llc_slices(/*in*/ const int cpu)
+{
+    int cpus[MAX_SHARED_CPUS];
+    char shared[4096] = {0};
+    if (read_cache_attribute(cpu < 0 ? sched_getcpu() : cpu, 3, "shared_cpu_list",
+                             shared, sizeof(shared)) != 0) {
+        return 0;
+    }
+
+    const size_t num_cpus = parse_cpu_list(shared, cpus, MAX_SHARED_CPUS);
+    return unique_physical_cores(cpus, num_cpus);
+}
+
+int llc_slice_hash_known(/*in*/ const size_t num_slices)
+{
+    return num_slices == 1 || num_slices == 2 || num_slices == 4 || num_slices == 8;
+}
@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+#include "noise_monitor.h"
+#include "cpu.h"
+#include "utility.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The dependent adds of a frequency probe, and the runs it takes the
+// fastest of
+#define FREQUENCY_PROBE_ADDS 20000
+#define FREQUENCY_PROBE_RUNS 5
+
+// How long the baseline interrupt rate and frequency are measured for
+#define BASELINE_NANOSECONDS 100000000L
+
+// Finds the column of `cpu` in the header of /proc/interrupts ("CPU0
+// CPU1 ..."), only online CPUs have one
+static int find_irq_column(const int cpu)
+{
+    FILE* f = fopen("/proc/interrupts", "r");
+    if (f == NULL) {
+        perror("/proc/interrupts");
+        return -1;
+    }
+
+    char* line = NULL;
+    size_t size = 0;
+    int column = -1;
+    if (getline(&line, &size, f) > 0) {
+        char name[32];
+        snprintf(name, sizeof(name), "CPU%d", cpu);
+
+        char* saved;
+        int index = 0;
+        for (char* token = strtok_r(line, " \t\n", &saved); token != NULL;
+             token = strtok_r(NULL, " \t\n", &saved), index++)
+        {
+            if (strcmp(token, name) == 0) {
+                column = index;
+                break;
+            }
+        }
+    }
+
+    free(line);
+    fclose(f);
+    return column;
+}
+
+// Sums the interrupts every source of /proc/interrupts delivered to the CPU
+// of `column`. Sources with fewer columns (e.g. ERR) are skipped.
+static uint64_t read_interrupts(const int column)
+{
+    FILE* f = fopen("/proc/interrupts", "r");
+    if (f == NULL) {
+        return 0;
+    }
+
+    char* line = NULL;
+    size_t size = 0;
+    uint64_t total = 0;
+    for (int header = 1; getline(&line, &size, f) > 0; header = 0)
+    {
+        const char* p = strchr(line, ':');
+        if (header || p == NULL) {
+            continue;
+        }
+        p++;
+
+        for (int index = 0; index <= column; index++)
+        {
+            char* end;
+            const unsigned long long count = strtoull(p, &end, 10);
+            if (end == p) {
+                break;
+            }
+            if (index == column) {
+                total += count;
+            }
+            p = end;
+        }
+    }
+
+    free(line);
+    fclose(f);
+    return total;
+}
+
+// Reads the busy and total time of a CPU from /proc/stat, in clock ticks
+static int read_cpu_time(const int cpu, uint64_t* busy, uint64_t* total)
+{
+    FILE* f = fopen("/proc/stat", "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "cpu%d ", cpu);
+
+    int status = -1;
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (strncmp(line, name, strlen(name)) != 0) {
+            continue;
+        }
+
+        unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+        if (sscanf(line + strlen(name), "%llu %llu %llu %llu %llu %llu %llu %llu",
+                   &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) == 8) {
+            *total = user + nice + system + idle + iowait + irq + softirq + steal;
+            *busy = *total - idle - iowait;
+            status = 0;
+        }
+        break;
+    }
+
+    fclose(f);
+    return status;
+}
+
+// Reads the first word of a sysfs file, or "unknown"
+static void read_state(const char* path, char* state)
+{
+    strcpy(state, "unknown");
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+
+    char value[NOISE_STATE_SIZE];
+    if (fscanf(f, "%31s", value) == 1) {
+        strcpy(state, value);
+    }
+    fclose(f);
+}
+
+static void read_governor(const int cpu, char* governor)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+    read_state(path, governor);
+}
+
+// "on", "off" or "unknown", from intel_pstate or the generic cpufreq boost
+static void read_turbo(char* turbo)
+{
+    char value[NOISE_STATE_SIZE];
+    read_state("/sys/devices/system/cpu/intel_pstate/no_turbo", value);
+    if (strcmp(value, "unknown") != 0) {
+        strcpy(turbo, strcmp(value, "0") == 0 ? "on" : "off");
+        return;
+    }
+
+    read_state("/sys/devices/system/cpu/cpufreq/boost", value);
+    if (strcmp(value, "unknown") != 0) {
+        strcpy(turbo, strcmp(value, "0") == 0 ? "off" : "on");
+        return;
+    }
+
+    strcpy(turbo, "unknown");
+}
+
+// The TSC cycles of a fixed chain of dependent adds, the fastest of a few
+// runs. The chain runs at one add per core cycle, so it takes more TSC
+// cycles when the core runs slower.
+static uint64_t frequency_probe(void)
+{
+    uint64_t fastest = UINT64_MAX;
+    for (size_t run = 0; run < FREQUENCY_PROBE_RUNS; run++)
+    {
+        uint64_t x = 0;
+        const uint64_t start = read_timestamp();
+        for (size_t i = 0; i < FREQUENCY_PROBE_ADDS; i++) {
+            asm volatile("add $1, %0" : "+r"(x));
+        }
+        const uint64_t elapsed = read_timestamp() - start;
+
+        fastest = elapsed < fastest ? elapsed : fastest;
+    }
+
+    return fastest;
+}
+
+int init_noise_monitor(/*in*/ const int cpu, /*out*/ noise_monitor* monitor)
+{
+    *monitor = (noise_monitor){
+        .cpu = cpu,
+        .sibling = smt_sibling(cpu),
+        .irq_column = find_irq_column(cpu),
+        .frequency = 1.0,
+        .frequency_probe = UINT64_MAX
+    };
+    if (monitor->irq_column < 0) {
+        fprintf(stderr, "init_noise_monitor: cpu %d has no column in /proc/interrupts\n", cpu);
+        return -1;
+    }
+
+    read_governor(cpu, monitor->governor);
+    read_turbo(monitor->turbo);
+
+    uint64_t aperf, mperf;
+    monitor->has_aperf_mperf = read_msr(cpu, NOISE_APERF_MSR, &aperf) == 0
+                            && read_msr(cpu, NOISE_MPERF_MSR, &mperf) == 0;
+
+    // spin for a while to see how often the CPU is interrupted at rest,
+    // and how fast it runs. The fastest probe is the baseline, the first
+    // ones run cold.
+    struct timespec start, now;
+    const uint64_t interrupts = read_interrupts(monitor->irq_column);
+    const uint64_t tsc = read_timestamp();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        const uint64_t probe = frequency_probe();
+        monitor->frequency_probe = probe < monitor->frequency_probe ? probe : monitor->frequency_probe;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) < BASELINE_NANOSECONDS);
+    const uint64_t cycles = read_timestamp() - tsc;
+    monitor->interrupt_rate = (double)(read_interrupts(monitor->irq_column) - interrupts) / (double)cycles;
+
+    // /proc/stat counts in USER_HZ, whatever the kernel's tick
+    const long nanoseconds = (now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec);
+    monitor->tick_cycles = (uint64_t)((double)cycles / (double)nanoseconds * 1e9 / (double)sysconf(_SC_CLK_TCK));
+
+    uint64_t aperf_end, mperf_end;
+    if (monitor->has_aperf_mperf
+        && read_msr(cpu, NOISE_APERF_MSR, &aperf_end) == 0
+        && read_msr(cpu, NOISE_MPERF_MSR, &mperf_end) == 0
+        && mperf_end > mperf) {
+        monitor->frequency = (double)(aperf_end - aperf) / (double)(mperf_end - mperf);
+    }
+
+    return 0;
+}
+
+void print_noise_monitor(/*in*/ FILE* out, /*in*/ const noise_monitor* monitor)
+{
+    fprintf(out, "noise: cpu %d, %.1f interrupts per 10^9 cycles, ", monitor->cpu,
+            monitor->interrupt_rate * 1e9);
+    if (monitor->has_aperf_mperf) {
+        fprintf(out, "frequency %.2fx nominal (APERF/MPERF), ", monitor->frequency);
+    } else {
+        fprintf(out, "frequency probe %lu cycles, ", monitor->frequency_probe);
+    }
+    fprintf(out, "governor %s, turbo %s\n", monitor->governor, monitor->turbo);
+
+    if (strcmp(monitor->governor, "performance") != 0 && strcmp(monitor->governor, "unknown") != 0) {
+        fprintf(out, "warning: the %s governor changes the frequency under load, "
+                "use the performance governor\n", monitor->governor);
+    }
+    if (strcmp(monitor->turbo, "on") == 0) {
+        fprintf(out, "warning: turbo is on, the frequency depends on the load of the other cores\n");
+    }
+
+    uint64_t busy, total;
+    if (monitor->sibling >= 0 && read_cpu_time(monitor->sibling, &busy, &total) == 0) {
+        fprintf(out, "noise: cpu %d is the SMT sibling, batches are rejected if it's busy "
+                "(batches shorter than a scheduler tick can't tell)\n", monitor->sibling);
+    }
+}
+
+size_t noise_batch_size(
+    /*in*/ const noise_monitor* monitor,
+    /*in*/ const size_t samples,
+    /*in*/ const uint64_t cycles)
+{
+    if (cycles == 0) {
+        return samples;
+    }
+    return (size_t)ceil((double)samples * (double)monitor->tick_cycles / (double)cycles);
+}
+
+void begin_noise_batch(/*in*/ const noise_monitor* monitor, /*out*/ noise_snapshot* begin)
+{
+    *begin = (noise_snapshot){0};
+
+    // the slow reads first, so the batch starts right after the TSC is read
+    if (monitor->sibling >= 0) {
+        read_cpu_time(monitor->sibling, &begin->sibling_busy, &begin->sibling_total);
+    }
+    begin->interrupts = read_interrupts(monitor->irq_column);
+    if (monitor->has_aperf_mperf) {
+        read_msr(monitor->cpu, NOISE_APERF_MSR, &begin->aperf);
+        read_msr(monitor->cpu, NOISE_MPERF_MSR, &begin->mperf);
+    } else {
+        begin->frequency_probe = frequency_probe();
+    }
+    begin->tsc = read_timestamp();
+}
+
+uint32_t end_noise_batch(
+    /*in*/ const noise_monitor* monitor,
+    /*in*/ const noise_snapshot* begin,
+    /*out*/ noise_report* report)
+{
+    const uint64_t tsc = read_timestamp();
+    *report = (noise_report){
+        .sources = 0,
+        .cycles = tsc - begin->tsc,
+        .frequency = 1.0,
+        .unhalted = 1.0,
+        .sibling_busy = 0.0
+    };
+
+    if (monitor->has_aperf_mperf) {
+        uint64_t aperf, mperf;
+        if (read_msr(monitor->cpu, NOISE_APERF_MSR, &aperf) == 0
+            && read_msr(monitor->cpu, NOISE_MPERF_MSR, &mperf) == 0
+            && mperf > begin->mperf) {
+            report->frequency = (double)(aperf - begin->aperf) / (double)(mperf - begin->mperf)
+                / monitor->frequency;
+            report->unhalted = (double)(mperf - begin->mperf) / (double)report->cycles;
+        }
+    } else {
+        // how much the core sped up or slowed down over the batch, the
+        // probes don't give an absolute frequency the baseline can be
+        // compared with (the core ramps up as they run)
+        report->frequency = (double)begin->frequency_probe / (double)frequency_probe();
+    }
+
+    report->interrupts = read_interrupts(monitor->irq_column) - begin->interrupts;
+    report->expected_interrupts = monitor->interrupt_rate * (double)report->cycles;
+
+    // /proc/stat only advances once per tick, without one the sibling
+    // could have been busy for the whole batch
+    uint64_t busy, total;
+    if (monitor->sibling >= 0 && read_cpu_time(monitor->sibling, &busy, &total) == 0) {
+        report->sibling_busy = total > begin->sibling_total
+            ? (double)(busy - begin->sibling_busy) / (double)(total - begin->sibling_total)
+            : NAN;
+    }
+
+    if ((double)report->interrupts > 2 * report->expected_interrupts + NOISE_INTERRUPT_SLACK) {
+        report->sources |= NOISE_INTERRUPTS;
+    }
+    if (report->frequency < 1 - NOISE_FREQUENCY_TOLERANCE || report->frequency > 1 + NOISE_FREQUENCY_TOLERANCE) {
+        report->sources |= NOISE_FREQUENCY;
+    }
+    if (report->unhalted < 1 - NOISE_HALTED_TOLERANCE) {
+        report->sources |= NOISE_HALTED;
+    }
+    if (!isnan(report->sibling_busy) && report->sibling_busy > NOISE_SIBLING_TOLERANCE) {
+        report->sources |= NOISE_SIBLING;
+    }
+
+    char governor[NOISE_STATE_SIZE];
+    char turbo[NOISE_STATE_SIZE];
+    read_governor(monitor->cpu, governor);
+    read_turbo(turbo);
+    if (strcmp(governor, monitor->governor) != 0 || strcmp(turbo, monitor->turbo) != 0) {
+        report->sources |= NOISE_GOVERNOR;
+    }
+
+    return report->sources;
+}
+
+void write_noise_report_header(/*in*/ FILE* out)
+{
+    fprintf(out, "Level,Batch,Attempt,Kept,Sources,Cycles,Interrupts,ExpectedInterrupts,"
+            "Frequency,Unhalted,SiblingBusy\n");
+}
+
+void write_noise_report(
+    /*in*/ FILE* out,
+    /*in*/ const char* level,
+    /*in*/ const size_t batch,
+    /*in*/ const size_t attempt,
+    /*in*/ const int kept,
+    /*in*/ const noise_report* report)
+{
+    static const char* const names[] = {"interrupts", "frequency", "halted", "sibling", "governor"};
+
+    fprintf(out, "%s,%lu,%lu,%d,", level, batch, attempt, kept);
+    if (report->sources == 0) {
+        fprintf(out, "none");
+    }
+    for (size_t i = 0, first = 1; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (report->sources & (1u << i)) {
+            fprintf(out, first ? "%s" : "|%s", names[i]);
+            first = 0;
+        }
+    }
+    fprintf(out, ",%lu,%lu,%.2f,%.4f,%.4f,", report->cycles, report->interrupts,
+            report->expected_interrupts, report->frequency, report->unhalted);
+    if (isnan(report->sibling_busy)) {
+        fprintf(out, "unknown\n");
+    } else {
+        fprintf(out, "%.4f\n", report->sibling_busy);
+    }
+}
@@ -0,0 +1,193 @@
+#include "occupancy_aggregate.h"
+#include "cache.h"
+#include "eviction_set.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+occupancy_aggregate new_occupancy_aggregate(
+    /*in*/ const eviction_set es,
+    /*in*/ const size_t bin_width)
+{
+    const size_t lines_per_set = es.cache_lines + es.warmup_lines;
+    const size_t num_cells = es.cache_sets * es.cache_sets * lines_per_set;
+    const size_t size = num_cells * sizeof(occupancy_cell);
+
+    occupancy_aggregate agg = {
+        .cells = NULL,
+        .cache_sets = es.cache_sets,
+        .cache_lines = es.cache_lines,
+        .warmup_lines = es.warmup_lines,
+        .lines_per_set = lines_per_set,
+        .bin_width = bin_width == 0 ? OCCUPANCY_HIST_BIN_WIDTH : bin_width,
+        .num_iterations = 0,
+        .size = size,
+        .cpu = -1
+    };
+
+    // MAP_POPULATE so that the first sample of each cell doesn't page fault
+    occupancy_cell* cells = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                 MAP_POPULATE | MAP_ANONYMOUS | MAP_PRIVATE,
+                                 -1, 0);
+    if (cells == MAP_FAILED) {
+        perror("new_occupancy_aggregate");
+        agg.size = 0;
+        return agg;
+    }
+
+    // the mapping is zeroed, only the minimums need a starting value
+    for (size_t i = 0; i < num_cells; i++) {
+        cells[i].min = UINT16_MAX;
+    }
+
+    agg.cells = cells;
+    return agg;
+}
+
+void free_occupancy_aggregate(/*inout*/ occupancy_aggregate* agg)
+{
+    if (agg == NULL) {
+        return;
+    }
+
+    if (agg->cells != NULL) {
+        munmap(agg->cells, agg->size);
+    }
+
+    *agg = (occupancy_aggregate){
+        .cells = NULL,
+        .cache_sets = 0,
+        .cache_lines = 0,
+        .warmup_lines = 0,
+        .lines_per_set = 0,
+        .bin_width = 0,
+        .num_iterations = 0,
+        .size = 0,
+        .cpu = -1
+    };
+}
+
+int write_occupancy_aggregate(
+    /*in*/ const occupancy_aggregate agg,
+    /*in*/ const char* filename)
+{
+    FILE* out = fopen(filename, "wb");
+    if (out == NULL) {
+        perror(filename);
+        return -1;
+    }
+
+    const occupancy_aggregate_header header = {
+        .magic = OCCUPANCY_AGGREGATE_MAGIC,
+        .version = OCCUPANCY_AGGREGATE_VERSION,
+        .line_size = CACHE_LINE_SIZE,
+        .cache_sets = (uint32_t)agg.cache_sets,
+        .cache_lines = (uint32_t)agg.cache_lines,
+        .warmup_lines = (uint32_t)agg.warmup_lines,
+        .num_iterations = (uint32_t)agg.num_iterations,
+        .hist_bins = OCCUPANCY_HIST_BINS,
+        .bin_width = (uint32_t)agg.bin_width,
+        .cell_size = sizeof(occupancy_cell),
+        .cpu = (uint32_t)agg.cpu
+    };
+
+    const int ok = fwrite(&header, sizeof(header), 1, out) == 1
+        && fwrite(agg.cells, 1, agg.size, out) == agg.size;
+
+    if (fclose(out) != 0 || !ok) {
+        perror(filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+int occupancy_aggregate_to_csv(
+    /*in*/ const char* binary_filename,
+    /*in*/ const char* csv_filename)
+{
+    const int fd = open(binary_filename, O_RDONLY);
+    if (fd < 0) {
+        perror(binary_filename);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(occupancy_aggregate_header)) {
+        fprintf(stderr, "%s: not an occupancy aggregate file\n", binary_filename);
+        close(fd);
+        return -1;
+    }
+
+    const size_t map_size = (size_t)st.st_size;
+    const byte* mem = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror(binary_filename);
+        return -1;
+    }
+
+    // validate the header before trusting any of the sizes inside it
+    const occupancy_aggregate_header* header = (const occupancy_aggregate_header*)mem;
+    const size_t lines_per_set = (size_t)header->cache_lines + header->warmup_lines;
+    const size_t num_cells = (size_t)header->cache_sets * header->cache_sets * lines_per_set;
+
+    if (header->magic != OCCUPANCY_AGGREGATE_MAGIC
+        || header->version != OCCUPANCY_AGGREGATE_VERSION
+        || header->hist_bins != OCCUPANCY_HIST_BINS
+        || header->cell_size != sizeof(occupancy_cell)
+        || map_size < sizeof(occupancy_aggregate_header) + num_cells * sizeof(occupancy_cell))
+    {
+        fprintf(stderr, "%s: not an occupancy aggregate file\n", binary_filename);
+        munmap((void*)mem, map_size);
+        return -1;
+    }
+
+    FILE* csv = fopen(csv_filename, "w");
+    if (csv == NULL) {
+        perror(csv_filename);
+        munmap((void*)mem, map_size);
+        return -1;
+    }
+
+    const occupancy_cell* cells = (const occupancy_cell*)(mem + sizeof(occupancy_aggregate_header));
+
+    fprintf(csv, "Set,SetIndex,LineIndex,Count,Min,Max,Mean");
+    for (size_t bin = 0; bin < OCCUPANCY_HIST_BINS; bin++) {
+        fprintf(csv, ",H%lu", bin);
+    }
+    fprintf(csv, "\n");
+
+    const occupancy_cell* cell = cells;
+    for (size_t set = 0; set < header->cache_sets; set++)
+    {
+        for (size_t s_prime = 0; s_prime < header->cache_sets; s_prime++)
+        {
+            for (size_t l_prime = 0; l_prime < lines_per_set; l_prime++, cell++)
+            {
+                // cells without samples have no meaningful min/max/mean
+                if (cell->count == 0) {
+                    continue;
+                }
+
+                fprintf(csv, "%lu,%lu,%lu,%u,%u,%u,%.2f",
+                        set, s_prime, l_prime, cell->count, cell->min, cell->max,
+                        (double)cell->sum / cell->count);
+                for (size_t bin = 0; bin < OCCUPANCY_HIST_BINS; bin++) {
+                    fprintf(csv, ",%u", cell->histogram[bin]);
+                }
+                fprintf(csv, "\n");
+            } // l_prime
+        } // s_prime
+    } // set
+
+    fclose(csv);
+    munmap((void*)mem, map_size);
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "occupancy_compare.h"
+#include "result_file.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Mean and (sample) variance of one cell over every iteration
+typedef struct {
+    double mean;
+    double variance;
+    size_t n;
+} cell_moments;
+
+static cell_moments cell_statistics(const occupancy_result_file rf,
+                                    const size_t s_prime, const size_t l_prime)
+{
+    const size_t n = rf.header->num_iterations;
+    double sum = 0.0;
+    double sum_sq = 0.0;
+
+    for (size_t iter = 0; iter < n; iter++)
+    {
+        const double x = load_occupancy_result(rf, iter, s_prime, l_prime);
+        sum += x;
+        sum_sq += x * x;
+    }
+
+    const double mean = sum / (double)n;
+    const double variance = n > 1
+        ? (sum_sq - (double)n * mean * mean) / (double)(n - 1)
+        : 0.0;
+
+    return (cell_moments){
+        .mean = mean,
+        .variance = variance > 0.0 ? variance : 0.0,
+        .n = n
+    };
+}
+
+int compare_occupancy_results(
+    /*in*/ const char* reference_filename,
+    /*in*/ const char* candidate_filename,
+    /*in*/ const double critical_t,
+    /*in*/ const double tolerance,
+    /*out*/ occupancy_equivalence* result)
+{
+    occupancy_result_file reference = read_occupancy_result_file(reference_filename);
+    occupancy_result_file candidate = read_occupancy_result_file(candidate_filename);
+
+    int status = 0;
+    if (reference.cycles == NULL || candidate.cycles == NULL) {
+        status = -1;
+    } else if (reference.header->cache_sets != candidate.header->cache_sets
+               || reference.lines_per_set != candidate.lines_per_set
+               || reference.header->set != candidate.header->set
+               || reference.header->num_iterations == 0
+               || candidate.header->num_iterations == 0)
+    {
+        fprintf(stderr, "%s and %s are not profiles of the same set\n",
+                reference_filename, candidate_filename);
+        status = -1;
+    }
+
+    if (status != 0) {
+        close_occupancy_result_file(&reference);
+        close_occupancy_result_file(&candidate);
+        return -1;
+    }
+
+    *result = (occupancy_equivalence){ 0 };
+
+    double total_difference = 0.0;
+    for (size_t s_prime = 0; s_prime < reference.header->cache_sets; s_prime++)
+    {
+        for (size_t l_prime = 0; l_prime < reference.lines_per_set; l_prime++)
+        {
+            const cell_moments a = cell_statistics(reference, s_prime, l_prime);
+            const cell_moments b = cell_statistics(candidate, s_prime, l_prime);
+
+            const double difference = fabs(a.mean - b.mean);
+            const double standard_error = sqrt(a.variance / (double)a.n 
+                                               + b.variance / (double)b.n);
+
+            // two constant cells only differ if their values differ
+            const int differs = standard_error > 0.0
+                ? difference / standard_error > critical_t
+                : difference > 0.0;
+
+            result->num_cells += 1;
+            result->differing_cells += differs ? 1 : 0;
+            total_difference += difference;
+            if (difference > result->max_mean_difference) {
+                result->max_mean_difference = difference;
+            }
+        } // l_prime
+    } // s_prime
+
+    result->mean_difference = total_difference / (double)result->num_cells;
+    result->equivalent = (double)result->differing_cells 
+        <= tolerance * (double)result->num_cells;
+
+    close_occupancy_result_file(&reference);
+    close_occupancy_result_file(&candidate);
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "occupancy_drain.h"
+#include "cpu.h"
+#include "occupancy_aggregate.h"
+#include "perf_counters.h"
+#include "spsc_ring.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// How long the drain sleeps when both rings are empty. The profiling thread
+// publishes once per iteration, so the drain is idle most of the time
+#define DRAIN_POLL_NS 20000
+
+// Takes the published samples off the ring, returns how many there were
+static size_t drain_samples(occupancy_drain* drain)
+{
+    size_t total = 0;
+    const void* records;
+    size_t count;
+    while ((count = spsc_ring_peek(drain->samples, &records)) > 0)
+    {
+        const occupancy_record* record = records;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (record[i].cell == OCCUPANCY_DRAIN_END_ITERATION) {
+                drain->iteration++;
+                continue;
+            }
+
+            const size_t s_prime = record[i].cell / drain->lines_per_set;
+            const size_t l_prime = record[i].cell % drain->lines_per_set;
+            record_occupancy_sample(*drain->agg, drain->set, s_prime, l_prime, record[i].cycles);
+        }
+
+        spsc_ring_release(drain->samples, count);
+        total += count;
+    }
+
+    return total;
+}
+
+// Appends the published counter rows to the log, returns how many there were
+static size_t drain_rows(occupancy_drain* drain)
+{
+    size_t total = 0;
+    const void* rows;
+    size_t count;
+    while ((count = spsc_ring_peek(drain->rows, &rows)) > 0)
+    {
+        const occupancy_counter_row* row = rows;
+        if (drain->counter_log == NULL) {
+            spsc_ring_release(drain->rows, count);
+            continue;
+        }
+
+        // hold the lock for the whole row, other drains may share the log
+        flockfile(drain->counter_log);
+        for (size_t i = 0; i < count; i++)
+        {
+            fprintf(drain->counter_log, "%lu,%lu,%lu,%lu,%lu", row[i].warmup_lines, row[i].set,
+                    row[i].iteration, row[i].probes, row[i].cycles);
+            write_perf_counts(drain->counter_log, row[i].counts);
+            fprintf(drain->counter_log, "\n");
+        }
+        funlockfile(drain->counter_log);
+
+        spsc_ring_release(drain->rows, count);
+        total += count;
+    }
+
+    return total;
+}
+
+static void* drain_main(void* arg)
+{
+    occupancy_drain* drain = arg;
+
+    if (drain->cpu >= 0) {
+        pin_to_cpu(drain->cpu);
+    }
+
+    for (;;)
+    {
+        // the rings are drained once more after the stop, the producer only
+        // stops once it saw them drained anyway
+        const int stop = atomic_load_explicit(&drain->stop, memory_order_acquire);
+        const size_t drained = drain_samples(drain) + drain_rows(drain);
+        if (stop) {
+            break;
+        }
+
+        if (drained == 0) {
+            const struct timespec poll = { .tv_sec = 0, .tv_nsec = DRAIN_POLL_NS };
+            nanosleep(&poll, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+occupancy_drain* start_occupancy_drain(
+    /*in*/ const int cpu,
+    /*in*/ const size_t capacity,
+    /*in*/ FILE* counter_log)
+{
+    occupancy_drain* drain = aligned_alloc(CACHE_LINE_SIZE, sizeof(occupancy_drain));
+    if (drain == NULL) {
+        perror("start_occupancy_drain");
+        return NULL;
+    }
+
+    *drain = (occupancy_drain){ .counter_log = counter_log, .cpu = cpu };
+    atomic_init(&drain->stop, 0);
+    drain->samples = new_spsc_ring(sizeof(occupancy_record), capacity);
+    drain->rows = new_spsc_ring(sizeof(occupancy_counter_row), OCCUPANCY_DRAIN_ROWS);
+    if (drain->samples == NULL || drain->rows == NULL) {
+        free_spsc_ring(drain->samples);
+        free_spsc_ring(drain->rows);
+        free(drain);
+        return NULL;
+    }
+
+    if (pthread_create(&drain->thread, NULL, drain_main, drain) != 0) {
+        fprintf(stderr, "failed to start a drain on cpu %d\n", cpu);
+        free_spsc_ring(drain->samples);
+        free_spsc_ring(drain->rows);
+        free(drain);
+        return NULL;
+    }
+
+    return drain;
+}
+
+void stop_occupancy_drain(/*inout*/ occupancy_drain* drain)
+{
+    if (drain == NULL) {
+        return;
+    }
+
+    finish_drained_profile(drain);
+    atomic_store_explicit(&drain->stop, 1, memory_order_release);
+    pthread_join(drain->thread, NULL);
+
+    free_spsc_ring(drain->samples);
+    free_spsc_ring(drain->rows);
+    free(drain);
+}
+
+int begin_drained_profile(
+    /*inout*/ occupancy_drain* drain,
+    /*in*/ const eviction_set es,
+    /*in*/ const size_t set,
+    /*in*/ occupancy_aggregate* agg)
+{
+    // the samples of an iteration if they're drained, and the end of it
+    const size_t lines_per_set = es.cache_lines + es.warmup_lines;
+    const size_t iteration_records = (agg != NULL ? es.cache_sets * lines_per_set : 0) + 1;
+    if (iteration_records > drain->samples->capacity) {
+        fprintf(stderr, "warning: an iteration of set %lu doesn't fit in the drain, "
+                "storing its samples on the profiling thread\n", set);
+        return -1;
+    }
+
+    // the drain only reads the sink while it has samples, so it can be
+    // swapped once the last profile is drained
+    finish_drained_profile(drain);
+    drain->agg = agg;
+    drain->set = set;
+    drain->lines_per_set = lines_per_set;
+    drain->iteration_records = iteration_records;
+    drain->iteration = 0;
+    return 0;
+}
+
+void finish_drained_profile(/*inout*/ occupancy_drain* drain)
+{
+    spsc_ring_publish(drain->samples);
+    spsc_ring_publish(drain->rows);
+    while (!spsc_ring_drained(drain->samples) || !spsc_ring_drained(drain->rows))
+    {
+        sched_yield();
+    }
+}
+
+void wait_for_drain_room(/*inout*/ occupancy_drain* drain)
+{
+    if (spsc_ring_reserve(drain->samples, drain->iteration_records)
+        && spsc_ring_reserve(drain->rows, 1)) {
+        return;
+    }
+
+    drain->stalls++;
+    while (!spsc_ring_reserve(drain->samples, drain->iteration_records)
+           || !spsc_ring_reserve(drain->rows, 1))
+    {
+        sched_yield();
+    }
+}
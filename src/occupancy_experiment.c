@@ -0,0 +1,1041 @@
+#include "address.h"
+#include "cache.h"
+#include "cache_geometry.h"
+#include "campaign.h"
+#include "cpu.h"
+#include "eviction_set.h"
+#include "eviction_set_pool.h"
+#include "experiment.h"
+#include "interference.h"
+#include "latency_model.h"
+#include "occupancy_aggregate.h"
+#include "occupancy_compare.h"
+#include "occupancy_profile.h"
+#include "parallel_profile.h"
+#include "llc_slice.h"
+#include "perf_counters.h"
+#include "result_file.h"
+#include "timer.h"
+#include "utility.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_CPUS 1024
+#define MAX_TEST_SETS 65536
+#define MAX_WARMUPS 64
+#define DEFAULT_ITERATIONS 50
+#define DEFAULT_CHUNK 10
+#define DEFAULT_OUTPUT "results/occupancy"
+
+// The room a result file name needs past the output directory
+#define FILENAME_SUFFIX_SIZE 96
+
+// The warmup tests run unless given with `--warmups`: TEST 1 is no warmup, 
+// TEST 2 is 8 warmup lines
+static const size_t default_warmups[] = {0, 8};
+
+// Profiles every set in the L2 in one pass, keeping only the per-cell
+// aggregates rather than every raw sample.
+static int all_sets(const cache_level_geometry l2, const size_t* warmups, const size_t size_warmups,
+                    const size_t iterations, const int* cpus, const size_t num_cpus,
+                    const char* output, const char* variant, const occupancy_options options)
+{
+    char filename[EXPERIMENT_PATH_SIZE] = {0};
+
+    for (const size_t* warmup_lines = warmups; warmup_lines < (warmups + size_warmups); warmup_lines++)
+    {
+        printf("Starting all sets test with %lu warmup lines...\n", *warmup_lines);
+        fflush(stdout);
+
+        // the aggregate only needs the geometry of the eviction set, the
+        // workers allocate their own
+        const eviction_set geometry = {
+            .cache_sets = l2.sets,
+            .cache_lines = l2.ways,
+            .warmup_lines = *warmup_lines
+        };
+        occupancy_aggregate agg = new_occupancy_aggregate(geometry, OCCUPANCY_HIST_BIN_WIDTH);
+        if (agg.cells == NULL) {
+            return 1;
+        }
+
+        // one job per set, each job only writes the cells of its own set
+        occupancy_job* jobs = malloc(l2.sets * sizeof(occupancy_job));
+        if (jobs == NULL) {
+            free_occupancy_aggregate(&agg);
+            return 1;
+        }
+        for (size_t set = 0; set < l2.sets; set++) {
+            jobs[set] = (occupancy_job){
+                .set = set,
+                .warmup_lines = *warmup_lines,
+                .output_filename = NULL,
+                .agg = &agg
+            };
+        }
+
+        int status = run_occupancy_jobs(jobs, l2.sets, cpus, num_cpus,
+                                        l2.sets, l2.ways, 0, iterations, options);
+        agg.num_iterations = iterations;
+        agg.cpu = num_cpus == 1 ? cpus[0] : -1;
+        free(jobs);
+
+        // the CPUs are recorded in the file, not its name
+        snprintf(filename, sizeof(filename), "%s/%lu_warmup_%s_all_sets.bin",
+                 output, *warmup_lines, variant);
+        if (status == 0) {
+            status = write_occupancy_aggregate(agg, filename);
+        }
+
+        free_occupancy_aggregate(&agg);
+
+        if (status != 0) {
+            return 1;
+        }
+
+        printf("Finished\n");
+        fflush(stdout);
+    }
+
+    return 0;
+}
+
+// Profiles each test set with both the exhaustive engine and the engine
+// selected by `candidate`, and checks that the two profiles are
+// statistically equivalent.
+static int validate(const cache_level_geometry level, const size_t llc_slices,
+                    const size_t* test_set, const size_t size_test_set,
+                    const size_t* warmups, const size_t size_warmups,
+                    const size_t iterations, const int* cpus, const size_t num_cpus,
+                    const char* output, const occupancy_options candidate)
+{
+    // both engines time with the same timer (and share the eviction sets), 
+    // so only the engines differ
+    const occupancy_options exhaustive = {
+        .flush_mode = OCCUPANCY_FLUSH_FULL,
+        .timer = candidate.timer,
+        .eviction_sets = candidate.eviction_sets
+    };
+    const char* tag = llc_slices == 0 ? "" : "_L3";
+
+    int status = 0;
+    char reference[EXPERIMENT_PATH_SIZE] = {0};
+    char candidate_filename[EXPERIMENT_PATH_SIZE] = {0};
+
+    for (const size_t* warmup_lines = warmups; warmup_lines < (warmups + size_warmups); warmup_lines++)
+    {
+        for (const size_t* set = test_set; set < (test_set + size_test_set); set++)
+        {
+            if (*set >= level.sets) {
+                continue;
+            }
+
+            snprintf(reference, sizeof(reference), "%s/validate_full%s_W%lu_S%lu.bin",
+                     output, tag, *warmup_lines, *set);
+            snprintf(candidate_filename, sizeof(candidate_filename), "%s/validate_candidate%s_W%lu_S%lu.bin",
+                     output, tag, *warmup_lines, *set);
+
+            const occupancy_job jobs[] = {
+                { .set = *set, .warmup_lines = *warmup_lines, .output_filename = reference },
+                { .set = *set, .warmup_lines = *warmup_lines, .output_filename = candidate_filename },
+            };
+
+            // run the two engines one after the other on the same core(s)
+            occupancy_equivalence eq;
+            if (run_occupancy_jobs(&jobs[0], 1, cpus, num_cpus > 0 ? 1 : 0,
+                                   level.sets, level.ways, llc_slices, iterations, exhaustive) != 0
+                || run_occupancy_jobs(&jobs[1], 1, cpus, num_cpus > 0 ? 1 : 0,
+                                      level.sets, level.ways, llc_slices, iterations, candidate) != 0
+                || compare_occupancy_results(reference, candidate_filename,
+                                             OCCUPANCY_DEFAULT_CRITICAL_T,
+                                             OCCUPANCY_DEFAULT_TOLERANCE, &eq) != 0)
+            {
+                return 1;
+            }
+
+            printf("set %3lu, %lu warmup: %5lu/%lu cells differ (max |diff| %.1f, mean |diff| %.2f cycles) %s\n",
+                   *set, *warmup_lines, eq.differing_cells, eq.num_cells,
+                   eq.max_mean_difference, eq.mean_difference,
+                   eq.equivalent ? "equivalent" : "NOT EQUIVALENT");
+            fflush(stdout);
+
+            status |= !eq.equivalent;
+        }
+    }
+
+    return status;
+}
+
+// Profiles each test set on the first of `cpus` twice, alone and while the
+// aggressors of `group` run on other cores, checks whether the two profiles
+// differ like `validate` does, and writes the comparison of every (set,
+// warmup) pair to <output>/interference.csv
+static int interfere(const cache_level_geometry level, const size_t llc_slices,
+                     const size_t* test_set, const size_t size_test_set,
+                     const size_t* warmups, const size_t size_warmups,
+                     const size_t iterations, const int* cpus, const char* output,
+                     const occupancy_options options, interference* group)
+{
+    const char* tag = llc_slices == 0 ? "" : "_L3";
+    const char* aggressor = interference_pattern_name(group->options.pattern);
+
+    char filename[EXPERIMENT_PATH_SIZE];
+    snprintf(filename, sizeof(filename), "%s/interference.csv", output);
+    FILE* out = fopen(filename, "w");
+    if (out == NULL) {
+        perror(filename);
+        return 1;
+    }
+    fprintf(out, "Set,Warmup,Aggressor,Aggressors,Cells,DifferingCells,MeanDifference,"
+            "MaxMeanDifference,AggressorLines,AggressorCycles\n");
+
+    int status = 0;
+    char quiet[EXPERIMENT_PATH_SIZE] = {0};
+    char loud[EXPERIMENT_PATH_SIZE] = {0};
+
+    for (const size_t* warmup_lines = warmups; warmup_lines < (warmups + size_warmups) && status == 0; warmup_lines++)
+    {
+        for (const size_t* set = test_set; set < (test_set + size_test_set); set++)
+        {
+            if (*set >= level.sets) {
+                continue;
+            }
+
+            snprintf(quiet, sizeof(quiet), "%s/interference_quiet%s_W%lu_S%lu.bin",
+                     output, tag, *warmup_lines, *set);
+            snprintf(loud, sizeof(loud), "%s/interference_%s%s_W%lu_S%lu.bin",
+                     output, aggressor, tag, *warmup_lines, *set);
+
+            const occupancy_job jobs[] = {
+                { .set = *set, .warmup_lines = *warmup_lines, .output_filename = quiet },
+                { .set = *set, .warmup_lines = *warmup_lines, .output_filename = loud },
+            };
+
+            // the same core profiles the set alone, then with the neighbors
+            if (run_occupancy_jobs(&jobs[0], 1, cpus, 1, level.sets, level.ways,
+                                   llc_slices, iterations, options) != 0) {
+                status = 1;
+                break;
+            }
+
+            resume_interference(group);
+            const int loud_status = run_occupancy_jobs(&jobs[1], 1, cpus, 1, level.sets, level.ways,
+                                                       llc_slices, iterations, options);
+            const uint64_t cycles = read_timestamp() - group->started_at;
+            const uint64_t lines = pause_interference(group);
+
+            occupancy_equivalence eq;
+            if (loud_status != 0
+                || compare_occupancy_results(quiet, loud, OCCUPANCY_DEFAULT_CRITICAL_T,
+                                             OCCUPANCY_DEFAULT_TOLERANCE, &eq) != 0) {
+                status = 1;
+                break;
+            }
+
+            fprintf(out, "%lu,%lu,%s,%lu,%lu,%lu,%.3f,%.3f,%lu,%lu\n", *set, *warmup_lines, aggressor,
+                    group->num_aggressors, eq.num_cells, eq.differing_cells, eq.mean_difference,
+                    eq.max_mean_difference, lines, cycles);
+            printf("set %3lu, %lu warmup, %lu %s aggressors (%.2f lines/kcycle): "
+                   "%5lu/%lu cells differ (max |diff| %.1f, mean |diff| %.2f cycles)\n",
+                   *set, *warmup_lines, group->num_aggressors, aggressor,
+                   cycles == 0 ? 0.0 : 1000.0 * (double)lines / (double)cycles,
+                   eq.differing_cells, eq.num_cells, eq.max_mean_difference, eq.mean_difference);
+            fflush(stdout);
+        }
+    }
+
+    fclose(out);
+    return status;
+}
+
+// Returns a fingerprint of the options that change the samples of a 
+// profile: the engine, the timer, the kernels, and whether counters or a 
+// drain run alongside it
+static uint64_t sampling_fingerprint(const occupancy_options options)
+{
+    const uint64_t fields[] = {
+        options.flush_mode,
+        options.neighborhood,
+        options.batch_size,
+        (uint64_t)options.generic_kernels,
+        options.timer != NULL ? (uint64_t)options.timer->mode + 1 : 0,
+        options.counter_log != NULL,
+        options.drain_cpus != NULL
+    };
+    return campaign_checksum(fields, sizeof(fields));
+}
+
+// The progress of the profile of one (set, warmup) pair of a campaign
+typedef struct {
+    size_t set;
+    size_t warmup_lines;
+    const char* filename;
+    char* chunk_filename;
+    // the iterations in the result file, and whether the profile stopped 
+    // early (every cell was decided) so it needs no more
+    size_t done;
+    int finished;
+    // whether the result file changed, so its means are out of date
+    int changed;
+} profile_progress;
+
+// Returns the name of a result file without its directory, as it's kept in 
+// the manifest
+static const char* manifest_name(const char* filename)
+{
+    const char* slash = strrchr(filename, '/');
+    return slash == NULL ? filename : slash + 1;
+}
+
+// Finds how many iterations of a profile are done: the chunks of its file 
+// in the manifest, in order from the first iteration, as long as the file 
+// holds them, they're of this set and warmup, they were sampled with the 
+// same options, and their samples still match their checksum. Anything in 
+// the file past them is cut off. A file sampled with other options isn't 
+// touched, it's an error.
+static int resume_profile(const campaign* c, const cache_level_geometry level, const uint64_t sampling,
+                          profile_progress* p)
+{
+    p->done = 0;
+    p->finished = 0;
+    if (access(p->filename, F_OK) != 0) {
+        return 0;
+    }
+
+    occupancy_result_file rf = read_occupancy_result_file(p->filename);
+    if (rf.cycles == NULL) {
+        return -1;
+    }
+
+    // never mix samples taken with other options into a profile
+    if (rf.header->sampling != sampling) {
+        fprintf(stderr, "%s: was sampled with other options, resume it with those "
+                "or profile into another --output\n", p->filename);
+        close_occupancy_result_file(&rf);
+        return -1;
+    }
+
+    size_t available = 0;
+    if (rf.header->cache_sets == level.sets && rf.header->cache_lines == level.ways
+        && rf.header->warmup_lines == p->warmup_lines && rf.header->set == p->set) {
+        available = rf.header->num_iterations;
+    }
+
+    const size_t iteration_samples = rf.header->cache_sets * rf.lines_per_set;
+    const campaign_chunk* chunk;
+    while (!p->finished && (chunk = find_campaign_chunk(c, manifest_name(p->filename), p->done)) != NULL)
+    {
+        if (chunk->set != p->set || chunk->warmup_lines != p->warmup_lines || chunk->iterations == 0
+            || chunk->options != sampling
+            || p->done + chunk->iterations > available
+            || campaign_checksum(rf.cycles + p->done * iteration_samples,
+                                 chunk->iterations * iteration_samples * sizeof(uint16_t)) != chunk->checksum) {
+            break;
+        }
+
+        p->done += chunk->iterations;
+        p->finished = chunk->iterations < chunk->requested;
+    }
+
+    const size_t in_file = rf.header->num_iterations;
+    close_occupancy_result_file(&rf);
+
+    if (p->done == 0) {
+        return unlink(p->filename) == 0 ? 0 : -1;
+    }
+    if (p->done < in_file) {
+        p->changed = 1;
+        return cut_occupancy_result_file(p->filename, p->done);
+    }
+    return 0;
+}
+
+// Adds the chunk a job just profiled to its result file and records it in 
+// the manifest
+static int add_chunk(campaign* c, profile_progress* p, const size_t requested)
+{
+    occupancy_result_file rf = read_occupancy_result_file(p->chunk_filename);
+    if (rf.cycles == NULL) {
+        return -1;
+    }
+
+    campaign_chunk chunk = {
+        .set = p->set,
+        .warmup_lines = p->warmup_lines,
+        .first = p->done,
+        .requested = requested,
+        .iterations = rf.header->num_iterations,
+        .checksum = campaign_checksum(rf.cycles, (size_t)rf.header->num_iterations
+                                      * rf.header->cache_sets * rf.lines_per_set * sizeof(uint16_t)),
+        .options = rf.header->sampling
+    };
+    snprintf(chunk.file, sizeof(chunk.file), "%s", manifest_name(p->filename));
+    close_occupancy_result_file(&rf);
+
+    // a profile always runs at least one iteration, an empty chunk failed
+    if (chunk.iterations == 0) {
+        fprintf(stderr, "%s: holds no iterations\n", p->chunk_filename);
+        unlink(p->chunk_filename);
+        return -1;
+    }
+
+    // the row only goes in once the samples are in the file
+    if (append_occupancy_result_file(p->filename, p->chunk_filename) != 0
+        || record_campaign_chunk(c, &chunk) != 0) {
+        return -1;
+    }
+
+    p->done += chunk.iterations;
+    p->finished = chunk.iterations < requested;
+    p->changed = 1;
+    return 0;
+}
+
+// Profiles each of the test sets, writing the raw samples of every (set, 
+// warmup) pair to its own result file. The iterations are profiled 
+// `chunk` at a time, into a file of their own that's then appended to the 
+// result file and recorded in the manifest of the campaign (see 
+// campaign.h). With `resume` the iterations the manifest says are done, 
+// and whose samples still match, are kept and only the rest are profiled, 
+// otherwise every profile starts over. The means of a result file are only 
+// reduced again if it changed.
+static int test_sets(const cache_level_geometry level, const size_t llc_slices,
+                     const size_t* test_set, const size_t size_test_set,
+                     const size_t* warmups, const size_t size_warmups,
+                     const size_t iterations, const size_t chunk, 
+                     const int* cpus, const size_t num_cpus,
+                     const int resume, const char* output, const char* variant,
+                     const occupancy_options options, campaign* c)
+{
+    // each (set, warmup) pair is its own job and writes its own result file
+    const char* tag = llc_slices == 0 ? "" : "_L3";
+
+    const size_t num_pairs = size_warmups * size_test_set;
+    const size_t filename_size = strlen(output) + FILENAME_SUFFIX_SIZE;
+    char* filenames = calloc(2 * num_pairs, filename_size);
+    profile_progress* pairs = calloc(num_pairs, sizeof(profile_progress));
+    profile_progress** round = malloc(num_pairs * sizeof(profile_progress*));
+    occupancy_job* jobs = malloc(num_pairs * sizeof(occupancy_job));
+    if (filenames == NULL || pairs == NULL || round == NULL || jobs == NULL) {
+        perror("test_sets");
+        free(filenames);
+        free(pairs);
+        free(round);
+        free(jobs);
+        return 1;
+    }
+
+    int status = 0;
+    size_t num_profiles = 0;
+    size_t resumed = 0;
+    for (size_t w = 0; w < size_warmups; w++)
+    {
+        for (size_t i = 0; i < size_test_set && status == 0; i++)
+        {
+            if (test_set[i] >= level.sets) {
+                continue;
+            }
+
+            // "no_warmup" rather than "0_warmup", as the files were always named
+            char prefix[32] = "no";
+            if (warmups[w] != 0) {
+                snprintf(prefix, sizeof(prefix), "%lu", warmups[w]);
+            }
+
+            profile_progress* p = &pairs[num_profiles++];
+            char* filename = filenames + 2 * (p - pairs) * filename_size;
+            p->chunk_filename = filename + filename_size;
+            p->filename = filename;
+            p->set = test_set[i];
+            p->warmup_lines = warmups[w];
+            snprintf(filename, filename_size, "%s/%s_warmup_%s%s_S%lu.bin",
+                     output, prefix, variant, tag, test_set[i]);
+            snprintf(p->chunk_filename, filename_size, "%s.chunk", filename);
+
+            if (resume) {
+                status = resume_profile(c, level, options.fingerprint, p);
+                resumed += p->done < iterations ? p->done : iterations;
+            } else if (access(filename, F_OK) == 0) {
+                status = unlink(filename);
+            }
+        }
+    }
+
+    if (resumed > 0) {
+        printf("Resuming, %lu of %lu iterations are already done\n", resumed, num_profiles * iterations);
+    }
+    printf("Starting the tests of %lu warmup sizes...\n", size_warmups);
+    fflush(stdout);
+
+    // every round profiles the next chunk of each profile that needs the 
+    // same number of iterations, usually all of them
+    while (status == 0)
+    {
+        size_t count = 0;
+        size_t num_jobs = 0;
+        for (size_t i = 0; i < num_profiles; i++)
+        {
+            profile_progress* p = &pairs[i];
+            if (p->finished || p->done >= iterations) {
+                continue;
+            }
+
+            const size_t next = iterations - p->done < chunk ? iterations - p->done : chunk;
+            if (count == 0) {
+                count = next;
+            }
+            if (next != count) {
+                continue;
+            }
+
+            round[num_jobs] = p;
+            jobs[num_jobs++] = (occupancy_job){
+                .set = p->set,
+                .warmup_lines = p->warmup_lines,
+                .output_filename = p->chunk_filename,
+                .agg = NULL
+            };
+        }
+        if (num_jobs == 0) {
+            break;
+        }
+
+        status = run_occupancy_jobs(jobs, num_jobs, cpus, num_cpus, level.sets, level.ways,
+                                    llc_slices, count, options);
+        for (size_t j = 0; j < num_jobs && status == 0; j++) {
+            status = add_chunk(c, round[j], count);
+        }
+    }
+    free(jobs);
+    free(round);
+
+    // reduce every profile to the matrix plot.py draws, next to it, unless 
+    // it's already there and still up to date
+    char* means_filename = malloc(filename_size);
+    for (size_t i = 0; i < num_profiles && status == 0; i++)
+    {
+        if (means_filename == NULL) {
+            perror("test_sets");
+            status = -1;
+            break;
+        }
+
+        const char* filename = pairs[i].filename;
+        snprintf(means_filename, filename_size, "%.*s_means.csv", (int)(strlen(filename) - 4), filename);
+        if (pairs[i].changed || access(means_filename, F_OK) != 0) {
+            status = occupancy_result_to_means(filename, means_filename);
+        }
+    }
+    free(means_filename);
+    free(pairs);
+    free(filenames);
+    if (status != 0) {
+        return 1;
+    }
+
+    printf("Finished\n");
+    fflush(stdout);
+
+    return 0;
+}
+
+// Prints the mean latency at each position of a batch, relative to the
+// first probe of the batch
+static void print_perturbation(const occupancy_perturbation* perturbation, const size_t batch_size)
+{
+    if (perturbation->count[0] == 0) {
+        return;
+    }
+
+    const double first = (double)perturbation->sum[0] / (double)perturbation->count[0];
+
+    printf("Batch position, mean cycles, difference from position 0\n");
+    for (size_t i = 0; i < batch_size && i < OCCUPANCY_MAX_BATCH_SIZE; i++)
+    {
+        if (perturbation->count[i] == 0) {
+            continue;
+        }
+
+        const double mean = (double)perturbation->sum[i] / (double)perturbation->count[i];
+        printf("%14lu, %11.2f, %+.2f\n", i, mean, mean - first);
+    }
+}
+
+// Usage: occupancy [--all-sets | --validate | --geometry] [--cpus <list>] 
+//                  [--flush full|targeted] [--neighborhood <lines>|region]
+//                  [--batch <probes>] [--perturbation] [--generic-kernels]
+//                  [--timer rdtscp|cpuid|rdpmc] [--counters] [--adaptive]
+//                  [--level l2|l3] [--slices <n>] [--sets <list>] [--resume]
+//                  [--drain <list>] [--warmups <list>] [--iterations <n>]
+//                  [--chunk <n>] [--output <dir>]
+//                  [--aggressors <list> [--aggressor stream|stride|prime]
+//                   [--aggressor-size <bytes>] [--aggressor-stride <lines>]
+//                   [--aggressor-sets <list>]]
+//
+// `--cpus` takes a list like "0-3,8", one worker is pinned to each
+// physical core in the list. Without it everything runs on the calling
+// thread.
+//
+// Every set is profiled for `--iterations` iterations (50 by default) with 
+// each of the `--warmups` warmup sizes, a list in the format of `--cpus` 
+// (0 and 8 lines by default). The results are written to `--output` 
+// (results/occupancy by default), tagged with the build variant of the 
+// runner (e.g. 8_warmup_O2_S0.bin). When the runner shares a pool of 
+// eviction sets (see experiment.h) the workers take theirs from it, so the 
+// eviction sets of a geometry are only built once for all of the jobs.
+//
+// `--flush targeted` only flushes the lines the previous probe could have 
+// cached (plus their 4 KiB region, or `--neighborhood` lines around each) 
+// instead of the whole 
+// eviction set. `--batch` primes once for every <probes> probes, which are 
+// made in a random order, and `--perturbation` reports how much the earlier 
+// probes of a batch change the later ones. `--validate` checks the selected 
+// engine (targeted flushing if no engine options are given) against the 
+// exhaustive one. `--generic-kernels` primes through the generic loop 
+// instead of the kernel generated for the detected geometry.
+//
+// Every probe is timed with the `--timer` serialization (rdtscp by default), 
+// whose overhead is calibrated at startup and subtracted from each sample.
+// `--counters` also counts cache misses and prefetches with the hardware 
+// counters around every probe and writes the totals of each iteration to 
+// <dir>/counters.csv. It's ignored by `--validate`, and skipped 
+// with a warning if perf isn't available.
+//
+// `--adaptive` calibrates a model of the L1/L2/L3/RAM latencies at startup, 
+// classifies every sample as it's taken, and stops profiling a set once the 
+// hit rate of every cell is decided, rather than always running all of the 
+// iterations.
+//
+// The L2 geometry is detected at startup, `--geometry` prints it and checks 
+// the associativity with a timing sweep. Test sets that don't exist in the 
+// detected L2 are skipped. `--sets` replaces the hand picked test sets with 
+// a list in the format of `--cpus`, e.g. "0-1023,4096".
+//
+// `--level l3` profiles the last level cache instead, with eviction sets 
+// placed by physical address and slice (see `new_llc_eviction_set`, this 
+// needs root for /proc/self/pagemap). The number of slices is detected, or 
+// given with `--slices`. Every probe touches every set of the eviction set, 
+// so only one worker runs per L3, and targeted flushing is the default 
+// since flushing the whole eviction set is several times the size of the 
+// L3. `--adaptive` classifies with a per slice model of L3 hits and RAM. 
+// `--all-sets` isn't supported, its aggregate would be sets^2 cells.
+//
+// `--aggressors` takes a list of CPUs in the format of `--cpus` to run
+// aggressor threads on while the first CPU of `--cpus` profiles (see
+// interference.h): each test set is profiled alone and then under the
+// `--aggressor` pattern, `stream` (the default) read-modify-writes a
+// buffer of `--aggressor-size` bytes (twice the L3) in order, `stride` every
+// `--aggressor-stride` lines of it (4), and `prime` primes the sets of an
+// LLC eviction set that hold the `--aggressor-sets` (the test sets) of the
+// profiled level, evicting the victim's lines from the shared L3 (see
+// `prime_llc_sets_of`). The aggressors
+// start together at a TSC deadline as the victim starts, and pause between
+// the profiles. How many cells of each profile the neighbors changed (see
+// `--validate`) and how many lines the aggressors touched are written to
+// <dir>/interference.csv. The aggressors must be on other physical cores.
+//
+// `--drain` takes a list of CPUs in the format of `--cpus`, one for each
+// worker, to run a drain thread on (see occupancy_drain.h): the workers only
+// hand the samples of an aggregate and their counter rows to it through a
+// lock-free ring, and the drain folds them into the aggregate and writes
+// the counter log, so none of that happens on the profiling core. The
+// samples of a result file are still stored by the worker, that's cheaper
+// than handing them over. A worker
+// waits for its drain between iterations if the ring is full, never during
+// one. The drains must be on other physical cores than the workers.
+//
+// The test sets are profiled `--chunk` iterations at a time (all of them 
+// unless `--chunk` or `--resume` is given, 10 with `--resume`, or all of 
+// them with `--adaptive`), and each chunk is appended to its result file 
+// and recorded with a checksum of its samples in <dir>/manifest.csv, along 
+// with a fingerprint of the machine (see campaign.h). `--resume` keeps the 
+// iterations of every (set, warmup) pair that the manifest recorded on this 
+// machine and whose samples still match, and only profiles the rest: an 
+// interrupted sweep loses at most a chunk of each profile, and a larger 
+// `--iterations` adds iterations to the existing files. It refuses to add 
+// to a file sampled with other options (the engine, `--timer`, 
+// `--generic-kernels`, `--counters` or `--drain`). Without it every 
+// profile starts over. The means of a result file are only reduced again 
+// if the file changed.
+//
+// Each result file is also reduced to the mean latency of every (s', l') 
+// cell, the matrix plot.py draws, e.g. 8_warmup_O1_S0_means.csv (see 
+// `occupancy_result_to_means`).
+int occupancy_experiment(int argc, char** argv, const experiment_context* context)
+{
+    static const size_t default_sets[] = {0, 1, 3, 64, 128, 256, 384, 448, 500, 510, 511};
+    int set_list[MAX_TEST_SETS];
+    size_t selected_sets[MAX_TEST_SETS];
+    const size_t* test_set = default_sets;
+    size_t size_test_set = sizeof(default_sets) / sizeof(size_t);
+    size_t iterations = DEFAULT_ITERATIONS;
+    size_t chunk = 0;
+    int warmup_list[MAX_WARMUPS];
+    size_t selected_warmups[MAX_WARMUPS];
+    const size_t* warmups = default_warmups;
+    size_t size_warmups = sizeof(default_warmups) / sizeof(size_t);
+    const char* output = DEFAULT_OUTPUT;
+    const char* variant = context == NULL ? "O1" : context->variant;
+
+    int run_all_sets = 0;
+    int run_validate = 0;
+    int run_geometry = 0;
+    int engine_selected = 0;
+    occupancy_perturbation perturbation = {0};
+    occupancy_options options = {
+        .flush_mode = OCCUPANCY_FLUSH_FULL,
+        .neighborhood = OCCUPANCY_DEFAULT_NEIGHBORHOOD,
+        .batch_size = 1,
+        .perturbation = NULL,
+        .generic_kernels = 0,
+        .timer = NULL,
+        .eviction_sets = context == NULL ? NULL : context->eviction_sets
+    };
+    timer_mode timer_mode = TIMER_RDTSCP;
+    int record_counters = 0;
+    int adaptive = 0;
+    int cpus[MAX_CPUS] = {0};
+    size_t num_cpus = 0;
+    int drain_cpus[MAX_CPUS] = {0};
+    size_t num_drain_cpus = 0;
+    int profile_llc = 0;
+    size_t llc_slices = 0;
+    int resume = 0;
+    interference_options aggressors;
+    default_interference_options(&aggressors);
+
+    for (int i = 1; i < argc; i++)
+    {
+        const int parsed = parse_interference_option(argc, argv, &i, &aggressors);
+        if (parsed < 0) {
+            return 1;
+        } else if (parsed > 0) {
+            continue;
+        }
+
+        if (strcmp(argv[i], "--all-sets") == 0) {
+            run_all_sets = 1;
+        } else if (strcmp(argv[i], "--geometry") == 0) {
+            run_geometry = 1;
+        } else if (strcmp(argv[i], "--validate") == 0) {
+            run_validate = 1;
+        } else if (strcmp(argv[i], "--flush") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            engine_selected = 1;
+            if (strcmp(mode, "full") == 0) {
+                options.flush_mode = OCCUPANCY_FLUSH_FULL;
+            } else if (strcmp(mode, "targeted") == 0) {
+                options.flush_mode = OCCUPANCY_FLUSH_TARGETED;
+            } else {
+                fprintf(stderr, "unknown flush mode: %s\n", mode);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            engine_selected = 1;
+            if (parse_count(argv[++i], &options.batch_size) != 0 || options.batch_size > OCCUPANCY_MAX_BATCH_SIZE) {
+                fprintf(stderr, "batch size must be between 1 and %d\n", OCCUPANCY_MAX_BATCH_SIZE);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--timer") == 0 && i + 1 < argc) {
+            if (parse_timer_mode(argv[++i], &timer_mode) != 0) {
+                fprintf(stderr, "unknown timer: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--adaptive") == 0) {
+            adaptive = 1;
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            record_counters = 1;
+        } else if (strcmp(argv[i], "--generic-kernels") == 0) {
+            options.generic_kernels = 1;
+        } else if (strcmp(argv[i], "--perturbation") == 0) {
+            options.perturbation = &perturbation;
+        } else if (strcmp(argv[i], "--neighborhood") == 0 && i + 1 < argc) {
+            // 0 flushes the probed line alone
+            const char* neighborhood = argv[++i];
+            if (strcmp(neighborhood, "region") == 0) {
+                options.neighborhood = OCCUPANCY_NEIGHBORHOOD_REGION;
+            } else if (strcmp(neighborhood, "0") == 0) {
+                options.neighborhood = 0;
+            } else if (parse_count(neighborhood, &options.neighborhood) != 0) {
+                fprintf(stderr, "--neighborhood must be a number of lines or region: %s\n", neighborhood);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            num_cpus = parse_cpu_list(argv[++i], cpus, MAX_CPUS);
+            if (num_cpus == 0) {
+                fprintf(stderr, "invalid cpu list: %s\n", argv[i]);
+                return 1;
+            }
+            num_cpus = unique_physical_cores(cpus, num_cpus);
+        } else if (strcmp(argv[i], "--drain") == 0 && i + 1 < argc) {
+            num_drain_cpus = parse_cpu_list(argv[++i], drain_cpus, MAX_CPUS);
+            if (num_drain_cpus == 0) {
+                fprintf(stderr, "invalid drain cpu list: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+            const char* level = argv[++i];
+            if (strcmp(level, "l2") == 0) {
+                profile_llc = 0;
+            } else if (strcmp(level, "l3") == 0) {
+                profile_llc = 1;
+            } else {
+                fprintf(stderr, "unknown cache level: %s\n", level);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--slices") == 0 && i + 1 < argc) {
+            if (parse_count(argv[++i], &llc_slices) != 0 || llc_slices > LLC_MAX_SLICES) {
+                fprintf(stderr, "--slices must be between 1 and %d: %s\n", LLC_MAX_SLICES, argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--sets") == 0 && i + 1 < argc) {
+            size_test_set = parse_cpu_list(argv[++i], set_list, MAX_TEST_SETS);
+            if (size_test_set == 0) {
+                fprintf(stderr, "invalid set list: %s\n", argv[i]);
+                return 1;
+            }
+            for (size_t set = 0; set < size_test_set; set++) {
+                selected_sets[set] = (size_t)set_list[set];
+            }
+            test_set = selected_sets;
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = 1;
+        } else if (strcmp(argv[i], "--warmups") == 0 && i + 1 < argc) {
+            size_warmups = parse_cpu_list(argv[++i], warmup_list, MAX_WARMUPS);
+            if (size_warmups == 0) {
+                fprintf(stderr, "invalid warmup list: %s\n", argv[i]);
+                return 1;
+            }
+            for (size_t w = 0; w < size_warmups; w++) {
+                selected_warmups[w] = (size_t)warmup_list[w];
+            }
+            warmups = selected_warmups;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            if (parse_count(argv[++i], &iterations) != 0) {
+                fprintf(stderr, "--iterations must be positive: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) {
+            if (parse_count(argv[++i], &chunk) != 0) {
+                fprintf(stderr, "--chunk must be positive: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--all-sets | --validate | --geometry] [--cpus <list>] "
+                    "[--flush full|targeted] [--neighborhood <lines>|region] "
+                    "[--batch <probes>] [--perturbation] [--generic-kernels] "
+                    "[--timer rdtscp|cpuid|rdpmc] [--counters] [--adaptive] "
+                    "[--level l2|l3] [--slices <n>] [--sets <list>] [--resume] [--drain <list>] "
+                    "[--warmups <list>] [--iterations <n>] [--chunk <n>] [--output <dir>] "
+                    "[--aggressors <list> [--aggressor stream|stride|prime] [--aggressor-size <bytes>] "
+                    "[--aggressor-stride <lines>] [--aggressor-sets <list>]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // size everything from the L2 of the machine we're running on
+    cache_geometry geometry;
+    if (detect_cache_geometry(&geometry) != 0) {
+        fprintf(stderr, "warning: not every cache level was detected, using defaults\n");
+    }
+
+    if (run_geometry) {
+        print_cache_geometry(stdout, geometry);
+
+        // double check the associativity of the L2 with a timing sweep
+        size_t measured_ways = 0;
+        if (measure_associativity(geometry.l2, 2 * geometry.l2.ways, &measured_ways) != 0) {
+            fprintf(stderr, "could not measure the associativity of the L2\n");
+            return 1;
+        }
+        printf("L2 : %lu ways measured\n", measured_ways);
+        return measured_ways == geometry.l2.ways ? 0 : 1;
+    }
+
+    // the profiled level, and for the LLC its number of slices
+    cache_level_geometry level = geometry.l2;
+    if (profile_llc) {
+        level = geometry.l3;
+        if (llc_slices == 0) {
+            llc_slices = detect_llc_slices(num_cpus > 0 ? cpus[0] : -1);
+        }
+        if (level.size == 0 || llc_slices == 0) {
+            fprintf(stderr, "no L3 was detected, or its number of slices is unknown (use --slices)\n");
+            return 1;
+        }
+        if (run_all_sets) {
+            fprintf(stderr, "--all-sets isn't supported for the L3, select sets with --sets\n");
+            return 1;
+        }
+        if (!engine_selected) {
+            options.flush_mode = OCCUPANCY_FLUSH_TARGETED;
+        }
+        num_cpus = unique_llcs(cpus, num_cpus);
+        printf("L3 : %lu slices of %lu sets\n", llc_slices, level.sets / llc_slices);
+    } else {
+        llc_slices = 0;
+    }
+
+    // one drain per worker, each on a core no worker profiles on
+    if (num_drain_cpus > 0) {
+        const size_t num_workers = num_cpus == 0 ? 1 : num_cpus;
+        if (num_drain_cpus < num_workers) {
+            fprintf(stderr, "--drain needs a cpu for each of the %lu workers\n", num_workers);
+            return 1;
+        }
+        for (size_t d = 0; d < num_workers; d++)
+        {
+            const long core = physical_core_id(drain_cpus[d]);
+            for (size_t c = 0; c < num_cpus; c++)
+            {
+                if (drain_cpus[d] == cpus[c] || (core >= 0 && core == physical_core_id(cpus[c]))) {
+                    fprintf(stderr, "drain cpu %d shares a core with a worker\n", drain_cpus[d]);
+                    return 1;
+                }
+            }
+        }
+        options.drain_cpus = drain_cpus;
+    }
+
+    // calibrate the timer on this thread, pinned workers calibrate their own
+    probe_timer timer;
+    init_timer(timer_mode, &timer);
+    print_timer(stdout, timer);
+    options.timer = &timer;
+    options.fingerprint = sampling_fingerprint(options);
+
+    latency_model model;
+    if (adaptive) {
+        if (calibrate_latency_model(&timer, geometry, &model) != 0) {
+            fprintf(stderr, "warning: the cache levels can't be told apart by latency, "
+                    "running every iteration\n");
+        } else {
+            print_latency_model(stdout, model);
+            options.model = &model;
+        }
+    }
+
+    // the L3 of each slice is told apart from RAM with the lines of an LLC 
+    // eviction set, which is only needed for the calibration
+    llc_latency_model llc_model;
+    if (adaptive && profile_llc && options.model != NULL) {
+        eviction_set llc_es = options.eviction_sets != NULL
+            ? acquire_eviction_set(options.eviction_sets, level.sets, level.ways, 0, llc_slices)
+            : new_llc_eviction_set(level, llc_slices, 0);
+        if (llc_es.warmup_section.start_addr == NULL
+            || calibrate_llc_latency_model(&timer, geometry, llc_es, llc_slices, &llc_model) != 0) {
+            fprintf(stderr, "warning: the L3 of every slice can't be told apart from RAM, "
+                    "running every iteration\n");
+            options.model = NULL;
+        } else {
+            print_llc_latency_model(stdout, &llc_model);
+            options.llc_model = &llc_model;
+        }
+        if (options.eviction_sets != NULL) {
+            release_eviction_set(options.eviction_sets, &llc_es);
+        } else {
+            free_eviction_set(&llc_es);
+        }
+    }
+
+    // check that perf works here before asking every worker to open counters
+    FILE* counter_log = NULL;
+    perf_counters counters;
+    if (record_counters && !run_validate) {
+        if (open_perf_counters(&counters) != 0) {
+            fprintf(stderr, "warning: hardware counters are unavailable, not recording counters\n");
+        } else {
+            close_perf_counters(&counters);
+            char filename[EXPERIMENT_PATH_SIZE];
+            snprintf(filename, sizeof(filename), "%s/counters.csv", output);
+            counter_log = fopen(filename, "w");
+            if (counter_log == NULL) {
+                perror(filename);
+                return 1;
+            }
+            write_occupancy_counters_header(counter_log);
+        }
+    }
+    options.counter_log = counter_log;
+
+    int status = 0;
+    if (aggressors.num_cpus > 0) {
+        if (num_cpus == 0 || run_validate || run_all_sets) {
+            fprintf(stderr, "--aggressors needs --cpus for the victim, and no --validate or --all-sets\n");
+            status = 1;
+        }
+        for (size_t a = 0; a < aggressors.num_cpus && status == 0; a++)
+        {
+            const long core = physical_core_id(aggressors.cpus[a]);
+            if (aggressors.cpus[a] == cpus[0] || (core >= 0 && core == physical_core_id(cpus[0]))) {
+                fprintf(stderr, "aggressor cpu %d shares a core with the victim\n", aggressors.cpus[a]);
+                status = 1;
+            }
+        }
+
+        // priming attacks the sets under test unless told otherwise, in
+        // the L3 the aggressors share with the victim
+        aggressors.level = level;
+        aggressors.llc_slices = llc_slices;
+        if (aggressors.pattern == INTERFERENCE_PRIME && aggressors.num_sets == 0) {
+            for (size_t s = 0; s < size_test_set && s < INTERFERENCE_MAX_SETS; s++) {
+                if (test_set[s] < level.sets) {
+                    aggressors.sets[aggressors.num_sets++] = test_set[s];
+                }
+            }
+        }
+        if (status == 0 && aggressors.pattern == INTERFERENCE_PRIME && llc_slices == 0
+            && prime_llc_sets_of(&aggressors, level, geometry.l3, detect_llc_slices(cpus[0])) != 0) {
+            status = 1;
+        }
+
+        interference group;
+        if (status == 0 && start_interference(&aggressors, &group) != 0) {
+            status = 1;
+        }
+        if (status == 0) {
+            status = interfere(level, llc_slices, test_set, size_test_set, warmups, size_warmups,
+                               iterations, cpus, output, options, &group);
+            stop_interference(&group);
+        }
+    } else if (run_validate) {
+        if (!engine_selected) {
+            options.flush_mode = OCCUPANCY_FLUSH_TARGETED;
+        }
+        status = validate(level, llc_slices, test_set, size_test_set, warmups, size_warmups,
+                          iterations, cpus, num_cpus, output, options);
+    } else if (run_all_sets) {
+        status = all_sets(level, warmups, size_warmups, iterations, cpus, num_cpus, output, variant, options);
+    } else {
+        // every chunk restarts the workers and rebuilds their eviction 
+        // sets, so a profile is only chunked when it's asked to be or may 
+        // be resumed. An adaptive profile decides on all of its iterations 
+        // at once.
+        if (chunk == 0) {
+            chunk = resume && options.model == NULL ? DEFAULT_CHUNK : iterations;
+        }
+
+        campaign c;
+        if (open_campaign(output, "occupancy", host_fingerprint(geometry), &c) != 0) {
+            status = 1;
+        } else {
+            status = test_sets(level, llc_slices, test_set, size_test_set, warmups, size_warmups,
+                               iterations, chunk, cpus, num_cpus, resume, output, variant, options, &c);
+            close_campaign(&c);
+        }
+    }
+
+    if (options.perturbation != NULL) {
+        print_perturbation(options.perturbation, options.batch_size);
+    }
+
+    if (counter_log != NULL) {
+        fclose(counter_log);
+    }
+    free_timer(&timer);
+    return status;
+}
@@ -2,47 +2,581 @@
 #include "address.h"
 #include "cache.h"
 #include "eviction_set.h"
+#include "latency_model.h"
+#include "occupancy_aggregate.h"
+#include "occupancy_drain.h"
+#include "perf_counters.h"
+#include "probe_kernels.h"
+#include "result_file.h"
+#include "timer.h"
 #include "utility.h"
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-void occupancy_profile(eviction_set es, const size_t set, const size_t num_iterations, const char* output_filename)
+// Where the samples of a profile go, exactly one of `results` and `agg` is 
+// set. With a drain the samples for `agg`, and the counter rows, are 
+// handed to it.
+typedef struct {
+    occupancy_result_file* results;
+    occupancy_aggregate* agg;
+    occupancy_drain* drain;
+} sample_sink;
+
+static inline __attribute__((always_inline))
+void record_sample(const sample_sink sink, const size_t set, const size_t iter,
+                   const size_t s_prime, const size_t l_prime, const uint64_t time)
+{
+    if (sink.results != NULL) {
+        // the indices are implied by the position in the file
+        store_occupancy_result(*sink.results, iter, s_prime, l_prime, time);
+    } else if (sink.drain != NULL) {
+        // the drain folds it in on another core, see `begin_drained_profile`
+        drain_sample(sink.drain, s_prime, l_prime, time);
+    } else {
+        // fold the sample into the statistics for (s, s`, l`)
+        record_occupancy_sample(*sink.agg, set, s_prime, l_prime, time);
+    }
+}
+
+// The hit/miss counts of every cell (s`, l`) of the set being profiled, used
+// to stop once every cell is decided
+typedef struct {
+    const latency_model* model;
+    const llc_latency_model* llc_model;
+    uint32_t* hits;
+    uint32_t* samples;
+    size_t lines_per_set;
+    size_t num_cells;
+} cell_classifier;
+
+// Returns a classifier with `hits == NULL` if `model` is NULL or the counts
+// can't be allocated, in which case every sample is ignored
+static cell_classifier new_cell_classifier(const eviction_set es, const latency_model* model,
+                                           const llc_latency_model* llc_model)
+{
+    cell_classifier c = { .model = NULL, .llc_model = NULL, .hits = NULL, .samples = NULL };
+    if (model == NULL) {
+        return c;
+    }
+
+    c.lines_per_set = es.cache_lines + es.warmup_lines;
+    c.num_cells = es.cache_sets * c.lines_per_set;
+    c.hits = calloc(c.num_cells, sizeof(uint32_t));
+    c.samples = calloc(c.num_cells, sizeof(uint32_t));
+    if (c.hits == NULL || c.samples == NULL) {
+        perror("occupancy_profile");
+        free(c.hits);
+        free(c.samples);
+        c.hits = NULL;
+        c.samples = NULL;
+        return c;
+    }
+
+    c.model = model;
+    c.llc_model = llc_model;
+    return c;
+}
+
+static void free_cell_classifier(cell_classifier* c)
+{
+    free(c->hits);
+    free(c->samples);
+    c->hits = NULL;
+    c->samples = NULL;
+}
+
+static inline __attribute__((always_inline))
+void classify_sample(const cell_classifier c, const size_t s_prime, const size_t l_prime,
+                     const uint64_t time)
+{
+    if (c.hits == NULL) {
+        return;
+    }
+
+    const size_t cell = s_prime * c.lines_per_set + l_prime;
+    c.hits[cell] += c.llc_model != NULL
+        ? llc_hit(c.llc_model, s_prime, time)
+        : classify_latency(c.model, time) <= OCCUPANCY_HIT_LEVEL;
+    c.samples[cell] += 1;
+}
+
+// Returns whether the hit rate of every cell is known to be above or below
+// 1/2 with `LATENCY_CONFIDENCE_Z` confidence
+static int all_cells_decided(const cell_classifier c)
+{
+    if (c.hits == NULL) {
+        return 0;
+    }
+
+    for (size_t cell = 0; cell < c.num_cells; cell++)
+    {
+        if (c.samples[cell] == 0) {
+            return 0;
+        }
+
+        double lower, upper;
+        wilson_interval(c.hits[cell], c.samples[cell], LATENCY_CONFIDENCE_Z, &lower, &upper);
+        if (lower <= 0.5 && upper >= 0.5) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Flushes `line` and the `neighborhood` lines on either side of it (or its
+// whole 4 KiB region), without leaving the eviction set. Does not fence.
+static inline __attribute__((always_inline))
+void flush_line_neighborhood(const eviction_set es, const byte* line, const size_t neighborhood)
+{
+    const byte* es_start = es.memory.start_addr;
+    const byte* es_last = es.memory.start_addr + es.memory.size - CACHE_LINE_SIZE;
+
+    const byte* first;
+    const byte* last;
+    if (neighborhood == OCCUPANCY_NEIGHBORHOOD_REGION) {
+        first = (const byte*)((uint64_t)line & ~(uint64_t)(PREFETCH_REGION_SIZE - 1));
+        last = first + PREFETCH_REGION_SIZE - CACHE_LINE_SIZE;
+        first = first < es_start ? es_start : first;
+        last = last > es_last ? es_last : last;
+    } else {
+        const size_t span = neighborhood * CACHE_LINE_SIZE;
+        first = (size_t)(line - es_start) > span ? line - span : es_start;
+        last = (size_t)(es_last - line) > span ? line + span : es_last;
+    }
+
+    for (const byte* to_flush = first; to_flush <= last; to_flush += CACHE_LINE_SIZE)
+    {
+        clflush(to_flush);
+    }
+}
+
+// Brings the eviction set back to a clean state before the next probe.
+// `touched` are the lines accessed since the last clean other than the
+// lines of `set`, if `touched == NULL` nothing is known about the state of
+// the cache and the whole eviction set is flushed.
+static inline __attribute__((always_inline))
+void clean_eviction_set(const eviction_set es, const size_t set,
+                        byte* const* touched, const size_t num_touched,
+                        const occupancy_options options)
+{
+    if (options.flush_mode == OCCUPANCY_FLUSH_FULL || touched == NULL) {
+        flush_eviction_set(es);
+        return;
+    }
+
+    // the prime only touched the lines of `set`, and the probes only touched
+    // `touched`, so those (and whatever the prefetchers pulled in around
+    // them) are the only lines of ES that can be cached
+    for (size_t line = 0; line < es.cache_lines + es.warmup_lines; line++)
+    {
+        flush_line_neighborhood(es, eviction_set_line(es, set, line), options.neighborhood);
+    }
+    for (size_t i = 0; i < num_touched; i++)
+    {
+        flush_line_neighborhood(es, touched[i], options.neighborhood);
+    }
+
+    // fence to ensure flush has completed
+    fence();
+}
+
+// Returns the kernels specialized for the geometry of `es`, or NULL if the
+// generic prime has to be used
+static const probe_kernels* select_kernels(const eviction_set es, const occupancy_options options)
+{
+    // the kernels compute the addresses of a contiguous set
+    if (options.generic_kernels || es.lines != NULL) {
+        return NULL;
+    }
+
+    return find_probe_kernels(es.cache_sets, es.cache_lines, es.warmup_lines);
+}
+
+// Primes set s in ES, then accesses `line` and determines hit or miss. With
+// `counters` the hardware counters are only enabled around the access.
+static inline __attribute__((always_inline))
+uint64_t prime_and_probe(const eviction_set es, const size_t set, const byte* line,
+                         const probe_kernels* kernels, const probe_timer* timer,
+                         const perf_counters* counters)
+{
+    // the prime + probe kernels time with rdtscp, so they only stand in for 
+    // the rdtscp timer
+    if (kernels != NULL && counters == NULL && (timer == NULL || timer->mode == TIMER_RDTSCP)) {
+        const uint64_t time = kernels->prime_probe(es.warmup_section.start_addr, set, line);
+        return timer == NULL ? time : timer_subtract_overhead(timer, time);
+    }
+
+    if (kernels != NULL) {
+        kernels->prime(es.warmup_section.start_addr, set);
+    } else {
+        prime_set_write_with_warmup(es, set);
+    }
+
+    if (counters != NULL) {
+        enable_perf_counters(counters);
+    }
+    const uint64_t time = timer == NULL ? time_one_line_read_access(line) : timed_read(timer, line);
+    if (counters != NULL) {
+        disable_perf_counters(counters);
+    }
+
+    return time;
+}
+
+void write_occupancy_counters_header(/*in*/ FILE* counter_log)
+{
+    fprintf(counter_log, "WarmupLines,Set,Iteration,Probes,Cycles");
+    write_perf_counts_header(counter_log);
+    fprintf(counter_log, "\n");
+    fflush(counter_log);
+}
+
+// Appends the counts of one iteration to the counter log (or hands them to
+// the drain) and resets the counters for the next one
+static void log_counters(const eviction_set es, const size_t set, const size_t iter,
+                         const size_t probes, const uint64_t cycles, const occupancy_options options,
+                         const sample_sink sink)
 {
-    // Init the CSV file 
-    FILE* csv = fopen(output_filename, "w");
-    fprintf(csv, "Iteration,SetIndex,LineIndex,Cycles\n");
+    perf_counts counts;
+    read_perf_counters(options.counters, &counts);
+    reset_perf_counters(options.counters);
+
+    if (sink.drain != NULL) {
+        const occupancy_counter_row row = {
+            .warmup_lines = es.warmup_lines,
+            .set = set,
+            .iteration = iter,
+            .probes = probes,
+            .cycles = cycles,
+            .counts = counts
+        };
+        drain_counter_row(sink.drain, &row);
+        return;
+    }
+
+    // hold the lock for the whole row, other workers may share the log
+    flockfile(options.counter_log);
+    fprintf(options.counter_log, "%lu,%lu,%lu,%lu,%lu", es.warmup_lines, set, iter, probes, cycles);
+    write_perf_counts(options.counter_log, counts);
+    fprintf(options.counter_log, "\n");
+    funlockfile(options.counter_log);
+}
+
+// The PAPP algorithm, one prime per probe. Sets the number of iterations
+// that ran, returns 0.
+static int profile_set_single(const eviction_set es, const size_t set, const size_t num_iterations,
+                              const occupancy_options options, const sample_sink sink,
+                              size_t* iterations_run)
+{
+    byte* previous = NULL;
+    cell_classifier classifier = new_cell_classifier(es, options.model, options.llc_model);
+    *iterations_run = num_iterations;
+    const probe_kernels* kernels = select_kernels(es, options);
+    const perf_counters* counters = options.counter_log != NULL ? options.counters : NULL;
+
+    if (counters != NULL) {
+        reset_perf_counters(counters);
+    }
 
     // For the number of iterations given in the call
     for (size_t iter = 0; iter < num_iterations; iter ++)
     {
+        uint64_t cycles = 0;
+
+        // Wait for the drain to have room for the whole iteration, so it 
+        // never has to wait in the middle of one
+        if (sink.drain != NULL) {
+            wait_for_drain_room(sink.drain);
+        }
+
         // For each line, (s`, l`), in ES
         for (size_t s_prime = 0; s_prime < es.cache_sets; s_prime++)
         {
             for (size_t l_prime = 0; l_prime < es.cache_lines + es.warmup_lines; l_prime++)
             {
                 // Calculate the address of the line we want to observe, (s`, l`)
-                byte* line = es.warmup_section.start_addr 
-                    + (s_prime * CACHE_LINE_SIZE) 
-                    + (l_prime * CACHE_LINE_SIZE * es.cache_sets);
+                byte* line = eviction_set_line(es, s_prime, l_prime);
 
-                // Flush ES from the cache 
-                flush_eviction_set(es);
+                // Flush ES (or the parts of it that may be cached) from the cache
+                clean_eviction_set(es, set, previous == NULL ? NULL : &previous, 1, options);
 
-                // Prime set s in ES 
-                prime_set_write_with_warmup(es, set); 
+                // Prime set s in ES, then access cache line (s`, l`) and
+                // determine hit or miss
+                const uint64_t time = prime_and_probe(es, set, line, kernels, options.timer, counters);
+                previous = line;
+                cycles += time;
 
-                // Access cache line (s`, l`) and determine hit or miss 
-                const uint64_t time = time_one_line_read_access(line);
-
-                // Print the data from this iteration
-                // Format is: "Set,Iteration,SPrime,LPrime,Cycles"
-                fprintf(csv, "%lu,%lu,%lu,%lu\n",
-                        iter,s_prime,l_prime,time);
+                // Record the data from this iteration
+                record_sample(sink, set, iter, s_prime, l_prime, time);
+                classify_sample(classifier, s_prime, l_prime, time);
                 fence();
             } // l_prime
-        } // s_prime 
-    } // iter 
-    
-    // Close the csv file 
-    fclose(csv);
+        } // s_prime
+
+        if (sink.drain != NULL) {
+            end_drained_iteration(sink.drain);
+        }
+        if (counters != NULL) {
+            log_counters(es, set, iter, es.cache_sets * (es.cache_lines + es.warmup_lines), cycles,
+                         options, sink);
+        }
+
+        // Stop once more iterations can't change any hit/miss decision
+        if (all_cells_decided(classifier)) {
+            *iterations_run = iter + 1;
+            break;
+        }
+    } // iter
+
+    free_cell_classifier(&classifier);
+    return 0;
+}
+
+// Primes once per batch of `options.batch_size` probes, probing the lines of
+// each iteration in a new pseudorandom order through a pointer chase.
+// Sets the number of iterations that ran, returns -1 if the probe order
+// couldn't be allocated.
+static int profile_set_batched(const eviction_set es, const size_t set, const size_t num_iterations,
+                               const occupancy_options options, const sample_sink sink,
+                               size_t* iterations_run)
+{
+    const size_t lines_per_set = es.cache_lines + es.warmup_lines;
+    const size_t num_lines = es.cache_sets * lines_per_set;
+    const size_t batch_size = options.batch_size > OCCUPANCY_MAX_BATCH_SIZE
+        ? OCCUPANCY_MAX_BATCH_SIZE
+        : options.batch_size;
+
+    uint32_t* order = malloc(num_lines * sizeof(uint32_t));
+    if (order == NULL) {
+        perror("occupancy_profile");
+        return -1;
+    }
+
+    cell_classifier classifier = new_cell_classifier(es, options.model, options.llc_model);
+    *iterations_run = num_iterations;
+
+    byte* batch[OCCUPANCY_MAX_BATCH_SIZE] = {0};
+    byte* previous_batch[OCCUPANCY_MAX_BATCH_SIZE] = {0};
+    uint64_t times[OCCUPANCY_MAX_BATCH_SIZE] = {0};
+    size_t previous_size = 0;
+    int first_clean = 1;
+
+    const probe_kernels* kernels = select_kernels(es, options);
+    const perf_counters* counters = options.counter_log != NULL ? options.counters : NULL;
+
+    if (counters != NULL) {
+        reset_perf_counters(counters);
+    }
+
+    occupancy_perturbation perturbation = {0};
+    uint64_t rng = 0x9E3779B97F4A7C15ULL ^ (set + 1);
+
+    // For the number of iterations given in the call
+    for (size_t iter = 0; iter < num_iterations; iter ++)
+    {
+        uint64_t cycles = 0;
+
+        // Wait for the drain to have room for the whole iteration, so it 
+        // never has to wait in the middle of one
+        if (sink.drain != NULL) {
+            wait_for_drain_room(sink.drain);
+        }
+
+        // Shuffle the order of every line, (s`, l`), in ES (Fisher-Yates)
+        for (size_t i = 0; i < num_lines; i++) {
+            order[i] = (uint32_t)i;
+        }
+        for (size_t i = num_lines - 1; i > 0; i--) {
+            const size_t j = next_random(&rng) % (i + 1);
+            const uint32_t tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+
+        for (size_t start = 0; start < num_lines; start += batch_size)
+        {
+            const size_t size = num_lines - start < batch_size ? num_lines - start : batch_size;
+
+            // Link the lines of this batch into a chain, this writes to the
+            // lines so it has to happen before the flush
+            for (size_t i = 0; i < size; i++) {
+                const size_t index = order[start + i];
+                batch[i] = eviction_set_line(es, index / lines_per_set, index % lines_per_set);
+            }
+            for (size_t i = 0; i < size; i++) {
+                *(byte**)(batch[i] + OCCUPANCY_CHASE_OFFSET) = i + 1 < size ? batch[i + 1] : NULL;
+            }
+
+            // Flush ES (or the parts of it that may be cached) from the cache,
+            // this batch was just written to and the last batch was probed
+            if (first_clean || options.flush_mode == OCCUPANCY_FLUSH_FULL) {
+                clean_eviction_set(es, set, NULL, 0, options);
+                first_clean = 0;
+            } else {
+                for (size_t i = 0; i < size; i++) {
+                    flush_line_neighborhood(es, batch[i], options.neighborhood);
+                }
+                clean_eviction_set(es, set, previous_batch, previous_size, options);
+            }
+
+            // Prime set s in ES
+            if (kernels != NULL) {
+                kernels->prime(es.warmup_section.start_addr, set);
+            } else {
+                prime_set_write_with_warmup(es, set);
+            }
+
+            // Chase through the batch, timing each access
+            if (counters != NULL) {
+                enable_perf_counters(counters);
+            }
+            byte* line = batch[0];
+            if (options.timer != NULL) {
+                for (size_t i = 0; i < size; i++) {
+                    times[i] = timed_pointer_chase(options.timer, (byte* const*)(line + OCCUPANCY_CHASE_OFFSET), &line);
+                }
+            } else {
+                for (size_t i = 0; i < size; i++) {
+                    times[i] = time_one_pointer_chase((byte* const*)(line + OCCUPANCY_CHASE_OFFSET), &line);
+                }
+            }
+            fence();
+            if (counters != NULL) {
+                disable_perf_counters(counters);
+            }
+
+            // Record the data from this batch
+            for (size_t i = 0; i < size; i++) {
+                const size_t index = order[start + i];
+                record_sample(sink, set, iter, index / lines_per_set, index % lines_per_set, times[i]);
+                classify_sample(classifier, index / lines_per_set, index % lines_per_set, times[i]);
+                perturbation.sum[i] += times[i];
+                perturbation.count[i] += 1;
+                previous_batch[i] = batch[i];
+                cycles += times[i];
+            }
+            previous_size = size;
+        }
+
+        if (sink.drain != NULL) {
+            end_drained_iteration(sink.drain);
+        }
+        if (counters != NULL) {
+            log_counters(es, set, iter, num_lines, cycles, options, sink);
+        }
+
+        // Stop once more iterations can't change any hit/miss decision
+        if (all_cells_decided(classifier)) {
+            *iterations_run = iter + 1;
+            break;
+        }
+    } // iter
+
+    if (options.perturbation != NULL) {
+        for (size_t i = 0; i < batch_size; i++) {
+            __atomic_fetch_add(&options.perturbation->sum[i], perturbation.sum[i], __ATOMIC_RELAXED);
+            __atomic_fetch_add(&options.perturbation->count[i], perturbation.count[i], __ATOMIC_RELAXED);
+        }
+    }
+
+    free_cell_classifier(&classifier);
+    free(order);
+    return 0;
+}
+
+static int profile_set(const eviction_set es, const size_t set, const size_t num_iterations,
+                       const occupancy_options options, const sample_sink sink,
+                       size_t* iterations_run)
+{
+    if (options.batch_size > 1) {
+        return profile_set_batched(es, set, num_iterations, options, sink, iterations_run);
+    } else {
+        return profile_set_single(es, set, num_iterations, options, sink, iterations_run);
+    }
+}
+
+int occupancy_profile(eviction_set es, const size_t set, const size_t num_iterations,
+                      const char* output_filename, const occupancy_options options)
+{
+    // Map the result file, this reserves space for every sample so nothing
+    // but a store happens in between probes. It only gets its final name 
+    // once it's complete
+    char partial_filename[PATH_MAX];
+    snprintf(partial_filename, sizeof(partial_filename), "%s.partial", output_filename);
+
+    occupancy_result_file results = open_occupancy_result_file(
+        partial_filename, es, set, num_iterations);
+    if (results.cycles == NULL) {
+        return -1;
+    }
+    results.header->sampling = options.fingerprint;
+
+    // The samples are stored into the file here, a drain only writes the 
+    // counter rows
+    sample_sink sink = { .results = &results, .agg = NULL, .drain = NULL };
+    if (options.drain != NULL && begin_drained_profile(options.drain, es, set, NULL) == 0) {
+        sink.drain = options.drain;
+    }
+
+    size_t iterations_run = 0;
+    int status = profile_set(es, set, num_iterations, options, sink, &iterations_run);
+    if (sink.drain != NULL) {
+        finish_drained_profile(sink.drain);
+    }
+
+    // Only keep the iterations that ran if the profile stopped early
+    if (status == 0) {
+        status = truncate_occupancy_result_file(&results, iterations_run);
+    }
+
+    // Unmap and close the result file
+    close_occupancy_result_file(&results);
+
+    // A failed profile never gets the final name
+    if (status != 0) {
+        unlink(partial_filename);
+        return -1;
+    }
+    if (rename(partial_filename, output_filename) != 0) {
+        perror(output_filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+int occupancy_profile_all_sets(eviction_set es, const size_t num_iterations,
+                               occupancy_aggregate* agg, const occupancy_options options)
+{
+    // For every set, s, in ES
+    for (size_t set = 0; set < es.cache_sets; set++)
+    {
+        if (occupancy_profile_aggregate(es, set, num_iterations, *agg, options) != 0) {
+            return -1;
+        }
+    } // set
+
+    agg->num_iterations += num_iterations;
+    return 0;
+}
+
+int occupancy_profile_aggregate(eviction_set es, const size_t set, const size_t num_iterations,
+                                occupancy_aggregate agg, const occupancy_options options)
+{
+    sample_sink sink = { .results = NULL, .agg = &agg, .drain = NULL };
+    if (options.drain != NULL && begin_drained_profile(options.drain, es, set, &agg) == 0) {
+        sink.drain = options.drain;
+    }
+
+    size_t iterations_run = 0;
+    const int status = profile_set(es, set, num_iterations, options, sink, &iterations_run);
+    if (sink.drain != NULL) {
+        finish_drained_profile(sink.drain);
+    }
+
+    return status;
 }
@@ -0,0 +1,229 @@
+#include "parallel_profile.h"
+#include "cpu.h"
+#include "eviction_set.h"
+#include "eviction_set_pool.h"
+#include "occupancy_drain.h"
+#include "occupancy_profile.h"
+#include "perf_counters.h"
+#include "timer.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// State shared between all of the workers
+typedef struct {
+    const occupancy_job* jobs;
+    size_t num_jobs;
+    size_t cache_sets;
+    size_t cache_lines;
+    size_t llc_slices;
+    size_t num_iterations;
+    occupancy_options options;
+    atomic_size_t next_job;
+    atomic_int failed;
+    atomic_int dropped_job;
+    atomic_int warned_permuted;
+} job_queue;
+
+typedef struct {
+    job_queue* queue;
+    int cpu;
+    int drain_cpu;
+    pthread_t thread;
+} worker;
+
+// Pulls jobs off the queue until it's empty. `cpu < 0` skips pinning.
+// Gets an eviction set for a job with `warmup_lines` warmup lines, from the 
+// pool of the options if there is one
+static eviction_set get_eviction_set(const job_queue* queue, const size_t warmup_lines)
+{
+    if (queue->options.eviction_sets != NULL) {
+        return acquire_eviction_set(queue->options.eviction_sets, queue->cache_sets,
+                                    queue->cache_lines, warmup_lines, queue->llc_slices);
+    }
+
+    return queue->llc_slices == 0
+        ? new_eviction_set(queue->cache_sets, queue->cache_lines, warmup_lines)
+        : new_llc_eviction_set((cache_level_geometry){ .sets = queue->cache_sets,
+                                                       .ways = queue->cache_lines },
+                               queue->llc_slices, warmup_lines);
+}
+
+// Frees an eviction set of `get_eviction_set`, or hands it back to its pool
+static void put_eviction_set(const job_queue* queue, eviction_set* es)
+{
+    if (queue->options.eviction_sets != NULL) {
+        release_eviction_set(queue->options.eviction_sets, es);
+    } else {
+        free_eviction_set(es);
+    }
+}
+
+static void run_worker(job_queue* queue, const int cpu, const int drain_cpu)
+{
+    if (cpu >= 0 && pin_to_cpu(cpu) != 0) {
+        atomic_store(&queue->failed, 1);
+        return;
+    }
+
+    // the overhead depends on the core, and an rdpmc counter only counts 
+    // for the thread that opened it, so each worker calibrates its own timer
+    occupancy_options options = queue->options;
+    probe_timer timer;
+    if (options.timer != NULL) {
+        init_timer(options.timer->mode, &timer);
+        options.timer = &timer;
+    }
+
+    // counters only count for the thread that opened them
+    perf_counters counters;
+    if (options.counter_log != NULL) {
+        if (open_perf_counters(&counters) == 0) {
+            options.counters = &counters;
+        } else {
+            options.counter_log = NULL;
+        }
+    }
+
+    // samples are stored by a drain on another core, started after the 
+    // counters so it knows whether it writes counter rows. A drain has a
+    // single producer, so every worker starts its own
+    options.drain = NULL;
+    if (options.drain_cpus != NULL) {
+        options.drain = start_occupancy_drain(drain_cpu, OCCUPANCY_DRAIN_DEFAULT_CAPACITY,
+                                              options.counter_log);
+        if (options.drain == NULL) {
+            atomic_store(&queue->failed, 1);
+        }
+    }
+
+    // each worker keeps its own eviction set, so no two cores ever touch 
+    // the same lines
+    eviction_set es = { .warmup_section = { .start_addr = NULL } };
+    size_t es_warmup_lines = 0;
+
+    // a worker without its drain leaves the jobs to the others
+    while (options.drain_cpus == NULL || options.drain != NULL)
+    {
+        const size_t index = atomic_fetch_add(&queue->next_job, 1);
+        if (index >= queue->num_jobs) {
+            break;
+        }
+
+        const occupancy_job job = queue->jobs[index];
+
+        // only swap the eviction set if the warmup size changed
+        if (es.warmup_section.start_addr == NULL || es_warmup_lines != job.warmup_lines) {
+            put_eviction_set(queue, &es);
+            es = get_eviction_set(queue, job.warmup_lines);
+            es_warmup_lines = job.warmup_lines;
+        }
+        if (es.warmup_section.start_addr == NULL) {
+            fprintf(stderr, "failed to allocate an eviction set for set %lu\n", job.set);
+            atomic_store(&queue->dropped_job, 1);
+            break;
+        }
+        if (es.permuted && job.agg == NULL && atomic_exchange(&queue->warned_permuted, 1) == 0) {
+            fprintf(stderr, "warning: the eviction sets were found without physical addresses, "
+                    "set %lu (and SetIndex) may be another set of the cache\n", job.set);
+        }
+
+        const int status = job.agg != NULL
+            ? occupancy_profile_aggregate(es, job.set, queue->num_iterations, *job.agg, options)
+            : occupancy_profile(es, job.set, queue->num_iterations, job.output_filename, options);
+        if (status != 0) {
+            fprintf(stderr, "failed to profile set %lu\n", job.set);
+            atomic_store(&queue->dropped_job, 1);
+        }
+    }
+
+    put_eviction_set(queue, &es);
+    if (options.drain != NULL) {
+        if (options.drain->stalls > 0) {
+            fprintf(stderr, "note: %lu iterations on cpu %d waited for the drain\n",
+                    options.drain->stalls, cpu);
+        }
+        stop_occupancy_drain(options.drain);
+    }
+    if (options.timer != NULL) {
+        free_timer(&timer);
+    }
+    if (options.counter_log != NULL) {
+        close_perf_counters(&counters);
+    }
+}
+
+static void* worker_main(void* arg)
+{
+    worker* w = arg;
+    run_worker(w->queue, w->cpu, w->drain_cpu);
+    return NULL;
+}
+
+int run_occupancy_jobs(
+    /*in*/ const occupancy_job* jobs,
+    /*in*/ const size_t num_jobs,
+    /*in*/ const int* cpus,
+    /*in*/ const size_t num_cpus,
+    /*in*/ const size_t cache_sets,
+    /*in*/ const size_t cache_lines,
+    /*in*/ const size_t llc_slices,
+    /*in*/ const size_t num_iterations,
+    /*in*/ const occupancy_options options)
+{
+    job_queue queue = {
+        .jobs = jobs,
+        .num_jobs = num_jobs,
+        .cache_sets = cache_sets,
+        .cache_lines = cache_lines,
+        .llc_slices = llc_slices,
+        .num_iterations = num_iterations,
+        .options = options
+    };
+    atomic_init(&queue.next_job, 0);
+    atomic_init(&queue.failed, 0);
+    atomic_init(&queue.dropped_job, 0);
+    atomic_init(&queue.warned_permuted, 0);
+
+    // no CPUs given, run everything right here
+    if (num_cpus == 0) {
+        run_worker(&queue, -1, options.drain_cpus != NULL ? options.drain_cpus[0] : -1);
+        return (atomic_load(&queue.failed) || atomic_load(&queue.dropped_job)) ? -1 : 0;
+    }
+
+    worker* workers = calloc(num_cpus, sizeof(worker));
+    if (workers == NULL) {
+        perror("run_occupancy_jobs");
+        return -1;
+    }
+
+    size_t started = 0;
+    for (; started < num_cpus; started++)
+    {
+        workers[started] = (worker){
+            .queue = &queue,
+            .cpu = cpus[started],
+            .drain_cpu = options.drain_cpus != NULL ? options.drain_cpus[started] : -1
+        };
+        if (pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0) {
+            fprintf(stderr, "failed to start a worker on cpu %d\n", cpus[started]);
+            atomic_store(&queue.failed, 1);
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    free(workers);
+
+    // a worker may have failed to pin after others drained the queue, 
+    // every job still ran as long as one worker was alive and none was
+    // dropped for lack of an eviction set
+    return (started == 0 || atomic_load(&queue.next_job) < num_jobs
+            || atomic_load(&queue.dropped_job)) ? -1 : 0;
+}
@@ -0,0 +1,782 @@
+#define _GNU_SOURCE
+#include "utility.h"
+#include "access_pattern.h"
+#include "address.h"
+#include "buffer.h"
+#include "cache.h"
+#include "cache_geometry.h"
+#include "cpu.h"
+#include "experiment.h"
+#include "interference.h"
+#include "latency_model.h"
+#include "llc_slice.h"
+#include "perf_counters.h"
+#include "prefetcher.h"
+#include "timer.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define BUF_SIZE (1 << 20)
+#define DEFAULT_OUTPUT "results/patterns"
+
+// Retrainings timed to report the cost of a prefetcher reset
+#define RESET_TIMING_REPETITIONS 11
+
+// Probes per training size of each pattern, unless given with `--samples`
+#define DEFAULT_SAMPLES 200
+
+#define MAX_PATTERNS 256
+#define MAX_SPEC_SIZE 512
+
+// The probe distances and delays (in TSC cycles) of `--timeliness`, unless 
+// given with `--distance` and `--delays`
+#define DEFAULT_MAX_DISTANCE 16
+static const uint64_t default_delays[] = {0, 50, 100, 200, 400, 800, 1600, 3200};
+
+// Times a read of `addr`. If `counts` isn't NULL the hardware counters are 
+// enabled around the read and what they counted is stored in it.
+static inline uint64_t probe(const probe_timer* timer, const perf_counters* counters,
+                             const byte* addr, perf_counts* counts)
+{
+    if (counts == NULL) {
+        return timed_read(timer, addr);
+    }
+
+    reset_perf_counters(counters);
+    enable_perf_counters(counters);
+    const uint64_t time = timed_read(timer, addr);
+    disable_perf_counters(counters);
+    read_perf_counters(counters, counts);
+
+    return time;
+}
+
+// Writes the counts of every sample next to their training size, if they
+// were recorded
+static void write_counters(const char* filename, const uint16_t* training_size,
+                           const perf_counts* counts, const size_t samples)
+{
+    if (counts == NULL) {
+        return;
+    }
+
+    FILE *results = fopen(filename, "w");
+    if (results == NULL) {
+        perror(filename);
+        return;
+    }
+    fprintf(results, "TrainingSize");
+    write_perf_counts_header(results);
+    fprintf(results, "\n");
+    for (size_t i = 0; i < samples; i++) {
+        fprintf(results, "%hu", training_size[i]);
+        write_perf_counts(results, counts[i]);
+        fprintf(results, "\n");
+    }
+    fclose(results);
+}
+
+// Which of the built in patterns run when none are given
+typedef enum {
+    PRESET_ALL,
+    PRESET_NEXT_LINE,
+    PRESET_STRIDE
+} pattern_preset;
+
+// The built in patterns, run when none are given. `stride_<n>` patterns are
+// added for each of `default_strides`
+static const char* const default_patterns[] = {
+    "next_line deltas=1 train=64",
+    "backwards deltas=-1",
+    "backwards_stride_4 deltas=-4",
+    "two_streams deltas=1 streams=2",
+    "eight_streams deltas=2 streams=8",
+    "page_cross deltas=1 start=56 train=16",
+    "page_cross_backwards deltas=-1 start=7 train=16",
+    "footprint deltas=3,2,4,23",
+    "irregular deltas=1,2,1,5,-3",
+};
+static const uint16_t default_strides[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 16, 24, 32};
+
+// Appends the patterns of a pattern file, one description per line, blank 
+// lines and lines starting with '#' are skipped
+static int read_pattern_file(const char* filename, access_pattern* patterns, size_t* num_patterns)
+{
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        perror(filename);
+        return -1;
+    }
+
+    int status = 0;
+    char line[MAX_SPEC_SIZE];
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        const char* spec = line + strspn(line, " \t");
+        if (*spec == '#' || *spec == '\n' || *spec == '\0') {
+            continue;
+        }
+
+        if (*num_patterns == MAX_PATTERNS) {
+            fprintf(stderr, "%s: more than %d patterns\n", filename, MAX_PATTERNS);
+            status = -1;
+        } else {
+            status = parse_access_pattern(spec, &patterns[(*num_patterns)++]);
+        }
+    }
+
+    fclose(file);
+    return status;
+}
+
+// Adds the built in patterns of a preset, the next line pattern is the 
+// first of `default_patterns`
+static void add_default_patterns(const pattern_preset preset, access_pattern* patterns, size_t* num_patterns)
+{
+    const size_t num_defaults = preset == PRESET_ALL ? sizeof(default_patterns) / sizeof(default_patterns[0])
+                              : preset == PRESET_NEXT_LINE ? 1
+                              : 0;
+    for (size_t i = 0; i < num_defaults; i++) {
+        parse_access_pattern(default_patterns[i], &patterns[(*num_patterns)++]);
+    }
+
+    if (preset == PRESET_NEXT_LINE) {
+        return;
+    }
+
+    char spec[MAX_SPEC_SIZE];
+    for (size_t i = 0; i < sizeof(default_strides) / sizeof(uint16_t); i++) {
+        snprintf(spec, sizeof(spec), "stride_%u deltas=%u", default_strides[i], default_strides[i]);
+        parse_access_pattern(spec, &patterns[(*num_patterns)++]);
+    }
+}
+
+// Takes `num_samples` probes of a compiled pattern, the training sizes
+// interleaved, so drift over the run affects them all
+static void sample_pattern(const access_kernel kernel, byte* target, const size_t t_size,
+                           const prefetcher_trainer* trainer, const probe_timer* timer,
+                           const perf_counters* counters, const size_t num_sizes,
+                           const size_t num_samples, uint16_t* training_size, uint64_t* times,
+                           perf_counts* counts)
+{
+    for (size_t i = 0; i < num_samples; i++) {
+        // clear out buffer and retrain the prefetcher, this ensures we 
+        // start with a "clean slate"
+        flush_buffer(target, t_size);
+        retrain_prefetcher(*trainer);
+
+        // ensure all prior memory accesses have completed
+        fence();
+
+        const size_t ts = i % num_sizes;
+        training_size[i] = (uint16_t)ts;
+
+        // make `ts` accesses of every stream, then time the access the 
+        // pattern predicts next
+        const byte* next = run_access_kernel(kernel, ts);
+        times[i] = probe(timer, counters, next, counts == NULL ? NULL : &counts[i]);
+    }
+}
+
+// Writes the latency of every probe of a pattern to `filename`
+static int write_latencies(const char* filename, const uint16_t* training_size, const uint64_t* times,
+                           const size_t num_samples)
+{
+    FILE* results = fopen(filename, "w");
+    if (results == NULL) {
+        perror(filename);
+        return -1;
+    }
+
+    fprintf(results, "TrainingSize,Cycles\n");
+    for (size_t i = 0; i < num_samples; i++) {
+        fprintf(results, "%hu,%lu\n", training_size[i], times[i]);
+    }
+    fclose(results);
+    return 0;
+}
+
+// Appends a row per training size comparing the coverage of a pattern
+// alone and under interference to <dir>/interference.csv
+static void write_interference_coverage(FILE* out, const access_pattern* pattern, const char* aggressor,
+                                        const pattern_coverage* quiet, const pattern_coverage* loud)
+{
+    for (size_t ts = 0; ts <= pattern->max_training; ts++)
+    {
+        if (quiet[ts].samples == 0 || loud[ts].samples == 0) {
+            continue;
+        }
+
+        const double quiet_coverage = (double)(quiet[ts].levels[LEVEL_L1] + quiet[ts].levels[LEVEL_L2])
+            / (double)quiet[ts].samples;
+        const double loud_coverage = (double)(loud[ts].levels[LEVEL_L1] + loud[ts].levels[LEVEL_L2])
+            / (double)loud[ts].samples;
+        fprintf(out, "%s,%lu,%s,%lu,%.4f,%.4f,%.4f,%.4f\n", pattern->name, ts, aggressor, loud[ts].samples,
+                quiet_coverage, loud_coverage,
+                (double)quiet[ts].levels[LEVEL_L3] / (double)quiet[ts].samples,
+                (double)loud[ts].levels[LEVEL_L3] / (double)loud[ts].samples);
+    }
+}
+
+// Probes a pattern `samples_per_size` times at every training size, and 
+// writes the latency of every probe to <output>/<name>.csv. If 
+// `summary` isn't NULL the probes are classified with `model` and the 
+// coverage of each training size is appended to it.
+//
+// With a `group` of aggressors the probes are taken again while they run,
+// written to <output>/<name>_<aggressor>.csv, and if `interference_out`
+// isn't NULL the coverage of each training size with and without them is
+// appended to it.
+static int run_pattern(const access_pattern* pattern, byte* target, const size_t t_size,
+                       const prefetcher_trainer* trainer, const probe_timer* timer,
+                       const perf_counters* counters, const latency_model* model,
+                       const size_t samples_per_size, const char* output, FILE* summary,
+                       interference* group, FILE* interference_out)
+{
+    access_kernel kernel = compile_access_pattern(pattern, 0, target, t_size);
+    if (kernel.addresses == NULL) {
+        return -1;
+    }
+
+    const size_t num_sizes = pattern->max_training + 1;
+    const size_t num_samples = samples_per_size * num_sizes;
+    uint16_t* training_size = malloc(num_samples * sizeof(uint16_t));
+    uint64_t* times = malloc(num_samples * sizeof(uint64_t));
+    perf_counts* counts = counters == NULL ? NULL : calloc(num_samples, sizeof(perf_counts));
+    pattern_coverage* coverage = malloc(num_sizes * sizeof(pattern_coverage));
+    if (training_size == NULL || times == NULL || coverage == NULL || (counters != NULL && counts == NULL)) {
+        perror("run_pattern");
+        free(training_size);
+        free(times);
+        free(counts);
+        free(coverage);
+        free_access_kernel(&kernel);
+        return -1;
+    }
+
+    // print progress 
+    printf("Testing ");
+    print_access_pattern(stdout, pattern);
+    fflush(stdout);
+
+    sample_pattern(kernel, target, t_size, trainer, timer, counters, num_sizes, num_samples,
+                   training_size, times, counts);
+
+    // print results
+    char filename[EXPERIMENT_PATH_SIZE] = {0};
+    snprintf(filename, sizeof(filename), "%s/%s.csv", output, pattern->name);
+    int status = write_latencies(filename, training_size, times, num_samples);
+
+    snprintf(filename, sizeof(filename), "%s/%s_counters.csv", output, pattern->name);
+    write_counters(filename, training_size, counts, num_samples);
+
+    if (summary != NULL) {
+        tally_pattern_coverage(model, training_size, times, num_samples, pattern->max_training, coverage);
+        write_pattern_coverage(summary, pattern, coverage);
+    }
+
+    if (group != NULL)
+    {
+        // the same probes with the neighbors running, without counters
+        const char* aggressor = interference_pattern_name(group->options.pattern);
+        resume_interference(group);
+        sample_pattern(kernel, target, t_size, trainer, timer, NULL, num_sizes, num_samples,
+                       training_size, times, NULL);
+        pause_interference(group);
+
+        snprintf(filename, sizeof(filename), "%s/%s_%s.csv", output, pattern->name, aggressor);
+        status |= write_latencies(filename, training_size, times, num_samples);
+
+        pattern_coverage* loud = malloc(num_sizes * sizeof(pattern_coverage));
+        if (loud == NULL) {
+            perror("run_pattern");
+            status = -1;
+        } else if (interference_out != NULL && summary != NULL) {
+            tally_pattern_coverage(model, training_size, times, num_samples, pattern->max_training, loud);
+            write_interference_coverage(interference_out, pattern, aggressor, coverage, loud);
+
+            const pattern_coverage q = coverage[pattern->max_training];
+            const pattern_coverage l = loud[pattern->max_training];
+            if (q.samples > 0 && l.samples > 0) {
+                printf("  coverage at %lu accesses: %.3f alone, %.3f with %lu %s aggressors\n",
+                       pattern->max_training,
+                       (double)(q.levels[LEVEL_L1] + q.levels[LEVEL_L2]) / (double)q.samples,
+                       (double)(l.levels[LEVEL_L1] + l.levels[LEVEL_L2]) / (double)l.samples,
+                       group->num_aggressors, aggressor);
+            }
+        }
+        free(loud);
+    }
+
+    free(training_size);
+    free(times);
+    free(counts);
+    free(coverage);
+    free_access_kernel(&kernel);
+    return status;
+}
+
+// Parses a comma separated list of delays
+static size_t parse_delays(const char* list, uint64_t* delays, const size_t max_delays)
+{
+    size_t count = 0;
+    const char* p = list;
+    while (*p != '\0')
+    {
+        char* end;
+        const unsigned long long delay = strtoull(p, &end, 10);
+        if (end == p || (*end != ',' && *end != '\0') || count == max_delays) {
+            return 0;
+        }
+
+        delays[count++] = delay;
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    return count;
+}
+
+// Trains the prefetcher with the full training of a pattern, waits, and 
+// probes one of the lines the pattern would access next, `samples_per_cell` 
+// times for every (distance, delay) pair. The latency of every probe is 
+// written to <output>/<name>_timeliness.csv, and if `surface` isn't 
+// NULL the medians and coverage of every pair are appended to it.
+static int run_timeliness(const access_pattern* pattern, byte* target, const size_t t_size,
+                          const prefetcher_trainer* trainer, const probe_timer* timer,
+                          const latency_model* model, const size_t max_distance,
+                          const uint64_t* delays, const uint64_t* measured_delays,
+                          const size_t num_delays, const size_t samples_per_cell,
+                          const char* output, FILE* surface)
+{
+    access_kernel kernel = compile_access_pattern(pattern, max_distance - 1, target, t_size);
+    if (kernel.addresses == NULL) {
+        return -1;
+    }
+
+    const size_t training = pattern->max_training;
+    const size_t num_cells = max_distance * num_delays;
+    const size_t num_samples = samples_per_cell * num_cells;
+    uint16_t* distance = malloc(num_samples * sizeof(uint16_t));
+    uint16_t* delay = malloc(num_samples * sizeof(uint16_t));
+    uint64_t* times = malloc(num_samples * sizeof(uint64_t));
+    timeliness_cell* cells = malloc(num_cells * sizeof(timeliness_cell));
+    if (distance == NULL || delay == NULL || times == NULL || cells == NULL) {
+        perror("run_timeliness");
+        free(distance);
+        free(delay);
+        free(times);
+        free(cells);
+        free_access_kernel(&kernel);
+        return -1;
+    }
+
+    // print progress 
+    printf("Testing timeliness of ");
+    print_access_pattern(stdout, pattern);
+    fflush(stdout);
+
+    // a single probe per sample, probing one line would train the 
+    // prefetcher for the next
+    for (size_t i = 0; i < num_samples; i++) {
+        flush_buffer(target, t_size);
+        retrain_prefetcher(*trainer);
+        fence();
+
+        const size_t cell = i % num_cells;
+        distance[i] = (uint16_t)(cell / num_delays + 1);
+        delay[i] = (uint16_t)(cell % num_delays);
+
+        run_access_kernel(kernel, training);
+        busy_wait(delays[delay[i]]);
+        times[i] = timed_read(timer, access_kernel_probe(kernel, training, distance[i]));
+    }
+
+    // print results
+    char filename[EXPERIMENT_PATH_SIZE] = {0};
+    snprintf(filename, sizeof(filename), "%s/%s_timeliness.csv", output, pattern->name);
+    FILE* results = fopen(filename, "w");
+    if (results == NULL) {
+        perror(filename);
+    } else {
+        fprintf(results, "Distance,Delay,Cycles\n");
+        for (size_t i = 0; i < num_samples; i++) {
+            fprintf(results, "%hu,%lu,%lu\n", distance[i], delays[delay[i]], times[i]);
+        }
+        fclose(results);
+    }
+
+    if (surface != NULL
+        && tally_timeliness_surface(model, distance, delay, times, num_samples,
+                                    max_distance, num_delays, cells) == 0) {
+        write_timeliness_surface(surface, pattern, max_distance, delays, measured_delays, num_delays, cells);
+
+        // the depth is the furthest line prefetched by the longest delay, 
+        // and a line arrives by the first delay it's mostly covered at
+        size_t depth = 0;
+        for (size_t d = 1; d <= max_distance; d++) {
+            if (cells[(d - 1) * num_delays + num_delays - 1].coverage >= 0.5) {
+                depth = d;
+            }
+        }
+        printf("    depth %lu lines, arrival:", depth);
+        for (size_t d = 1; d <= depth; d++) {
+            for (size_t i = 0; i < num_delays; i++) {
+                if (cells[(d - 1) * num_delays + i].coverage >= 0.5) {
+                    printf(" +%lu by %lu", d, measured_delays[i]);
+                    break;
+                }
+            }
+        }
+        printf("\n");
+    }
+
+    free(distance);
+    free(delay);
+    free(times);
+    free(cells);
+    free_access_kernel(&kernel);
+    return results == NULL ? -1 : 0;
+}
+
+// Usage: naive_stride [--timer rdtscp|cpuid|rdpmc] [--counters] 
+//                     [--streams <n>] [--prefetchers <disabled mask>]
+//                     [--pattern <description>]... [--patterns <file>]
+//                     [--samples <n>] [--timeliness [--distance <lines>] 
+//                     [--delays <cycles,...>]] [--preset all|next-line|stride]
+//                     [--cpu <cpu>] [--output <dir>]
+//                     [--aggressors <list> [--aggressor stream|stride|prime]
+//                      [--aggressor-size <bytes>] [--aggressor-stride <lines>]
+//                      [--aggressor-sets <list>]]
+//
+// Measures how the prefetchers respond to access patterns (see 
+// `access_pattern` for the description format), each given with 
+// `--pattern` or read from a `--patterns` file with one description per 
+// line. Without either the built in patterns of `--preset` run, all of 
+// them by default: next line, strides of 1 to 32 lines, backwards strides, 
+// interleaved streams, page crossings, a spatial footprint and an 
+// irregular delta sequence. The next-line preset only runs the next line 
+// pattern, and the stride preset only the strides.
+//
+// Every pattern is probed `--samples` times (200 by default) at every 
+// training size on `--cpu` (the CPU the job started on by default), and 
+// the latencies are written to <dir>/<name>.csv, where the output 
+// directory is results/patterns by default. A latency model is calibrated 
+// at startup and the coverage of every training size, and how many of the 
+// prefetches were late, is written to <dir>/summary.csv.
+//
+// `--counters` also counts the cache misses and prefetches of every sample 
+// with the hardware counters, and writes them next to each result file 
+// (e.g. <dir>/next_line_counters.csv).
+//
+// `--timeliness` measures how far ahead and how early the prefetchers fetch 
+// instead. After the full training of a pattern, the line 1 to `--distance` 
+// (16 by default) accesses ahead is probed after each of the `--delays` (in 
+// TSC cycles, 0 to 3200 by default), `--samples` times per pair. Each wait 
+// is calibrated at startup. The latencies go to <dir>/<name>_timeliness.csv, 
+// and the (distance, delay) surface of median latency and coverage to 
+// <dir>/timeliness.csv. The prefetch depth and the delay by which each line 
+// arrives are printed.
+//
+// Before every sample the prefetcher is retrained by walking `--streams` 
+// streams (64 by default) over twice the size of the L2, see 
+// `retrain_prefetcher`. The median cost of a retraining is printed.
+//
+// `--aggressors` takes a list of CPUs (like "2-3") to run aggressor threads
+// on, see interference.h. Every pattern is then probed again while they
+// run the `--aggressor` pattern: `stream` (the default) read-modify-writes
+// a buffer of `--aggressor-size` bytes (twice the L3) in order, `stride`
+// every `--aggressor-stride` lines of it (4), and `prime` primes the sets of
+// an LLC eviction set that hold the `--aggressor-sets` of the L2 (all of
+// them by default), so the neighbors evict lines of those sets from the
+// shared L3 (see `prime_llc_sets_of`, it needs root for the pagemap).
+// The aggressors start together at a TSC deadline as the probes start. The
+// latencies go to <dir>/<name>_<aggressor>.csv, and the coverage of every
+// training size alone and with the neighbors (and how much of each was
+// late) to <dir>/interference.csv. It isn't supported with `--timeliness`.
+//
+// `--prefetchers` disables the hardware prefetchers in the mask (bit 0 the 
+// L2 streamer, 1 the L2 adjacent line, 2 the L1 next line and 3 the L1 IP 
+// prefetcher, e.g. 0xf for all of them) on the CPU the test runs on through 
+// MSR 0x1a4, and restores them at the end. It needs root and the msr module.
+int pattern_experiment(int argc, char** argv, const experiment_context* context)
+{ 
+    (void)context;
+    timer_mode timer_mode = TIMER_RDTSCP;
+    int record_counters = 0;
+    size_t num_streams = PREFETCHER_DEFAULT_STREAMS;
+    int control_prefetchers = 0;
+    uint32_t disabled_prefetchers = 0;
+    size_t samples_per_size = DEFAULT_SAMPLES;
+    access_pattern patterns[MAX_PATTERNS];
+    size_t num_patterns = 0;
+    pattern_preset preset = PRESET_ALL;
+    int cpu = -1;
+    const char* output = DEFAULT_OUTPUT;
+    int timeliness = 0;
+    size_t max_distance = DEFAULT_MAX_DISTANCE;
+    uint64_t delays[TIMELINESS_MAX_DELAYS];
+    size_t num_delays = sizeof(default_delays) / sizeof(uint64_t);
+    memcpy(delays, default_delays, sizeof(default_delays));
+    interference_options aggressors;
+    default_interference_options(&aggressors);
+
+    for (int i = 1; i < argc; i++)
+    {
+        const int parsed = parse_interference_option(argc, argv, &i, &aggressors);
+        if (parsed < 0) {
+            return 1;
+        } else if (parsed > 0) {
+            continue;
+        }
+
+        if (strcmp(argv[i], "--timer") == 0 && i + 1 < argc) {
+            if (parse_timer_mode(argv[++i], &timer_mode) != 0) {
+                fprintf(stderr, "unknown timer: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            record_counters = 1;
+        } else if (strcmp(argv[i], "--streams") == 0 && i + 1 < argc) {
+            num_streams = strtoul(argv[++i], NULL, 10);
+            if (num_streams == 0) {
+                fprintf(stderr, "--streams must be positive\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--prefetchers") == 0 && i + 1 < argc) {
+            disabled_prefetchers = (uint32_t)strtoul(argv[++i], NULL, 0);
+            control_prefetchers = 1;
+            if (disabled_prefetchers > PREFETCHER_ALL) {
+                fprintf(stderr, "the prefetcher mask must be at most 0x%x\n", PREFETCHER_ALL);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pattern") == 0 && i + 1 < argc) {
+            if (num_patterns == MAX_PATTERNS) {
+                fprintf(stderr, "more than %d patterns\n", MAX_PATTERNS);
+                return 1;
+            }
+            if (parse_access_pattern(argv[++i], &patterns[num_patterns++]) != 0) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--patterns") == 0 && i + 1 < argc) {
+            if (read_pattern_file(argv[++i], patterns, &num_patterns) != 0) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            samples_per_size = strtoul(argv[++i], NULL, 10);
+            if (samples_per_size == 0) {
+                fprintf(stderr, "--samples must be positive\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--timeliness") == 0) {
+            timeliness = 1;
+        } else if (strcmp(argv[i], "--distance") == 0 && i + 1 < argc) {
+            max_distance = strtoul(argv[++i], NULL, 10);
+            if (max_distance == 0 || max_distance > TIMELINESS_MAX_DISTANCE) {
+                fprintf(stderr, "--distance must be between 1 and %d\n", TIMELINESS_MAX_DISTANCE);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--delays") == 0 && i + 1 < argc) {
+            num_delays = parse_delays(argv[++i], delays, TIMELINESS_MAX_DELAYS);
+            if (num_delays == 0) {
+                fprintf(stderr, "invalid delays (at most %d): %s\n", TIMELINESS_MAX_DELAYS, argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--preset") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (strcmp(name, "all") == 0) {
+                preset = PRESET_ALL;
+            } else if (strcmp(name, "next-line") == 0) {
+                preset = PRESET_NEXT_LINE;
+            } else if (strcmp(name, "stride") == 0) {
+                preset = PRESET_STRIDE;
+            } else {
+                fprintf(stderr, "unknown preset: %s\n", name);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            if (parse_cpu_list(argv[++i], &cpu, 1) == 0) {
+                fprintf(stderr, "invalid cpu: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--timer rdtscp|cpuid|rdpmc] [--counters] "
+                    "[--streams <n>] [--prefetchers <disabled mask>] "
+                    "[--pattern <description>]... [--patterns <file>] [--samples <n>] "
+                    "[--timeliness [--distance <lines>] [--delays <cycles,...>]] "
+                    "[--preset all|next-line|stride] [--cpu <cpu>] [--output <dir>] "
+                    "[--aggressors <list> [--aggressor stream|stride|prime] [--aggressor-size <bytes>] "
+                    "[--aggressor-stride <lines>] [--aggressor-sets <list>]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (aggressors.num_cpus > 0 && timeliness) {
+        fprintf(stderr, "--aggressors isn't supported with --timeliness\n");
+        return 1;
+    }
+
+    if (num_patterns == 0) {
+        add_default_patterns(preset, patterns, &num_patterns);
+    }
+
+    // stay on this cpu, the prefetcher control MSR is per core
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+    if (pin_to_cpu(cpu) != 0) {
+        return 1;
+    }
+    for (size_t a = 0; a < aggressors.num_cpus; a++)
+    {
+        const long core = physical_core_id(aggressors.cpus[a]);
+        if (aggressors.cpus[a] == cpu || (core >= 0 && core == physical_core_id(cpu))) {
+            fprintf(stderr, "aggressor cpu %d shares a core with the victim\n", aggressors.cpus[a]);
+            return 1;
+        }
+    }
+
+    uint32_t saved_prefetchers = 0;
+    if (control_prefetchers) {
+        if (read_prefetcher_control(cpu, &saved_prefetchers) != 0
+            || write_prefetcher_control(cpu, disabled_prefetchers) != 0) {
+            fprintf(stderr, "the hardware prefetchers can't be controlled here\n");
+            return 1;
+        }
+        printf("cpu %d: prefetchers 0x%x disabled (was 0x%x)\n", cpu, disabled_prefetchers, saved_prefetchers);
+    }
+
+    probe_timer timer;
+    init_timer(timer_mode, &timer);
+    print_timer(stdout, timer);
+
+    perf_counters counters = { .group_fd = -1 };
+    if (record_counters && open_perf_counters(&counters) != 0) {
+        fprintf(stderr, "warning: hardware counters are unavailable, not recording counters\n");
+        record_counters = 0;
+    }
+
+    // the trainer walks twice the L2 of the machine we're running on to 
+    // give a "clean slate"
+    cache_geometry geometry;
+    detect_cache_geometry(&geometry);
+
+    // from here on every exit goes through `done`, which restores the
+    // prefetchers
+    int status = 0;
+    FILE* summary = NULL;
+    FILE* interference_out = NULL;
+    interference group;
+    int interfering = 0;
+
+    byte* target = map_buffer(BUF_SIZE, NULL);
+    prefetcher_trainer trainer = new_prefetcher_trainer(geometry.l2, num_streams);
+    if (target == NULL || trainer.buffer == NULL) {
+        fprintf(stderr, "failed to allocate the target or the trainer\n");
+        status = 1;
+        goto done;
+    }
+
+    printf("prefetcher reset: %lu streams, %lu cycles\n", num_streams,
+           time_prefetcher_retrain(trainer, RESET_TIMING_REPETITIONS));
+
+    // the coverage of a pattern is the fraction of probes served from the 
+    // L2 or closer
+    latency_model model;
+    char summary_filename[EXPERIMENT_PATH_SIZE];
+    snprintf(summary_filename, sizeof(summary_filename), "%s/%s", output,
+             timeliness ? "timeliness.csv" : "summary.csv");
+    if (calibrate_latency_model(&timer, geometry, &model) != 0) {
+        fprintf(stderr, "warning: the cache levels can't be told apart by latency, "
+                "not writing %s\n", summary_filename);
+    } else {
+        print_latency_model(stdout, model);
+        summary = fopen(summary_filename, "w");
+        if (summary == NULL) {
+            perror(summary_filename);
+        } else if (timeliness) {
+            write_timeliness_surface_header(summary);
+        } else {
+            write_pattern_coverage_header(summary);
+        }
+    }
+
+    // the waits overshoot, record how long they really are
+    uint64_t measured_delays[TIMELINESS_MAX_DELAYS];
+    if (timeliness) {
+        printf("delays:");
+        for (size_t i = 0; i < num_delays; i++) {
+            measured_delays[i] = calibrate_busy_wait(delays[i]);
+            printf(" %lu (%lu)", delays[i], measured_delays[i]);
+        }
+        printf(" cycles\n");
+    }
+
+    // the neighbors prime the sets of the L3 that hold the L2 sets
+    if (aggressors.num_cpus > 0) {
+        if (aggressors.pattern == INTERFERENCE_PRIME
+            && prime_llc_sets_of(&aggressors, geometry.l2, geometry.l3, detect_llc_slices(cpu)) != 0) {
+            status = 1;
+            goto done;
+        }
+        if (start_interference(&aggressors, &group) != 0) {
+            status = 1;
+            goto done;
+        }
+        interfering = 1;
+
+        char filename[EXPERIMENT_PATH_SIZE];
+        snprintf(filename, sizeof(filename), "%s/interference.csv", output);
+        interference_out = fopen(filename, "w");
+        if (interference_out == NULL) {
+            perror(filename);
+        } else {
+            fprintf(interference_out, "Pattern,TrainingSize,Aggressor,Samples,QuietCoverage,Coverage,"
+                    "QuietLate,Late\n");
+        }
+    }
+
+    const perf_counters* counters_or_null = record_counters ? &counters : NULL;
+    for (size_t i = 0; i < num_patterns; i++) {
+        if (timeliness) {
+            status |= run_timeliness(&patterns[i], target, BUF_SIZE, &trainer, &timer, &model,
+                                     max_distance, delays, measured_delays, num_delays,
+                                     samples_per_size, output, summary) != 0;
+        } else {
+            status |= run_pattern(&patterns[i], target, BUF_SIZE, &trainer, &timer, counters_or_null,
+                                  &model, samples_per_size, output, summary,
+                                  aggressors.num_cpus > 0 ? &group : NULL, interference_out) != 0;
+        }
+    }
+    printf("... Finished %lu patterns.\n", num_patterns);
+
+done:
+    if (interfering) {
+        stop_interference(&group);
+    }
+    if (interference_out != NULL) {
+        fclose(interference_out);
+    }
+
+    if (summary != NULL) {
+        fclose(summary);
+    }
+
+    if (control_prefetchers) {
+        write_prefetcher_control(cpu, saved_prefetchers);
+    }
+
+    free_prefetcher_trainer(&trainer);
+    unmap_buffer(target, BUF_SIZE);
+    if (record_counters) {
+        close_perf_counters(&counters);
+    }
+    free_timer(&timer);
+    return status;
+}
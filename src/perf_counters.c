@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include "perf_counters.h"
+
+#include <cpuid.h>
+#include <linux/perf_event.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Generic cache events are encoded as cache | (operation << 8) | (result << 16)
+#define HW_CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+// Raw Intel events are encoded as event | (umask << 8), these encodings are
+// the same from Skylake to Sapphire Rapids
+#define INTEL_RAW_EVENT(event, umask) ((event) | ((umask) << 8))
+
+typedef struct {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+    int intel_only;
+} event_spec;
+
+static const event_spec events[PERF_NUM_EVENTS] = {
+    [PERF_L1D_MISS] = {
+        "L1DMiss", PERF_TYPE_HW_CACHE,
+        HW_CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 0
+    },
+    [PERF_L1D_REPLACEMENT] = { "L1DReplacement", PERF_TYPE_RAW, INTEL_RAW_EVENT(0x51, 0x01), 1 },
+    [PERF_L2_MISS] = { "L2Miss", PERF_TYPE_RAW, INTEL_RAW_EVENT(0x24, 0x3f), 1 },
+    [PERF_L2_PREFETCH] = { "L2Prefetch", PERF_TYPE_RAW, INTEL_RAW_EVENT(0x24, 0xf8), 1 },
+    [PERF_L1D_PREFETCH] = {
+        "L1DPrefetch", PERF_TYPE_HW_CACHE,
+        HW_CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_PREFETCH, PERF_COUNT_HW_CACHE_RESULT_ACCESS), 0
+    },
+    [PERF_LLC_MISS] = {
+        "LLCMiss", PERF_TYPE_HW_CACHE,
+        HW_CACHE_EVENT(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 0
+    },
+};
+
+static int is_intel(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0, &eax, &ebx, &ecx, &edx) && ebx == 0x756e6547; // "Genu"
+}
+
+int open_perf_counters(/*out*/ perf_counters* pc)
+{
+    pc->group_fd = -1;
+    pc->num_open = 0;
+    for (size_t i = 0; i < PERF_NUM_EVENTS; i++) {
+        pc->fds[i] = -1;
+    }
+
+    const int intel = is_intel();
+
+    for (size_t i = 0; i < PERF_NUM_EVENTS; i++)
+    {
+        if (events[i].intel_only && !intel) {
+            continue;
+        }
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = events[i].type;
+        attr.size = sizeof(attr);
+        attr.config = events[i].config;
+        attr.disabled = pc->group_fd < 0; // only the leader starts disabled
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+
+        // unsupported events fail to open and are left out of the group
+        const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, pc->group_fd, 0);
+        if (fd < 0) {
+            continue;
+        }
+
+        if (ioctl(fd, PERF_EVENT_IOC_ID, &pc->ids[i]) != 0) {
+            close(fd);
+            continue;
+        }
+
+        if (pc->group_fd < 0) {
+            pc->group_fd = fd;
+        }
+        pc->fds[i] = fd;
+        pc->num_open++;
+    }
+
+    return pc->num_open > 0 ? 0 : -1;
+}
+
+void close_perf_counters(/*inout*/ perf_counters* pc)
+{
+    // close the members before the leader
+    for (size_t i = 0; i < PERF_NUM_EVENTS; i++)
+    {
+        if (pc->fds[i] >= 0 && pc->fds[i] != pc->group_fd) {
+            close(pc->fds[i]);
+        }
+        pc->fds[i] = -1;
+    }
+
+    if (pc->group_fd >= 0) {
+        close(pc->group_fd);
+    }
+
+    pc->group_fd = -1;
+    pc->num_open = 0;
+}
+
+void reset_perf_counters(/*in*/ const perf_counters* pc)
+{
+    if (pc->group_fd >= 0) {
+        ioctl(pc->group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void enable_perf_counters(/*in*/ const perf_counters* pc)
+{
+    if (pc->group_fd >= 0) {
+        ioctl(pc->group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void disable_perf_counters(/*in*/ const perf_counters* pc)
+{
+    if (pc->group_fd >= 0) {
+        ioctl(pc->group_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+int read_perf_counters(/*in*/ const perf_counters* pc, /*out*/ perf_counts* counts)
+{
+    for (size_t i = 0; i < PERF_NUM_EVENTS; i++) {
+        counts->values[i] = PERF_COUNT_UNAVAILABLE;
+    }
+
+    if (pc->group_fd < 0) {
+        return -1;
+    }
+
+    // PERF_FORMAT_GROUP | PERF_FORMAT_ID: nr, then a (value, id) pair per event
+    uint64_t buffer[1 + 2 * PERF_NUM_EVENTS];
+    const ssize_t size = read(pc->group_fd, buffer, sizeof(buffer));
+    if (size < (ssize_t)sizeof(uint64_t)) {
+        return -1;
+    }
+
+    for (uint64_t n = 0; n < buffer[0] && n < PERF_NUM_EVENTS; n++)
+    {
+        const uint64_t value = buffer[1 + 2 * n];
+        const uint64_t id = buffer[2 + 2 * n];
+
+        for (size_t i = 0; i < PERF_NUM_EVENTS; i++)
+        {
+            if (pc->fds[i] >= 0 && pc->ids[i] == id) {
+                counts->values[i] = value;
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+const char* perf_event_name(/*in*/ const perf_event_id event)
+{
+    return event < PERF_NUM_EVENTS ? events[event].name : "Unknown";
+}
+
+void write_perf_counts_header(/*in*/ FILE* out)
+{
+    for (size_t i = 0; i < PERF_NUM_EVENTS; i++) {
+        fprintf(out, ",%s", events[i].name);
+    }
+}
+
+void write_perf_counts(/*in*/ FILE* out, /*in*/ const perf_counts counts)
+{
+    for (size_t i = 0; i < PERF_NUM_EVENTS; i++)
+    {
+        if (counts.values[i] == PERF_COUNT_UNAVAILABLE) {
+            fputc(',', out);
+        } else {
+            fprintf(out, ",%lu", counts.values[i]);
+        }
+    }
+}
@@ -0,0 +1,262 @@
+#include "pointer_chase.h"
+#include "cache.h"
+#include "utility.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The lines of a page
+#define LINES_PER_PAGE (CHASE_PAGE_SIZE / CACHE_LINE_SIZE)
+
+// Where the end of a timed chase is stored, so the loads can't be dropped
+static void* volatile chase_sink;
+
+static const char* const layout_names[] = {"random", "pages", "tlb", "stride"};
+#define NUM_LAYOUTS (sizeof(layout_names) / sizeof(layout_names[0]))
+
+int parse_chase_layout(/*in*/ const char* name, /*out*/ chase_layout* layout)
+{
+    for (size_t i = 0; i < NUM_LAYOUTS; i++)
+    {
+        if (strcmp(name, layout_names[i]) == 0) {
+            *layout = (chase_layout)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char* chase_layout_name(/*in*/ const chase_layout layout)
+{
+    return (size_t)layout < NUM_LAYOUTS ? layout_names[layout] : "unknown";
+}
+
+size_t chase_node_spacing(/*in*/ const chase_layout layout, /*in*/ const size_t stride)
+{
+    return layout == CHASE_TLB ? CHASE_PAGE_SIZE
+        : layout == CHASE_STRIDE ? stride
+        : CACHE_LINE_SIZE;
+}
+
+// Shuffles `count` indices with Fisher-Yates
+static void shuffle(size_t* order, const size_t count, uint64_t* rng)
+{
+    for (size_t i = count; i > 1; i--)
+    {
+        const size_t j = next_random(rng) % i;
+        const size_t swap = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = swap;
+    }
+}
+
+// Returns the byte offset of every node of a layout, in the order they're
+// visited, or NULL on failure
+static size_t* chase_order(const size_t working_set, const chase_layout layout, const size_t stride,
+                           const uint64_t seed, size_t* num_nodes)
+{
+    const size_t spacing = chase_node_spacing(layout, stride);
+    const size_t nodes = working_set / spacing;
+    if (nodes == 0 || spacing < sizeof(void*) || spacing % sizeof(void*) != 0) {
+        fprintf(stderr, "build_chase_chain: %lu bytes can't be linked every %lu bytes\n",
+                working_set, spacing);
+        return NULL;
+    }
+
+    size_t* order = malloc(nodes * sizeof(size_t));
+    if (order == NULL) {
+        perror("build_chase_chain");
+        return NULL;
+    }
+
+    uint64_t rng = seed == 0 ? 1 : seed;
+    for (size_t i = 0; i < nodes; i++) {
+        order[i] = i;
+    }
+
+    switch (layout) {
+    case CHASE_RANDOM:
+        shuffle(order, nodes, &rng);
+        for (size_t i = 0; i < nodes; i++) {
+            order[i] *= CACHE_LINE_SIZE;
+        }
+        break;
+
+    case CHASE_PAGES: {
+        // the pages in a random order, then the lines of each page (the
+        // last one may be partial) in a random order
+        const size_t pages = (nodes + LINES_PER_PAGE - 1) / LINES_PER_PAGE;
+        size_t* page_order = malloc(pages * sizeof(size_t));
+        if (page_order == NULL) {
+            perror("build_chase_chain");
+            free(order);
+            return NULL;
+        }
+        for (size_t page = 0; page < pages; page++) {
+            page_order[page] = page;
+        }
+        shuffle(page_order, pages, &rng);
+
+        size_t next = 0;
+        for (size_t p = 0; p < pages; p++)
+        {
+            const size_t first = page_order[p] * LINES_PER_PAGE;
+            const size_t lines = nodes - first < LINES_PER_PAGE ? nodes - first : LINES_PER_PAGE;
+            for (size_t line = 0; line < lines; line++) {
+                order[next + line] = (first + line) * CACHE_LINE_SIZE;
+            }
+            shuffle(order + next, lines, &rng);
+            next += lines;
+        }
+        free(page_order);
+        break;
+    }
+
+    case CHASE_TLB:
+        shuffle(order, nodes, &rng);
+        for (size_t i = 0; i < nodes; i++) {
+            order[i] = order[i] * CHASE_PAGE_SIZE + (next_random(&rng) % LINES_PER_PAGE) * CACHE_LINE_SIZE;
+        }
+        break;
+
+    default:
+        for (size_t i = 0; i < nodes; i++) {
+            order[i] *= stride;
+        }
+        break;
+    }
+
+    *num_nodes = nodes;
+    return order;
+}
+
+chase_chain build_chase_chain(
+    /*in*/ byte* buffer,
+    /*in*/ const size_t working_set,
+    /*in*/ const chase_layout layout,
+    /*in*/ const size_t stride,
+    /*in*/ const uint64_t seed)
+{
+    chase_chain chain = { .start = NULL };
+    build_chase_chains(buffer, working_set, layout, stride, seed, 1, &chain);
+    return chain;
+}
+
+int build_chase_chains(
+    /*in*/ byte* buffer,
+    /*in*/ const size_t working_set,
+    /*in*/ const chase_layout layout,
+    /*in*/ const size_t stride,
+    /*in*/ const uint64_t seed,
+    /*in*/ const size_t num_chains,
+    /*out*/ chase_chain* chains)
+{
+    size_t nodes;
+    size_t* order = chase_order(working_set, layout, stride, seed, &nodes);
+    if (order == NULL) {
+        return -1;
+    }
+    if (num_chains == 0 || num_chains > nodes) {
+        fprintf(stderr, "build_chase_chains: %lu nodes can't be split into %lu chains\n", nodes, num_chains);
+        free(order);
+        return -1;
+    }
+
+    // consecutive runs of the order, each closed into a cycle of its own
+    for (size_t c = 0; c < num_chains; c++)
+    {
+        const size_t first = nodes * c / num_chains;
+        const size_t length = nodes * (c + 1) / num_chains - first;
+        for (size_t i = 0; i < length; i++) {
+            *(void**)(buffer + order[first + i]) = buffer + order[first + (i + 1) % length];
+        }
+
+        chains[c] = (chase_chain){
+            .start = (void**)(buffer + order[first]),
+            .nodes = length,
+            .working_set = working_set / num_chains
+        };
+    }
+
+    free(order);
+    return 0;
+}
+
+double time_chase(/*in*/ const chase_chain chain, /*in*/ const size_t loads)
+{
+    const size_t rounds = (loads + CHASE_UNROLL - 1) / CHASE_UNROLL;
+    void** p = chain.start;
+
+    const uint64_t start = read_timestamp();
+    for (size_t i = 0; i < rounds; i++)
+    {
+        // each load's address is the value of the one before, so they can't
+        // overlap
+        p = (void**)*p; p = (void**)*p; p = (void**)*p; p = (void**)*p;
+        p = (void**)*p; p = (void**)*p; p = (void**)*p; p = (void**)*p;
+        p = (void**)*p; p = (void**)*p; p = (void**)*p; p = (void**)*p;
+        p = (void**)*p; p = (void**)*p; p = (void**)*p; p = (void**)*p;
+    }
+    const uint64_t elapsed = read_timestamp() - start;
+
+    chase_sink = p;
+    return (double)elapsed / (double)(rounds * CHASE_UNROLL);
+}
+
+// Follows `n` chains in lockstep, `n` being a constant once inlined so the
+// loop over the chains unrolls and their pointers stay in registers
+static inline __attribute__((always_inline))
+uint64_t chase_lockstep(void** const* starts, const size_t n, const size_t rounds)
+{
+    void** p[CHASE_MAX_CHAINS];
+    for (size_t c = 0; c < n; c++) {
+        p[c] = starts[c];
+    }
+
+    const uint64_t start = read_timestamp();
+    for (size_t i = 0; i < rounds; i++)
+    {
+#pragma GCC unroll 16
+        for (size_t c = 0; c < n; c++) {
+            p[c] = (void**)*p[c];
+        }
+    }
+    const uint64_t elapsed = read_timestamp() - start;
+
+    for (size_t c = 0; c < n; c++) {
+        chase_sink = p[c];
+    }
+    return elapsed;
+}
+
+#define LOCKSTEP_CASE(n) \
+    case n: \
+        elapsed = chase_lockstep(starts, n, rounds); \
+        break;
+
+double time_chases(
+    /*in*/ const chase_chain* chains,
+    /*in*/ const size_t num_chains,
+    /*in*/ const size_t rounds)
+{
+    void** starts[CHASE_MAX_CHAINS];
+    for (size_t c = 0; c < num_chains && c < CHASE_MAX_CHAINS; c++) {
+        starts[c] = chains[c].start;
+    }
+
+    uint64_t elapsed = 0;
+    switch (num_chains) {
+    LOCKSTEP_CASE(1) LOCKSTEP_CASE(2) LOCKSTEP_CASE(3) LOCKSTEP_CASE(4)
+    LOCKSTEP_CASE(5) LOCKSTEP_CASE(6) LOCKSTEP_CASE(7) LOCKSTEP_CASE(8)
+    LOCKSTEP_CASE(9) LOCKSTEP_CASE(10) LOCKSTEP_CASE(11) LOCKSTEP_CASE(12)
+    LOCKSTEP_CASE(13) LOCKSTEP_CASE(14) LOCKSTEP_CASE(15) LOCKSTEP_CASE(16)
+    default:
+        return 0;
+    }
+
+    return (double)elapsed / (double)rounds;
+}
@@ -0,0 +1,150 @@
+#include "prefetcher.h"
+#include "buffer.h"
+#include "cache.h"
+#include "utility.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+prefetcher_trainer new_prefetcher_trainer(
+    /*in*/ const cache_level_geometry l2,
+    /*in*/ const size_t num_streams)
+{
+    const prefetcher_trainer failed = { .buffer = NULL };
+    if (num_streams == 0) {
+        return failed;
+    }
+
+    // whole lines per stream, so no two streams share a line
+    const size_t stream_size = 2 * l2.size / num_streams / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    const size_t size = stream_size * num_streams;
+    if (stream_size == 0) {
+        return failed;
+    }
+
+    byte* buffer = map_buffer(size, NULL);
+    if (buffer == NULL) {
+        return failed;
+    }
+
+    return (prefetcher_trainer){
+        .buffer = buffer,
+        .size = size,
+        .num_streams = num_streams,
+        .stream_size = stream_size
+    };
+}
+
+void free_prefetcher_trainer(/*inout*/ prefetcher_trainer* trainer)
+{
+    if (trainer == NULL || trainer->buffer == NULL) {
+        return;
+    }
+
+    unmap_buffer(trainer->buffer, trainer->size);
+    *trainer = (prefetcher_trainer){ .buffer = NULL };
+}
+
+void retrain_prefetcher(/*in*/ const prefetcher_trainer trainer)
+{
+    for (size_t pass = 0; pass < PREFETCHER_TRAINING_PASSES; pass++)
+    {
+        for (size_t offset = 0; offset < trainer.stream_size; offset += CACHE_LINE_SIZE)
+        {
+            for (size_t stream = 0; stream < trainer.num_streams; stream++)
+            {
+                *(volatile const byte*)(trainer.buffer + stream * trainer.stream_size + offset);
+            }
+        }
+    }
+
+    fence();
+}
+
+uint64_t time_prefetcher_retrain(
+    /*in*/ const prefetcher_trainer trainer,
+    /*in*/ const size_t repetitions)
+{
+    uint64_t* samples = malloc(repetitions * sizeof(uint64_t));
+    if (samples == NULL) {
+        perror("time_prefetcher_retrain");
+        return 0;
+    }
+
+    for (size_t i = 0; i < repetitions; i++)
+    {
+        const uint64_t start = read_timestamp();
+        retrain_prefetcher(trainer);
+        samples[i] = read_timestamp() - start;
+    }
+
+    qsort(samples, repetitions, sizeof(uint64_t), compare_u64);
+    const uint64_t median = samples[repetitions / 2];
+
+    free(samples);
+    return median;
+}
+
+// Opens /dev/cpu/<cpu>/msr, printing why if it can't be opened
+static int open_msr(const int cpu, const int flags)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+
+    const int fd = open(path, flags);
+    if (fd < 0) {
+        perror(path);
+    }
+
+    return fd;
+}
+
+int read_prefetcher_control(/*in*/ const int cpu, /*out*/ uint32_t* disabled)
+{
+    const int fd = open_msr(cpu, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    uint64_t value;
+    const int status = pread(fd, &value, sizeof(value), PREFETCHER_CONTROL_MSR) == sizeof(value) ? 0 : -1;
+    close(fd);
+
+    if (status != 0) {
+        fprintf(stderr, "read_prefetcher_control: MSR 0x%x can't be read on cpu %d\n",
+                PREFETCHER_CONTROL_MSR, cpu);
+        return -1;
+    }
+
+    *disabled = (uint32_t)(value & PREFETCHER_ALL);
+    return 0;
+}
+
+int write_prefetcher_control(/*in*/ const int cpu, /*in*/ const uint32_t disabled)
+{
+    const int fd = open_msr(cpu, O_RDWR);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // only the prefetcher bits change, the rest of the MSR is kept
+    uint64_t value;
+    int status = pread(fd, &value, sizeof(value), PREFETCHER_CONTROL_MSR) == sizeof(value) ? 0 : -1;
+    if (status == 0) {
+        value = (value & ~(uint64_t)PREFETCHER_ALL) | (disabled & PREFETCHER_ALL);
+        status = pwrite(fd, &value, sizeof(value), PREFETCHER_CONTROL_MSR) == sizeof(value) ? 0 : -1;
+    }
+    close(fd);
+
+    if (status != 0) {
+        fprintf(stderr, "write_prefetcher_control: MSR 0x%x can't be written on cpu %d\n",
+                PREFETCHER_CONTROL_MSR, cpu);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "probe_kernels.h"
+#include "address.h"
+#include "cache.h"
+#include "utility.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Generates a prime kernel and a prime + probe kernel for one geometry. 
+// The kernels are never inlined, so each one is a single fixed instruction 
+// stream no matter where it's called from.
+#define DEFINE_PROBE_KERNELS(sets, ways, warmup)                                    \
+    static __attribute__((noinline))                                                \
+    void prime_##sets##_##ways##_##warmup(byte* base, size_t set)                  \
+    {                                                                               \
+        prime_kernel_body(base, set, sets, (ways) + (warmup));                      \
+    }                                                                               \
+                                                                                    \
+    static __attribute__((noinline))                                                \
+    uint64_t prime_probe_##sets##_##ways##_##warmup(byte* base, size_t set,        \
+                                                    const byte* line)              \
+    {                                                                               \
+        prime_kernel_body(base, set, sets, (ways) + (warmup));                      \
+        return time_one_line_read_access(line);                                     \
+    }
+
+PROBE_KERNEL_LIST(DEFINE_PROBE_KERNELS)
+
+#define PROBE_KERNEL_ENTRY(S, W, N)                                                 \
+    {                                                                               \
+        .sets = S,                                                                  \
+        .ways = W,                                                                  \
+        .warmup_lines = N,                                                          \
+        .prime = prime_##S##_##W##_##N,                                             \
+        .prime_probe = prime_probe_##S##_##W##_##N                                  \
+    },
+
+// The dispatch table, one entry per tuple in PROBE_KERNEL_LIST
+static const probe_kernels kernel_table[] = {
+    PROBE_KERNEL_LIST(PROBE_KERNEL_ENTRY)
+};
+
+const probe_kernels* find_probe_kernels(
+    /*in*/ const size_t sets,
+    /*in*/ const size_t ways,
+    /*in*/ const size_t warmup_lines)
+{
+    const size_t num_kernels = sizeof(kernel_table) / sizeof(probe_kernels);
+
+    for (size_t i = 0; i < num_kernels; i++)
+    {
+        const probe_kernels* k = &kernel_table[i];
+        if (k->sets == sets && k->ways == ways && k->warmup_lines == warmup_lines) {
+            return k;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,399 @@
+#include "result_file.h"
+#include "cache.h"
+#include "cpu.h"
+#include "eviction_set.h"
+#include "sample_stats.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+occupancy_result_file open_occupancy_result_file(
+    /*in*/ const char* filename,
+    /*in*/ const eviction_set es,
+    /*in*/ const size_t set,
+    /*in*/ const size_t num_iterations)
+{
+    occupancy_result_file rf = { .header = NULL, .cycles = NULL, .fd = -1 };
+
+    const size_t lines_per_set = es.cache_lines + es.warmup_lines;
+    const size_t num_samples = num_iterations * es.cache_sets * lines_per_set;
+    const size_t map_size = sizeof(occupancy_result_header)
+        + num_samples * sizeof(uint16_t);
+
+    const int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(filename);
+        return rf;
+    }
+
+    // size the file up front so the whole thing can be mapped at once
+    if (ftruncate(fd, (off_t)map_size) != 0) {
+        perror(filename);
+        close(fd);
+        return rf;
+    }
+
+    // MAP_POPULATE faults every page in now, rather than in between probes
+    void* mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (mem == MAP_FAILED) {
+        perror(filename);
+        close(fd);
+        return rf;
+    }
+
+    rf.header = mem;
+    rf.cycles = (uint16_t*)((byte*)mem + sizeof(occupancy_result_header));
+    rf.lines_per_set = lines_per_set;
+    rf.map_size = map_size;
+    rf.fd = fd;
+
+    *rf.header = (occupancy_result_header){
+        .magic = OCCUPANCY_RESULT_MAGIC,
+        .version = OCCUPANCY_RESULT_VERSION,
+        .line_size = CACHE_LINE_SIZE,
+        .cache_sets = (uint32_t)es.cache_sets,
+        .cache_lines = (uint32_t)es.cache_lines,
+        .warmup_lines = (uint32_t)es.warmup_lines,
+        .set = (uint32_t)set,
+        .num_iterations = (uint32_t)num_iterations,
+        .cpu = (uint32_t)pinned_cpu(),
+        .flags = es.permuted ? OCCUPANCY_RESULT_PERMUTED_SETS : 0,
+        .sampling = 0
+    };
+
+    return rf;
+}
+
+int truncate_occupancy_result_file(
+    /*inout*/ occupancy_result_file* rf,
+    /*in*/ const size_t num_iterations)
+{
+    if (num_iterations >= rf->header->num_iterations) {
+        return 0;
+    }
+
+    rf->header->num_iterations = (uint32_t)num_iterations;
+
+    const size_t num_samples = num_iterations * rf->header->cache_sets * rf->lines_per_set;
+    const size_t file_size = sizeof(occupancy_result_header) + num_samples * sizeof(uint16_t);
+    if (ftruncate(rf->fd, (off_t)file_size) != 0) {
+        perror("truncate_occupancy_result_file");
+        return -1;
+    }
+
+    return 0;
+}
+
+void close_occupancy_result_file(/*inout*/ occupancy_result_file* rf)
+{
+    if (rf == NULL) {
+        return;
+    }
+
+    if (rf->header != NULL) {
+        munmap(rf->header, rf->map_size);
+    }
+
+    if (rf->fd >= 0) {
+        close(rf->fd);
+    }
+
+    *rf = (occupancy_result_file){ .header = NULL, .cycles = NULL, .fd = -1 };
+}
+
+occupancy_result_file read_occupancy_result_file(/*in*/ const char* filename)
+{
+    occupancy_result_file rf = { .header = NULL, .cycles = NULL, .fd = -1 };
+
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return rf;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(occupancy_result_header)) {
+        fprintf(stderr, "%s: not an occupancy result file\n", filename);
+        close(fd);
+        return rf;
+    }
+
+    const size_t map_size = (size_t)st.st_size;
+    byte* mem = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED) {
+        perror(filename);
+        close(fd);
+        return rf;
+    }
+
+    // validate the header before trusting any of the sizes inside it
+    occupancy_result_header* header = (occupancy_result_header*)mem;
+    const size_t lines_per_set = (size_t)header->cache_lines + header->warmup_lines;
+    const size_t num_samples = (size_t)header->num_iterations
+        * header->cache_sets * lines_per_set;
+
+    if (header->magic != OCCUPANCY_RESULT_MAGIC
+        || header->version != OCCUPANCY_RESULT_VERSION
+        || map_size < sizeof(occupancy_result_header) + num_samples * sizeof(uint16_t))
+    {
+        fprintf(stderr, "%s: not an occupancy result file\n", filename);
+        munmap(mem, map_size);
+        close(fd);
+        return rf;
+    }
+
+    rf.header = header;
+    rf.cycles = (uint16_t*)(mem + sizeof(occupancy_result_header));
+    rf.lines_per_set = lines_per_set;
+    rf.map_size = map_size;
+    rf.fd = fd;
+
+    return rf;
+}
+
+// Reads the header of a result file opened for writing, returns -1 if it
+// isn't one
+static int read_result_header(const int fd, const char* filename, occupancy_result_header* header)
+{
+    if (pread(fd, header, sizeof(*header), 0) != (ssize_t)sizeof(*header)
+        || header->magic != OCCUPANCY_RESULT_MAGIC
+        || header->version != OCCUPANCY_RESULT_VERSION)
+    {
+        fprintf(stderr, "%s: not an occupancy result file\n", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+int append_occupancy_result_file(
+    /*in*/ const char* filename,
+    /*in*/ const char* chunk_filename)
+{
+    if (access(filename, F_OK) != 0) {
+        if (rename(chunk_filename, filename) != 0) {
+            perror(filename);
+            return -1;
+        }
+        return 0;
+    }
+
+    occupancy_result_file chunk = read_occupancy_result_file(chunk_filename);
+    if (chunk.cycles == NULL) {
+        return -1;
+    }
+
+    const int fd = open(filename, O_RDWR);
+    if (fd < 0) {
+        perror(filename);
+        close_occupancy_result_file(&chunk);
+        return -1;
+    }
+
+    occupancy_result_header header;
+    if (read_result_header(fd, filename, &header) != 0) {
+        close(fd);
+        close_occupancy_result_file(&chunk);
+        return -1;
+    }
+    if (header.line_size != chunk.header->line_size
+        || header.cache_sets != chunk.header->cache_sets
+        || header.cache_lines != chunk.header->cache_lines
+        || header.warmup_lines != chunk.header->warmup_lines
+        || header.set != chunk.header->set)
+    {
+        fprintf(stderr, "%s: holds a profile of another set or geometry than %s\n",
+                filename, chunk_filename);
+        close(fd);
+        close_occupancy_result_file(&chunk);
+        return -1;
+    }
+    if (header.sampling != chunk.header->sampling) {
+        fprintf(stderr, "%s: was sampled with other options than %s\n", filename, chunk_filename);
+        close(fd);
+        close_occupancy_result_file(&chunk);
+        return -1;
+    }
+
+    // the samples go right after the last iteration in the header, over 
+    // anything an interrupted append left behind
+    const size_t iteration_size = (size_t)chunk.header->cache_sets * chunk.lines_per_set * sizeof(uint16_t);
+    const size_t chunk_size = chunk.header->num_iterations * iteration_size;
+    const off_t end = (off_t)(sizeof(header) + header.num_iterations * iteration_size);
+
+    int status = 0;
+    size_t written = 0;
+    while (written < chunk_size && status == 0)
+    {
+        const ssize_t n = pwrite(fd, (const byte*)chunk.cycles + written, chunk_size - written,
+                                 end + (off_t)written);
+        if (n < 0) {
+            status = -1;
+        } else {
+            written += (size_t)n;
+        }
+    }
+
+    header.num_iterations += chunk.header->num_iterations;
+    if (header.cpu != chunk.header->cpu) {
+        header.cpu = OCCUPANCY_RESULT_ANY_CPU;
+    }
+    header.flags |= chunk.header->flags;
+    if (status != 0
+        || pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+        || ftruncate(fd, end + (off_t)chunk_size) != 0)
+    {
+        perror(filename);
+        status = -1;
+    }
+
+    close(fd);
+    close_occupancy_result_file(&chunk);
+    if (status == 0 && unlink(chunk_filename) != 0) {
+        perror(chunk_filename);
+    }
+    return status;
+}
+
+int cut_occupancy_result_file(
+    /*in*/ const char* filename,
+    /*in*/ const size_t num_iterations)
+{
+    const int fd = open(filename, O_RDWR);
+    if (fd < 0) {
+        perror(filename);
+        return -1;
+    }
+
+    occupancy_result_header header;
+    if (read_result_header(fd, filename, &header) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (num_iterations >= header.num_iterations) {
+        close(fd);
+        return 0;
+    }
+
+    const size_t iteration_size = (size_t)header.cache_sets
+        * (header.cache_lines + header.warmup_lines) * sizeof(uint16_t);
+    header.num_iterations = (uint32_t)num_iterations;
+
+    int status = 0;
+    if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+        || ftruncate(fd, (off_t)(sizeof(header) + num_iterations * iteration_size)) != 0)
+    {
+        perror(filename);
+        status = -1;
+    }
+
+    close(fd);
+    return status;
+}
+
+int occupancy_result_to_csv(
+    /*in*/ const char* binary_filename,
+    /*in*/ const char* csv_filename)
+{
+    occupancy_result_file rf = read_occupancy_result_file(binary_filename);
+    if (rf.cycles == NULL) {
+        return -1;
+    }
+
+    FILE* csv = fopen(csv_filename, "w");
+    if (csv == NULL) {
+        perror(csv_filename);
+        close_occupancy_result_file(&rf);
+        return -1;
+    }
+
+    fprintf(csv, "Iteration,SetIndex,LineIndex,Cycles\n");
+    for (size_t iter = 0; iter < rf.header->num_iterations; iter++)
+    {
+        for (size_t s_prime = 0; s_prime < rf.header->cache_sets; s_prime++)
+        {
+            for (size_t l_prime = 0; l_prime < rf.lines_per_set; l_prime++)
+            {
+                fprintf(csv, "%lu,%lu,%lu,%u\n", iter, s_prime, l_prime,
+                        load_occupancy_result(rf, iter, s_prime, l_prime));
+            } // l_prime
+        } // s_prime
+    } // iter
+
+    fclose(csv);
+    close_occupancy_result_file(&rf);
+
+    return 0;
+}
+
+int occupancy_result_to_means(
+    /*in*/ const char* binary_filename,
+    /*in*/ const char* csv_filename)
+{
+    occupancy_result_file rf = read_occupancy_result_file(binary_filename);
+    if (rf.cycles == NULL) {
+        return -1;
+    }
+
+    // the rows summed are whole iterations, a few at a time so the 32 bit 
+    // sums can't overflow
+    const size_t row_length = rf.header->cache_sets * rf.lines_per_set;
+    uint32_t* sums = malloc(row_length * sizeof(uint32_t));
+    uint64_t* totals = calloc(row_length, sizeof(uint64_t));
+    if (sums == NULL || totals == NULL) {
+        perror("occupancy_result_to_means");
+        free(sums);
+        free(totals);
+        close_occupancy_result_file(&rf);
+        return -1;
+    }
+
+    for (size_t iter = 0; iter < rf.header->num_iterations; iter += SAMPLE_MAX_SUM_ROWS)
+    {
+        const size_t rows = rf.header->num_iterations - iter < SAMPLE_MAX_SUM_ROWS
+            ? rf.header->num_iterations - iter
+            : SAMPLE_MAX_SUM_ROWS;
+        sum_sample_rows(rf.cycles + iter * row_length, rows, row_length, sums);
+        for (size_t cell = 0; cell < row_length; cell++) {
+            totals[cell] += sums[cell];
+        }
+    }
+    free(sums);
+
+    FILE* csv = fopen(csv_filename, "w");
+    if (csv == NULL) {
+        perror(csv_filename);
+        free(totals);
+        close_occupancy_result_file(&rf);
+        return -1;
+    }
+
+    fprintf(csv, "SetIndex");
+    for (size_t l_prime = 0; l_prime < rf.lines_per_set; l_prime++) {
+        fprintf(csv, ",%lu", l_prime);
+    }
+    fprintf(csv, "\n");
+
+    const double iterations = rf.header->num_iterations > 0 ? (double)rf.header->num_iterations : 1.0;
+    for (size_t s_prime = 0; s_prime < rf.header->cache_sets; s_prime++)
+    {
+        fprintf(csv, "%lu", s_prime);
+        for (size_t l_prime = 0; l_prime < rf.lines_per_set; l_prime++) {
+            fprintf(csv, ",%.2f", (double)totals[s_prime * rf.lines_per_set + l_prime] / iterations);
+        }
+        fprintf(csv, "\n");
+    }
+
+    fclose(csv);
+    free(totals);
+    close_occupancy_result_file(&rf);
+
+    return 0;
+}
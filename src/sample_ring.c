@@ -0,0 +1,351 @@
+#define _GNU_SOURCE
+#include "sample_ring.h"
+#include "buffer.h"
+#include "cache.h"
+#include "cpu.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// The writer copies lines into a buffer of this size before writing them out
+#define STAGING_SIZE (64 * 1024)
+
+// How long the writer sleeps when the ring is empty
+#define WRITER_POLL_NS 50000
+
+// Returns the bytes needed for `lines` ring lines with a period of `period`
+// lines, of which `excluded_lines` are skipped (none if they'd cover it all)
+static size_t placed_size(const size_t lines, const size_t period, const size_t excluded_lines)
+{
+    const size_t usable = excluded_lines < period ? period - excluded_lines : period;
+    return (lines + usable - 1) / usable * period * CACHE_LINE_SIZE;
+}
+
+// Returns the address of the `index`th line of the ring. Each stripe of
+// `period` lines holds `period - excluded_count` ring lines, starting right
+// after the excluded sets.
+static uint16_t* ring_line(const sample_ring* ring, const size_t index)
+{
+    const size_t usable = ring->period - ring->excluded_count;
+    const size_t line = index % ring->capacity_lines;
+    const size_t stripe = line / usable;
+    const size_t set = (ring->excluded_first + ring->excluded_count + line % usable) % ring->period;
+
+    return (uint16_t*)(ring->memory + (stripe * ring->period + set) * CACHE_LINE_SIZE);
+}
+
+sample_ring* new_sample_ring(
+    /*in*/ const size_t capacity,
+    /*in*/ const void* excluded,
+    /*in*/ const size_t excluded_lines,
+    /*in*/ const cache_geometry geometry)
+{
+    // aligned to a line so head and tail get lines of their own
+    sample_ring* ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(sample_ring));
+    if (ring == NULL) {
+        perror("new_sample_ring");
+        return NULL;
+    }
+    memset(ring, 0, sizeof(sample_ring));
+
+    ring->capacity_lines = (capacity + SAMPLES_PER_LINE - 1) / SAMPLES_PER_LINE;
+
+    // the period is only known once we know whether we got hugepages, so
+    // size for whichever period needs more memory, then place the lines
+    const size_t page_lines = 4096 / CACHE_LINE_SIZE;
+    const size_t excluded_count = excluded == NULL ? 0 : excluded_lines;
+    const size_t huge_size = placed_size(ring->capacity_lines, geometry.l2.sets, excluded_count);
+    const size_t page_size = placed_size(ring->capacity_lines, page_lines, excluded_count);
+    ring->memory_size = huge_size > page_size ? huge_size : page_size;
+    ring->memory = map_buffer(ring->memory_size, &ring->hugepages);
+    if (ring->memory == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->period = ring->hugepages ? geometry.l2.sets : page_lines;
+    if (excluded != NULL && excluded_lines < ring->period) {
+        ring->excluded_first = ((uint64_t)excluded / CACHE_LINE_SIZE) % ring->period;
+        ring->excluded_count = excluded_lines;
+    }
+
+    ring->fd = -1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->done, 0);
+    atomic_init(&ring->failed, 0);
+
+    return ring;
+}
+
+void free_sample_ring(/*inout*/ sample_ring* ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+
+    unmap_buffer(ring->memory, ring->memory_size);
+    free(ring);
+}
+
+// Writes all of `length` bytes, returns -1 on failure
+static int write_all(const int fd, const byte* data, size_t length)
+{
+    while (length > 0)
+    {
+        const ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+
+    return 0;
+}
+
+static void* writer_main(void* arg)
+{
+    sample_ring* ring = arg;
+
+    if (ring->writer_cpu >= 0) {
+        pin_to_cpu(ring->writer_cpu);
+    }
+
+    byte* staging = malloc(STAGING_SIZE);
+    if (staging == NULL) {
+        perror("sample writer");
+        atomic_store(&ring->failed, 1);
+    }
+
+    size_t tail = 0;
+    size_t staged = 0;
+
+    for (;;)
+    {
+        // once the producer is done, the last line may be partially filled
+        const int done = atomic_load_explicit(&ring->done, memory_order_acquire);
+        const size_t head = done
+            ? (ring->final_samples + SAMPLES_PER_LINE - 1) / SAMPLES_PER_LINE
+            : atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        const size_t available = head - tail;
+        while (tail < head)
+        {
+            size_t count = SAMPLES_PER_LINE;
+            if (done && tail == head - 1 && ring->final_samples % SAMPLES_PER_LINE != 0) {
+                count = ring->final_samples % SAMPLES_PER_LINE;
+            }
+
+            if (staging != NULL) {
+                memcpy(staging + staged, ring_line(ring, tail), count * sizeof(uint16_t));
+                staged += count * sizeof(uint16_t);
+            }
+
+            // the line has been copied out, the producer may reuse it
+            tail++;
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+            if (staging != NULL && staged + CACHE_LINE_SIZE > STAGING_SIZE) {
+                if (write_all(ring->fd, staging, staged) != 0) {
+                    perror("sample writer");
+                    atomic_store(&ring->failed, 1);
+                }
+                staged = 0;
+            }
+        }
+
+        if (staging != NULL && staged > 0 && (done || available == 0)) {
+            if (write_all(ring->fd, staging, staged) != 0) {
+                perror("sample writer");
+                atomic_store(&ring->failed, 1);
+            }
+            staged = 0;
+        }
+
+        if (done) {
+            break;
+        }
+
+        if (available == 0) {
+            const struct timespec poll = { .tv_sec = 0, .tv_nsec = WRITER_POLL_NS };
+            nanosleep(&poll, NULL);
+        }
+    }
+
+    free(staging);
+    return NULL;
+}
+
+int start_sample_writer(
+    /*inout*/ sample_ring* ring,
+    /*in*/ const char* filename,
+    /*in*/ const int cpu)
+{
+    ring->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ring->fd < 0) {
+        perror(filename);
+        return -1;
+    }
+
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->done, 0);
+    atomic_store(&ring->failed, 0);
+    ring->next_line = 0;
+    ring->cached_tail = 0;
+    ring->in_line = SAMPLES_PER_LINE; // the first push starts line 0
+    ring->cursor = NULL;
+    ring->final_samples = 0;
+    ring->writer_cpu = cpu;
+
+    if (pthread_create(&ring->writer, NULL, writer_main, ring) != 0) {
+        fprintf(stderr, "failed to start the sample writer\n");
+        close(ring->fd);
+        ring->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void advance_sample_ring(/*inout*/ sample_ring* ring)
+{
+    // every line before the next one is full now
+    atomic_store_explicit(&ring->head, ring->next_line, memory_order_release);
+
+    // wait for the writer to drain the line we're about to reuse, only
+    // looking at its tail once our copy says the ring is full
+    while (ring->next_line - ring->cached_tail >= ring->capacity_lines)
+    {
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (ring->next_line - ring->cached_tail >= ring->capacity_lines) {
+            sched_yield();
+        }
+    }
+
+    ring->cursor = ring_line(ring, ring->next_line);
+    ring->in_line = 0;
+    ring->next_line++;
+}
+
+int finish_sample_writer(/*inout*/ sample_ring* ring)
+{
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->final_samples = ring->next_line == 0
+        ? 0
+        : (ring->next_line - 1) * SAMPLES_PER_LINE + ring->in_line;
+    atomic_store_explicit(&ring->done, 1, memory_order_release);
+
+    pthread_join(ring->writer, NULL);
+    close(ring->fd);
+    ring->fd = -1;
+
+    return atomic_load(&ring->failed) ? -1 : 0;
+}
+
+const uint16_t* map_sample_file(/*in*/ const char* filename, /*out*/ size_t* count)
+{
+    *count = 0;
+
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* mem = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror(filename);
+        return NULL;
+    }
+
+    *count = (size_t)st.st_size / sizeof(uint16_t);
+    return mem;
+}
+
+void unmap_sample_file(/*in*/ const uint16_t* samples, /*in*/ const size_t count)
+{
+    if (samples != NULL) {
+        munmap((void*)samples, count * sizeof(uint16_t));
+    }
+}
+
+int compact_sample_file(
+    /*in*/ const char* filename,
+    /*in*/ const size_t* run_lengths,
+    /*in*/ const uint8_t* keep,
+    /*in*/ const size_t num_runs,
+    /*out*/ size_t* kept)
+{
+    *kept = 0;
+
+    const int fd = open(filename, O_RDWR);
+    if (fd < 0) {
+        perror(filename);
+        return -1;
+    }
+
+    size_t total = 0;
+    for (size_t run = 0; run < num_runs; run++) {
+        total += run_lengths[run];
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < total * sizeof(uint16_t)) {
+        fprintf(stderr, "%s: holds fewer samples than its %lu runs\n", filename, num_runs);
+        close(fd);
+        return -1;
+    }
+    if (total == 0) {
+        close(fd);
+        return 0;
+    }
+
+    uint16_t* samples = mmap(NULL, total * sizeof(uint16_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (samples == MAP_FAILED) {
+        perror(filename);
+        close(fd);
+        return -1;
+    }
+
+    // slide every kept run down over the dropped ones before it
+    size_t read = 0;
+    for (size_t run = 0; run < num_runs; run++)
+    {
+        if (keep[run]) {
+            memmove(samples + *kept, samples + read, run_lengths[run] * sizeof(uint16_t));
+            *kept += run_lengths[run];
+        }
+        read += run_lengths[run];
+    }
+
+    munmap(samples, total * sizeof(uint16_t));
+    const int status = ftruncate(fd, (off_t)(*kept * sizeof(uint16_t)));
+    if (status != 0) {
+        perror(filename);
+    }
+    close(fd);
+    return status == 0 ? 0 : -1;
+}
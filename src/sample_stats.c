@@ -0,0 +1,373 @@
+#include "sample_stats.h"
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The sub-histograms of `sample_histogram`
+#define SUB_HISTOGRAMS 4
+
+// The samples counted into the 32 bit sub-histograms before they're added
+// to the caller's, so that no sub-histogram bin can overflow
+#define HISTOGRAM_CHUNK ((size_t)UINT32_MAX)
+
+// The instruction set forced with `select_sample_stats_isa`, or -1 to pick
+// the widest one
+static int forced_isa = -1;
+
+static int isa_supported(const sample_stats_isa isa)
+{
+    switch (isa) {
+    case SAMPLE_STATS_AVX512:
+        return __builtin_cpu_supports("avx512bw");
+    case SAMPLE_STATS_AVX2:
+        return __builtin_cpu_supports("avx2");
+    default:
+        return 1;
+    }
+}
+
+sample_stats_isa sample_stats_selected_isa(void)
+{
+    if (forced_isa >= 0) {
+        return (sample_stats_isa)forced_isa;
+    }
+
+    return isa_supported(SAMPLE_STATS_AVX512) ? SAMPLE_STATS_AVX512
+        : isa_supported(SAMPLE_STATS_AVX2) ? SAMPLE_STATS_AVX2
+        : SAMPLE_STATS_SCALAR;
+}
+
+int select_sample_stats_isa(/*in*/ const sample_stats_isa isa)
+{
+    if (!isa_supported(isa)) {
+        fprintf(stderr, "this CPU doesn't support %s\n", sample_stats_isa_name(isa));
+        return -1;
+    }
+
+    forced_isa = (int)isa;
+    return 0;
+}
+
+const char* sample_stats_isa_name(/*in*/ const sample_stats_isa isa)
+{
+    switch (isa) {
+    case SAMPLE_STATS_AVX512:
+        return "avx512";
+    case SAMPLE_STATS_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+static void min_max_scalar(const uint16_t* samples, const size_t first, const size_t num_samples,
+                           uint16_t* min, uint16_t* max)
+{
+    for (size_t i = first; i < num_samples; i++)
+    {
+        *min = samples[i] < *min ? samples[i] : *min;
+        *max = samples[i] > *max ? samples[i] : *max;
+    }
+}
+
+__attribute__((target("avx2")))
+static void min_max_avx2(const uint16_t* samples, const size_t num_samples, uint16_t* min, uint16_t* max)
+{
+    __m256i low = _mm256_set1_epi16((short)UINT16_MAX);
+    __m256i high = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 16 <= num_samples; i += 16)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i));
+        low = _mm256_min_epu16(low, v);
+        high = _mm256_max_epu16(high, v);
+    }
+
+    uint16_t lows[16];
+    uint16_t highs[16];
+    _mm256_storeu_si256((__m256i*)lows, low);
+    _mm256_storeu_si256((__m256i*)highs, high);
+    min_max_scalar(lows, 0, 16, min, max);
+    min_max_scalar(highs, 0, 16, min, max);
+    min_max_scalar(samples, i, num_samples, min, max);
+}
+
+__attribute__((target("avx512bw")))
+static void min_max_avx512(const uint16_t* samples, const size_t num_samples, uint16_t* min, uint16_t* max)
+{
+    __m512i low = _mm512_set1_epi16((short)UINT16_MAX);
+    __m512i high = _mm512_setzero_si512();
+
+    size_t i = 0;
+    for (; i + 32 <= num_samples; i += 32)
+    {
+        const __m512i v = _mm512_loadu_si512(samples + i);
+        low = _mm512_min_epu16(low, v);
+        high = _mm512_max_epu16(high, v);
+    }
+
+    uint16_t lows[32];
+    uint16_t highs[32];
+    _mm512_storeu_si512(lows, low);
+    _mm512_storeu_si512(highs, high);
+    min_max_scalar(lows, 0, 32, min, max);
+    min_max_scalar(highs, 0, 32, min, max);
+    min_max_scalar(samples, i, num_samples, min, max);
+}
+
+void sample_min_max(
+    /*in*/ const uint16_t* samples,
+    /*in*/ const size_t num_samples,
+    /*out*/ uint16_t* min,
+    /*out*/ uint16_t* max)
+{
+    *min = UINT16_MAX;
+    *max = 0;
+
+    switch (sample_stats_selected_isa()) {
+    case SAMPLE_STATS_AVX512:
+        min_max_avx512(samples, num_samples, min, max);
+        break;
+    case SAMPLE_STATS_AVX2:
+        min_max_avx2(samples, num_samples, min, max);
+        break;
+    default:
+        min_max_scalar(samples, 0, num_samples, min, max);
+        break;
+    }
+
+    if (num_samples == 0) {
+        *min = 0;
+    }
+}
+
+int sample_histogram(
+    /*in*/ const uint16_t* samples,
+    /*in*/ const size_t num_samples,
+    /*inout*/ uint64_t* histogram)
+{
+    uint32_t* sub = calloc(SUB_HISTOGRAMS * SAMPLE_HISTOGRAM_BINS, sizeof(uint32_t));
+    if (sub == NULL) {
+        perror("sample_histogram");
+        return -1;
+    }
+
+    for (size_t first = 0; first < num_samples; first += HISTOGRAM_CHUNK)
+    {
+        const size_t last = num_samples - first > HISTOGRAM_CHUNK ? first + HISTOGRAM_CHUNK : num_samples;
+
+        size_t i = first;
+        for (; i + SUB_HISTOGRAMS <= last; i += SUB_HISTOGRAMS)
+        {
+            sub[samples[i]]++;
+            sub[SAMPLE_HISTOGRAM_BINS + samples[i + 1]]++;
+            sub[2 * SAMPLE_HISTOGRAM_BINS + samples[i + 2]]++;
+            sub[3 * SAMPLE_HISTOGRAM_BINS + samples[i + 3]]++;
+        }
+        for (; i < last; i++) {
+            sub[samples[i]]++;
+        }
+
+        for (size_t s = 0; s < SUB_HISTOGRAMS; s++)
+        {
+            for (size_t value = 0; value < SAMPLE_HISTOGRAM_BINS; value++) {
+                histogram[value] += sub[s * SAMPLE_HISTOGRAM_BINS + value];
+            }
+        }
+        memset(sub, 0, SUB_HISTOGRAMS * SAMPLE_HISTOGRAM_BINS * sizeof(uint32_t));
+    }
+
+    free(sub);
+    return 0;
+}
+
+void histogram_percentiles(
+    /*in*/ const uint64_t* histogram,
+    /*in*/ const double* percentiles,
+    /*in*/ const size_t num_percentiles,
+    /*out*/ uint64_t* values)
+{
+    uint64_t total = 0;
+    uint64_t largest = 0;
+    for (size_t value = 0; value < SAMPLE_HISTOGRAM_BINS; value++)
+    {
+        total += histogram[value];
+        largest = histogram[value] != 0 ? value : largest;
+    }
+
+    size_t p = 0;
+    uint64_t seen = 0;
+    for (size_t value = 0; value < SAMPLE_HISTOGRAM_BINS && p < num_percentiles; value++)
+    {
+        seen += histogram[value];
+        while (p < num_percentiles && seen > (uint64_t)(percentiles[p] * (double)total)) {
+            values[p++] = value;
+        }
+    }
+
+    // the percentiles no sample is past, i.e. 1
+    while (p < num_percentiles) {
+        values[p++] = largest;
+    }
+}
+
+// Counts the samples at or below each edge, the bands are the differences
+static void band_counts_scalar(const uint16_t* samples, const size_t first, const size_t num_samples,
+                               const uint16_t* edges, const size_t num_edges, uint64_t* at_or_below)
+{
+    for (size_t i = first; i < num_samples; i++)
+    {
+        for (size_t e = 0; e < num_edges; e++) {
+            at_or_below[e] += samples[i] <= edges[e];
+        }
+    }
+}
+
+__attribute__((target("avx2,popcnt")))
+static void band_counts_avx2(const uint16_t* samples, const size_t num_samples,
+                             const uint16_t* edges, const size_t num_edges, uint64_t* at_or_below)
+{
+    __m256i bounds[SAMPLE_MAX_BANDS];
+    for (size_t e = 0; e < num_edges; e++) {
+        bounds[e] = _mm256_set1_epi16((short)edges[e]);
+    }
+
+    size_t i = 0;
+    for (; i + 16 <= num_samples; i += 16)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i));
+        for (size_t e = 0; e < num_edges; e++)
+        {
+            // there's no unsigned compare, v <= edge if max(v, edge) == edge,
+            // and the mask has two bits per sample
+            const __m256i below = _mm256_cmpeq_epi16(_mm256_max_epu16(v, bounds[e]), bounds[e]);
+            at_or_below[e] += (uint64_t)_mm_popcnt_u32((uint32_t)_mm256_movemask_epi8(below)) / 2;
+        }
+    }
+
+    band_counts_scalar(samples, i, num_samples, edges, num_edges, at_or_below);
+}
+
+__attribute__((target("avx512bw,popcnt")))
+static void band_counts_avx512(const uint16_t* samples, const size_t num_samples,
+                               const uint16_t* edges, const size_t num_edges, uint64_t* at_or_below)
+{
+    __m512i bounds[SAMPLE_MAX_BANDS];
+    for (size_t e = 0; e < num_edges; e++) {
+        bounds[e] = _mm512_set1_epi16((short)edges[e]);
+    }
+
+    size_t i = 0;
+    for (; i + 32 <= num_samples; i += 32)
+    {
+        const __m512i v = _mm512_loadu_si512(samples + i);
+        for (size_t e = 0; e < num_edges; e++) {
+            at_or_below[e] += (uint64_t)_mm_popcnt_u32(_mm512_cmple_epu16_mask(v, bounds[e]));
+        }
+    }
+
+    band_counts_scalar(samples, i, num_samples, edges, num_edges, at_or_below);
+}
+
+void sample_band_histogram(
+    /*in*/ const uint16_t* samples,
+    /*in*/ const size_t num_samples,
+    /*in*/ const uint16_t* edges,
+    /*in*/ const size_t num_edges,
+    /*out*/ uint64_t* counts)
+{
+    uint64_t at_or_below[SAMPLE_MAX_BANDS] = {0};
+    const size_t bands = num_edges < SAMPLE_MAX_BANDS ? num_edges : SAMPLE_MAX_BANDS;
+
+    switch (sample_stats_selected_isa()) {
+    case SAMPLE_STATS_AVX512:
+        band_counts_avx512(samples, num_samples, edges, bands, at_or_below);
+        break;
+    case SAMPLE_STATS_AVX2:
+        band_counts_avx2(samples, num_samples, edges, bands, at_or_below);
+        break;
+    default:
+        band_counts_scalar(samples, 0, num_samples, edges, bands, at_or_below);
+        break;
+    }
+
+    uint64_t below = 0;
+    for (size_t e = 0; e < bands; e++)
+    {
+        counts[e] = at_or_below[e] - below;
+        below = at_or_below[e];
+    }
+    counts[bands] = num_samples - below;
+}
+
+static void sum_rows_scalar(const uint16_t* row, const size_t first, const size_t row_length, uint32_t* sums)
+{
+    for (size_t i = first; i < row_length; i++) {
+        sums[i] += row[i];
+    }
+}
+
+__attribute__((target("avx2")))
+static void sum_rows_avx2(const uint16_t* samples, const size_t num_rows, const size_t row_length,
+                          uint32_t* sums)
+{
+    for (size_t row = 0; row < num_rows; row++)
+    {
+        const uint16_t* r = samples + row * row_length;
+
+        size_t i = 0;
+        for (; i + 8 <= row_length; i += 8)
+        {
+            const __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(r + i)));
+            __m256i* sum = (__m256i*)(sums + i);
+            _mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), wide));
+        }
+        sum_rows_scalar(r, i, row_length, sums);
+    }
+}
+
+__attribute__((target("avx512bw")))
+static void sum_rows_avx512(const uint16_t* samples, const size_t num_rows, const size_t row_length,
+                            uint32_t* sums)
+{
+    for (size_t row = 0; row < num_rows; row++)
+    {
+        const uint16_t* r = samples + row * row_length;
+
+        size_t i = 0;
+        for (; i + 16 <= row_length; i += 16)
+        {
+            const __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(r + i)));
+            _mm512_storeu_si512(sums + i, _mm512_add_epi32(_mm512_loadu_si512(sums + i), wide));
+        }
+        sum_rows_scalar(r, i, row_length, sums);
+    }
+}
+
+void sum_sample_rows(
+    /*in*/ const uint16_t* samples,
+    /*in*/ const size_t num_rows,
+    /*in*/ const size_t row_length,
+    /*out*/ uint32_t* sums)
+{
+    memset(sums, 0, row_length * sizeof(uint32_t));
+
+    switch (sample_stats_selected_isa()) {
+    case SAMPLE_STATS_AVX512:
+        sum_rows_avx512(samples, num_rows, row_length, sums);
+        break;
+    case SAMPLE_STATS_AVX2:
+        sum_rows_avx2(samples, num_rows, row_length, sums);
+        break;
+    default:
+        for (size_t row = 0; row < num_rows; row++) {
+            sum_rows_scalar(samples + row * row_length, 0, row_length, sums);
+        }
+        break;
+    }
+}
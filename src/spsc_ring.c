@@ -0,0 +1,50 @@
+#include "spsc_ring.h"
+#include "buffer.h"
+#include "cache.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+spsc_ring* new_spsc_ring(/*in*/ const size_t record_size, /*in*/ const size_t capacity)
+{
+    // the struct is aligned to a line so head and tail get lines of their own
+    spsc_ring* ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(spsc_ring));
+    if (ring == NULL) {
+        perror("new_spsc_ring");
+        return NULL;
+    }
+
+    ring->record_size = record_size;
+    ring->capacity = 1;
+    while (ring->capacity < capacity) {
+        ring->capacity *= 2;
+    }
+    ring->mask = ring->capacity - 1;
+
+    ring->records_size = ring->capacity * record_size;
+    ring->records = map_buffer(ring->records_size, NULL);
+    if (ring->records == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->next = 0;
+    ring->cached_tail = 0;
+    ring->cached_head = 0;
+
+    return ring;
+}
+
+void free_spsc_ring(/*inout*/ spsc_ring* ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+
+    unmap_buffer(ring->records, ring->records_size);
+    free(ring);
+}
@@ -0,0 +1,254 @@
+#include "stream_kernels.h"
+#include "cache.h"
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The value the write kernels store
+#define FILL_PATTERN 0x5A5A5A5A5A5A5A5AULL
+
+static uint64_t read_lines_kernel(byte* dst, const byte* src, size_t bytes)
+{
+    (void)dst;
+    read_buffer(src, bytes);
+    return 0;
+}
+
+static uint64_t rmw_lines_kernel(byte* dst, const byte* src, size_t bytes)
+{
+    (void)src;
+    write_buffer(dst, bytes);
+    return 0;
+}
+
+// The scalar kernels stay scalar loops at every optimization level (not
+// vectorized, nor turned into memset or memcpy), so they remain the
+// baseline for the vector ones
+
+__attribute__((optimize("no-tree-vectorize")))
+static uint64_t read_scalar(byte* dst, const byte* src, size_t bytes)
+{
+    (void)dst;
+    const uint64_t* words = (const uint64_t*)src;
+    uint64_t sums[4] = {0, 0, 0, 0};
+    for (size_t i = 0; i < bytes / sizeof(uint64_t); i += 4)
+    {
+        sums[0] += words[i];
+        sums[1] += words[i + 1];
+        sums[2] += words[i + 2];
+        sums[3] += words[i + 3];
+    }
+
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+__attribute__((optimize("no-tree-vectorize", "no-tree-loop-distribute-patterns")))
+static uint64_t write_scalar(byte* dst, const byte* src, size_t bytes)
+{
+    (void)src;
+    uint64_t* words = (uint64_t*)dst;
+    for (size_t i = 0; i < bytes / sizeof(uint64_t); i++) {
+        words[i] = FILL_PATTERN;
+    }
+
+    return 0;
+}
+
+__attribute__((optimize("no-tree-vectorize", "no-tree-loop-distribute-patterns")))
+static uint64_t copy_scalar(byte* dst, const byte* src, size_t bytes)
+{
+    uint64_t* to = (uint64_t*)dst;
+    const uint64_t* from = (const uint64_t*)src;
+    for (size_t i = 0; i < bytes / sizeof(uint64_t); i++) {
+        to[i] = from[i];
+    }
+
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static uint64_t read_avx2(byte* dst, const byte* src, size_t bytes)
+{
+    (void)dst;
+    __m256i sums[4] = {_mm256_setzero_si256(), _mm256_setzero_si256(),
+                       _mm256_setzero_si256(), _mm256_setzero_si256()};
+    for (size_t i = 0; i < bytes; i += STREAM_BLOCK)
+    {
+        for (size_t j = 0; j < 4; j++) {
+            const __m256i a = _mm256_load_si256((const __m256i*)(src + i + j * 64));
+            const __m256i b = _mm256_load_si256((const __m256i*)(src + i + j * 64 + 32));
+            sums[j] = _mm256_add_epi64(sums[j], _mm256_xor_si256(a, b));
+        }
+    }
+
+    const __m256i sum = _mm256_add_epi64(_mm256_add_epi64(sums[0], sums[1]),
+                                         _mm256_add_epi64(sums[2], sums[3]));
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static uint64_t write_avx2(byte* dst, const byte* src, size_t bytes)
+{
+    (void)src;
+    const __m256i fill = _mm256_set1_epi64x((long long)FILL_PATTERN);
+    for (size_t i = 0; i < bytes; i += 32) {
+        _mm256_store_si256((__m256i*)(dst + i), fill);
+    }
+
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static uint64_t write_nt_avx2(byte* dst, const byte* src, size_t bytes)
+{
+    (void)src;
+    const __m256i fill = _mm256_set1_epi64x((long long)FILL_PATTERN);
+    for (size_t i = 0; i < bytes; i += 32) {
+        _mm256_stream_si256((__m256i*)(dst + i), fill);
+    }
+
+    _mm_sfence();
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static uint64_t copy_avx2(byte* dst, const byte* src, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i += 32) {
+        _mm256_store_si256((__m256i*)(dst + i), _mm256_load_si256((const __m256i*)(src + i)));
+    }
+
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static uint64_t copy_nt_avx2(byte* dst, const byte* src, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i += 32) {
+        _mm256_stream_si256((__m256i*)(dst + i), _mm256_load_si256((const __m256i*)(src + i)));
+    }
+
+    _mm_sfence();
+    return 0;
+}
+
+__attribute__((target("avx512f")))
+static uint64_t read_avx512(byte* dst, const byte* src, size_t bytes)
+{
+    (void)dst;
+    __m512i sums[4] = {_mm512_setzero_si512(), _mm512_setzero_si512(),
+                       _mm512_setzero_si512(), _mm512_setzero_si512()};
+    for (size_t i = 0; i < bytes; i += STREAM_BLOCK)
+    {
+        for (size_t j = 0; j < 4; j++) {
+            sums[j] = _mm512_add_epi64(sums[j], _mm512_load_si512((const void*)(src + i + j * 64)));
+        }
+    }
+
+    return (uint64_t)_mm512_reduce_add_epi64(_mm512_add_epi64(_mm512_add_epi64(sums[0], sums[1]),
+                                                              _mm512_add_epi64(sums[2], sums[3])));
+}
+
+__attribute__((target("avx512f")))
+static uint64_t write_avx512(byte* dst, const byte* src, size_t bytes)
+{
+    (void)src;
+    const __m512i fill = _mm512_set1_epi64((long long)FILL_PATTERN);
+    for (size_t i = 0; i < bytes; i += 64) {
+        _mm512_store_si512((void*)(dst + i), fill);
+    }
+
+    return 0;
+}
+
+__attribute__((target("avx512f")))
+static uint64_t write_nt_avx512(byte* dst, const byte* src, size_t bytes)
+{
+    (void)src;
+    const __m512i fill = _mm512_set1_epi64((long long)FILL_PATTERN);
+    for (size_t i = 0; i < bytes; i += 64) {
+        _mm512_stream_si512((void*)(dst + i), fill);
+    }
+
+    _mm_sfence();
+    return 0;
+}
+
+__attribute__((target("avx512f")))
+static uint64_t copy_avx512(byte* dst, const byte* src, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i += 64) {
+        _mm512_store_si512((void*)(dst + i), _mm512_load_si512((const void*)(src + i)));
+    }
+
+    return 0;
+}
+
+__attribute__((target("avx512f")))
+static uint64_t copy_nt_avx512(byte* dst, const byte* src, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i += 64) {
+        _mm512_stream_si512((void*)(dst + i), _mm512_load_si512((const void*)(src + i)));
+    }
+
+    _mm_sfence();
+    return 0;
+}
+
+static const stream_kernel kernels[] = {
+    { "read-lines",     STREAM_READ,  STREAM_SCALAR, 0, read_lines_kernel },
+    { "rmw-lines",      STREAM_WRITE, STREAM_SCALAR, 0, rmw_lines_kernel },
+    { "read-scalar",    STREAM_READ,  STREAM_SCALAR, 0, read_scalar },
+    { "write-scalar",   STREAM_WRITE, STREAM_SCALAR, 0, write_scalar },
+    { "copy-scalar",    STREAM_COPY,  STREAM_SCALAR, 0, copy_scalar },
+    { "read-avx2",      STREAM_READ,  STREAM_AVX2,   0, read_avx2 },
+    { "write-avx2",     STREAM_WRITE, STREAM_AVX2,   0, write_avx2 },
+    { "write-nt-avx2",  STREAM_WRITE, STREAM_AVX2,   1, write_nt_avx2 },
+    { "copy-avx2",      STREAM_COPY,  STREAM_AVX2,   0, copy_avx2 },
+    { "copy-nt-avx2",   STREAM_COPY,  STREAM_AVX2,   1, copy_nt_avx2 },
+    { "read-avx512",    STREAM_READ,  STREAM_AVX512, 0, read_avx512 },
+    { "write-avx512",   STREAM_WRITE, STREAM_AVX512, 0, write_avx512 },
+    { "write-nt-avx512", STREAM_WRITE, STREAM_AVX512, 1, write_nt_avx512 },
+    { "copy-avx512",    STREAM_COPY,  STREAM_AVX512, 0, copy_avx512 },
+    { "copy-nt-avx512", STREAM_COPY,  STREAM_AVX512, 1, copy_nt_avx512 },
+};
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+const stream_kernel* stream_kernels(/*out*/ size_t* num_kernels)
+{
+    *num_kernels = NUM_KERNELS;
+    return kernels;
+}
+
+const stream_kernel* find_stream_kernel(/*in*/ const char* name)
+{
+    for (size_t i = 0; i < NUM_KERNELS; i++)
+    {
+        if (strcmp(kernels[i].name, name) == 0) {
+            return &kernels[i];
+        }
+    }
+
+    return NULL;
+}
+
+int stream_kernel_supported(/*in*/ const stream_kernel* kernel)
+{
+    switch (kernel->isa) {
+    case STREAM_AVX512:
+        return __builtin_cpu_supports("avx512f");
+    case STREAM_AVX2:
+        return __builtin_cpu_supports("avx2");
+    default:
+        return 1;
+    }
+}
+
+const char* stream_op_name(/*in*/ const stream_op op)
+{
+    return op == STREAM_READ ? "read" : op == STREAM_WRITE ? "write" : "copy";
+}
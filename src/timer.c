@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include "timer.h"
+#include "utility.h"
+
+#include <linux/perf_event.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char* const mode_names[] = {
+    [TIMER_RDTSCP] = "rdtscp",
+    [TIMER_CPUID_RDTSC] = "cpuid",
+    [TIMER_RDPMC] = "rdpmc",
+};
+
+int parse_timer_mode(/*in*/ const char* name, /*out*/ timer_mode* mode)
+{
+    for (size_t i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++)
+    {
+        if (strcmp(name, mode_names[i]) == 0) {
+            *mode = (timer_mode)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char* timer_mode_name(/*in*/ const timer_mode mode)
+{
+    return mode <= TIMER_RDPMC ? mode_names[mode] : "unknown";
+}
+
+// Opens a cycle counter for the calling thread that can be read with rdpmc,
+// the kernel has to allow it (/sys/bus/event_source/devices/cpu/rdpmc)
+static int open_rdpmc(probe_timer* timer)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+        perror("perf_event_open");
+        return -1;
+    }
+
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    struct perf_event_mmap_page* page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+        perror("perf_event_open");
+        close(fd);
+        return -1;
+    }
+
+    // index 0 means the event isn't on a counter we may read
+    if (!page->cap_user_rdpmc || page->index == 0) {
+        fprintf(stderr, "rdpmc isn't allowed from userspace\n");
+        munmap(page, page_size);
+        close(fd);
+        return -1;
+    }
+
+    timer->pmc_index = page->index - 1;
+    timer->counter_mask = page->pmc_width >= 64 ? UINT64_MAX : (1ULL << page->pmc_width) - 1;
+    timer->perf_fd = fd;
+    timer->perf_page = page;
+
+    return 0;
+}
+
+// Times an empty region with a constant mode
+static inline __attribute__((always_inline))
+uint64_t empty_measurement_as(const timer_mode mode, const probe_timer* timer)
+{
+    mfence();
+    const uint64_t start = timer_begin(mode, timer->pmc_index);
+    const uint64_t end = timer_end(mode, timer->pmc_index);
+    return (end - start) & timer->counter_mask;
+}
+
+static uint64_t empty_measurement(const probe_timer* timer)
+{
+    switch (timer->mode) {
+        case TIMER_CPUID_RDTSC: return empty_measurement_as(TIMER_CPUID_RDTSC, timer);
+        case TIMER_RDPMC: return empty_measurement_as(TIMER_RDPMC, timer);
+        default: return empty_measurement_as(TIMER_RDTSCP, timer);
+    }
+}
+
+// Measures the overhead, resolution and jitter of an empty timed region
+static int calibrate_timer(probe_timer* timer)
+{
+    uint64_t* samples = malloc(TIMER_CALIBRATION_SAMPLES * sizeof(uint64_t));
+    if (samples == NULL) {
+        perror("calibrate_timer");
+        return -1;
+    }
+
+    // warm up the instruction cache and the branch predictors first
+    for (size_t i = 0; i < TIMER_CALIBRATION_SAMPLES / 10; i++) {
+        empty_measurement(timer);
+    }
+    for (size_t i = 0; i < TIMER_CALIBRATION_SAMPLES; i++) {
+        samples[i] = empty_measurement(timer);
+    }
+
+    qsort(samples, TIMER_CALIBRATION_SAMPLES, sizeof(uint64_t), compare_u64);
+
+    timer->overhead = samples[TIMER_CALIBRATION_SAMPLES / 2];
+    timer->jitter = samples[(TIMER_CALIBRATION_SAMPLES * 3) / 4] - samples[TIMER_CALIBRATION_SAMPLES / 4];
+
+    timer->resolution = 0;
+    for (size_t i = 1; i < TIMER_CALIBRATION_SAMPLES; i++)
+    {
+        const uint64_t step = samples[i] - samples[i - 1];
+        if (step != 0 && (timer->resolution == 0 || step < timer->resolution)) {
+            timer->resolution = step;
+        }
+    }
+
+    free(samples);
+    return 0;
+}
+
+int init_timer(/*in*/ const timer_mode mode, /*out*/ probe_timer* timer)
+{
+    *timer = (probe_timer){
+        .mode = mode,
+        .counter_mask = UINT64_MAX,
+        .perf_fd = -1,
+        .perf_page = NULL
+    };
+
+    int status = 0;
+    if (mode == TIMER_RDPMC && open_rdpmc(timer) != 0) {
+        fprintf(stderr, "warning: falling back to the %s timer\n", mode_names[TIMER_RDTSCP]);
+        timer->mode = TIMER_RDTSCP;
+        status = -1;
+    }
+
+    // without a calibration the overhead stays 0 and nothing is subtracted
+    if (calibrate_timer(timer) != 0) {
+        status = -1;
+    }
+
+    return status;
+}
+
+void free_timer(/*inout*/ probe_timer* timer)
+{
+    if (timer->perf_page != NULL) {
+        munmap(timer->perf_page, (size_t)sysconf(_SC_PAGESIZE));
+    }
+
+    if (timer->perf_fd >= 0) {
+        close(timer->perf_fd);
+    }
+
+    timer->perf_page = NULL;
+    timer->perf_fd = -1;
+}
+
+uint64_t calibrate_busy_wait(/*in*/ const uint64_t cycles)
+{
+    uint64_t samples[BUSY_WAIT_CALIBRATION_SAMPLES];
+
+    // the first waits warm up the branch predictors
+    for (size_t i = 0; i < BUSY_WAIT_CALIBRATION_SAMPLES / 10; i++) {
+        busy_wait(cycles);
+    }
+    for (size_t i = 0; i < BUSY_WAIT_CALIBRATION_SAMPLES; i++) {
+        samples[i] = busy_wait(cycles);
+    }
+
+    qsort(samples, BUSY_WAIT_CALIBRATION_SAMPLES, sizeof(uint64_t), compare_u64);
+    return samples[BUSY_WAIT_CALIBRATION_SAMPLES / 2];
+}
+
+void print_timer(/*in*/ FILE* out, /*in*/ const probe_timer timer)
+{
+    fprintf(out, "timer: %s, overhead %lu cycles (subtracted), resolution %lu cycles, "
+            "jitter %lu cycles (IQR)\n", timer_mode_name(timer.mode), timer.overhead,
+            timer.resolution, timer.jitter);
+}